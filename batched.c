@@ -0,0 +1,806 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "batched.h"
+#include "kernels.h"
+#include "profile.h"
+#include "threadpool.h"
+
+// Row alignment of the amplitude array, for the vector loads of the kernels
+#define BATCHED_ALIGNMENT 64
+
+// Fewest instances per group: one AVX-512 register of double complex lanes
+#define BATCHED_MIN_LANES 4
+
+struct BatchedState {
+    int num_qubits;
+    size_t state_size;       // amplitudes per instance
+    size_t batch_size;
+    size_t group_lanes;      // instances per group (the last group may hold fewer)
+    ComplexNum* amplitudes;  // the groups one after another
+    RngState* rng;           // one stream per instance
+};
+
+// Instances b .. b + lanes - 1 stored together: row i, amplitude i of each
+// of them, at rows + i * lanes
+typedef struct {
+    int num_qubits;
+    ComplexNum* rows;
+    size_t lanes;
+    RngState* rng;
+    size_t first;            // instance held by lane 0
+} LaneGroup;
+
+// Lanes per group: as many instances as fill a cache tile of
+// default_local_qubits() qubits, but at least BATCHED_MIN_LANES
+static size_t lanes_per_group(int num_qubits, size_t batch_size) {
+    int local_qubits = default_local_qubits();
+    size_t lanes = num_qubits < local_qubits ? (size_t)1 << (local_qubits - num_qubits) : 1;
+    if (lanes < BATCHED_MIN_LANES) {
+        lanes = BATCHED_MIN_LANES;
+    }
+    return lanes < batch_size ? lanes : batch_size;
+}
+
+static size_t num_groups(const BatchedState* state) {
+    return (state->batch_size + state->group_lanes - 1) / state->group_lanes;
+}
+
+static LaneGroup lane_group(const BatchedState* state, size_t g) {
+    size_t first = g * state->group_lanes;
+    size_t left = state->batch_size - first;
+    LaneGroup group = {
+        .num_qubits = state->num_qubits,
+        .rows = state->amplitudes + first * state->state_size,
+        .lanes = left < state->group_lanes ? left : state->group_lanes,
+        .rng = state->rng + first,
+        .first = first
+    };
+    return group;
+}
+
+// Address of amplitude index of instance b
+static ComplexNum* instance_amplitude(const BatchedState* state, size_t b, size_t index) {
+    LaneGroup group = lane_group(state, b / state->group_lanes);
+    return group.rows + index * group.lanes + (b - group.first);
+}
+
+BatchedState* create_batched_state(int num_qubits, size_t batch_size) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    if (num_qubits < 1 || num_qubits > MAX_QUBITS || batch_size < 1) {
+        fprintf(stderr, "Error: Batched states need 1 to %d qubits and at least one instance\n", MAX_QUBITS);
+        return NULL;
+    }
+    size_t state_size = (size_t)1 << num_qubits;
+    if (batch_size > SIZE_MAX / sizeof(ComplexNum) / state_size) {
+        fprintf(stderr, "Error: %zu instances of a %d-qubit state do not fit in memory\n", batch_size, num_qubits);
+        return NULL;
+    }
+    size_t bytes = state_size * batch_size * sizeof(ComplexNum);
+    BatchedState* state = malloc(sizeof(BatchedState));
+    void* amplitudes = NULL;
+    if (!state || posix_memalign(&amplitudes, BATCHED_ALIGNMENT, bytes) != 0) {
+        fprintf(stderr, "Error: Could not allocate %.1f GiB for %zu instances of a %d-qubit state\n",
+                bytes / 1073741824.0, batch_size, num_qubits);
+        free(state);
+        return NULL;
+    }
+    state->rng = malloc(batch_size * sizeof(RngState));
+    if (!state->rng) {
+        fprintf(stderr, "Error: Out of memory creating a batched state\n");
+        free(amplitudes);
+        free(state);
+        return NULL;
+    }
+    profile_allocate(1, bytes);
+    profile_sweep(state_size * batch_size);
+    memset(amplitudes, 0, bytes);
+
+    state->num_qubits = num_qubits;
+    state->state_size = state_size;
+    state->batch_size = batch_size;
+    state->group_lanes = lanes_per_group(num_qubits, batch_size);
+    state->amplitudes = amplitudes;
+    for (size_t b = 0; b < batch_size; b++) {
+        *instance_amplitude(state, b, 0) = 1.0;
+        rng_seed_next_stream(&state->rng[b]);
+    }
+    return state;
+}
+
+void destroy_batched_state(BatchedState* state) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    if (!state) {
+        return;
+    }
+    free(state->amplitudes);
+    free(state->rng);
+    free(state);
+}
+
+int batched_num_qubits(const BatchedState* state) {
+    return state->num_qubits;
+}
+
+size_t batched_size(const BatchedState* state) {
+    return state->batch_size;
+}
+
+ComplexNum batched_amplitude(const BatchedState* state, size_t b, size_t index) {
+    return *instance_amplitude(state, b, index);
+}
+
+// Whether other can exchange amplitudes with instance b of state; prints an error otherwise
+static bool check_instance(const BatchedState* state, size_t b, const QuantumState* other) {
+    if (b >= state->batch_size) {
+        fprintf(stderr, "Error: Instance %zu is outside the batch of %zu\n", b, state->batch_size);
+        return false;
+    }
+    if (other->backend != BACKEND_STATE_VECTOR || other->num_qubits != state->num_qubits) {
+        fprintf(stderr, "Error: Batched instances only exchange amplitudes with %d-qubit state vectors\n",
+                state->num_qubits);
+        return false;
+    }
+    return true;
+}
+
+bool copy_batched_instance(const BatchedState* state, size_t b, QuantumState* dest) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    if (!check_instance(state, b, dest)) {
+        return false;
+    }
+    profile_sweep(state->state_size);
+    for (size_t i = 0; i < state->state_size; i++) {
+        set_amplitude(dest, i, *instance_amplitude(state, b, i));
+    }
+    dest->rng = state->rng[b];
+    return true;
+}
+
+bool set_batched_instance(BatchedState* state, size_t b, const QuantumState* src) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    if (!check_instance(state, b, src)) {
+        return false;
+    }
+    profile_sweep(state->state_size);
+    for (size_t i = 0; i < state->state_size; i++) {
+        *instance_amplitude(state, b, i) = get_amplitude(src, i);
+    }
+    state->rng[b] = src->rng;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Row sweeps
+// ---------------------------------------------------------------------------
+
+typedef struct RowSweep RowSweep;
+
+// Arguments shared by the workers of one sweep over the rows. Rows are
+// handed out in blocks of about PARALLEL_THRESHOLD amplitudes; the blocks
+// depend only on the group's shape, so per-block sums add up the same way
+// whatever the thread count.
+struct RowSweep {
+    ComplexNum* rows;
+    size_t lanes;
+    IndexPattern pattern;
+    size_t rows_per_block;
+    size_t target_mask;
+    ComplexNum matrix[2][2];
+    ComplexNum phase;
+    const ComplexNum* dense_matrix;
+    const ComplexNum* lane_values;   // per-lane matrices or phases
+    int dim;
+    size_t offsets[1 << MAX_FUSED_QUBITS];
+    double* sums;                    // lanes partial sums per block
+    const struct LaneDiagonal* diagonal;
+    void (*apply)(const RowSweep* sweep, size_t block, size_t begin, size_t end);
+};
+
+static void matrix_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    (void)block;
+    kernel_apply_matrix_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->target_mask, sweep->matrix,
+                             begin, end);
+}
+
+static void lane_matrix_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    (void)block;
+    kernel_apply_lane_matrices_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->target_mask,
+                                    sweep->lane_values, begin, end);
+}
+
+static void phase_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    (void)block;
+    kernel_apply_phase_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->phase, begin, end);
+}
+
+static void lane_phase_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    (void)block;
+    kernel_apply_lane_phases_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->lane_values, begin, end);
+}
+
+static void swap_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    (void)block;
+    kernel_swap_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->target_mask, begin, end);
+}
+
+static void dense_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    (void)block;
+    if (sweep->lane_values) {
+        kernel_apply_lane_dense_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->offsets, sweep->dim,
+                                     sweep->lane_values, begin, end);
+    } else {
+        kernel_apply_dense_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->offsets, sweep->dim,
+                                sweep->dense_matrix, begin, end);
+    }
+}
+
+static void norm_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    kernel_norm_squared_rows(sweep->rows, sweep->lanes, &sweep->pattern, sweep->sums + block * sweep->lanes,
+                             begin, end);
+}
+
+static void block_range(void* ctx, size_t begin, size_t end) {
+    const RowSweep* sweep = ctx;
+    for (size_t block = begin; block < end; block++) {
+        size_t first = block * sweep->rows_per_block;
+        size_t last = first + sweep->rows_per_block;
+        sweep->apply(sweep, block, first, last < sweep->pattern.count ? last : sweep->pattern.count);
+    }
+}
+
+static size_t rows_per_block(const LaneGroup* group) {
+    return PARALLEL_THRESHOLD / group->lanes > 0 ? PARALLEL_THRESHOLD / group->lanes : 1;
+}
+
+// Blocks of a sweep over count rows
+static size_t sweep_blocks(const LaneGroup* group, size_t count) {
+    return (count + rows_per_block(group) - 1) / rows_per_block(group);
+}
+
+// Sweeps the rows of group matching (fixed_mask, set_mask) with apply
+static void run_sweep(const LaneGroup* group, RowSweep* sweep, size_t fixed_mask, size_t set_mask,
+                      void (*apply)(const RowSweep*, size_t, size_t, size_t)) {
+    sweep->rows = group->rows;
+    sweep->lanes = group->lanes;
+    sweep->rows_per_block = rows_per_block(group);
+    sweep->apply = apply;
+    make_index_pattern(&sweep->pattern, group->num_qubits, fixed_mask, set_mask);
+    profile_sweep(sweep->pattern.count * group->lanes);
+    parallel_for_coarse(sweep_blocks(group, sweep->pattern.count), block_range, sweep);
+}
+
+// Writes the weight of each instance's rows matching (fixed_mask, set_mask)
+// to sums, using partial (lanes per block of the sweep) for the block sums
+static void sum_lane_probabilities(const LaneGroup* group, size_t fixed_mask, size_t set_mask, double* sums,
+                                   double* partial) {
+    RowSweep sweep = { .sums = partial };
+    make_index_pattern(&sweep.pattern, group->num_qubits, fixed_mask, set_mask);
+    size_t blocks = sweep_blocks(group, sweep.pattern.count);
+    memset(partial, 0, blocks * group->lanes * sizeof(double));
+    run_sweep(group, &sweep, fixed_mask, set_mask, norm_rows);
+    for (size_t b = 0; b < group->lanes; b++) {
+        sums[b] = 0.0;
+    }
+    for (size_t block = 0; block < blocks; block++) {
+        for (size_t b = 0; b < group->lanes; b++) {
+            sums[b] += partial[block * group->lanes + b];
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Gates
+// ---------------------------------------------------------------------------
+
+// Gates of every instance at one position of the circuits, with scratch
+// space for one matrix per lane and for the sums of measurements
+typedef struct {
+    const Gate** gates;
+    ComplexNum* lane_values;
+    double* probabilities;   // 2 per lane
+    double* partial_sums;    // lanes per block of a half-state sweep
+} LaneGates;
+
+// The 2x2 matrix a gate applies to its last qubit where its other qubits
+// (controls) are 1. Returns false for gates that are not of that form.
+static bool controlled_matrix(const Gate* gate, ComplexNum m[2][2]) {
+    switch (gate->type) {
+        case CNOT:
+        case TOFFOLI:
+            m[0][0] = 0; m[0][1] = 1;
+            m[1][0] = 1; m[1][1] = 0;
+            return true;
+        case CONTROLLED_PHASE:
+            m[0][0] = 1; m[0][1] = 0;
+            m[1][0] = 0; m[1][1] = cexp(I * gate->angle);
+            return true;
+        case UNITARY:
+            if (gate->num_qubits != 1) {
+                return false;
+            }
+            return gate_matrix(gate, &m[0][0]);
+        case SWAP:
+        case PHASE_FLIP:
+        case MEASURE:
+        case QFT:
+        case INVERSE_QFT:
+            return false;
+        default:
+            return gate_matrix(gate, &m[0][0]);
+    }
+}
+
+// Controlled 2x2 gates: diagonal ones scale the rows whose target bit picks
+// a diagonal entry that is not 1, the others update row pairs
+static void apply_controlled_gates(const LaneGroup* group, const LaneGates* lanes) {
+    const Gate* gate = lanes->gates[0];
+    size_t n = group->lanes;
+    size_t target_mask = (size_t)1 << gate->qubits[gate->num_qubits - 1];
+    size_t control_mask = 0;
+    for (int j = 0; j < gate->num_qubits - 1; j++) {
+        control_mask |= (size_t)1 << gate->qubits[j];
+    }
+
+    RowSweep sweep = { .target_mask = target_mask };
+    controlled_matrix(gate, sweep.matrix);
+    bool shared = true;
+    bool diagonal = true;
+    bool identity[2] = { true, true };
+    for (size_t b = 0; b < n; b++) {
+        ComplexNum m[2][2];
+        controlled_matrix(lanes->gates[b], m);
+        for (int e = 0; e < 4; e++) {
+            ComplexNum value = m[e / 2][e % 2];
+            lanes->lane_values[e * n + b] = value;
+            shared = shared && value == sweep.matrix[e / 2][e % 2];
+        }
+        diagonal = diagonal && m[0][1] == 0 && m[1][0] == 0;
+        identity[0] = identity[0] && m[0][0] == 1;
+        identity[1] = identity[1] && m[1][1] == 1;
+    }
+
+    if (!diagonal) {
+        sweep.lane_values = lanes->lane_values;
+        run_sweep(group, &sweep, control_mask | target_mask, control_mask, shared ? matrix_rows : lane_matrix_rows);
+        return;
+    }
+    for (int r = 0; r < 2; r++) {
+        if (identity[r]) {
+            continue;
+        }
+        sweep.phase = sweep.matrix[r][r];
+        sweep.lane_values = lanes->lane_values + 3 * r * n;
+        run_sweep(group, &sweep, control_mask | target_mask, control_mask | (r ? target_mask : 0),
+                  shared ? phase_rows : lane_phase_rows);
+    }
+}
+
+static void apply_dense_gates(const LaneGroup* group, const LaneGates* lanes) {
+    const Gate* gate = lanes->gates[0];
+    size_t n = group->lanes;
+    RowSweep sweep = { .dim = 1 << gate->num_qubits };
+    size_t entries = (size_t)sweep.dim * sweep.dim;
+    size_t fixed_mask = 0;
+    for (int l = 0; l < sweep.dim; l++) {
+        sweep.offsets[l] = 0;
+        for (int j = 0; j < gate->num_qubits; j++) {
+            if (l & (1 << j)) {
+                sweep.offsets[l] |= (size_t)1 << gate->qubits[j];
+            }
+        }
+    }
+    for (int j = 0; j < gate->num_qubits; j++) {
+        fixed_mask |= (size_t)1 << gate->qubits[j];
+    }
+
+    bool shared = true;
+    for (size_t b = 1; b < n && shared; b++) {
+        shared = memcmp(lanes->gates[b]->matrix, gate->matrix, entries * sizeof(ComplexNum)) == 0;
+    }
+    if (shared) {
+        sweep.dense_matrix = gate->matrix;
+        run_sweep(group, &sweep, fixed_mask, 0, dense_rows);
+        return;
+    }
+    for (size_t b = 0; b < n; b++) {
+        for (size_t e = 0; e < entries; e++) {
+            lanes->lane_values[e * n + b] = lanes->gates[b]->matrix[e];
+        }
+    }
+    sweep.lane_values = lanes->lane_values;
+    run_sweep(group, &sweep, fixed_mask, 0, dense_rows);
+}
+
+static void apply_phase_flips(const LaneGroup* group, const LaneGates* lanes) {
+    profile_sweep(group->lanes);
+    for (size_t b = 0; b < group->lanes; b++) {
+        ComplexNum* amplitude = &group->rows[lanes->gates[b]->basis_state * group->lanes + b];
+        *amplitude = -*amplitude;
+    }
+}
+
+// Each instance draws its outcome as measure_qubit does, then the rows are
+// collapsed with a factor per lane: 0 for the rejected outcome, the
+// renormalization for the kept one
+static void apply_measurements(const LaneGroup* group, const LaneGates* lanes, int* classical_bits,
+                               int num_classical_bits) {
+    const Gate* gate = lanes->gates[0];
+    size_t n = group->lanes;
+    size_t mask = (size_t)1 << gate->qubits[0];
+    double* probabilities = lanes->probabilities;
+    sum_lane_probabilities(group, mask, 0, probabilities, lanes->partial_sums);
+    sum_lane_probabilities(group, mask, mask, probabilities + n, lanes->partial_sums);
+
+    ComplexNum* factors = lanes->lane_values;
+    for (size_t b = 0; b < n; b++) {
+        double prob_0 = probabilities[b];
+        double prob_1 = probabilities[n + b];
+        double rand_val = rng_uniform(&group->rng[b]);
+        int result = (rand_val * (prob_0 + prob_1) > prob_0) ? 1 : 0;
+        double scale = 1.0 / sqrt(result ? prob_1 : prob_0);
+        factors[b] = result ? 0.0 : scale;
+        factors[n + b] = result ? scale : 0.0;
+        if (classical_bits) {
+            classical_bits[b * num_classical_bits + lanes->gates[b]->classical_bit] = result;
+        }
+    }
+
+    RowSweep sweep = { .lane_values = factors };
+    run_sweep(group, &sweep, mask, 0, lane_phase_rows);
+    sweep.lane_values = factors + n;
+    run_sweep(group, &sweep, mask, mask, lane_phase_rows);
+}
+
+static void apply_lane_gates(const LaneGroup* group, const LaneGates* lanes, int* classical_bits,
+                             int num_classical_bits) {
+    const Gate* gate = lanes->gates[0];
+    PROFILE_SCOPE(gate->type, gate->num_qubits > 0 ? gate->qubits[gate->num_qubits - 1] : -1);
+    switch (gate->type) {
+        case MEASURE:
+            apply_measurements(group, lanes, classical_bits, num_classical_bits);
+            return;
+        case PHASE_FLIP:
+            apply_phase_flips(group, lanes);
+            return;
+        case SWAP: {
+            if (gate->qubits[0] == gate->qubits[1]) {
+                return;
+            }
+            size_t mask1 = (size_t)1 << gate->qubits[0];
+            size_t mask2 = (size_t)1 << gate->qubits[1];
+            RowSweep sweep = { .target_mask = mask1 | mask2 };
+            run_sweep(group, &sweep, mask1 | mask2, mask1, swap_rows);
+            return;
+        }
+        case UNITARY:
+            if (gate->num_qubits > 1) {
+                apply_dense_gates(group, lanes);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    apply_controlled_gates(group, lanes);
+}
+
+static bool is_diagonal_gate(GateType type) {
+    return type == PAULI_Z || type == PHASE || type == ROTATION_Z || type == CONTROLLED_PHASE;
+}
+
+static void batch_diagonal_gate(DiagonalBatch* batch, const Gate* gate) {
+    const int* q = gate->qubits;
+    switch (gate->type) {
+        case PAULI_Z:          diagonal_batch_pauli_z(batch, q[0]); break;
+        case PHASE:            diagonal_batch_phase(batch, q[0], gate->angle); break;
+        case ROTATION_Z:       diagonal_batch_rotation_z(batch, q[0], gate->angle); break;
+        case CONTROLLED_PHASE: diagonal_batch_controlled_phase(batch, q[0], q[1], gate->angle); break;
+        default:               break;
+    }
+}
+
+// Phase tables of a diagonal run, laid out as rows of lanes (see
+// diagonal_batch_apply): the low table covers the low bits of the row index,
+// high table h multiplies in when bit h of the run number is set, and terms
+// on two high qubits give one phase per lane and run
+typedef struct LaneDiagonal {
+    int high_bits;
+    size_t run_length;             // rows covered by one table
+    ComplexNum* low_table;
+    ComplexNum* high_tables[MAX_QUBITS];
+    size_t* high_masks;
+    ComplexNum* high_phases;       // lanes per term
+    int num_high_terms;
+} LaneDiagonal;
+
+// Refreshes levels[lowest..0] as build_levels in diagonal.c does
+static void build_lane_levels(const LaneDiagonal* diagonal, size_t lanes, size_t run, int lowest,
+                              const ComplexNum** levels, ComplexNum* buffers) {
+    size_t entries = diagonal->run_length * lanes;
+    for (int h = lowest; h >= 0; h--) {
+        const ComplexNum* above = levels[h + 1];
+        if ((run >> h) & 1 && diagonal->high_tables[h]) {
+            ComplexNum* table = buffers + (size_t)h * entries;
+            kernel_multiply(table, above, diagonal->high_tables[h], entries);
+            levels[h] = table;
+        } else {
+            levels[h] = above;
+        }
+    }
+}
+
+static void diagonal_rows(const RowSweep* sweep, size_t block, size_t begin, size_t end) {
+    (void)block;
+    const LaneDiagonal* diagonal = sweep->diagonal;
+    size_t lanes = sweep->lanes;
+    int high_bits = diagonal->high_bits;
+    const ComplexNum* levels[MAX_QUBITS + 1];
+    ComplexNum* buffers = malloc((high_bits > 0 ? high_bits : 1) * diagonal->run_length * lanes * sizeof(ComplexNum));
+    ComplexNum* factors = malloc(lanes * sizeof(ComplexNum));
+    IndexPattern contiguous;
+    make_index_pattern(&contiguous, 0, 0, 0);
+
+    size_t first_run = begin / diagonal->run_length;
+    levels[high_bits] = diagonal->low_table;
+    build_lane_levels(diagonal, lanes, first_run, high_bits - 1, levels, buffers);
+
+    for (size_t run = first_run; run * diagonal->run_length < end; run++) {
+        if (run > first_run) {
+            build_lane_levels(diagonal, lanes, run, __builtin_ctzll(run), levels, buffers);
+        }
+        size_t start = run * diagonal->run_length;
+        size_t first = begin > start ? begin - start : 0;
+        size_t last = end - start < diagonal->run_length ? end - start : diagonal->run_length;
+        ComplexNum* a = sweep->rows + start * lanes;
+        kernel_multiply(a + first * lanes, a + first * lanes, levels[0] + first * lanes, (last - first) * lanes);
+
+        bool any = false;
+        for (size_t b = 0; b < lanes; b++) {
+            factors[b] = 1.0;
+        }
+        for (int t = 0; t < diagonal->num_high_terms; t++) {
+            if ((start & diagonal->high_masks[t]) == diagonal->high_masks[t]) {
+                for (size_t b = 0; b < lanes; b++) {
+                    factors[b] *= diagonal->high_phases[t * lanes + b];
+                }
+                any = true;
+            }
+        }
+        if (any) {
+            kernel_apply_lane_phases_rows(a, lanes, &contiguous, factors, first, last);
+        }
+    }
+    free(buffers);
+    free(factors);
+}
+
+// Runs of two or more diagonal gates share one sweep, as in execute_circuit:
+// each instance collects its own terms, which fill its lane of the tables
+static void apply_diagonal_run(const LaneGroup* group, const Circuit* const* work, size_t first, size_t end) {
+    PROFILE_SCOPE(PROFILE_DIAGONAL_BATCH, -1);
+    size_t lanes = group->lanes;
+    int n = group->num_qubits;
+    // Tables hold about 2^DIAGONAL_TABLE_BITS entries, as for a single state
+    int low_bits = 0;
+    while (low_bits < n && ((size_t)2 << low_bits) * lanes <= ((size_t)1 << DIAGONAL_TABLE_BITS)) {
+        low_bits++;
+    }
+    LaneDiagonal diagonal = { .high_bits = n - low_bits, .run_length = (size_t)1 << low_bits };
+    size_t low_mask = diagonal.run_length - 1;
+    size_t entries = diagonal.run_length * lanes;
+    diagonal.low_table = malloc(entries * sizeof(ComplexNum));
+    diagonal.high_masks = malloc((end - first) * sizeof(size_t));
+    diagonal.high_phases = malloc((end - first) * lanes * sizeof(ComplexNum));
+    profile_allocate(3, entries * sizeof(ComplexNum) + (end - first) * (sizeof(size_t) + lanes * sizeof(ComplexNum)));
+
+    DiagonalBatch batch;
+    diagonal_batch_init(&batch);
+    for (size_t b = 0; b < lanes; b++) {
+        for (size_t g = first; g < end; g++) {
+            batch_diagonal_gate(&batch, &work[group->first + b]->gates[g]);
+        }
+        ComplexNum global = cexp(I * batch.global_angle);
+        for (size_t j = 0; j < diagonal.run_length; j++) {
+            diagonal.low_table[j * lanes + b] = global;
+        }
+
+        // The instances merge their gates into the same terms, in the same order
+        int num_high_terms = 0;
+        for (int t = 0; t < batch.num_terms; t++) {
+            size_t mask = batch.terms[t].mask;
+            ComplexNum phase = cexp(I * batch.terms[t].angle);
+            size_t low = mask & low_mask;
+            size_t high = mask >> low_bits;
+            ComplexNum* table = diagonal.low_table;
+            if (high != 0 && (high & (high - 1)) == 0) {
+                int h = __builtin_ctzll(high);
+                if (!diagonal.high_tables[h]) {
+                    diagonal.high_tables[h] = malloc(entries * sizeof(ComplexNum));
+                    for (size_t e = 0; e < entries; e++) {
+                        diagonal.high_tables[h][e] = 1.0;
+                    }
+                }
+                table = diagonal.high_tables[h];
+            } else if (high != 0) {
+                diagonal.high_masks[num_high_terms] = mask;
+                diagonal.high_phases[num_high_terms * lanes + b] = phase;
+                num_high_terms++;
+                continue;
+            }
+            for (size_t j = 0; j < diagonal.run_length; j++) {
+                if ((j & low) == low) {
+                    table[j * lanes + b] *= phase;
+                }
+            }
+        }
+        diagonal.num_high_terms = num_high_terms;
+        batch.num_terms = 0;
+        batch.global_angle = 0.0;
+    }
+    diagonal_batch_free(&batch);
+
+    RowSweep sweep = { .diagonal = &diagonal };
+    run_sweep(group, &sweep, 0, 0, diagonal_rows);
+
+    for (int h = 0; h < diagonal.high_bits; h++) {
+        free(diagonal.high_tables[h]);
+    }
+    free(diagonal.low_table);
+    free(diagonal.high_masks);
+    free(diagonal.high_phases);
+}
+
+// Whether two gates differ in nothing but their parameters
+static bool same_structure(const Gate* a, const Gate* b) {
+    if (a->type != b->type || a->num_qubits != b->num_qubits ||
+        memcmp(a->qubits, b->qubits, a->num_qubits * sizeof(int)) != 0) {
+        return false;
+    }
+    return a->type != MEASURE || a->classical_bit == b->classical_bit;
+}
+
+static bool has_transforms(const Circuit* circuit) {
+    for (size_t g = 0; g < circuit->num_gates; g++) {
+        if (circuit->gates[g].type == QFT || circuit->gates[g].type == INVERSE_QFT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Gate sequence shared by the instances, and scratch space for each group
+typedef struct {
+    const BatchedState* state;
+    const Circuit* const* work;
+    int* classical_bits;
+    int num_classical_bits;
+    const Gate** gates;        // group_lanes per group
+    ComplexNum* lane_values;   // values_per_lane * group_lanes per group
+    size_t values_per_lane;
+    double* sums;              // sums_per_lane * group_lanes per group
+    size_t sums_per_lane;
+} BatchedRun;
+
+// Runs every gate on each group in turn, so a group stays in cache for the whole circuit
+static void run_groups(void* ctx, size_t begin, size_t end) {
+    const BatchedRun* run = ctx;
+    size_t lanes_max = run->state->group_lanes;
+    for (size_t g = begin; g < end; g++) {
+        LaneGroup group = lane_group(run->state, g);
+        LaneGates lanes = {
+            .gates = run->gates + g * lanes_max,
+            .lane_values = run->lane_values + g * lanes_max * run->values_per_lane,
+            .probabilities = run->sums + g * lanes_max * run->sums_per_lane,
+        };
+        lanes.partial_sums = lanes.probabilities + 2 * group.lanes;
+        int* bits = run->classical_bits ? run->classical_bits + group.first * run->num_classical_bits : NULL;
+        for (size_t i = 0; i < run->work[0]->num_gates; ) {
+            size_t end = i;
+            while (end < run->work[0]->num_gates && is_diagonal_gate(run->work[0]->gates[end].type)) {
+                end++;
+            }
+            if (end - i >= 2) {
+                apply_diagonal_run(&group, run->work, i, end);
+                i = end;
+                continue;
+            }
+            for (size_t b = 0; b < group.lanes; b++) {
+                lanes.gates[b] = &run->work[group.first + b]->gates[i];
+            }
+            apply_lane_gates(&group, &lanes, bits, run->num_classical_bits);
+            i++;
+        }
+    }
+}
+
+bool execute_circuits_batched(const Circuit* const* circuits, BatchedState* state, int* classical_bits) {
+    size_t n = state->batch_size;
+    for (size_t b = 0; b < n; b++) {
+        if (circuits[b]->num_qubits != state->num_qubits) {
+            fprintf(stderr, "Error: Circuit %zu has %d qubits but the batched state has %d\n",
+                    b, circuits[b]->num_qubits, state->num_qubits);
+            return false;
+        }
+    }
+
+    // Transforms become gates so the instances share one gate sequence
+    const Circuit** work = calloc(n, sizeof(Circuit*));
+    Circuit** expanded = calloc(n, sizeof(Circuit*));
+    bool ok = work && expanded;
+    bool expand = false;
+    for (size_t b = 0; ok && b < n; b++) {
+        expand = expand || has_transforms(circuits[b]);
+    }
+    for (size_t b = 0; ok && b < n; b++) {
+        work[b] = circuits[b];
+        if (expand) {
+            expanded[b] = expand_transforms(circuits[b], 0);
+            work[b] = expanded[b];
+            ok = expanded[b] != NULL;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory preparing batched circuits\n");
+    }
+
+    for (size_t b = 0; ok && b < n; b++) {
+        bool same = work[b]->num_gates == work[0]->num_gates &&
+                    circuits[b]->num_classical_bits == circuits[0]->num_classical_bits;
+        for (size_t g = 0; same && g < work[0]->num_gates; g++) {
+            same = same_structure(&work[0]->gates[g], &work[b]->gates[g]);
+        }
+        if (!same) {
+            fprintf(stderr, "Error: Circuit %zu does not have the gates of circuit 0 on the same qubits\n", b);
+            ok = false;
+        }
+    }
+
+    // Per-lane matrices are sized for the widest dense gate; measurements sum
+    // two probabilities per lane, plus the partial sums of a half-state sweep
+    int widest = 1;
+    for (size_t g = 0; ok && g < work[0]->num_gates; g++) {
+        const Gate* gate = &work[0]->gates[g];
+        if (gate->type == UNITARY && gate->num_qubits > widest) {
+            widest = gate->num_qubits;
+        }
+    }
+    LaneGroup first = lane_group(state, 0);
+    size_t groups = num_groups(state);
+    size_t slots = groups * state->group_lanes;
+    BatchedRun run = {
+        .state = state,
+        .work = work,
+        .classical_bits = classical_bits,
+        .num_classical_bits = circuits[0]->num_classical_bits,
+        .values_per_lane = (size_t)1 << (2 * widest),
+        .sums_per_lane = 2 + sweep_blocks(&first, state->state_size / 2)
+    };
+    if (ok) {
+        run.gates = malloc(slots * sizeof(Gate*));
+        run.lane_values = malloc(slots * run.values_per_lane * sizeof(ComplexNum));
+        run.sums = malloc(slots * run.sums_per_lane * sizeof(double));
+        if (!run.gates || !run.lane_values || !run.sums) {
+            fprintf(stderr, "Error: Out of memory preparing batched circuits\n");
+            ok = false;
+        }
+    }
+
+    // Groups run in parallel; a single group parallelizes its sweeps instead
+    if (ok) {
+        parallel_for_coarse(groups, run_groups, &run);
+    }
+
+    for (size_t b = 0; expanded && b < n; b++) {
+        if (expanded[b]) {
+            destroy_circuit(expanded[b]);
+        }
+    }
+    free(expanded);
+    free(work);
+    free(run.gates);
+    free(run.lane_values);
+    free(run.sums);
+    return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef BATCHED_H
+#define BATCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "circuit.h"
+
+// Batches of independent small state vectors that run the same circuit with
+// different parameters, such as phase estimation over a range of phases or a
+// sweep of rotation angles. The amplitudes are interleaved, index major and
+// instance minor: row i holds amplitude i of a run of instances,
+// contiguously, so each gate is one sweep over the rows in which every lane
+// of a row gets the same update, vectorized across instances. Gates whose
+// parameters agree in every instance run the ordinary span kernels over
+// whole runs of rows; the others read a matrix (or phase) per lane.
+//
+// The instances are split into groups interleaved on their own, each about
+// the size of a cache tile (see default_local_qubits), and each group runs
+// the whole circuit before the next one starts, so a group stays in cache as
+// a single small state would. Groups run on the worker pool in parallel.
+// Amplitudes are stored in double precision.
+
+typedef struct BatchedState BatchedState;
+
+// batch_size instances of |0...0> on num_qubits qubits. Instance b takes the
+// next random stream of the seed (see qsim_set_seed), as if the instances
+// had been created one after another. Returns NULL after printing an error.
+BatchedState* create_batched_state(int num_qubits, size_t batch_size);
+void destroy_batched_state(BatchedState* state);
+
+int batched_num_qubits(const BatchedState* state);
+size_t batched_size(const BatchedState* state);
+
+// Amplitude index of instance b
+ComplexNum batched_amplitude(const BatchedState* state, size_t b, size_t index);
+
+// Copies instance b, with its random stream, into dest (a state vector on the
+// same qubits), so sampling and observables apply to single instances; and
+// sets instance b from src the same way. Return false after printing an error.
+bool copy_batched_instance(const BatchedState* state, size_t b, QuantumState* dest);
+bool set_batched_instance(BatchedState* state, size_t b, const QuantumState* src);
+
+// Runs circuits[b] against instance b for every instance. The circuits must
+// have the state's qubit count and the same gates on the same qubits; angles,
+// UNITARY matrices and PHASE_FLIP basis states may differ (e.g. circuits from
+// build_phase_estimation_circuit with different phases). Fourier transforms
+// run as their Hadamards, controlled phases and swaps. Each instance measures
+// with its own random stream, drawing what a single state would, and writes
+// its results to classical_bits + b * num_classical_bits (may be NULL).
+// Returns false after printing an error, before any gate has run.
+bool execute_circuits_batched(const Circuit* const* circuits, BatchedState* state, int* classical_bits);
+
+#endif /* BATCHED_H */
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "quantum.h"
+#include "circuit.h"
+#include "kernels.h"
+#include "threadpool.h"
+
+// Benchmark driver, built as its own binary (see README): times every gate
+// kernel for each register size and target position, then the algorithm entry
+// points, and writes the results as JSON so runs can be compared across
+// releases and machines. Each measurement is warmed up, repeated, and
+// reported as the median repetition.
+
+#define PI 3.14159265358979323846
+#define DEFAULT_MIN_QUBITS 10
+#define DEFAULT_MAX_QUBITS 24
+#define DEFAULT_REPETITIONS 5
+#define DEFAULT_WARMUP 1
+
+// A timed repetition applies a gate often enough to cover about this many amplitudes
+#define AMPLITUDES_PER_REPETITION ((size_t)1 << 24)
+
+// Grover's search takes about 2^(n/2) iterations, so it only runs on smaller registers
+#define GROVER_MAX_QUBITS 16
+
+#define SAMPLE_SHOTS (1 << 20)
+#define SHOR_QUBITS 8
+#define SHOR_NUMBER 15
+
+// One benchmarked gate: `touched` is the fraction of the amplitudes its kernel
+// reads and writes (diagonal and controlled gates skip the rest)
+typedef struct {
+    const char* name;
+    GateType type;
+    int num_qubits;
+    double touched;
+} BenchGate;
+
+static const BenchGate bench_gates[] = {
+    { "hadamard",         HADAMARD,         1, 1.0  },
+    { "pauli_x",          PAULI_X,          1, 1.0  },
+    { "pauli_y",          PAULI_Y,          1, 1.0  },
+    { "pauli_z",          PAULI_Z,          1, 0.5  },
+    { "phase",            PHASE,            1, 0.5  },
+    { "rotation_x",       ROTATION_X,       1, 1.0  },
+    { "rotation_y",       ROTATION_Y,       1, 1.0  },
+    { "rotation_z",       ROTATION_Z,       1, 1.0  },
+    { "cnot",             CNOT,             2, 0.5  },
+    { "controlled_phase", CONTROLLED_PHASE, 2, 0.25 },
+    { "swap",             SWAP,             2, 0.5  },
+    { "toffoli",          TOFFOLI,          3, 0.25 }
+};
+
+typedef struct {
+    int min_qubits;
+    int max_qubits;
+    int repetitions;
+    int warmup;
+    Precision precision;
+    const char* output_path;   // NULL: stdout
+} BenchOptions;
+
+// Median and minimum of the repetition times of one measurement
+typedef struct {
+    double median;
+    double min;
+} Timing;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static Timing summarize(double* times, int count) {
+    qsort(times, count, sizeof(double), compare_doubles);
+    Timing timing = { times[count / 2], times[0] };
+    if (count % 2 == 0) {
+        timing.median = 0.5 * (times[count / 2 - 1] + times[count / 2]);
+    }
+    return timing;
+}
+
+static size_t amplitude_bytes(Precision precision) {
+    return precision == PRECISION_SINGLE ? sizeof(ComplexFloat) : sizeof(ComplexNum);
+}
+
+// Target at the given position; the other qubits of the gate sit next to it,
+// above when there is room and below otherwise (controls first, target last)
+static Gate make_bench_gate(const BenchGate* info, int num_qubits, int target) {
+    Gate gate = { .type = info->type, .num_qubits = info->num_qubits, .angle = 0.3 };
+    int step = target + info->num_qubits - 1 < num_qubits ? 1 : -1;
+    for (int j = 0; j < info->num_qubits - 1; j++) {
+        gate.qubits[j] = target + step * (j + 1);
+    }
+    gate.qubits[info->num_qubits - 1] = target;
+    return gate;
+}
+
+static Timing time_gate(QuantumState* state, const Gate* gate, size_t applications, const BenchOptions* options,
+                        double* times) {
+    for (int w = 0; w < options->warmup; w++) {
+        apply_gate(state, gate, NULL);
+    }
+    for (int r = 0; r < options->repetitions; r++) {
+        double start = now();
+        for (size_t a = 0; a < applications; a++) {
+            apply_gate(state, gate, NULL);
+        }
+        times[r] = (now() - start) / applications;
+    }
+    return summarize(times, options->repetitions);
+}
+
+static void write_separator(FILE* out, bool* first) {
+    fprintf(out, *first ? "\n" : ",\n");
+    *first = false;
+}
+
+static void bench_kernels(FILE* out, const BenchOptions* options, double* times) {
+    static const char* position_names[] = { "low", "middle", "high" };
+    bool first = true;
+    fprintf(out, "  \"kernels\": [");
+    for (int n = options->min_qubits; n <= options->max_qubits; n++) {
+        QuantumState* state = create_quantum_state_with_precision(n, options->precision);
+        if (!state) {
+            break;
+        }
+        size_t size = (size_t)1 << n;
+        size_t applications = size < AMPLITUDES_PER_REPETITION ? AMPLITUDES_PER_REPETITION / size : 1;
+        int positions[3] = { 0, n / 2, n - 1 };
+        fprintf(stderr, "Timing gate kernels on %d qubits\n", n);
+
+        for (size_t g = 0; g < sizeof(bench_gates) / sizeof(bench_gates[0]); g++) {
+            const BenchGate* info = &bench_gates[g];
+            for (int p = 0; p < 3 && info->num_qubits <= n; p++) {
+                Gate gate = make_bench_gate(info, n, positions[p]);
+                Timing t = time_gate(state, &gate, applications, options, times);
+                double bytes = 2.0 * info->touched * size * amplitude_bytes(options->precision);
+                write_separator(out, &first);
+                fprintf(out,
+                        "    {\"gate\": \"%s\", \"qubits\": %d, \"position\": \"%s\", \"target\": %d, "
+                        "\"seconds\": %.6e, \"min_seconds\": %.6e, \"gates_per_s\": %.6e, "
+                        "\"amplitudes_per_s\": %.6e, \"gb_per_s\": %.4f}",
+                        info->name, n, position_names[p], positions[p], t.median, t.min, 1.0 / t.median,
+                        size / t.median, bytes / t.median * 1e-9);
+            }
+        }
+        destroy_quantum_state(state);
+    }
+    fprintf(out, "\n  ],\n");
+}
+
+typedef enum {
+    ALGORITHM_QFT,
+    ALGORITHM_GROVER,
+    ALGORITHM_PHASE_ESTIMATION,
+    ALGORITHM_SHOR,
+    ALGORITHM_SAMPLING
+} Algorithm;
+
+static const char* algorithm_names[] = { "qft", "grover", "phase_estimation", "shor", "sampling" };
+
+static void run_algorithm(QuantumState* state, Algorithm algorithm) {
+    int period;
+    ShotHistogram histogram;
+    switch (algorithm) {
+        case ALGORITHM_QFT:
+            quantum_fourier_transform(state);
+            break;
+        case ALGORITHM_GROVER:
+            grover_search(state, state->state_size - 1);
+            break;
+        case ALGORITHM_PHASE_ESTIMATION:
+            quantum_phase_estimation(state, 2 * PI / 3);
+            break;
+        case ALGORITHM_SHOR:
+            shor_period_finding(state, SHOR_NUMBER, &period);
+            break;
+        case ALGORITHM_SAMPLING:
+            if (sample_shots(state, SAMPLE_SHOTS, NULL, 0, &histogram)) {
+                free_shot_histogram(&histogram);
+            }
+            break;
+    }
+}
+
+// Gates the algorithm applies, from the circuit it is built from (sampling applies none)
+static size_t algorithm_gates(Algorithm algorithm, int num_qubits) {
+    Circuit* circuit = NULL;
+    switch (algorithm) {
+        case ALGORITHM_QFT:              circuit = build_qft_circuit(num_qubits); break;
+        case ALGORITHM_GROVER:           circuit = build_grover_circuit(num_qubits, 0); break;
+        case ALGORITHM_PHASE_ESTIMATION: circuit = build_phase_estimation_circuit(num_qubits, 2 * PI / 3); break;
+        case ALGORITHM_SHOR:             circuit = build_shor_period_finding_circuit(num_qubits, SHOR_NUMBER); break;
+        case ALGORITHM_SAMPLING:         break;
+    }
+    size_t gates = 0;
+    if (circuit) {
+        // A whole-register QFT counts as the Hadamards, controlled phases and
+        // swaps it replaces, so rates stay comparable with gate-by-gate runs
+        for (size_t i = 0; i < circuit->num_gates; i++) {
+            const Gate* gate = &circuit->gates[i];
+            size_t m = (size_t)gate->register_size;
+            gates += gate->type == QFT || gate->type == INVERSE_QFT ? m * (m + 1) / 2 + m / 2 : 1;
+        }
+        destroy_circuit(circuit);
+    }
+    return gates;
+}
+
+// Gates/s, amplitudes/s and GB/s are effective rates: what applying every gate
+// as its own sweep over the state would need to achieve the measured time,
+// whether or not the run fused or tiled them. Sampling reads the state once.
+static void bench_algorithm(FILE* out, bool* first, Algorithm algorithm, int n, const BenchOptions* options,
+                            double* times) {
+    QuantumState* state = create_quantum_state_with_precision(n, options->precision);
+    if (!state) {
+        return;
+    }
+    if (algorithm == ALGORITHM_SAMPLING) {
+        for (int q = 0; q < n; q++) {
+            apply_hadamard(state, q);
+        }
+    }
+    fprintf(stderr, "Timing %s on %d qubits\n", algorithm_names[algorithm], n);
+
+    for (int w = 0; w < options->warmup; w++) {
+        run_algorithm(state, algorithm);
+    }
+    for (int r = 0; r < options->repetitions; r++) {
+        double start = now();
+        run_algorithm(state, algorithm);
+        times[r] = now() - start;
+    }
+    Timing t = summarize(times, options->repetitions);
+    destroy_quantum_state(state);
+
+    size_t gates = algorithm_gates(algorithm, n);
+    double sweeps = algorithm == ALGORITHM_SAMPLING ? 1.0 : (double)gates;
+    double amplitudes = sweeps * ldexp(1.0, n);
+    double bytes = amplitudes * amplitude_bytes(options->precision) * (algorithm == ALGORITHM_SAMPLING ? 1 : 2);
+    write_separator(out, first);
+    fprintf(out,
+            "    {\"algorithm\": \"%s\", \"qubits\": %d, \"gates\": %zu, \"seconds\": %.6e, "
+            "\"min_seconds\": %.6e, \"gates_per_s\": %.6e, \"amplitudes_per_s\": %.6e, \"gb_per_s\": %.4f",
+            algorithm_names[algorithm], n, gates, t.median, t.min, gates / t.median, amplitudes / t.median,
+            bytes / t.median * 1e-9);
+    if (algorithm == ALGORITHM_SAMPLING) {
+        fprintf(out, ", \"shots\": %d, \"shots_per_s\": %.6e", SAMPLE_SHOTS, SAMPLE_SHOTS / t.median);
+    }
+    fprintf(out, "}");
+}
+
+static void bench_algorithms(FILE* out, const BenchOptions* options, double* times) {
+    bool first = true;
+    fprintf(out, "  \"algorithms\": [");
+    for (int n = options->min_qubits; n <= options->max_qubits; n++) {
+        bench_algorithm(out, &first, ALGORITHM_QFT, n, options, times);
+        if (n <= GROVER_MAX_QUBITS) {
+            bench_algorithm(out, &first, ALGORITHM_GROVER, n, options, times);
+        }
+        bench_algorithm(out, &first, ALGORITHM_PHASE_ESTIMATION, n, options, times);
+        bench_algorithm(out, &first, ALGORITHM_SAMPLING, n, options, times);
+    }
+    // Shor's demonstration circuit has a fixed size
+    bench_algorithm(out, &first, ALGORITHM_SHOR, SHOR_QUBITS, options, times);
+    fprintf(out, "\n  ]\n");
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  --min-qubits N            smallest register to time (default %d)\n"
+            "  --max-qubits N            largest register to time (default %d)\n"
+            "  --repetitions N           timed repetitions per measurement (default %d)\n"
+            "  --warmup N                untimed runs before each measurement (default %d)\n"
+            "  --precision single|double amplitude storage (default %s)\n"
+            "  -o FILE                   write the JSON results to FILE instead of stdout\n",
+            program, DEFAULT_MIN_QUBITS, DEFAULT_MAX_QUBITS, DEFAULT_REPETITIONS, DEFAULT_WARMUP,
+            DEFAULT_PRECISION == PRECISION_SINGLE ? "single" : "double");
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions* options) {
+    options->min_qubits = DEFAULT_MIN_QUBITS;
+    options->max_qubits = DEFAULT_MAX_QUBITS;
+    options->repetitions = DEFAULT_REPETITIONS;
+    options->warmup = DEFAULT_WARMUP;
+    options->precision = DEFAULT_PRECISION;
+    options->output_path = NULL;
+
+    for (int i = 1; i < argc; i += 2) {
+        const char* arg = argv[i];
+        const char* value = argv[i + 1];
+        if (!value) {
+            fprintf(stderr, "Error: %s needs a value\n", arg);
+            return false;
+        }
+        if (strcmp(arg, "--min-qubits") == 0) {
+            options->min_qubits = atoi(value);
+        } else if (strcmp(arg, "--max-qubits") == 0) {
+            options->max_qubits = atoi(value);
+        } else if (strcmp(arg, "--repetitions") == 0) {
+            options->repetitions = atoi(value);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            options->warmup = atoi(value);
+        } else if (strcmp(arg, "--precision") == 0) {
+            if (strcmp(value, "single") != 0 && strcmp(value, "double") != 0) {
+                fprintf(stderr, "Error: --precision must be 'single' or 'double'\n");
+                return false;
+            }
+            options->precision = strcmp(value, "single") == 0 ? PRECISION_SINGLE : PRECISION_DOUBLE;
+        } else if (strcmp(arg, "-o") == 0) {
+            options->output_path = value;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", arg);
+            return false;
+        }
+    }
+
+    // Multi-qubit gates need three qubits
+    if (options->min_qubits < 3 || options->max_qubits < options->min_qubits || options->max_qubits > MAX_QUBITS) {
+        fprintf(stderr, "Error: Qubit range must lie between 3 and %d\n", MAX_QUBITS);
+        return false;
+    }
+    if (options->repetitions < 1 || options->warmup < 0) {
+        fprintf(stderr, "Error: Need at least one repetition and no negative warm-up\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    FILE* out = stdout;
+    if (options.output_path && !(out = fopen(options.output_path, "w"))) {
+        fprintf(stderr, "Error: Cannot write %s\n", options.output_path);
+        return 1;
+    }
+    double* times = malloc(options.repetitions * sizeof(double));
+    qsim_set_seed(1);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"isa\": \"%s\",\n", kernel_isa_name());
+    fprintf(out, "  \"threads\": %d,\n", threadpool_num_threads());
+    fprintf(out, "  \"precision\": \"%s\",\n", options.precision == PRECISION_SINGLE ? "single" : "double");
+    fprintf(out, "  \"repetitions\": %d,\n", options.repetitions);
+    fprintf(out, "  \"warmup\": %d,\n", options.warmup);
+    bench_kernels(out, &options, times);
+    bench_algorithms(out, &options, times);
+    fprintf(out, "}\n");
+
+    free(times);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
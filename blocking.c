@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "circuit.h"
+#include "profile.h"
+#include "threadpool.h"
+
+#define PI 3.14159265358979323846
+
+// How far ahead the executor looks when deciding whether to remap a qubit
+#define LOOKAHEAD_GATES 256
+
+// A high qubit is swapped into the local range when at least this many of
+// the upcoming gates target it; otherwise its gate streams the state directly
+#define REMAP_MIN_USES 2
+
+#define MIN_LOCAL_QUBITS 10
+
+typedef struct {
+    const Circuit* circuit;
+    int local_qubits;
+    int physical[MAX_QUBITS];   // logical qubit -> physical bit position
+    int logical[MAX_QUBITS];    // physical bit position -> logical qubit
+    Circuit* group;             // pending gates with local targets, on physical qubits
+} BlockedExecutor;
+
+typedef struct {
+    const Circuit* group;
+    QuantumState* state;
+    int local_qubits;
+} TileJob;
+
+int default_local_qubits(void) {
+    const char* env = getenv("QSIM_BLOCK_QUBITS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+
+    // Tiles take half of L2 so the next tile's lines and the tables fit beside them
+    long l2 = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (l2 <= 0) {
+        l2 = 256 * 1024;
+    }
+    int local = MIN_LOCAL_QUBITS;
+    while (((size_t)sizeof(ComplexNum) << (local + 1)) <= (size_t)l2 / 2) {
+        local++;
+    }
+    return local;
+}
+
+bool gate_needs_local(const Gate* gate, int j) {
+    switch (gate->type) {
+        case CNOT:
+        case TOFFOLI:
+            return j == gate->num_qubits - 1;
+        case PAULI_Z:
+        case PHASE:
+        case ROTATION_Z:
+        case CONTROLLED_PHASE:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void push_gate(Circuit* scratch, const Gate* gate) {
+    if (scratch->num_gates == scratch->capacity) {
+        scratch->capacity *= 2;
+        scratch->gates = realloc(scratch->gates, scratch->capacity * sizeof(Gate));
+    }
+    scratch->gates[scratch->num_gates++] = *gate;
+}
+
+void append_tile_gate(Circuit* scratch, const Gate* gate, size_t tile, int local_qubits, double* angle) {
+    Gate local = *gate;
+    int num_local = 0;
+    for (int j = 0; j < gate->num_qubits; j++) {
+        int q = gate->qubits[j];
+        if (q < local_qubits) {
+            local.qubits[num_local++] = q;
+        } else if (!((tile >> (q - local_qubits)) & 1)) {
+            // Targets are always local, so this is a control or a diagonal qubit
+            if (gate->type == ROTATION_Z) {
+                *angle -= gate->angle / 2;
+            }
+            return;
+        }
+    }
+    if (num_local == gate->num_qubits) {
+        push_gate(scratch, gate);
+        return;
+    }
+
+    // Every high qubit is 1 from here on
+    switch (gate->type) {
+        case CNOT:
+        case TOFFOLI:
+            local.type = num_local == 3 ? TOFFOLI : num_local == 2 ? CNOT : PAULI_X;
+            break;
+        case PAULI_Z:
+            *angle += PI;
+            return;
+        case PHASE:
+            *angle += gate->angle;
+            return;
+        case ROTATION_Z:
+            *angle += gate->angle / 2;
+            return;
+        case CONTROLLED_PHASE:
+            if (num_local == 0) {
+                *angle += gate->angle;
+                return;
+            }
+            local.type = PHASE;
+            break;
+        default:
+            break;
+    }
+    local.num_qubits = num_local;
+    push_gate(scratch, &local);
+}
+
+static void tile_range(void* ctx, size_t begin, size_t end) {
+    // The gates on each tile belong to the tiled run being recorded
+    PROFILE_QUIET_SCOPE();
+    TileJob* job = ctx;
+    size_t tile_size = (size_t)1 << job->local_qubits;
+    Circuit* scratch = create_circuit(job->local_qubits);
+    DiagonalBatch constant;
+    diagonal_batch_init(&constant);
+
+    for (size_t t = begin; t < end; t++) {
+        // A tile is a complete state on the local qubits
+        QuantumState tile = *job->state;
+        tile.num_qubits = job->local_qubits;
+        tile.state_size = tile_size;
+        if (job->state->precision == PRECISION_SINGLE) {
+            tile.amplitudes_single = job->state->amplitudes_single + t * tile_size;
+        } else {
+            tile.amplitudes = job->state->amplitudes + t * tile_size;
+        }
+
+        double angle = 0.0;
+        scratch->num_gates = 0;
+        for (size_t g = 0; g < job->group->num_gates; g++) {
+            append_tile_gate(scratch, &job->group->gates[g], t, job->local_qubits, &angle);
+        }
+        execute_circuit(scratch, &tile, NULL);
+        if (angle != 0.0) {
+            constant.global_angle = angle;
+            diagonal_batch_apply(&tile, &constant);
+        }
+    }
+
+    // The scratch gates share their matrices with the group
+    scratch->num_gates = 0;
+    destroy_circuit(scratch);
+    diagonal_batch_free(&constant);
+}
+
+// Applies the pending gates tile by tile
+static void flush_group(BlockedExecutor* exec, QuantumState* state) {
+    Circuit* group = exec->group;
+    if (group->num_gates == 1) {
+        apply_gate(state, &group->gates[0], NULL);
+    } else if (group->num_gates > 1) {
+        PROFILE_SCOPE(PROFILE_TILED_RUN, -1);
+        profile_sweep(state->state_size);
+        TileJob job = { group, state, exec->local_qubits };
+        parallel_for_coarse(state->state_size >> exec->local_qubits, tile_range, &job);
+    }
+    for (size_t g = 0; g < group->num_gates; g++) {
+        if (group->gates[g].type == UNITARY) {
+            free(group->gates[g].matrix);
+        }
+    }
+    group->num_gates = 0;
+}
+
+static void swap_physical(BlockedExecutor* exec, QuantumState* state, int p1, int p2) {
+    apply_swap(state, p1, p2);
+    int l1 = exec->logical[p1];
+    int l2 = exec->logical[p2];
+    exec->logical[p1] = l2;
+    exec->logical[p2] = l1;
+    exec->physical[l1] = p2;
+    exec->physical[l2] = p1;
+}
+
+static bool targets(const Gate* gate, int logical_qubit) {
+    for (int j = 0; j < gate->num_qubits; j++) {
+        if (gate->qubits[j] == logical_qubit && gate_needs_local(gate, j)) return true;
+    }
+    return false;
+}
+
+// Gates that act on the whole register rather than on their listed qubits
+static bool is_global_gate(const Gate* gate) {
+    return gate->type == MEASURE || gate->type == PHASE_FLIP || gate->type == QFT || gate->type == INVERSE_QFT;
+}
+
+// Distance to the next gate from `from` that targets logical_qubit (LOOKAHEAD_GATES if none)
+static size_t next_target_use(const Circuit* circuit, size_t from, int logical_qubit) {
+    size_t end = from + LOOKAHEAD_GATES < circuit->num_gates ? from + LOOKAHEAD_GATES : circuit->num_gates;
+    for (size_t g = from; g < end; g++) {
+        if (targets(&circuit->gates[g], logical_qubit)) {
+            return g - from;
+        }
+    }
+    return LOOKAHEAD_GATES;
+}
+
+static int count_target_uses(const Circuit* circuit, size_t from, int logical_qubit) {
+    size_t end = from + LOOKAHEAD_GATES < circuit->num_gates ? from + LOOKAHEAD_GATES : circuit->num_gates;
+    int uses = 0;
+    for (size_t g = from; g < end && !is_global_gate(&circuit->gates[g]); g++) {
+        uses += targets(&circuit->gates[g], logical_qubit);
+    }
+    return uses;
+}
+
+// Whether every qubit gate targets is currently local
+static bool is_local(const BlockedExecutor* exec, const Gate* gate) {
+    for (int j = 0; j < gate->num_qubits; j++) {
+        if (gate_needs_local(gate, j) && exec->physical[gate->qubits[j]] >= exec->local_qubits) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Brings the high targets of gate g into the local range, evicting the local
+// qubits whose next target use lies furthest ahead. Returns false when the
+// gate should rather be applied to the full state as it is.
+static bool make_local(BlockedExecutor* exec, QuantumState* state, size_t g) {
+    const Gate* gate = &exec->circuit->gates[g];
+    for (int j = 0; j < gate->num_qubits; j++) {
+        if (gate_needs_local(gate, j) && exec->physical[gate->qubits[j]] >= exec->local_qubits &&
+            count_target_uses(exec->circuit, g, gate->qubits[j]) < REMAP_MIN_USES) {
+            return false;
+        }
+    }
+
+    flush_group(exec, state);
+    for (int j = 0; j < gate->num_qubits; j++) {
+        int high = exec->physical[gate->qubits[j]];
+        if (!gate_needs_local(gate, j) || high < exec->local_qubits) {
+            continue;
+        }
+        int victim = -1;
+        size_t furthest = 0;
+        for (int p = 0; p < exec->local_qubits; p++) {
+            if (targets(gate, exec->logical[p])) continue;
+            size_t distance = next_target_use(exec->circuit, g, exec->logical[p]);
+            if (victim < 0 || distance > furthest) {
+                victim = p;
+                furthest = distance;
+            }
+        }
+        swap_physical(exec, state, high, victim);
+    }
+    return true;
+}
+
+// Copy of gate with its logical qubits (and basis state) replaced by physical ones
+static Gate physical_gate(const BlockedExecutor* exec, const Gate* gate) {
+    Gate mapped = *gate;
+    for (int j = 0; j < gate->num_qubits; j++) {
+        mapped.qubits[j] = exec->physical[gate->qubits[j]];
+    }
+    if (gate->type == PHASE_FLIP) {
+        mapped.basis_state = 0;
+        for (int q = 0; q < exec->circuit->num_qubits; q++) {
+            if (gate->basis_state & ((size_t)1 << q)) {
+                mapped.basis_state |= (size_t)1 << exec->physical[q];
+            }
+        }
+    }
+    return mapped;
+}
+
+// Undoes the remapping so the state is back in logical qubit order and runs
+// the pending gates. Swaps between local positions join the last group; the
+// rest stream the state.
+static void restore_logical_order(BlockedExecutor* exec, QuantumState* state) {
+    for (int q = 0; q < exec->circuit->num_qubits; q++) {
+        int p = exec->physical[q];
+        if (p == q) {
+            continue;
+        }
+        if (p < exec->local_qubits && q < exec->local_qubits) {
+            Gate swap = { .type = SWAP, .num_qubits = 2, .qubits = { q, p } };
+            circuit_append(exec->group, &swap);
+            int other = exec->logical[q];
+            exec->logical[p] = other;
+            exec->logical[q] = q;
+            exec->physical[other] = p;
+            exec->physical[q] = q;
+        } else {
+            flush_group(exec, state);
+            swap_physical(exec, state, q, p);
+        }
+    }
+    flush_group(exec, state);
+}
+
+void execute_circuit_blocked(const Circuit* circuit, QuantumState* state, int* classical_bits, int local_qubits) {
+    if (circuit->num_qubits != state->num_qubits) {
+        fprintf(stderr, "Error: Circuit has %d qubits but the state has %d\n",
+                circuit->num_qubits, state->num_qubits);
+        return;
+    }
+    if (local_qubits <= 0) {
+        local_qubits = default_local_qubits();
+    }
+    // Gates wider than the tile, or a state that already fits, gain nothing from tiling
+    if (local_qubits < MAX_FUSED_QUBITS || local_qubits >= state->num_qubits) {
+        execute_circuit(circuit, state, classical_bits);
+        return;
+    }
+
+    BlockedExecutor exec = { .circuit = circuit, .local_qubits = local_qubits };
+    exec.group = create_circuit(circuit->num_qubits);
+    for (int q = 0; q < circuit->num_qubits; q++) {
+        exec.physical[q] = q;
+        exec.logical[q] = q;
+    }
+
+    for (size_t g = 0; g < circuit->num_gates; g++) {
+        const Gate* gate = &circuit->gates[g];
+        if (gate->type == SWAP) {
+            // Swaps only relabel; pending gates already name physical qubits
+            int p1 = exec.physical[gate->qubits[0]];
+            int p2 = exec.physical[gate->qubits[1]];
+            exec.physical[gate->qubits[0]] = p2;
+            exec.physical[gate->qubits[1]] = p1;
+            exec.logical[p1] = gate->qubits[1];
+            exec.logical[p2] = gate->qubits[0];
+            continue;
+        }
+
+        // Fourier transforms need their register on consecutive physical qubits
+        if (gate->type == QFT || gate->type == INVERSE_QFT) {
+            restore_logical_order(&exec, state);
+        }
+
+        bool local = !is_global_gate(gate) && (is_local(&exec, gate) || make_local(&exec, state, g));
+        Gate mapped = physical_gate(&exec, gate);
+        if (local) {
+            circuit_append(exec.group, &mapped);
+        } else {
+            flush_group(&exec, state);
+            apply_gate(state, &mapped, classical_bits);
+        }
+    }
+
+    restore_logical_order(&exec, state);
+    destroy_circuit(exec.group);
+}
@@ -0,0 +1,116 @@
+#ifndef CIRCUIT_H
+#define CIRCUIT_H
+
+#include <stddef.h>
+#include "quantum.h"
+
+// Circuits can be larger than any state vector, for backends such as the stabilizer tableau
+#define MAX_CIRCUIT_QUBITS MAX_STABILIZER_QUBITS
+
+// Default block size (in qubits) used when fusing algorithm circuits
+#define DEFAULT_FUSED_QUBITS 2
+
+// Smaller states stay in cache, where per-gate kernels beat dense blocks
+#define FUSION_MIN_QUBITS 20
+
+// One recorded operation. Qubit order follows the matching apply_* call:
+// controls first, target last (SWAP: both qubits; MEASURE: the measured qubit).
+typedef struct {
+    GateType type;
+    int num_qubits;
+    int qubits[MAX_FUSED_QUBITS];
+    double angle;          // PHASE, CONTROLLED_PHASE, ROTATION_*
+    size_t basis_state;    // PHASE_FLIP
+    int classical_bit;     // MEASURE
+    ComplexNum* matrix;    // UNITARY: 2^k x 2^k row-major, owned by the circuit
+    int first_qubit;       // QFT, INVERSE_QFT: transform qubits first_qubit ..
+    int register_size;     // .. first_qubit + register_size - 1 (num_qubits is 0)
+} Gate;
+
+// A gate list recorded against a fixed register size, executed on demand
+typedef struct {
+    int num_qubits;
+    int num_classical_bits;
+    Gate* gates;
+    size_t num_gates;
+    size_t capacity;
+} Circuit;
+
+Circuit* create_circuit(int num_qubits);
+void destroy_circuit(Circuit* circuit);
+
+// Appends a copy of gate after checking its qubits lie inside the register
+// and are all different. UNITARY matrices are copied, so the caller keeps
+// ownership of its buffer. Returns false after printing an error.
+bool circuit_append(Circuit* circuit, const Gate* gate);
+
+// Builder API mirroring the apply_* functions
+void circuit_hadamard(Circuit* circuit, int target_qubit);
+void circuit_pauli_x(Circuit* circuit, int target_qubit);
+void circuit_pauli_y(Circuit* circuit, int target_qubit);
+void circuit_pauli_z(Circuit* circuit, int target_qubit);
+void circuit_phase(Circuit* circuit, int target_qubit, double angle);
+void circuit_cnot(Circuit* circuit, int control_qubit, int target_qubit);
+void circuit_swap(Circuit* circuit, int qubit1, int qubit2);
+void circuit_toffoli(Circuit* circuit, int control1, int control2, int target);
+void circuit_controlled_phase(Circuit* circuit, int control_qubit, int target_qubit, double angle);
+void circuit_rotation_x(Circuit* circuit, int target_qubit, double angle);
+void circuit_rotation_y(Circuit* circuit, int target_qubit, double angle);
+void circuit_rotation_z(Circuit* circuit, int target_qubit, double angle);
+void circuit_phase_flip(Circuit* circuit, size_t basis_state);
+void circuit_measure(Circuit* circuit, int qubit, int classical_bit);
+void circuit_qft(Circuit* circuit, int first_qubit, int num_qubits);
+void circuit_inverse_qft(Circuit* circuit, int first_qubit, int num_qubits);
+void circuit_unitary(Circuit* circuit, const int* qubits, int num_target_qubits, const ComplexNum* matrix);
+
+// Applies a single recorded gate; measurement results go to classical_bits (may be NULL)
+void apply_gate(QuantumState* state, const Gate* gate, int* classical_bits);
+
+// Runs every gate of the circuit against state, which must have the same qubit count
+void execute_circuit(const Circuit* circuit, QuantumState* state, int* classical_bits);
+
+// Cache-blocked execution: consecutive gates whose targets lie in the low
+// local_qubits qubits are applied tile by tile (2^local_qubits amplitudes at a
+// time, so each tile stays in cache for the whole run). Controls and diagonal
+// gates on high qubits are constant within a tile and need no data movement;
+// high targets that upcoming gates use repeatedly are swapped into the local
+// range first. The state ends in normal qubit order.
+// local_qubits <= 0 uses default_local_qubits().
+void execute_circuit_blocked(const Circuit* circuit, QuantumState* state, int* classical_bits, int local_qubits);
+
+// Tile size (in qubits) fitting half of the L2 cache; QSIM_BLOCK_QUBITS overrides it
+int default_local_qubits(void);
+
+// Whether qubit j of gate must be local to apply it inside a tile. Controls
+// and diagonal gates only need the value of a qubit, which is constant over a tile.
+bool gate_needs_local(const Gate* gate, int j);
+
+// Appends to scratch the form gate takes inside one tile, where every qubit >=
+// local_qubits holds the corresponding bit of tile (the qubits gate_needs_local
+// names must be local). Gates whose high controls are 0 vanish and gates that
+// reduce to a constant phase add it to *angle. UNITARY matrices are shared
+// with gate, not copied, so reset scratch->num_gates before destroying it.
+void append_tile_gate(Circuit* scratch, const Gate* gate, size_t tile, int local_qubits, double* angle);
+
+// Writes the 2^k x 2^k matrix of a unitary gate (bit j of an index is gate->qubits[j]).
+// Returns false for MEASURE and PHASE_FLIP, which have no local matrix.
+bool gate_matrix(const Gate* gate, ComplexNum* matrix);
+
+// Gate fusion: returns a new circuit in which runs of neighbouring gates that
+// together touch at most max_fused_qubits qubits are merged into single UNITARY
+// gates, so each run costs one sweep over the state instead of one per gate
+Circuit* fuse_circuit(const Circuit* circuit, int max_fused_qubits);
+
+// Copy of circuit in which Fourier transforms reaching past the low
+// max_qubits qubits become Hadamards, controlled phases and swaps, for
+// executors that only hold the low qubits together
+Circuit* expand_transforms(const Circuit* circuit, int max_qubits);
+
+// Algorithm circuits: build once, execute on as many states as needed
+Circuit* build_grover_circuit(int num_qubits, size_t marked_state);
+Circuit* build_grover_oracle_circuit(int num_qubits, const size_t* marked_states, size_t num_marked);
+Circuit* build_qft_circuit(int num_qubits);
+Circuit* build_phase_estimation_circuit(int num_qubits, double true_phase);
+Circuit* build_shor_period_finding_circuit(int num_qubits, int number_to_factor);
+
+#endif /* CIRCUIT_H */
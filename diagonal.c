@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "quantum.h"
+#include "kernels.h"
+#include "profile.h"
+#include "threadpool.h"
+
+#define PI 3.14159265358979323846
+
+void diagonal_batch_init(DiagonalBatch* batch) {
+    batch->terms = NULL;
+    batch->num_terms = 0;
+    batch->capacity = 0;
+    batch->global_angle = 0.0;
+}
+
+void diagonal_batch_free(DiagonalBatch* batch) {
+    free(batch->terms);
+    diagonal_batch_init(batch);
+}
+
+void diagonal_batch_add(DiagonalBatch* batch, size_t mask, double angle) {
+    int weight = __builtin_popcountll(mask);
+    if (weight < 1 || weight > 2) {
+        fprintf(stderr, "Error: Diagonal terms act on one or two qubits\n");
+        return;
+    }
+
+    // Gates on the same qubits merge into one term
+    for (int t = 0; t < batch->num_terms; t++) {
+        if (batch->terms[t].mask == mask) {
+            batch->terms[t].angle += angle;
+            return;
+        }
+    }
+    if (batch->num_terms == batch->capacity) {
+        batch->capacity = batch->capacity ? 2 * batch->capacity : 16;
+        batch->terms = realloc(batch->terms, batch->capacity * sizeof(DiagonalTerm));
+    }
+    batch->terms[batch->num_terms].mask = mask;
+    batch->terms[batch->num_terms].angle = angle;
+    batch->num_terms++;
+}
+
+void diagonal_batch_phase(DiagonalBatch* batch, int qubit, double angle) {
+    diagonal_batch_add(batch, (size_t)1 << qubit, angle);
+}
+
+void diagonal_batch_pauli_z(DiagonalBatch* batch, int qubit) {
+    diagonal_batch_add(batch, (size_t)1 << qubit, PI);
+}
+
+void diagonal_batch_rotation_z(DiagonalBatch* batch, int qubit, double angle) {
+    // Rz(angle) = e^{-i angle/2} diag(1, e^{i angle})
+    batch->global_angle -= angle / 2;
+    diagonal_batch_add(batch, (size_t)1 << qubit, angle);
+}
+
+void diagonal_batch_controlled_phase(DiagonalBatch* batch, int control_qubit, int target_qubit, double angle) {
+    if (control_qubit == target_qubit) {
+        fprintf(stderr, "Error: Controlled phase needs two different qubits\n");
+        return;
+    }
+    diagonal_batch_add(batch, ((size_t)1 << control_qubit) | ((size_t)1 << target_qubit), angle);
+}
+
+typedef struct {
+    ComplexNum* amplitudes;
+    ComplexFloat* amplitudes_single;   // set instead of amplitudes for single precision states
+    int high_bits;              // qubits above the table bits
+    size_t run_length;          // amplitudes covered by one table
+    const ComplexNum* low_table;
+    ComplexNum** high_tables;   // per high qubit: factor applied when its bit is set, or NULL
+    const size_t* high_masks;   // terms on two high qubits, folded into one factor per run
+    const ComplexNum* high_phases;
+    int num_high_terms;
+} DiagonalSweep;
+
+// Refreshes levels[lowest..0]; levels[h] is the low table times the high
+// tables of every set bit >= h of run
+static void build_levels(const DiagonalSweep* sweep, size_t run, int lowest, const ComplexNum** levels,
+                         ComplexNum* buffers) {
+    for (int h = lowest; h >= 0; h--) {
+        const ComplexNum* above = levels[h + 1];
+        if ((run >> h) & 1 && sweep->high_tables[h]) {
+            ComplexNum* table = buffers + (size_t)h * sweep->run_length;
+            kernel_multiply(table, above, sweep->high_tables[h], sweep->run_length);
+            levels[h] = table;
+        } else {
+            levels[h] = above;
+        }
+    }
+}
+
+static void diagonal_sweep_range(void* ctx, size_t begin, size_t end) {
+    DiagonalSweep* sweep = ctx;
+    int high_bits = sweep->high_bits;
+    const ComplexNum* levels[MAX_QUBITS + 1];
+    ComplexNum* buffers = malloc((high_bits > 0 ? high_bits : 1) * sweep->run_length * sizeof(ComplexNum));
+    ComplexFloat* narrow = sweep->amplitudes_single ? malloc(sweep->run_length * sizeof(ComplexFloat)) : NULL;
+    IndexPattern contiguous;
+    make_index_pattern(&contiguous, 0, 0, 0);
+
+    size_t first_run = begin / sweep->run_length;
+    levels[high_bits] = sweep->low_table;
+    build_levels(sweep, first_run, high_bits - 1, levels, buffers);
+
+    for (size_t run = first_run; run * sweep->run_length < end; run++) {
+        // Moving to the next run sets one bit and clears the bits below it,
+        // so a single table product refreshes the levels
+        if (run > first_run) {
+            int lowest = __builtin_ctzll(run);
+            build_levels(sweep, run, lowest, levels, buffers);
+        }
+
+        size_t start = run * sweep->run_length;
+        size_t first = begin > start ? begin - start : 0;
+        size_t last = end - start < sweep->run_length ? end - start : sweep->run_length;
+        if (narrow) {
+            // Tables stay in double precision; each run's table is rounded once
+            for (size_t j = first; j < last; j++) {
+                narrow[j] = (ComplexFloat)levels[0][j];
+            }
+            ComplexFloat* a = sweep->amplitudes_single + start;
+            kernel_multiply_single(a + first, a + first, narrow + first, last - first);
+        } else {
+            ComplexNum* a = sweep->amplitudes + start;
+            kernel_multiply(a + first, a + first, levels[0] + first, last - first);
+        }
+
+        ComplexNum factor = 1.0;
+        size_t high_index = run * sweep->run_length;
+        for (int t = 0; t < sweep->num_high_terms; t++) {
+            if ((high_index & sweep->high_masks[t]) == sweep->high_masks[t]) {
+                factor *= sweep->high_phases[t];
+            }
+        }
+        if (factor != 1.0 && narrow) {
+            kernel_apply_phase_single(sweep->amplitudes_single + start, &contiguous, factor, first, last);
+        } else if (factor != 1.0) {
+            kernel_apply_phase(sweep->amplitudes + start, &contiguous, factor, first, last);
+        }
+    }
+    free(buffers);
+    free(narrow);
+}
+
+// Backends without a state vector take the terms as ordinary gates
+// (the global phase is unobservable there and dropped)
+static void apply_terms_as_gates(QuantumState* state, DiagonalBatch* batch) {
+    for (int t = 0; t < batch->num_terms; t++) {
+        size_t mask = batch->terms[t].mask;
+        int low = __builtin_ctzll(mask);
+        size_t rest = mask & (mask - 1);
+        if (rest) {
+            apply_controlled_phase(state, low, __builtin_ctzll(rest), batch->terms[t].angle);
+        } else {
+            apply_phase(state, low, batch->terms[t].angle);
+        }
+    }
+    batch->num_terms = 0;
+    batch->global_angle = 0.0;
+}
+
+void diagonal_batch_apply(QuantumState* state, DiagonalBatch* batch) {
+    PROFILE_SCOPE(PROFILE_DIAGONAL_BATCH, -1);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_terms_as_gates(state, batch);
+        return;
+    }
+    int n = state->num_qubits;
+    int low_bits = n < DIAGONAL_TABLE_BITS ? n : DIAGONAL_TABLE_BITS;
+    int high_bits = n - low_bits;
+    size_t run_length = (size_t)1 << low_bits;
+    size_t low_mask = run_length - 1;
+
+    ComplexNum* low_table = malloc(run_length * sizeof(ComplexNum));
+    ComplexNum* high_tables[MAX_QUBITS] = { NULL };
+    size_t* high_masks = malloc((batch->num_terms + 1) * sizeof(size_t));
+    ComplexNum* high_phases = malloc((batch->num_terms + 1) * sizeof(ComplexNum));
+    int num_high_terms = 0;
+    profile_allocate(3, run_length * sizeof(ComplexNum) +
+                            (batch->num_terms + 1) * (sizeof(size_t) + sizeof(ComplexNum)));
+
+    ComplexNum global = cexp(I * batch->global_angle);
+    for (size_t j = 0; j < run_length; j++) {
+        low_table[j] = global;
+    }
+
+    for (int t = 0; t < batch->num_terms; t++) {
+        size_t mask = batch->terms[t].mask;
+        ComplexNum phase = cexp(I * batch->terms[t].angle);
+        size_t low = mask & low_mask;
+        size_t high = mask >> low_bits;
+
+        if (high == 0) {
+            for (size_t j = 0; j < run_length; j++) {
+                if ((j & low) == low) low_table[j] *= phase;
+            }
+        } else if ((high & (high - 1)) == 0) {
+            // One high qubit: a factor on the low entries containing the rest of the mask
+            int h = __builtin_ctzll(high);
+            if (!high_tables[h]) {
+                high_tables[h] = malloc(run_length * sizeof(ComplexNum));
+                for (size_t j = 0; j < run_length; j++) high_tables[h][j] = 1.0;
+            }
+            for (size_t j = 0; j < run_length; j++) {
+                if ((j & low) == low) high_tables[h][j] *= phase;
+            }
+        } else {
+            // Two high qubits: a scalar per run
+            high_masks[num_high_terms] = mask;
+            high_phases[num_high_terms] = phase;
+            num_high_terms++;
+        }
+    }
+
+    DiagonalSweep sweep = {
+        state->amplitudes, state->amplitudes_single, high_bits, run_length, low_table, high_tables,
+        high_masks, high_phases, num_high_terms
+    };
+    profile_sweep(state->state_size);
+    parallel_for(state->state_size, diagonal_sweep_range, &sweep);
+
+    for (int h = 0; h < high_bits; h++) {
+        free(high_tables[h]);
+    }
+    free(low_table);
+    free(high_masks);
+    free(high_phases);
+    batch->num_terms = 0;
+    batch->global_angle = 0.0;
+}
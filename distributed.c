@@ -0,0 +1,699 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <mpi.h>
+#include "distributed.h"
+#include "kernels.h"
+#include "profile.h"
+#include "threadpool.h"
+
+// Gates scanned ahead when choosing the local qubit to evict
+#define EVICTION_LOOKAHEAD 256
+
+struct DistributedState {
+    int num_qubits;
+    int local_qubits;
+    int rank;
+    int num_ranks;
+    MPI_Comm comm;
+    bool fixed_layout;
+    QuantumState* local;         // this rank's amplitudes
+    size_t element_size;
+    size_t message_bytes;
+    void* send_buffer;           // message_bytes each
+    void* receive_buffer;
+    int physical[MAX_QUBITS];    // position of each logical qubit; positions >= local_qubits are rank bits
+    int logical[MAX_QUBITS];     // logical qubit at each position
+    DistributedStats stats;
+
+    // Gates waiting to run on the local amplitudes, already reduced for this
+    // rank, and the constant phase they add
+    Circuit* pending;
+    double pending_angle;
+    DiagonalBatch constant;
+};
+
+bool distributed_init(int* argc, char*** argv) {
+    int initialized;
+    MPI_Initialized(&initialized);
+    if (!initialized && MPI_Init(argc, argv) != MPI_SUCCESS) {
+        fprintf(stderr, "Error: Could not initialize MPI\n");
+        return false;
+    }
+    return true;
+}
+
+void distributed_finalize(void) {
+    int finalized;
+    MPI_Finalized(&finalized);
+    if (!finalized) {
+        MPI_Finalize();
+    }
+}
+
+int distributed_rank(void) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+}
+
+int distributed_num_ranks(void) {
+    int num_ranks;
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+    return num_ranks;
+}
+
+// Whether ok holds on every rank, so that all of them fail together
+static bool on_all_ranks(MPI_Comm comm, bool ok) {
+    int local = ok;
+    int all;
+    MPI_Allreduce(&local, &all, 1, MPI_INT, MPI_LAND, comm);
+    return all;
+}
+
+static char* local_data(const DistributedState* state) {
+    return state->local->precision == PRECISION_SINGLE ? (char*)state->local->amplitudes_single
+                                                       : (char*)state->local->amplitudes;
+}
+
+static void free_parts(DistributedState* state) {
+    if (state->local) {
+        destroy_quantum_state(state->local);
+    }
+    if (state->pending) {
+        state->pending->num_gates = 0;
+        destroy_circuit(state->pending);
+    }
+    diagonal_batch_free(&state->constant);
+    free(state->send_buffer);
+    free(state->receive_buffer);
+    MPI_Comm_free(&state->comm);
+    free(state);
+}
+
+DistributedState* create_distributed_state(int num_qubits, Precision precision, bool fixed_layout) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    int num_ranks = distributed_num_ranks();
+    int global_qubits = 0;
+    while (((size_t)1 << global_qubits) < (size_t)num_ranks) {
+        global_qubits++;
+    }
+    if (num_qubits < 1 || num_qubits > MAX_QUBITS) {
+        fprintf(stderr, "Error: Number of qubits must be between 1 and %d\n", MAX_QUBITS);
+        return NULL;
+    }
+    if (((size_t)1 << global_qubits) != (size_t)num_ranks || global_qubits >= num_qubits) {
+        fprintf(stderr, "Error: A %d-qubit distributed state needs a power of two below 2^%d ranks, not %d\n",
+                num_qubits, num_qubits, num_ranks);
+        return NULL;
+    }
+
+    MPI_Comm comm;
+    MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+    DistributedState* state = calloc(1, sizeof(DistributedState));
+    bool ok = state != NULL;
+    if (ok) {
+        state->num_qubits = num_qubits;
+        state->local_qubits = num_qubits - global_qubits;
+        state->num_ranks = num_ranks;
+        state->comm = comm;
+        state->fixed_layout = fixed_layout;
+        MPI_Comm_rank(comm, &state->rank);
+        for (int q = 0; q < num_qubits; q++) {
+            state->physical[q] = q;
+            state->logical[q] = q;
+        }
+        diagonal_batch_init(&state->constant);
+
+        // Rank 0 takes the first random stream, as a single process would
+        state->local = create_quantum_state_with_precision(state->local_qubits, precision);
+        state->element_size = precision == PRECISION_SINGLE ? sizeof(ComplexFloat) : sizeof(ComplexNum);
+        size_t half_bytes = state->element_size << (state->local_qubits - 1);
+        state->message_bytes = half_bytes < DISTRIBUTED_MESSAGE_BYTES ? half_bytes : DISTRIBUTED_MESSAGE_BYTES;
+        state->send_buffer = malloc(state->message_bytes);
+        state->receive_buffer = malloc(state->message_bytes);
+        state->pending = create_circuit(state->local_qubits);
+        ok = state->local && state->send_buffer && state->receive_buffer && state->pending;
+        if (ok && state->rank != 0) {
+            set_amplitude(state->local, 0, 0.0);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory for a %d-qubit distributed state on rank %d\n", num_qubits,
+                distributed_rank());
+    }
+    if (!on_all_ranks(comm, ok)) {
+        if (state) {
+            free_parts(state);
+        } else {
+            MPI_Comm_free(&comm);
+        }
+        return NULL;
+    }
+    return state;
+}
+
+void destroy_distributed_state(DistributedState* state) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    free_parts(state);
+}
+
+int distributed_num_qubits(const DistributedState* state) {
+    return state->num_qubits;
+}
+
+void distributed_stats(const DistributedState* state, DistributedStats* stats) {
+    *stats = state->stats;
+}
+
+// Records that the qubits at positions p1 and p2 have changed places
+static void relabel(DistributedState* state, int p1, int p2) {
+    int l1 = state->logical[p1];
+    int l2 = state->logical[p2];
+    state->logical[p1] = l2;
+    state->logical[p2] = l1;
+    state->physical[l1] = p2;
+    state->physical[l2] = p1;
+}
+
+// Runs the pending gates on the local amplitudes
+static void flush_pending(DistributedState* state) {
+    if (state->pending->num_gates > 0) {
+        execute_circuit_blocked(state->pending, state->local, NULL, 0);
+    }
+    if (state->pending_angle != 0.0) {
+        state->constant.global_angle = state->pending_angle;
+        diagonal_batch_apply(state->local, &state->constant);
+    }
+    // The pending gates share their matrices with the circuit being run
+    state->pending->num_gates = 0;
+    state->pending_angle = 0.0;
+}
+
+// Exchanges the qubit at global position `global` with the one at local
+// position `local`. Amplitudes whose local bit differs from the rank bit move:
+// this rank and its partner (the rank differing in that bit) trade those
+// halves, in index order of the remaining bits, in messages of message_bytes.
+static void exchange_positions(DistributedState* state, int global, int local) {
+    PROFILE_SCOPE(PROFILE_EXCHANGE, state->logical[global]);
+    double start = MPI_Wtime();
+    int bit = global - state->local_qubits;
+    int partner = state->rank ^ (1 << bit);
+    size_t run = (size_t)1 << local;          // moving amplitudes come in runs of this length
+    size_t first = (state->rank >> bit) & 1 ? 0 : run;
+    size_t half = state->local->state_size / 2;
+    size_t per_message = state->message_bytes / state->element_size;
+    size_t element_size = state->element_size;
+    char* data = local_data(state);
+    profile_sweep(half);
+
+    // Counts are powers of two, so a message either lies inside one run or
+    // covers whole runs
+    for (size_t done = 0; done < half; done += per_message) {
+        char* start_of_run = data + element_size * (first + done / run * 2 * run + done % run);
+        char* send = run >= per_message ? start_of_run : state->send_buffer;
+        if (run < per_message) {
+            for (size_t k = 0; k < per_message; k += run) {
+                memcpy((char*)state->send_buffer + k * element_size,
+                       data + element_size * (first + (done + k) / run * 2 * run), run * element_size);
+            }
+        }
+        MPI_Sendrecv(send, (int)state->message_bytes, MPI_BYTE, partner, 0, state->receive_buffer,
+                     (int)state->message_bytes, MPI_BYTE, partner, 0, state->comm, MPI_STATUS_IGNORE);
+        if (run >= per_message) {
+            memcpy(start_of_run, state->receive_buffer, state->message_bytes);
+        } else {
+            for (size_t k = 0; k < per_message; k += run) {
+                memcpy(data + element_size * (first + (done + k) / run * 2 * run),
+                       (char*)state->receive_buffer + k * element_size, run * element_size);
+            }
+        }
+    }
+
+    relabel(state, global, local);
+    state->stats.exchanges++;
+    state->stats.bytes_sent += half * element_size;
+    state->stats.exchange_seconds += MPI_Wtime() - start;
+}
+
+// Makes the qubits at positions p1 and p2 change places without changing the
+// state. Two global positions go through the top local one.
+static void swap_positions(DistributedState* state, int p1, int p2) {
+    int local_qubits = state->local_qubits;
+    int low = p1 < p2 ? p1 : p2;
+    int high = p1 < p2 ? p2 : p1;
+    if (high < local_qubits) {
+        Gate swap = { .type = SWAP, .num_qubits = 2, .qubits = { low, high } };
+        circuit_append(state->pending, &swap);
+        relabel(state, low, high);
+    } else if (low < local_qubits) {
+        flush_pending(state);
+        exchange_positions(state, high, low);
+    } else {
+        flush_pending(state);
+        exchange_positions(state, low, local_qubits - 1);
+        exchange_positions(state, high, local_qubits - 1);
+        exchange_positions(state, low, local_qubits - 1);
+    }
+}
+
+// Moves every qubit back to its own position, so rank r holds amplitudes
+// r * 2^local_qubits onwards in index order
+static void restore_layout(DistributedState* state) {
+    for (int q = 0; q < state->num_qubits; q++) {
+        if (state->physical[q] != q) {
+            swap_positions(state, q, state->physical[q]);
+        }
+    }
+    flush_pending(state);
+}
+
+static bool uses(const Gate* gate, int logical_qubit) {
+    for (int j = 0; j < gate->num_qubits; j++) {
+        if (gate->qubits[j] == logical_qubit) return true;
+    }
+    return false;
+}
+
+static bool targets(const Gate* gate, int logical_qubit) {
+    for (int j = 0; j < gate->num_qubits; j++) {
+        if (gate->qubits[j] == logical_qubit && gate_needs_local(gate, j)) return true;
+    }
+    return false;
+}
+
+// Distance to the next gate from `from` that targets logical_qubit (EVICTION_LOOKAHEAD if none)
+static size_t next_target_use(const Circuit* circuit, size_t from, int logical_qubit) {
+    size_t end = from + EVICTION_LOOKAHEAD < circuit->num_gates ? from + EVICTION_LOOKAHEAD : circuit->num_gates;
+    for (size_t g = from; g < end; g++) {
+        if (targets(&circuit->gates[g], logical_qubit)) {
+            return g - from;
+        }
+    }
+    return EVICTION_LOOKAHEAD;
+}
+
+// Brings the global targets of gate g to local positions and returns how many
+// it moved; their positions go to moved, for fixed layouts to move them back.
+// The evicted local qubit is one the gate does not use: with a fixed layout
+// the highest (its moving halves are contiguous), otherwise the one whose next
+// target use lies furthest ahead.
+static int make_local(DistributedState* state, const Circuit* circuit, size_t g, int moved[][2]) {
+    const Gate* gate = &circuit->gates[g];
+    int num_moved = 0;
+    for (int j = 0; j < gate->num_qubits; j++) {
+        int global = state->physical[gate->qubits[j]];
+        if (!gate_needs_local(gate, j) || global < state->local_qubits) {
+            continue;
+        }
+        int victim = -1;
+        size_t furthest = 0;
+        for (int p = state->local_qubits - 1; p >= 0; p--) {
+            if (uses(gate, state->logical[p])) continue;
+            if (state->fixed_layout) {
+                victim = p;
+                break;
+            }
+            size_t distance = next_target_use(circuit, g, state->logical[p]);
+            if (victim < 0 || distance > furthest) {
+                victim = p;
+                furthest = distance;
+            }
+        }
+        flush_pending(state);
+        exchange_positions(state, global, victim);
+        moved[num_moved][0] = global;
+        moved[num_moved][1] = victim;
+        num_moved++;
+    }
+    return num_moved;
+}
+
+// Copy of gate with its logical qubits (and basis state) replaced by positions
+static Gate physical_gate(const DistributedState* state, const Gate* gate) {
+    Gate mapped = *gate;
+    for (int j = 0; j < gate->num_qubits; j++) {
+        mapped.qubits[j] = state->physical[gate->qubits[j]];
+    }
+    if (gate->type == PHASE_FLIP) {
+        mapped.basis_state = 0;
+        for (int q = 0; q < state->num_qubits; q++) {
+            if ((gate->basis_state >> q) & 1) {
+                mapped.basis_state |= (size_t)1 << state->physical[q];
+            }
+        }
+    }
+    return mapped;
+}
+
+typedef struct {
+    const QuantumState* state;
+    IndexPattern pattern;
+} WeightSweep;
+
+static double weight_range(void* ctx, size_t begin, size_t end) {
+    WeightSweep* sweep = ctx;
+    if (sweep->state->precision == PRECISION_SINGLE) {
+        return kernel_norm_squared_single(sweep->state->amplitudes_single, &sweep->pattern, begin, end);
+    }
+    return kernel_norm_squared(sweep->state->amplitudes, &sweep->pattern, begin, end);
+}
+
+// Sum of |a_i|^2 over the local indices with i & fixed_mask == set_mask
+static double local_weight(const QuantumState* local, size_t fixed_mask, size_t set_mask) {
+    WeightSweep sweep = { .state = local };
+    make_index_pattern(&sweep.pattern, local->num_qubits, fixed_mask, set_mask);
+    return parallel_sum(sweep.pattern.count, weight_range, &sweep);
+}
+
+// Measures a qubit wherever it lies: the ranks sum the outcome weights, rank
+// 0 draws the outcome as measure_qubit does, and every rank projects onto it
+static int measure_distributed(DistributedState* state, int qubit) {
+    PROFILE_SCOPE(MEASURE, qubit);
+    flush_pending(state);
+    int position = state->physical[qubit];
+    int bit = position - state->local_qubits;
+    double weights[2] = { 0.0, 0.0 };
+    if (bit < 0) {
+        size_t mask = (size_t)1 << position;
+        weights[0] = local_weight(state->local, mask, 0);
+        weights[1] = local_weight(state->local, mask, mask);
+    } else {
+        weights[(state->rank >> bit) & 1] = local_weight(state->local, 0, 0);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, weights, 2, MPI_DOUBLE, MPI_SUM, state->comm);
+    int result = 0;
+    if (state->rank == 0) {
+        result = rng_uniform(&state->local->rng) * (weights[0] + weights[1]) > weights[0] ? 1 : 0;
+    }
+    MPI_Bcast(&result, 1, MPI_INT, 0, state->comm);
+
+    double scale = 1.0 / sqrt(weights[result]);
+    if (bit < 0) {
+        ComplexNum projection[2][2] = { { result ? 0.0 : scale, 0.0 }, { 0.0, result ? scale : 0.0 } };
+        apply_single_qubit_unitary(state->local, position, projection);
+    } else {
+        double factor = ((state->rank >> bit) & 1) == result ? scale : 0.0;
+        ComplexNum projection[2][2] = { { factor, 0.0 }, { 0.0, factor } };
+        apply_single_qubit_unitary(state->local, 0, projection);
+    }
+    return result;
+}
+
+bool execute_circuit_distributed(const Circuit* circuit, DistributedState* state, int* classical_bits) {
+    if (circuit->num_qubits != state->num_qubits) {
+        fprintf(stderr, "Error: Circuit has %d qubits but the state has %d\n",
+                circuit->num_qubits, state->num_qubits);
+        return false;
+    }
+
+    // Fourier transforms reaching the global qubits run as their gates
+    Circuit* work = expand_transforms(circuit, state->local_qubits);
+    if (!on_all_ranks(state->comm, work != NULL)) {
+        fprintf(stderr, "Error: Out of memory expanding %zu gates\n", circuit->num_gates);
+        if (work) {
+            destroy_circuit(work);
+        }
+        return false;
+    }
+    for (size_t g = 0; g < work->num_gates; g++) {
+        if (work->gates[g].num_qubits > state->local_qubits) {
+            fprintf(stderr, "Error: Gate %zu acts on %d qubits but each of the %d ranks holds %d; use fewer ranks\n",
+                    g + 1, work->gates[g].num_qubits, state->num_ranks, state->local_qubits);
+            destroy_circuit(work);
+            return false;
+        }
+    }
+
+    size_t local_mask = ((size_t)1 << state->local_qubits) - 1;
+    for (size_t g = 0; g < work->num_gates; g++) {
+        const Gate* gate = &work->gates[g];
+        int moved[MAX_FUSED_QUBITS][2];
+        int num_moved = 0;
+        switch (gate->type) {
+            case SWAP: {
+                int p1 = state->physical[gate->qubits[0]];
+                int p2 = state->physical[gate->qubits[1]];
+                if (state->fixed_layout) {
+                    // Move the amplitudes, then keep the labels
+                    swap_positions(state, p1, p2);
+                }
+                relabel(state, p1, p2);
+                continue;
+            }
+            case MEASURE: {
+                int result = measure_distributed(state, gate->qubits[0]);
+                if (classical_bits) {
+                    classical_bits[gate->classical_bit] = result;
+                }
+                continue;
+            }
+            case PHASE_FLIP: {
+                // The flipped amplitude lies on one rank
+                Gate mapped = physical_gate(state, gate);
+                if ((mapped.basis_state >> state->local_qubits) == (size_t)state->rank) {
+                    mapped.basis_state &= local_mask;
+                    append_tile_gate(state->pending, &mapped, state->rank, state->local_qubits,
+                                     &state->pending_angle);
+                }
+                continue;
+            }
+            case QFT:
+            case INVERSE_QFT:
+                // The register needs its own, consecutive positions
+                for (int q = gate->first_qubit; q < gate->first_qubit + gate->register_size; q++) {
+                    if (state->physical[q] != q) {
+                        restore_layout(state);
+                        break;
+                    }
+                }
+                break;
+            default:
+                num_moved = make_local(state, work, g, moved);
+                break;
+        }
+
+        Gate mapped = physical_gate(state, gate);
+        append_tile_gate(state->pending, &mapped, state->rank, state->local_qubits, &state->pending_angle);
+        if (state->fixed_layout && num_moved > 0) {
+            flush_pending(state);
+            while (num_moved > 0) {
+                num_moved--;
+                exchange_positions(state, moved[num_moved][0], moved[num_moved][1]);
+            }
+        }
+    }
+
+    flush_pending(state);
+    destroy_circuit(work);
+    return true;
+}
+
+bool visit_distributed_chunks(DistributedState* state, ChunkVisitor visit, void* ctx) {
+    restore_layout(state);
+    size_t per_message = state->message_bytes / state->element_size;
+    int message_qubits = 0;
+    while (((size_t)1 << message_qubits) < per_message) {
+        message_qubits++;
+    }
+    char* data = local_data(state);
+    bool ok = true;
+
+    if (state->rank == 0) {
+        ok = visit(state->local, 0, ctx);
+        QuantumState message = {
+            .num_qubits = message_qubits,
+            .state_size = per_message,
+            .backend = BACKEND_STATE_VECTOR,
+            .precision = state->local->precision
+        };
+        if (message.precision == PRECISION_SINGLE) {
+            message.amplitudes_single = state->receive_buffer;
+        } else {
+            message.amplitudes = state->receive_buffer;
+        }
+        // Later messages are still received after visit stops
+        for (int r = 1; r < state->num_ranks; r++) {
+            for (size_t offset = 0; offset < state->local->state_size; offset += per_message) {
+                MPI_Recv(state->receive_buffer, (int)state->message_bytes, MPI_BYTE, r, 0, state->comm,
+                         MPI_STATUS_IGNORE);
+                ok = ok && visit(&message, ((size_t)r << state->local_qubits) + offset, ctx);
+            }
+        }
+    } else {
+        for (size_t offset = 0; offset < state->local->state_size; offset += per_message) {
+            MPI_Send(data + offset * state->element_size, (int)state->message_bytes, MPI_BYTE, 0, 0, state->comm);
+        }
+    }
+
+    int visited = ok;
+    MPI_Bcast(&visited, 1, MPI_INT, 0, state->comm);
+    return visited;
+}
+
+static inline double probability_at(const QuantumState* local, size_t index) {
+    if (local->precision == PRECISION_SINGLE) {
+        ComplexFloat a = local->amplitudes_single[index];
+        return (double)crealf(a) * crealf(a) + (double)cimagf(a) * cimagf(a);
+    }
+    ComplexNum a = local->amplitudes[index];
+    return creal(a) * creal(a) + cimag(a) * cimag(a);
+}
+
+static int compare_outcomes(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Rank 0 draws ascending positions in the total weight as sample_shots does
+// and assigns each to the rank whose amplitudes it falls in; positions[s]
+// becomes relative to the start of that rank
+static void draw_positions(DistributedState* state, uint64_t shots, const double* weights, double* positions,
+                           int* counts) {
+    double total = 0.0;
+    for (int r = 0; r < state->num_ranks; r++) {
+        total += weights[r];
+        counts[r] = 0;
+    }
+    double remaining = 1.0;
+    double rank_start = 0.0;
+    int rank = 0;
+    for (uint64_t s = 0; s < shots; s++) {
+        remaining *= pow(rng_uniform_open(&state->local->rng), 1.0 / (double)(shots - s));
+        double position = total * (1.0 - remaining);
+        while (rank + 1 < state->num_ranks && rank_start + weights[rank] <= position) {
+            rank_start += weights[rank];
+            rank++;
+        }
+        positions[s] = position - rank_start;
+        counts[rank]++;
+    }
+}
+
+// Outcomes of the ascending positions that landed on this rank, found in one
+// forward walk over its amplitudes
+static void resolve_positions(const DistributedState* state, const double* positions, int count,
+                              const int* qubits, int num_qubits, uint64_t* outcomes) {
+    const QuantumState* local = state->local;
+    size_t index = 0;
+    double cumulative = 0.0;
+    double p = probability_at(local, 0);
+    for (int k = 0; k < count; k++) {
+        // Rounding at the end falls back to the last non-zero amplitude
+        while (index + 1 < local->state_size && (cumulative + p <= positions[k] || p == 0.0)) {
+            cumulative += p;
+            index++;
+            p = probability_at(local, index);
+        }
+        while (p == 0.0 && index > 0) {
+            index--;
+            p = probability_at(local, index);
+            cumulative -= p;
+        }
+        outcomes[k] = 0;
+        for (int j = 0; j < num_qubits; j++) {
+            int position = state->physical[qubits[j]];
+            size_t bit = position < state->local_qubits ? index >> position
+                                                        : (size_t)state->rank >> (position - state->local_qubits);
+            outcomes[k] |= (uint64_t)(bit & 1) << j;
+        }
+    }
+}
+
+bool sample_distributed_shots(DistributedState* state, uint64_t shots, const int* qubits, int num_qubits,
+                              ShotHistogram* histogram) {
+    PROFILE_SCOPE(PROFILE_SAMPLE, -1);
+    histogram->counts = NULL;
+    histogram->num_outcomes = 0;
+    histogram->shots = 0;
+    if (num_qubits < 1 || num_qubits > state->num_qubits || num_qubits > 64) {
+        fprintf(stderr, "Error: Cannot sample %d qubits of a %d-qubit state\n", num_qubits, state->num_qubits);
+        return false;
+    }
+    for (int j = 0; j < num_qubits; j++) {
+        bool repeated = false;
+        for (int k = 0; k < j; k++) {
+            repeated = repeated || qubits[k] == qubits[j];
+        }
+        if (qubits[j] < 0 || qubits[j] >= state->num_qubits || repeated) {
+            fprintf(stderr, "Error: Invalid or repeated qubit %d in sample\n", qubits[j]);
+            return false;
+        }
+    }
+    if (shots > INT_MAX) {
+        fprintf(stderr, "Error: Distributed states sample at most %d shots at a time\n", INT_MAX);
+        return false;
+    }
+    flush_pending(state);
+
+    bool root = state->rank == 0;
+    double weight = local_weight(state->local, 0, 0);
+    double* weights = root ? malloc(state->num_ranks * sizeof(double)) : NULL;
+    int* counts = root ? malloc(state->num_ranks * sizeof(int)) : NULL;
+    int* offsets = root ? malloc(state->num_ranks * sizeof(int)) : NULL;
+    double* positions = root ? malloc(shots * sizeof(double)) : NULL;
+    uint64_t* outcomes = root ? malloc(shots * sizeof(uint64_t)) : NULL;
+    if (!on_all_ranks(state->comm, !root || (weights && counts && offsets && positions && outcomes))) {
+        fprintf(stderr, "Error: Out of memory for %llu shots\n", (unsigned long long)shots);
+        free(weights);
+        free(counts);
+        free(offsets);
+        free(positions);
+        free(outcomes);
+        return false;
+    }
+
+    MPI_Gather(&weight, 1, MPI_DOUBLE, weights, 1, MPI_DOUBLE, 0, state->comm);
+    if (root) {
+        draw_positions(state, shots, weights, positions, counts);
+        offsets[0] = 0;
+        for (int r = 1; r < state->num_ranks; r++) {
+            offsets[r] = offsets[r - 1] + counts[r - 1];
+        }
+    }
+    int count;
+    MPI_Scatter(counts, 1, MPI_INT, &count, 1, MPI_INT, 0, state->comm);
+    double* mine = malloc((count + 1) * sizeof(double));
+    uint64_t* found = malloc((count + 1) * sizeof(uint64_t));
+    bool ok = on_all_ranks(state->comm, mine && found);
+    if (ok) {
+        MPI_Scatterv(positions, counts, offsets, MPI_DOUBLE, mine, count, MPI_DOUBLE, 0, state->comm);
+        resolve_positions(state, mine, count, qubits, num_qubits, found);
+        MPI_Gatherv(found, count, MPI_UINT64_T, outcomes, counts, offsets, MPI_UINT64_T, 0, state->comm);
+    } else {
+        fprintf(stderr, "Error: Out of memory for %d shots on rank %d\n", count, state->rank);
+    }
+    free(mine);
+    free(found);
+    free(weights);
+    free(counts);
+    free(offsets);
+    free(positions);
+
+    // Rank 0 merges the outcomes into the histogram
+    if (ok && root) {
+        qsort(outcomes, shots, sizeof(uint64_t), compare_outcomes);
+        size_t num_outcomes = 0;
+        for (uint64_t s = 0; s < shots; s++) {
+            num_outcomes += s == 0 || outcomes[s] != outcomes[s - 1];
+        }
+        histogram->counts = malloc(num_outcomes * sizeof(ShotCount));
+        if (!histogram->counts) {
+            fprintf(stderr, "Error: Out of memory for the shot histogram\n");
+            ok = false;
+        }
+        for (uint64_t s = 0; ok && s < shots; s++) {
+            if (s > 0 && outcomes[s] == outcomes[s - 1]) {
+                histogram->counts[histogram->num_outcomes - 1].count++;
+            } else {
+                histogram->counts[histogram->num_outcomes++] = (ShotCount){ outcomes[s], 1 };
+            }
+        }
+        histogram->shots = ok ? shots : 0;
+    }
+    free(outcomes);
+    return ok;
+}
@@ -0,0 +1,77 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "circuit.h"
+
+// State vectors spread over the processes of an MPI job (build with mpicc and
+// -DQSIM_WITH_MPI). With 2^p ranks, each holds 2^(n-p) amplitudes as an
+// ordinary state vector: the low n - p qubits are local, and the top p
+// "global" qubits are the bits of the rank number. Gates on local qubits, and
+// controls and diagonal gates on global ones (constant on each rank, as for
+// the tiles of execute_circuit_blocked), need no communication.
+//
+// A gate targeting a global qubit first exchanges it with a local qubit: each
+// rank trades the half of its amplitudes in which the two bits differ with
+// the rank whose number differs in that bit. With a fixed layout the qubits
+// are exchanged back after the gate. Otherwise the layout is remapped: the
+// global qubit stays local, and the local qubit evicted for it is the one
+// whose next use lies furthest ahead, so a run of gates on a global qubit
+// costs one exchange instead of two per gate. SWAP gates then only relabel.
+//
+// Every rank runs the same calls in the same order. Measurement outcomes and
+// shots are drawn on rank 0 from the random stream of its local state, so a
+// seeded run draws the same numbers as a single process: measurements give
+// the same bits, and shots the same counts unless a remapped layout makes the
+// ranks walk their amplitudes in another order.
+
+// Amplitudes travel in messages of at most this many bytes
+#define DISTRIBUTED_MESSAGE_BYTES ((size_t)16 << 20)
+
+typedef struct DistributedState DistributedState;
+
+// Communication of a state so far, on the calling rank
+typedef struct {
+    size_t exchanges;          // half-state exchanges with another rank
+    uint64_t bytes_sent;
+    double exchange_seconds;   // time spent exchanging, packing included
+} DistributedStats;
+
+// Starts and stops MPI for the process; every other function here must be
+// called in between. Returns false after printing an error.
+bool distributed_init(int* argc, char*** argv);
+void distributed_finalize(void);
+
+// Rank of this process and number of ranks
+int distributed_rank(void);
+int distributed_num_ranks(void);
+
+// |0...0> on num_qubits qubits over all ranks, whose number must be a power
+// of two below 2^num_qubits. fixed_layout exchanges global targets back after
+// each gate instead of remapping. Collective; returns NULL on every rank
+// after printing an error.
+DistributedState* create_distributed_state(int num_qubits, Precision precision, bool fixed_layout);
+void destroy_distributed_state(DistributedState* state);
+
+int distributed_num_qubits(const DistributedState* state);
+void distributed_stats(const DistributedState* state, DistributedStats* stats);
+
+// Runs every gate of the circuit against state, which must have the same
+// qubit count. Results go to classical_bits (may be NULL) on every rank.
+// Collective; returns false on every rank after printing an error.
+bool execute_circuit_distributed(const Circuit* circuit, DistributedState* state, int* classical_bits);
+
+// Calls visit on rank 0 for the amplitudes of every rank in index order (see
+// ChunkVisitor), restoring the qubit layout first; the other ranks send
+// theirs. Collective; stops visiting, returning false, when visit does.
+bool visit_distributed_chunks(DistributedState* state, ChunkVisitor visit, void* ctx);
+
+// sample_shots for distributed states: rank 0 draws every shot and each rank
+// finds the outcomes landing in its amplitudes. The histogram is filled on
+// rank 0 and left empty elsewhere. Collective.
+bool sample_distributed_shots(DistributedState* state, uint64_t shots, const int* qubits, int num_qubits,
+                              ShotHistogram* histogram);
+
+#endif /* DISTRIBUTED_H */
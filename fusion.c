@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "circuit.h"
+
+// A run of gates merged so far; open blocks always act on disjoint qubits
+typedef struct {
+    int qubits[MAX_FUSED_QUBITS];  // sorted ascending
+    int num_qubits;
+    ComplexNum* matrix;            // 2^num_qubits x 2^num_qubits, row-major
+    size_t num_gates;
+    Gate first_gate;               // emitted unchanged when nothing was merged
+} FusionBlock;
+
+static void set_permutation(ComplexNum* matrix, int dim, int (*row_of)(int column)) {
+    memset(matrix, 0, (size_t)dim * dim * sizeof(ComplexNum));
+    for (int c = 0; c < dim; c++) {
+        matrix[(size_t)row_of(c) * dim + c] = 1;
+    }
+}
+
+static int cnot_row(int column)    { return (column & 1) ? column ^ 2 : column; }
+static int swap_row(int column)    { return ((column & 1) << 1) | ((column >> 1) & 1); }
+static int toffoli_row(int column) { return ((column & 3) == 3) ? column ^ 4 : column; }
+
+static void set_2x2(ComplexNum* m, ComplexNum m00, ComplexNum m01, ComplexNum m10, ComplexNum m11) {
+    m[0] = m00; m[1] = m01;
+    m[2] = m10; m[3] = m11;
+}
+
+bool gate_matrix(const Gate* gate, ComplexNum* matrix) {
+    double c = cos(gate->angle / 2);
+    double s = sin(gate->angle / 2);
+    double h = 1.0 / sqrt(2.0);
+
+    switch (gate->type) {
+        case HADAMARD:   set_2x2(matrix, h, h, h, -h); return true;
+        case PAULI_X:    set_2x2(matrix, 0, 1, 1, 0); return true;
+        case PAULI_Y:    set_2x2(matrix, 0, -I, I, 0); return true;
+        case PAULI_Z:    set_2x2(matrix, 1, 0, 0, -1); return true;
+        case PHASE:      set_2x2(matrix, 1, 0, 0, cexp(I * gate->angle)); return true;
+        case ROTATION_X: set_2x2(matrix, c, -I * s, -I * s, c); return true;
+        case ROTATION_Y: set_2x2(matrix, c, -s, s, c); return true;
+        case ROTATION_Z: set_2x2(matrix, cexp(-I * gate->angle / 2), 0, 0, cexp(I * gate->angle / 2)); return true;
+        case CNOT:       set_permutation(matrix, 4, cnot_row); return true;
+        case SWAP:       set_permutation(matrix, 4, swap_row); return true;
+        case TOFFOLI:    set_permutation(matrix, 8, toffoli_row); return true;
+        case CONTROLLED_PHASE:
+            memset(matrix, 0, 16 * sizeof(ComplexNum));
+            matrix[0] = matrix[5] = matrix[10] = 1;
+            matrix[15] = cexp(I * gate->angle);
+            return true;
+        case UNITARY: {
+            size_t dim = (size_t)1 << gate->num_qubits;
+            memcpy(matrix, gate->matrix, dim * dim * sizeof(ComplexNum));
+            return true;
+        }
+        case PHASE_FLIP:
+        case MEASURE:
+        case QFT:
+        case INVERSE_QFT:
+            break;
+    }
+    return false;
+}
+
+// block->matrix = embed(op) * block->matrix, where op acts on op_qubits (a subset of the block's qubits)
+static void absorb(FusionBlock* block, const int* op_qubits, int op_num_qubits, const ComplexNum* op) {
+    int dim = 1 << block->num_qubits;
+    int op_dim = 1 << op_num_qubits;
+    int position_mask[MAX_FUSED_QUBITS];
+    int op_mask = 0;
+
+    for (int j = 0; j < op_num_qubits; j++) {
+        for (int p = 0; p < block->num_qubits; p++) {
+            if (block->qubits[p] == op_qubits[j]) {
+                position_mask[j] = 1 << p;
+                op_mask |= 1 << p;
+            }
+        }
+    }
+
+    // Block-local index holding op-local index s in the op's bit positions
+    int scatter[1 << MAX_FUSED_QUBITS];
+    for (int s = 0; s < op_dim; s++) {
+        scatter[s] = 0;
+        for (int j = 0; j < op_num_qubits; j++) {
+            if (s & (1 << j)) scatter[s] |= position_mask[j];
+        }
+    }
+
+    ComplexNum* result = malloc((size_t)dim * dim * sizeof(ComplexNum));
+    for (int r = 0; r < dim; r++) {
+        int r_op = 0;
+        for (int j = 0; j < op_num_qubits; j++) {
+            if (r & position_mask[j]) r_op |= 1 << j;
+        }
+        int r_rest = r & ~op_mask;
+        const ComplexNum* op_row = op + (size_t)r_op * op_dim;
+
+        for (int c = 0; c < dim; c++) {
+            ComplexNum sum = 0;
+            for (int s = 0; s < op_dim; s++) {
+                sum += op_row[s] * block->matrix[(size_t)(r_rest | scatter[s]) * dim + c];
+            }
+            result[(size_t)r * dim + c] = sum;
+        }
+    }
+    free(block->matrix);
+    block->matrix = result;
+}
+
+static void init_block(FusionBlock* block, const int* qubits, int num_qubits) {
+    int dim = 1 << num_qubits;
+    block->num_qubits = num_qubits;
+    memcpy(block->qubits, qubits, num_qubits * sizeof(int));
+    block->matrix = calloc((size_t)dim * dim, sizeof(ComplexNum));
+    for (int d = 0; d < dim; d++) {
+        block->matrix[(size_t)d * dim + d] = 1;
+    }
+    block->num_gates = 0;
+}
+
+static void emit_block(Circuit* out, FusionBlock* block) {
+    if (block->num_gates == 1) {
+        circuit_append(out, &block->first_gate);
+    } else if (block->num_gates > 1) {
+        circuit_unitary(out, block->qubits, block->num_qubits, block->matrix);
+    }
+    free(block->matrix);
+    block->matrix = NULL;
+}
+
+static bool block_touches(const FusionBlock* block, const Gate* gate) {
+    for (int p = 0; p < block->num_qubits; p++) {
+        for (int j = 0; j < gate->num_qubits; j++) {
+            if (block->qubits[p] == gate->qubits[j]) return true;
+        }
+    }
+    return false;
+}
+
+static int add_qubit_sorted(int* qubits, int count, int qubit) {
+    for (int p = 0; p < count; p++) {
+        if (qubits[p] == qubit) return count;
+    }
+    int p = count;
+    while (p > 0 && qubits[p - 1] > qubit) {
+        qubits[p] = qubits[p - 1];
+        p--;
+    }
+    qubits[p] = qubit;
+    return count + 1;
+}
+
+Circuit* fuse_circuit(const Circuit* circuit, int max_fused_qubits) {
+    if (max_fused_qubits < 1 || max_fused_qubits > MAX_FUSED_QUBITS) {
+        fprintf(stderr, "Error: Fused blocks must span 1 to %d qubits\n", MAX_FUSED_QUBITS);
+        return NULL;
+    }
+
+    Circuit* out = create_circuit(circuit->num_qubits);
+    FusionBlock* blocks = malloc((circuit->num_qubits + 1) * sizeof(FusionBlock));
+    int num_blocks = 0;
+    ComplexNum gate_op[1 << (2 * 3)];  // largest fixed gate is the 3-qubit Toffoli
+
+    for (size_t g = 0; g < circuit->num_gates; g++) {
+        const Gate* gate = &circuit->gates[g];
+
+        // Measurements, basis-state flips and Fourier transforms act on the
+        // whole register (or many qubits of it): flush everything
+        if (gate->type == MEASURE || gate->type == PHASE_FLIP || gate->type == QFT || gate->type == INVERSE_QFT) {
+            for (int b = 0; b < num_blocks; b++) {
+                emit_block(out, &blocks[b]);
+            }
+            num_blocks = 0;
+            circuit_append(out, gate);
+            continue;
+        }
+
+        // Qubits of the gate plus those of every open block it overlaps
+        int merged[2 * MAX_FUSED_QUBITS];
+        int num_merged = 0;
+        bool fits = gate->num_qubits <= max_fused_qubits;
+        for (int j = 0; j < gate->num_qubits; j++) {
+            num_merged = add_qubit_sorted(merged, num_merged, gate->qubits[j]);
+        }
+        for (int b = 0; b < num_blocks && fits; b++) {
+            if (!block_touches(&blocks[b], gate)) continue;
+            for (int p = 0; p < blocks[b].num_qubits && fits; p++) {
+                num_merged = add_qubit_sorted(merged, num_merged, blocks[b].qubits[p]);
+                fits = num_merged <= max_fused_qubits;
+            }
+        }
+
+        // Overlapping blocks are either merged into the new block or flushed first
+        FusionBlock block;
+        if (fits) {
+            init_block(&block, merged, num_merged);
+        }
+        int kept = 0;
+        for (int b = 0; b < num_blocks; b++) {
+            if (!block_touches(&blocks[b], gate)) {
+                blocks[kept++] = blocks[b];
+            } else if (fits) {
+                absorb(&block, blocks[b].qubits, blocks[b].num_qubits, blocks[b].matrix);
+                block.num_gates += blocks[b].num_gates;
+                block.first_gate = blocks[b].first_gate;
+                free(blocks[b].matrix);
+            } else {
+                emit_block(out, &blocks[b]);
+            }
+        }
+        num_blocks = kept;
+
+        if (!fits) {
+            circuit_append(out, gate);
+            continue;
+        }
+
+        // Pull in disjoint open blocks while the block still has room; they
+        // commute with everything emitted since they were opened
+        kept = 0;
+        for (int b = 0; b < num_blocks; b++) {
+            if (block.num_qubits + blocks[b].num_qubits > max_fused_qubits) {
+                blocks[kept++] = blocks[b];
+                continue;
+            }
+            FusionBlock grown;
+            int qubits[MAX_FUSED_QUBITS];
+            int count = block.num_qubits;
+            memcpy(qubits, block.qubits, count * sizeof(int));
+            for (int p = 0; p < blocks[b].num_qubits; p++) {
+                count = add_qubit_sorted(qubits, count, blocks[b].qubits[p]);
+            }
+            init_block(&grown, qubits, count);
+            absorb(&grown, blocks[b].qubits, blocks[b].num_qubits, blocks[b].matrix);
+            absorb(&grown, block.qubits, block.num_qubits, block.matrix);
+            grown.num_gates = blocks[b].num_gates + block.num_gates;
+            grown.first_gate = blocks[b].num_gates ? blocks[b].first_gate : block.first_gate;
+            free(blocks[b].matrix);
+            free(block.matrix);
+            block = grown;
+        }
+        num_blocks = kept;
+
+        ComplexNum* op = gate->type == UNITARY ? gate->matrix : gate_op;
+        if (gate->type != UNITARY) {
+            gate_matrix(gate, op);
+        }
+        absorb(&block, gate->qubits, gate->num_qubits, op);
+        if (block.num_gates == 0) {
+            block.first_gate = *gate;
+        }
+        block.num_gates++;
+        blocks[num_blocks++] = block;
+    }
+
+    for (int b = 0; b < num_blocks; b++) {
+        emit_block(out, &blocks[b]);
+    }
+    free(blocks);
+    return out;
+}
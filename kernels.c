@@ -0,0 +1,1152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef enum {
+    ISA_SCALAR,
+    ISA_AVX2,
+    ISA_AVX512
+} KernelIsa;
+
+// Contiguous span operations. a and b point at the first pair members of
+// len consecutive pairs; "adjacent" spans hold len pairs stored as (a0, a1);
+// dense spans update len consecutive groups base[j + offsets[0..dim)];
+// dense groups update len groups spaced stride apart, vectorized across matrix rows;
+// product spans write the element-wise product of two arrays (out may alias x);
+// lane kernels update rows of width elements, row i at a + i * stride, where
+// element j has its own matrix, entry (r, c) at m[(2 * r + c) * stride + j],
+// or its own phase, phases[j].
+typedef struct {
+    void (*matrix_span)(ComplexNum* a, ComplexNum* b, size_t len, const ComplexNum m[2][2]);
+    void (*matrix_adjacent)(ComplexNum* a, size_t len, const ComplexNum m[2][2]);
+    void (*phase_span)(ComplexNum* a, size_t len, ComplexNum phase);
+    void (*dense_span)(ComplexNum* base, const size_t* offsets, int dim, const ComplexNum* m, size_t len);
+    void (*dense_group)(ComplexNum* base, const size_t* offsets, int dim, const ComplexNum* m_transposed,
+                        size_t len, size_t stride);
+    void (*product_span)(ComplexNum* out, const ComplexNum* x, const ComplexNum* y, size_t len);
+    void (*matrix_lanes)(ComplexNum* a, ComplexNum* b, size_t rows, size_t width, const ComplexNum* m,
+                         size_t stride);
+    void (*phase_lanes)(ComplexNum* a, size_t rows, size_t width, const ComplexNum* phases, size_t stride);
+} KernelTable;
+
+// The same operations on single precision amplitudes, with the matrices
+// already rounded to single precision
+typedef struct {
+    void (*matrix_span)(ComplexFloat* a, ComplexFloat* b, size_t len, const ComplexFloat m[2][2]);
+    void (*matrix_adjacent)(ComplexFloat* a, size_t len, const ComplexFloat m[2][2]);
+    void (*phase_span)(ComplexFloat* a, size_t len, ComplexFloat phase);
+    void (*dense_span)(ComplexFloat* base, const size_t* offsets, int dim, const ComplexFloat* m, size_t len);
+    void (*dense_group)(ComplexFloat* base, const size_t* offsets, int dim, const ComplexFloat* m_transposed,
+                        size_t len, size_t stride);
+    void (*product_span)(ComplexFloat* out, const ComplexFloat* x, const ComplexFloat* y, size_t len);
+} SingleKernelTable;
+
+void make_index_pattern(IndexPattern* pattern, int num_qubits, size_t fixed_mask, size_t set_mask) {
+    pattern->num_fixed = 0;
+    for (int q = 0; q < num_qubits; q++) {
+        if (fixed_mask & ((size_t)1 << q)) {
+            pattern->fixed_qubits[pattern->num_fixed++] = q;
+        }
+    }
+    pattern->set_mask = set_mask;
+    pattern->count = (size_t)1 << (num_qubits - pattern->num_fixed);
+}
+
+// Length of the run of consecutive base indices starting at k whose
+// positions are consecutive in memory (step 1 << skip_low fixed bits)
+static inline size_t contiguous_run(const IndexPattern* pattern, int skip, size_t k, size_t end) {
+    size_t len = end - k;
+    if (pattern->num_fixed > skip) {
+        size_t run = (size_t)1 << (pattern->fixed_qubits[skip] - skip);
+        size_t left = run - (k & (run - 1));
+        if (left < len) len = left;
+    }
+    return len;
+}
+
+// ---------------------------------------------------------------------------
+// Scalar kernels
+// ---------------------------------------------------------------------------
+
+// Plain complex product without the C99 infinity/NaN recovery path, which
+// keeps the scalar loops free of library calls
+static inline ComplexNum cmul(ComplexNum x, ComplexNum y) {
+    return CMPLX(creal(x) * creal(y) - cimag(x) * cimag(y),
+                 creal(x) * cimag(y) + cimag(x) * creal(y));
+}
+
+static void matrix_span_scalar(ComplexNum* a, ComplexNum* b, size_t len, const ComplexNum m[2][2]) {
+    ComplexNum m00 = m[0][0], m01 = m[0][1], m10 = m[1][0], m11 = m[1][1];
+    for (size_t j = 0; j < len; j++) {
+        ComplexNum a0 = a[j];
+        ComplexNum a1 = b[j];
+        a[j] = cmul(m00, a0) + cmul(m01, a1);
+        b[j] = cmul(m10, a0) + cmul(m11, a1);
+    }
+}
+
+static void matrix_adjacent_scalar(ComplexNum* a, size_t len, const ComplexNum m[2][2]) {
+    for (size_t j = 0; j < len; j++) {
+        matrix_span_scalar(a + 2 * j, a + 2 * j + 1, 1, m);
+    }
+}
+
+static void phase_span_scalar(ComplexNum* a, size_t len, ComplexNum phase) {
+    for (size_t j = 0; j < len; j++) {
+        a[j] = cmul(a[j], phase);
+    }
+}
+
+static void dense_span_scalar(ComplexNum* base, const size_t* offsets, int dim, const ComplexNum* m, size_t len) {
+    ComplexNum in[1 << MAX_FUSED_QUBITS];
+    for (size_t j = 0; j < len; j++) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = base[offsets[c] + j];
+        }
+        for (int r = 0; r < dim; r++) {
+            const ComplexNum* row = m + (size_t)r * dim;
+            ComplexNum sum = 0;
+            for (int c = 0; c < dim; c++) {
+                sum += cmul(row[c], in[c]);
+            }
+            base[offsets[r] + j] = sum;
+        }
+    }
+}
+
+static void dense_group_scalar(ComplexNum* base, const size_t* offsets, int dim, const ComplexNum* m_transposed,
+                               size_t len, size_t stride) {
+    ComplexNum in[1 << MAX_FUSED_QUBITS];
+    ComplexNum out[1 << MAX_FUSED_QUBITS];
+    for (size_t j = 0; j < len; j++, base += stride) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = base[offsets[c]];
+            out[c] = 0;
+        }
+        for (int c = 0; c < dim; c++) {
+            const ComplexNum* column = m_transposed + (size_t)c * dim;
+            for (int r = 0; r < dim; r++) {
+                out[r] += cmul(column[r], in[c]);
+            }
+        }
+        for (int r = 0; r < dim; r++) {
+            base[offsets[r]] = out[r];
+        }
+    }
+}
+
+static void product_span_scalar(ComplexNum* out, const ComplexNum* x, const ComplexNum* y, size_t len) {
+    for (size_t j = 0; j < len; j++) {
+        out[j] = cmul(x[j], y[j]);
+    }
+}
+
+static void matrix_lanes_scalar(ComplexNum* a, ComplexNum* b, size_t rows, size_t width, const ComplexNum* m,
+                                size_t stride) {
+    for (size_t i = 0; i < rows; i++, a += stride, b += stride) {
+        for (size_t j = 0; j < width; j++) {
+            ComplexNum a0 = a[j];
+            ComplexNum a1 = b[j];
+            a[j] = cmul(m[j], a0) + cmul(m[stride + j], a1);
+            b[j] = cmul(m[2 * stride + j], a0) + cmul(m[3 * stride + j], a1);
+        }
+    }
+}
+
+static void phase_lanes_scalar(ComplexNum* a, size_t rows, size_t width, const ComplexNum* phases, size_t stride) {
+    for (size_t i = 0; i < rows; i++, a += stride) {
+        for (size_t j = 0; j < width; j++) {
+            a[j] = cmul(a[j], phases[j]);
+        }
+    }
+}
+
+static const KernelTable scalar_table = {
+    matrix_span_scalar, matrix_adjacent_scalar, phase_span_scalar, dense_span_scalar, dense_group_scalar,
+    product_span_scalar, matrix_lanes_scalar, phase_lanes_scalar
+};
+
+// Single precision scalar kernels
+
+static inline ComplexFloat cmulf(ComplexFloat x, ComplexFloat y) {
+    return CMPLXF(crealf(x) * crealf(y) - cimagf(x) * cimagf(y),
+                  crealf(x) * cimagf(y) + cimagf(x) * crealf(y));
+}
+
+static void matrix_span_scalar_single(ComplexFloat* a, ComplexFloat* b, size_t len, const ComplexFloat m[2][2]) {
+    ComplexFloat m00 = m[0][0], m01 = m[0][1], m10 = m[1][0], m11 = m[1][1];
+    for (size_t j = 0; j < len; j++) {
+        ComplexFloat a0 = a[j];
+        ComplexFloat a1 = b[j];
+        a[j] = cmulf(m00, a0) + cmulf(m01, a1);
+        b[j] = cmulf(m10, a0) + cmulf(m11, a1);
+    }
+}
+
+static void matrix_adjacent_scalar_single(ComplexFloat* a, size_t len, const ComplexFloat m[2][2]) {
+    for (size_t j = 0; j < len; j++) {
+        matrix_span_scalar_single(a + 2 * j, a + 2 * j + 1, 1, m);
+    }
+}
+
+static void phase_span_scalar_single(ComplexFloat* a, size_t len, ComplexFloat phase) {
+    for (size_t j = 0; j < len; j++) {
+        a[j] = cmulf(a[j], phase);
+    }
+}
+
+static void dense_span_scalar_single(ComplexFloat* base, const size_t* offsets, int dim, const ComplexFloat* m,
+                                     size_t len) {
+    ComplexFloat in[1 << MAX_FUSED_QUBITS];
+    for (size_t j = 0; j < len; j++) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = base[offsets[c] + j];
+        }
+        for (int r = 0; r < dim; r++) {
+            const ComplexFloat* row = m + (size_t)r * dim;
+            ComplexFloat sum = 0;
+            for (int c = 0; c < dim; c++) {
+                sum += cmulf(row[c], in[c]);
+            }
+            base[offsets[r] + j] = sum;
+        }
+    }
+}
+
+static void dense_group_scalar_single(ComplexFloat* base, const size_t* offsets, int dim,
+                                      const ComplexFloat* m_transposed, size_t len, size_t stride) {
+    ComplexFloat in[1 << MAX_FUSED_QUBITS];
+    ComplexFloat out[1 << MAX_FUSED_QUBITS];
+    for (size_t j = 0; j < len; j++, base += stride) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = base[offsets[c]];
+            out[c] = 0;
+        }
+        for (int c = 0; c < dim; c++) {
+            const ComplexFloat* column = m_transposed + (size_t)c * dim;
+            for (int r = 0; r < dim; r++) {
+                out[r] += cmulf(column[r], in[c]);
+            }
+        }
+        for (int r = 0; r < dim; r++) {
+            base[offsets[r]] = out[r];
+        }
+    }
+}
+
+static void product_span_scalar_single(ComplexFloat* out, const ComplexFloat* x, const ComplexFloat* y, size_t len) {
+    for (size_t j = 0; j < len; j++) {
+        out[j] = cmulf(x[j], y[j]);
+    }
+}
+
+static const SingleKernelTable scalar_single_table = {
+    matrix_span_scalar_single, matrix_adjacent_scalar_single, phase_span_scalar_single,
+    dense_span_scalar_single, dense_group_scalar_single, product_span_scalar_single
+};
+
+#ifdef KERNELS_X86_SIMD
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels: two interleaved complex doubles per register
+// ---------------------------------------------------------------------------
+
+__attribute__((target("avx2,fma")))
+static inline __m256d cmul_avx2(__m256d x, __m256d y) {
+    __m256d x_re = _mm256_movedup_pd(x);
+    __m256d x_im = _mm256_permute_pd(x, 0xF);
+    __m256d y_swap = _mm256_permute_pd(y, 0x5);
+    return _mm256_fmaddsub_pd(x_re, y, _mm256_mul_pd(x_im, y_swap));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d broadcast_avx2(ComplexNum z) {
+    return _mm256_setr_pd(creal(z), cimag(z), creal(z), cimag(z));
+}
+
+__attribute__((target("avx2,fma")))
+static void matrix_span_avx2(ComplexNum* a, ComplexNum* b, size_t len, const ComplexNum m[2][2]) {
+    __m256d m00 = broadcast_avx2(m[0][0]), m01 = broadcast_avx2(m[0][1]);
+    __m256d m10 = broadcast_avx2(m[1][0]), m11 = broadcast_avx2(m[1][1]);
+    size_t j = 0;
+    for (; j + 2 <= len; j += 2) {
+        __m256d a0 = _mm256_loadu_pd((double*)(a + j));
+        __m256d a1 = _mm256_loadu_pd((double*)(b + j));
+        __m256d r0 = _mm256_add_pd(cmul_avx2(m00, a0), cmul_avx2(m01, a1));
+        __m256d r1 = _mm256_add_pd(cmul_avx2(m10, a0), cmul_avx2(m11, a1));
+        _mm256_storeu_pd((double*)(a + j), r0);
+        _mm256_storeu_pd((double*)(b + j), r1);
+    }
+    matrix_span_scalar(a + j, b + j, len - j, m);
+}
+
+__attribute__((target("avx2,fma")))
+static void matrix_adjacent_avx2(ComplexNum* a, size_t len, const ComplexNum m[2][2]) {
+    __m256d c0 = _mm256_setr_pd(creal(m[0][0]), cimag(m[0][0]), creal(m[1][0]), cimag(m[1][0]));
+    __m256d c1 = _mm256_setr_pd(creal(m[0][1]), cimag(m[0][1]), creal(m[1][1]), cimag(m[1][1]));
+    for (size_t j = 0; j < len; j++) {
+        __m256d v = _mm256_loadu_pd((double*)(a + 2 * j));
+        __m256d v0 = _mm256_permute2f128_pd(v, v, 0x00);
+        __m256d v1 = _mm256_permute2f128_pd(v, v, 0x11);
+        __m256d r = _mm256_add_pd(cmul_avx2(c0, v0), cmul_avx2(c1, v1));
+        _mm256_storeu_pd((double*)(a + 2 * j), r);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void phase_span_avx2(ComplexNum* a, size_t len, ComplexNum phase) {
+    __m256d p = broadcast_avx2(phase);
+    size_t j = 0;
+    for (; j + 2 <= len; j += 2) {
+        __m256d v = _mm256_loadu_pd((double*)(a + j));
+        _mm256_storeu_pd((double*)(a + j), cmul_avx2(p, v));
+    }
+    phase_span_scalar(a + j, len - j, phase);
+}
+
+__attribute__((target("avx2,fma")))
+static void dense_span_avx2(ComplexNum* base, const size_t* offsets, int dim, const ComplexNum* m, size_t len) {
+    __m256d in[1 << MAX_FUSED_QUBITS];
+    size_t j = 0;
+    for (; j + 2 <= len; j += 2) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = _mm256_loadu_pd((double*)(base + offsets[c] + j));
+        }
+        for (int r = 0; r < dim; r++) {
+            const ComplexNum* row = m + (size_t)r * dim;
+            __m256d sum = _mm256_setzero_pd();
+            for (int c = 0; c < dim; c++) {
+                __m256d coefficient = _mm256_broadcast_pd((const __m128d*)(row + c));
+                sum = _mm256_add_pd(sum, cmul_avx2(coefficient, in[c]));
+            }
+            _mm256_storeu_pd((double*)(base + offsets[r] + j), sum);
+        }
+    }
+    dense_span_scalar(base + j, offsets, dim, m, len - j);
+}
+
+__attribute__((target("avx2,fma")))
+static void dense_group_avx2(ComplexNum* base, const size_t* offsets, int dim, const ComplexNum* m_transposed,
+                             size_t len, size_t stride) {
+    __m256d in[1 << MAX_FUSED_QUBITS];
+    __m256d out[1 << (MAX_FUSED_QUBITS - 1)];
+    for (size_t j = 0; j < len; j++, base += stride) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = _mm256_broadcast_pd((const __m128d*)(base + offsets[c]));
+        }
+        for (int r = 0; r < dim / 2; r++) {
+            out[r] = _mm256_setzero_pd();
+        }
+        for (int c = 0; c < dim; c++) {
+            const double* column = (const double*)(m_transposed + (size_t)c * dim);
+            for (int r = 0; r < dim / 2; r++) {
+                out[r] = _mm256_add_pd(out[r], cmul_avx2(in[c], _mm256_loadu_pd(column + 4 * r)));
+            }
+        }
+        for (int r = 0; r < dim / 2; r++) {
+            _mm_storeu_pd((double*)(base + offsets[2 * r]), _mm256_castpd256_pd128(out[r]));
+            _mm_storeu_pd((double*)(base + offsets[2 * r + 1]), _mm256_extractf128_pd(out[r], 1));
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void product_span_avx2(ComplexNum* out, const ComplexNum* x, const ComplexNum* y, size_t len) {
+    size_t j = 0;
+    for (; j + 2 <= len; j += 2) {
+        __m256d v = _mm256_loadu_pd((const double*)(x + j));
+        __m256d w = _mm256_loadu_pd((const double*)(y + j));
+        _mm256_storeu_pd((double*)(out + j), cmul_avx2(v, w));
+    }
+    product_span_scalar(out + j, x + j, y + j, len - j);
+}
+
+// Lanes are taken a register at a time, with their coefficients held over
+// the rows; the rows of a batched group are short and stay in cache
+__attribute__((target("avx2,fma")))
+static void matrix_lanes_avx2(ComplexNum* a, ComplexNum* b, size_t rows, size_t width, const ComplexNum* m,
+                              size_t stride) {
+    size_t j = 0;
+    for (; j + 2 <= width; j += 2) {
+        __m256d m00 = _mm256_loadu_pd((const double*)(m + j));
+        __m256d m01 = _mm256_loadu_pd((const double*)(m + stride + j));
+        __m256d m10 = _mm256_loadu_pd((const double*)(m + 2 * stride + j));
+        __m256d m11 = _mm256_loadu_pd((const double*)(m + 3 * stride + j));
+        for (size_t i = 0; i < rows; i++) {
+            double* pa = (double*)(a + i * stride + j);
+            double* pb = (double*)(b + i * stride + j);
+            __m256d a0 = _mm256_loadu_pd(pa);
+            __m256d a1 = _mm256_loadu_pd(pb);
+            _mm256_storeu_pd(pa, _mm256_add_pd(cmul_avx2(m00, a0), cmul_avx2(m01, a1)));
+            _mm256_storeu_pd(pb, _mm256_add_pd(cmul_avx2(m10, a0), cmul_avx2(m11, a1)));
+        }
+    }
+    if (j < width) {
+        matrix_lanes_scalar(a + j, b + j, rows, width - j, m + j, stride);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void phase_lanes_avx2(ComplexNum* a, size_t rows, size_t width, const ComplexNum* phases, size_t stride) {
+    size_t j = 0;
+    for (; j + 2 <= width; j += 2) {
+        __m256d p = _mm256_loadu_pd((const double*)(phases + j));
+        for (size_t i = 0; i < rows; i++) {
+            double* pa = (double*)(a + i * stride + j);
+            _mm256_storeu_pd(pa, cmul_avx2(p, _mm256_loadu_pd(pa)));
+        }
+    }
+    if (j < width) {
+        phase_lanes_scalar(a + j, rows, width - j, phases + j, stride);
+    }
+}
+
+static const KernelTable avx2_table = {
+    matrix_span_avx2, matrix_adjacent_avx2, phase_span_avx2, dense_span_avx2, dense_group_avx2,
+    product_span_avx2, matrix_lanes_avx2, phase_lanes_avx2
+};
+
+// ---------------------------------------------------------------------------
+// AVX2 single precision kernels: four interleaved complex floats per register
+// ---------------------------------------------------------------------------
+
+__attribute__((target("avx2,fma")))
+static inline __m256 cmul_avx2_single(__m256 x, __m256 y) {
+    __m256 x_re = _mm256_moveldup_ps(x);
+    __m256 x_im = _mm256_movehdup_ps(x);
+    __m256 y_swap = _mm256_permute_ps(y, 0xB1);
+    return _mm256_fmaddsub_ps(x_re, y, _mm256_mul_ps(x_im, y_swap));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 broadcast_avx2_single(ComplexFloat z) {
+    return _mm256_setr_ps(crealf(z), cimagf(z), crealf(z), cimagf(z),
+                          crealf(z), cimagf(z), crealf(z), cimagf(z));
+}
+
+__attribute__((target("avx2,fma")))
+static void matrix_span_avx2_single(ComplexFloat* a, ComplexFloat* b, size_t len, const ComplexFloat m[2][2]) {
+    __m256 m00 = broadcast_avx2_single(m[0][0]), m01 = broadcast_avx2_single(m[0][1]);
+    __m256 m10 = broadcast_avx2_single(m[1][0]), m11 = broadcast_avx2_single(m[1][1]);
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m256 a0 = _mm256_loadu_ps((float*)(a + j));
+        __m256 a1 = _mm256_loadu_ps((float*)(b + j));
+        __m256 r0 = _mm256_add_ps(cmul_avx2_single(m00, a0), cmul_avx2_single(m01, a1));
+        __m256 r1 = _mm256_add_ps(cmul_avx2_single(m10, a0), cmul_avx2_single(m11, a1));
+        _mm256_storeu_ps((float*)(a + j), r0);
+        _mm256_storeu_ps((float*)(b + j), r1);
+    }
+    matrix_span_scalar_single(a + j, b + j, len - j, m);
+}
+
+__attribute__((target("avx2,fma")))
+static void matrix_adjacent_avx2_single(ComplexFloat* a, size_t len, const ComplexFloat m[2][2]) {
+    __m256 c0 = _mm256_setr_ps(crealf(m[0][0]), cimagf(m[0][0]), crealf(m[1][0]), cimagf(m[1][0]),
+                               crealf(m[0][0]), cimagf(m[0][0]), crealf(m[1][0]), cimagf(m[1][0]));
+    __m256 c1 = _mm256_setr_ps(crealf(m[0][1]), cimagf(m[0][1]), crealf(m[1][1]), cimagf(m[1][1]),
+                               crealf(m[0][1]), cimagf(m[0][1]), crealf(m[1][1]), cimagf(m[1][1]));
+    size_t j = 0;
+    for (; j + 2 <= len; j += 2) {
+        __m256 v = _mm256_loadu_ps((float*)(a + 2 * j));
+        __m256 v0 = _mm256_permute_ps(v, 0x44);  // (a0, a0) in each pair lane
+        __m256 v1 = _mm256_permute_ps(v, 0xEE);  // (a1, a1) in each pair lane
+        __m256 r = _mm256_add_ps(cmul_avx2_single(c0, v0), cmul_avx2_single(c1, v1));
+        _mm256_storeu_ps((float*)(a + 2 * j), r);
+    }
+    matrix_adjacent_scalar_single(a + 2 * j, len - j, m);
+}
+
+__attribute__((target("avx2,fma")))
+static void phase_span_avx2_single(ComplexFloat* a, size_t len, ComplexFloat phase) {
+    __m256 p = broadcast_avx2_single(phase);
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m256 v = _mm256_loadu_ps((float*)(a + j));
+        _mm256_storeu_ps((float*)(a + j), cmul_avx2_single(p, v));
+    }
+    phase_span_scalar_single(a + j, len - j, phase);
+}
+
+__attribute__((target("avx2,fma")))
+static void dense_span_avx2_single(ComplexFloat* base, const size_t* offsets, int dim, const ComplexFloat* m,
+                                   size_t len) {
+    __m256 in[1 << MAX_FUSED_QUBITS];
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = _mm256_loadu_ps((float*)(base + offsets[c] + j));
+        }
+        for (int r = 0; r < dim; r++) {
+            const ComplexFloat* row = m + (size_t)r * dim;
+            __m256 sum = _mm256_setzero_ps();
+            for (int c = 0; c < dim; c++) {
+                __m256 coefficient = _mm256_castpd_ps(_mm256_broadcast_sd((const double*)(row + c)));
+                sum = _mm256_add_ps(sum, cmul_avx2_single(coefficient, in[c]));
+            }
+            _mm256_storeu_ps((float*)(base + offsets[r] + j), sum);
+        }
+    }
+    dense_span_scalar_single(base + j, offsets, dim, m, len - j);
+}
+
+__attribute__((target("avx2,fma")))
+static void product_span_avx2_single(ComplexFloat* out, const ComplexFloat* x, const ComplexFloat* y, size_t len) {
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m256 v = _mm256_loadu_ps((const float*)(x + j));
+        __m256 w = _mm256_loadu_ps((const float*)(y + j));
+        _mm256_storeu_ps((float*)(out + j), cmul_avx2_single(v, w));
+    }
+    product_span_scalar_single(out + j, x + j, y + j, len - j);
+}
+
+static const SingleKernelTable avx2_single_table = {
+    matrix_span_avx2_single, matrix_adjacent_avx2_single, phase_span_avx2_single, dense_span_avx2_single,
+    dense_group_scalar_single, product_span_avx2_single
+};
+
+// ---------------------------------------------------------------------------
+// AVX-512 kernels: four interleaved complex doubles per register
+// ---------------------------------------------------------------------------
+
+__attribute__((target("avx512f")))
+static inline __m512d cmul_avx512(__m512d x, __m512d y) {
+    __m512d x_re = _mm512_movedup_pd(x);
+    __m512d x_im = _mm512_permute_pd(x, 0xFF);
+    __m512d y_swap = _mm512_permute_pd(y, 0x55);
+    return _mm512_fmaddsub_pd(x_re, y, _mm512_mul_pd(x_im, y_swap));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d broadcast_avx512(ComplexNum z) {
+    return _mm512_setr_pd(creal(z), cimag(z), creal(z), cimag(z),
+                          creal(z), cimag(z), creal(z), cimag(z));
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void matrix_span_avx512(ComplexNum* a, ComplexNum* b, size_t len, const ComplexNum m[2][2]) {
+    __m512d m00 = broadcast_avx512(m[0][0]), m01 = broadcast_avx512(m[0][1]);
+    __m512d m10 = broadcast_avx512(m[1][0]), m11 = broadcast_avx512(m[1][1]);
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m512d a0 = _mm512_loadu_pd((double*)(a + j));
+        __m512d a1 = _mm512_loadu_pd((double*)(b + j));
+        __m512d r0 = _mm512_add_pd(cmul_avx512(m00, a0), cmul_avx512(m01, a1));
+        __m512d r1 = _mm512_add_pd(cmul_avx512(m10, a0), cmul_avx512(m11, a1));
+        _mm512_storeu_pd((double*)(a + j), r0);
+        _mm512_storeu_pd((double*)(b + j), r1);
+    }
+    matrix_span_avx2(a + j, b + j, len - j, m);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void matrix_adjacent_avx512(ComplexNum* a, size_t len, const ComplexNum m[2][2]) {
+    __m512d c0 = _mm512_setr_pd(creal(m[0][0]), cimag(m[0][0]), creal(m[1][0]), cimag(m[1][0]),
+                                creal(m[0][0]), cimag(m[0][0]), creal(m[1][0]), cimag(m[1][0]));
+    __m512d c1 = _mm512_setr_pd(creal(m[0][1]), cimag(m[0][1]), creal(m[1][1]), cimag(m[1][1]),
+                                creal(m[0][1]), cimag(m[0][1]), creal(m[1][1]), cimag(m[1][1]));
+    size_t j = 0;
+    for (; j + 2 <= len; j += 2) {
+        __m512d v = _mm512_loadu_pd((double*)(a + 2 * j));
+        __m512d v0 = _mm512_permutex_pd(v, 0x44);  // (a0, a0) in each pair lane
+        __m512d v1 = _mm512_permutex_pd(v, 0xEE);  // (a1, a1) in each pair lane
+        __m512d r = _mm512_add_pd(cmul_avx512(c0, v0), cmul_avx512(c1, v1));
+        _mm512_storeu_pd((double*)(a + 2 * j), r);
+    }
+    matrix_adjacent_avx2(a + 2 * j, len - j, m);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void phase_span_avx512(ComplexNum* a, size_t len, ComplexNum phase) {
+    __m512d p = broadcast_avx512(phase);
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m512d v = _mm512_loadu_pd((double*)(a + j));
+        _mm512_storeu_pd((double*)(a + j), cmul_avx512(p, v));
+    }
+    phase_span_avx2(a + j, len - j, phase);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void dense_span_avx512(ComplexNum* base, const size_t* offsets, int dim, const ComplexNum* m, size_t len) {
+    __m512d in[1 << MAX_FUSED_QUBITS];
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = _mm512_loadu_pd((double*)(base + offsets[c] + j));
+        }
+        for (int r = 0; r < dim; r++) {
+            const ComplexNum* row = m + (size_t)r * dim;
+            __m512d sum = _mm512_setzero_pd();
+            for (int c = 0; c < dim; c++) {
+                __m512d coefficient = _mm512_broadcast_f64x4(
+                    _mm256_broadcast_pd((const __m128d*)(row + c)));
+                sum = _mm512_add_pd(sum, cmul_avx512(coefficient, in[c]));
+            }
+            _mm512_storeu_pd((double*)(base + offsets[r] + j), sum);
+        }
+    }
+    dense_span_avx2(base + j, offsets, dim, m, len - j);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void product_span_avx512(ComplexNum* out, const ComplexNum* x, const ComplexNum* y, size_t len) {
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m512d v = _mm512_loadu_pd((const double*)(x + j));
+        __m512d w = _mm512_loadu_pd((const double*)(y + j));
+        _mm512_storeu_pd((double*)(out + j), cmul_avx512(v, w));
+    }
+    product_span_avx2(out + j, x + j, y + j, len - j);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void matrix_lanes_avx512(ComplexNum* a, ComplexNum* b, size_t rows, size_t width, const ComplexNum* m,
+                                size_t stride) {
+    size_t j = 0;
+    for (; j + 4 <= width; j += 4) {
+        __m512d m00 = _mm512_loadu_pd((const double*)(m + j));
+        __m512d m01 = _mm512_loadu_pd((const double*)(m + stride + j));
+        __m512d m10 = _mm512_loadu_pd((const double*)(m + 2 * stride + j));
+        __m512d m11 = _mm512_loadu_pd((const double*)(m + 3 * stride + j));
+        for (size_t i = 0; i < rows; i++) {
+            double* pa = (double*)(a + i * stride + j);
+            double* pb = (double*)(b + i * stride + j);
+            __m512d a0 = _mm512_loadu_pd(pa);
+            __m512d a1 = _mm512_loadu_pd(pb);
+            _mm512_storeu_pd(pa, _mm512_add_pd(cmul_avx512(m00, a0), cmul_avx512(m01, a1)));
+            _mm512_storeu_pd(pb, _mm512_add_pd(cmul_avx512(m10, a0), cmul_avx512(m11, a1)));
+        }
+    }
+    if (j < width) {
+        matrix_lanes_avx2(a + j, b + j, rows, width - j, m + j, stride);
+    }
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void phase_lanes_avx512(ComplexNum* a, size_t rows, size_t width, const ComplexNum* phases,
+                               size_t stride) {
+    size_t j = 0;
+    for (; j + 4 <= width; j += 4) {
+        __m512d p = _mm512_loadu_pd((const double*)(phases + j));
+        for (size_t i = 0; i < rows; i++) {
+            double* pa = (double*)(a + i * stride + j);
+            _mm512_storeu_pd(pa, cmul_avx512(p, _mm512_loadu_pd(pa)));
+        }
+    }
+    if (j < width) {
+        phase_lanes_avx2(a + j, rows, width - j, phases + j, stride);
+    }
+}
+
+static const KernelTable avx512_table = {
+    matrix_span_avx512, matrix_adjacent_avx512, phase_span_avx512, dense_span_avx512, dense_group_avx2,
+    product_span_avx512, matrix_lanes_avx512, phase_lanes_avx512
+};
+
+// ---------------------------------------------------------------------------
+// AVX-512 single precision kernels: eight interleaved complex floats per register
+// ---------------------------------------------------------------------------
+
+__attribute__((target("avx512f")))
+static inline __m512 cmul_avx512_single(__m512 x, __m512 y) {
+    __m512 x_re = _mm512_moveldup_ps(x);
+    __m512 x_im = _mm512_movehdup_ps(x);
+    __m512 y_swap = _mm512_permute_ps(y, 0xB1);
+    return _mm512_fmaddsub_ps(x_re, y, _mm512_mul_ps(x_im, y_swap));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 broadcast_avx512_single(ComplexFloat z) {
+    return _mm512_castpd_ps(_mm512_broadcastsd_pd(_mm_castps_pd(_mm_setr_ps(crealf(z), cimagf(z), 0, 0))));
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void matrix_span_avx512_single(ComplexFloat* a, ComplexFloat* b, size_t len, const ComplexFloat m[2][2]) {
+    __m512 m00 = broadcast_avx512_single(m[0][0]), m01 = broadcast_avx512_single(m[0][1]);
+    __m512 m10 = broadcast_avx512_single(m[1][0]), m11 = broadcast_avx512_single(m[1][1]);
+    size_t j = 0;
+    for (; j + 8 <= len; j += 8) {
+        __m512 a0 = _mm512_loadu_ps((float*)(a + j));
+        __m512 a1 = _mm512_loadu_ps((float*)(b + j));
+        __m512 r0 = _mm512_add_ps(cmul_avx512_single(m00, a0), cmul_avx512_single(m01, a1));
+        __m512 r1 = _mm512_add_ps(cmul_avx512_single(m10, a0), cmul_avx512_single(m11, a1));
+        _mm512_storeu_ps((float*)(a + j), r0);
+        _mm512_storeu_ps((float*)(b + j), r1);
+    }
+    matrix_span_avx2_single(a + j, b + j, len - j, m);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void matrix_adjacent_avx512_single(ComplexFloat* a, size_t len, const ComplexFloat m[2][2]) {
+    __m512 c0 = _mm512_castpd_ps(_mm512_broadcast_f64x4(_mm256_castps_pd(
+        _mm256_setr_ps(crealf(m[0][0]), cimagf(m[0][0]), crealf(m[1][0]), cimagf(m[1][0]),
+                       crealf(m[0][0]), cimagf(m[0][0]), crealf(m[1][0]), cimagf(m[1][0])))));
+    __m512 c1 = _mm512_castpd_ps(_mm512_broadcast_f64x4(_mm256_castps_pd(
+        _mm256_setr_ps(crealf(m[0][1]), cimagf(m[0][1]), crealf(m[1][1]), cimagf(m[1][1]),
+                       crealf(m[0][1]), cimagf(m[0][1]), crealf(m[1][1]), cimagf(m[1][1])))));
+    size_t j = 0;
+    for (; j + 4 <= len; j += 4) {
+        __m512 v = _mm512_loadu_ps((float*)(a + 2 * j));
+        __m512 v0 = _mm512_permute_ps(v, 0x44);  // (a0, a0) in each pair lane
+        __m512 v1 = _mm512_permute_ps(v, 0xEE);  // (a1, a1) in each pair lane
+        __m512 r = _mm512_add_ps(cmul_avx512_single(c0, v0), cmul_avx512_single(c1, v1));
+        _mm512_storeu_ps((float*)(a + 2 * j), r);
+    }
+    matrix_adjacent_avx2_single(a + 2 * j, len - j, m);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void phase_span_avx512_single(ComplexFloat* a, size_t len, ComplexFloat phase) {
+    __m512 p = broadcast_avx512_single(phase);
+    size_t j = 0;
+    for (; j + 8 <= len; j += 8) {
+        __m512 v = _mm512_loadu_ps((float*)(a + j));
+        _mm512_storeu_ps((float*)(a + j), cmul_avx512_single(p, v));
+    }
+    phase_span_avx2_single(a + j, len - j, phase);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void dense_span_avx512_single(ComplexFloat* base, const size_t* offsets, int dim, const ComplexFloat* m,
+                                     size_t len) {
+    __m512 in[1 << MAX_FUSED_QUBITS];
+    size_t j = 0;
+    for (; j + 8 <= len; j += 8) {
+        for (int c = 0; c < dim; c++) {
+            in[c] = _mm512_loadu_ps((float*)(base + offsets[c] + j));
+        }
+        for (int r = 0; r < dim; r++) {
+            const ComplexFloat* row = m + (size_t)r * dim;
+            __m512 sum = _mm512_setzero_ps();
+            for (int c = 0; c < dim; c++) {
+                __m512 coefficient = _mm512_castpd_ps(_mm512_broadcastsd_pd(_mm_load_sd((const double*)(row + c))));
+                sum = _mm512_add_ps(sum, cmul_avx512_single(coefficient, in[c]));
+            }
+            _mm512_storeu_ps((float*)(base + offsets[r] + j), sum);
+        }
+    }
+    dense_span_avx2_single(base + j, offsets, dim, m, len - j);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void product_span_avx512_single(ComplexFloat* out, const ComplexFloat* x, const ComplexFloat* y,
+                                       size_t len) {
+    size_t j = 0;
+    for (; j + 8 <= len; j += 8) {
+        __m512 v = _mm512_loadu_ps((const float*)(x + j));
+        __m512 w = _mm512_loadu_ps((const float*)(y + j));
+        _mm512_storeu_ps((float*)(out + j), cmul_avx512_single(v, w));
+    }
+    product_span_avx2_single(out + j, x + j, y + j, len - j);
+}
+
+static const SingleKernelTable avx512_single_table = {
+    matrix_span_avx512_single, matrix_adjacent_avx512_single, phase_span_avx512_single,
+    dense_span_avx512_single, dense_group_scalar_single, product_span_avx512_single
+};
+
+#endif /* KERNELS_X86_SIMD */
+
+// ---------------------------------------------------------------------------
+// Runtime dispatch
+// ---------------------------------------------------------------------------
+
+static KernelIsa detect_isa(void) {
+    KernelIsa best = ISA_SCALAR;
+#ifdef KERNELS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        best = ISA_AVX2;
+    }
+    if (best == ISA_AVX2 && __builtin_cpu_supports("avx512f")) {
+        best = ISA_AVX512;
+    }
+#endif
+
+    // QSIM_SIMD=scalar|avx2|avx512 can lower the selection (never raise it)
+    const char* requested = getenv("QSIM_SIMD");
+    if (requested) {
+        if (strcmp(requested, "scalar") == 0) best = ISA_SCALAR;
+        else if (strcmp(requested, "avx2") == 0 && best > ISA_AVX2) best = ISA_AVX2;
+    }
+    return best;
+}
+
+// Detected on first use; pool workers can start the first sweep together
+static pthread_once_t isa_once = PTHREAD_ONCE_INIT;
+static KernelIsa isa;
+
+static void init_isa(void) {
+    isa = detect_isa();
+}
+
+static KernelIsa selected_isa(void) {
+    pthread_once(&isa_once, init_isa);
+    return isa;
+}
+
+static const KernelTable* kernels(void) {
+#ifdef KERNELS_X86_SIMD
+    switch (selected_isa()) {
+        case ISA_AVX512: return &avx512_table;
+        case ISA_AVX2:   return &avx2_table;
+        default:         break;
+    }
+#endif
+    return &scalar_table;
+}
+
+static const SingleKernelTable* single_kernels(void) {
+#ifdef KERNELS_X86_SIMD
+    switch (selected_isa()) {
+        case ISA_AVX512: return &avx512_single_table;
+        case ISA_AVX2:   return &avx2_single_table;
+        default:         break;
+    }
+#endif
+    return &scalar_single_table;
+}
+
+const char* kernel_isa_name(void) {
+    switch (selected_isa()) {
+        case ISA_AVX512: return "avx512";
+        case ISA_AVX2:   return "avx2";
+        default:         return "scalar";
+    }
+}
+
+void kernel_apply_matrix(ComplexNum* amplitudes, const IndexPattern* pattern, size_t target_mask,
+                         const ComplexNum matrix[2][2], size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+
+    if (target_mask == 1) {
+        // Pair members are neighbours; runs of base indices map to runs of pairs
+        for (size_t k = begin; k < end; ) {
+            size_t len = contiguous_run(pattern, 1, k, end);
+            table->matrix_adjacent(amplitudes + pattern_index(pattern, k), len, matrix);
+            k += len;
+        }
+        return;
+    }
+
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        size_t i0 = pattern_index(pattern, k);
+        table->matrix_span(amplitudes + i0, amplitudes + (i0 | target_mask), len, matrix);
+        k += len;
+    }
+}
+
+void kernel_apply_phase(ComplexNum* amplitudes, const IndexPattern* pattern, ComplexNum phase,
+                        size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        table->phase_span(amplitudes + pattern_index(pattern, k), len, phase);
+        k += len;
+    }
+}
+
+void kernel_swap(ComplexNum* amplitudes, const IndexPattern* pattern, size_t swap_mask,
+                 size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        size_t i = pattern_index(pattern, k);
+        ComplexNum* a = amplitudes + i;
+        ComplexNum* b = amplitudes + (i ^ swap_mask);
+        for (size_t j = 0; j < len; j++) {
+            ComplexNum temp = a[j];
+            a[j] = b[j];
+            b[j] = temp;
+        }
+        k += len;
+    }
+}
+
+void kernel_apply_dense(ComplexNum* amplitudes, const IndexPattern* pattern, const size_t* offsets,
+                        int dim, const ComplexNum* matrix, size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+
+    // Long contiguous runs vectorize across neighbouring groups
+    if (pattern->fixed_qubits[0] >= 2) {
+        for (size_t k = begin; k < end; ) {
+            size_t len = contiguous_run(pattern, 0, k, end);
+            table->dense_span(amplitudes + pattern_index(pattern, k), offsets, dim, matrix, len);
+            k += len;
+        }
+        return;
+    }
+
+    // Otherwise vectorize each group across matrix rows, reading the matrix by columns
+    ComplexNum transposed[1 << (2 * MAX_FUSED_QUBITS)];
+    for (int r = 0; r < dim; r++) {
+        for (int c = 0; c < dim; c++) {
+            transposed[(size_t)c * dim + r] = matrix[(size_t)r * dim + c];
+        }
+    }
+    int skip = 0;
+    while (skip < pattern->num_fixed && pattern->fixed_qubits[skip] == skip) {
+        skip++;
+    }
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, skip, k, end);
+        table->dense_group(amplitudes + pattern_index(pattern, k), offsets, dim, transposed,
+                           len, (size_t)1 << skip);
+        k += len;
+    }
+}
+
+void kernel_multiply(ComplexNum* out, const ComplexNum* x, const ComplexNum* y, size_t len) {
+    kernels()->product_span(out, x, y, len);
+}
+
+double kernel_norm_squared(const ComplexNum* amplitudes, const IndexPattern* pattern, size_t begin, size_t end) {
+    double sum = 0.0;
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        const double* a = (const double*)(amplitudes + pattern_index(pattern, k));
+        for (size_t j = 0; j < 2 * len; j++) {
+            sum += a[j] * a[j];
+        }
+        k += len;
+    }
+    return sum;
+}
+
+// ---------------------------------------------------------------------------
+// Row entry points for batched states
+// ---------------------------------------------------------------------------
+
+// Consecutive base indices whose rows are consecutive form one span of
+// len * lanes amplitudes, so shared-matrix gates run as on a wide state vector
+void kernel_apply_matrix_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, size_t target_mask,
+                              const ComplexNum matrix[2][2], size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        size_t i0 = pattern_index(pattern, k);
+        table->matrix_span(rows + i0 * lanes, rows + (i0 | target_mask) * lanes, len * lanes, matrix);
+        k += len;
+    }
+}
+
+void kernel_apply_lane_matrices_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern,
+                                     size_t target_mask, const ComplexNum* lane_matrices,
+                                     size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        ComplexNum* a = rows + pattern_index(pattern, k) * lanes;
+        table->matrix_lanes(a, a + target_mask * lanes, len, lanes, lane_matrices, lanes);
+        k += len;
+    }
+}
+
+void kernel_apply_phase_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, ComplexNum phase,
+                             size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        table->phase_span(rows + pattern_index(pattern, k) * lanes, len * lanes, phase);
+        k += len;
+    }
+}
+
+void kernel_apply_lane_phases_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern,
+                                   const ComplexNum* phases, size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        table->phase_lanes(rows + pattern_index(pattern, k) * lanes, len, lanes, phases, lanes);
+        k += len;
+    }
+}
+
+void kernel_swap_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, size_t swap_mask,
+                      size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        size_t i = pattern_index(pattern, k);
+        ComplexNum* a = rows + i * lanes;
+        ComplexNum* b = rows + (i ^ swap_mask) * lanes;
+        for (size_t j = 0; j < len * lanes; j++) {
+            ComplexNum temp = a[j];
+            a[j] = b[j];
+            b[j] = temp;
+        }
+        k += len;
+    }
+}
+
+void kernel_apply_dense_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, const size_t* offsets,
+                             int dim, const ComplexNum* matrix, size_t begin, size_t end) {
+    const KernelTable* table = kernels();
+    size_t scaled[1 << MAX_FUSED_QUBITS];
+    for (int l = 0; l < dim; l++) {
+        scaled[l] = offsets[l] * lanes;
+    }
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        table->dense_span(rows + pattern_index(pattern, k) * lanes, scaled, dim, matrix, len * lanes);
+        k += len;
+    }
+}
+
+// Dense gates with a matrix per lane are rare (fused blocks of swept
+// circuits), so they take the scalar path
+void kernel_apply_lane_dense_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern,
+                                  const size_t* offsets, int dim, const ComplexNum* lane_matrices,
+                                  size_t begin, size_t end) {
+    ComplexNum in[1 << MAX_FUSED_QUBITS];
+    for (size_t k = begin; k < end; k++) {
+        ComplexNum* base = rows + pattern_index(pattern, k) * lanes;
+        for (size_t j = 0; j < lanes; j++) {
+            for (int c = 0; c < dim; c++) {
+                in[c] = base[offsets[c] * lanes + j];
+            }
+            for (int r = 0; r < dim; r++) {
+                const ComplexNum* row = lane_matrices + (size_t)r * dim * lanes + j;
+                ComplexNum sum = 0;
+                for (int c = 0; c < dim; c++) {
+                    sum += cmul(row[(size_t)c * lanes], in[c]);
+                }
+                base[offsets[r] * lanes + j] = sum;
+            }
+        }
+    }
+}
+
+void kernel_norm_squared_rows(const ComplexNum* rows, size_t lanes, const IndexPattern* pattern, double* sums,
+                              size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        const double* a = (const double*)(rows + pattern_index(pattern, k) * lanes);
+        for (size_t r = 0; r < len; r++, a += 2 * lanes) {
+            for (size_t j = 0; j < lanes; j++) {
+                sums[j] += a[2 * j] * a[2 * j] + a[2 * j + 1] * a[2 * j + 1];
+            }
+        }
+        k += len;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Single precision entry points
+// ---------------------------------------------------------------------------
+
+static void narrow_matrix(ComplexFloat out[2][2], const ComplexNum matrix[2][2]) {
+    for (int r = 0; r < 2; r++) {
+        for (int c = 0; c < 2; c++) {
+            out[r][c] = (ComplexFloat)matrix[r][c];
+        }
+    }
+}
+
+void kernel_apply_matrix_single(ComplexFloat* amplitudes, const IndexPattern* pattern, size_t target_mask,
+                                const ComplexNum matrix[2][2], size_t begin, size_t end) {
+    const SingleKernelTable* table = single_kernels();
+    ComplexFloat m[2][2];
+    narrow_matrix(m, matrix);
+
+    if (target_mask == 1) {
+        for (size_t k = begin; k < end; ) {
+            size_t len = contiguous_run(pattern, 1, k, end);
+            table->matrix_adjacent(amplitudes + pattern_index(pattern, k), len, m);
+            k += len;
+        }
+        return;
+    }
+
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        size_t i0 = pattern_index(pattern, k);
+        table->matrix_span(amplitudes + i0, amplitudes + (i0 | target_mask), len, m);
+        k += len;
+    }
+}
+
+void kernel_apply_phase_single(ComplexFloat* amplitudes, const IndexPattern* pattern, ComplexNum phase,
+                               size_t begin, size_t end) {
+    const SingleKernelTable* table = single_kernels();
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        table->phase_span(amplitudes + pattern_index(pattern, k), len, (ComplexFloat)phase);
+        k += len;
+    }
+}
+
+void kernel_swap_single(ComplexFloat* amplitudes, const IndexPattern* pattern, size_t swap_mask,
+                        size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        size_t i = pattern_index(pattern, k);
+        ComplexFloat* a = amplitudes + i;
+        ComplexFloat* b = amplitudes + (i ^ swap_mask);
+        for (size_t j = 0; j < len; j++) {
+            ComplexFloat temp = a[j];
+            a[j] = b[j];
+            b[j] = temp;
+        }
+        k += len;
+    }
+}
+
+void kernel_apply_dense_single(ComplexFloat* amplitudes, const IndexPattern* pattern, const size_t* offsets,
+                               int dim, const ComplexNum* matrix, size_t begin, size_t end) {
+    const SingleKernelTable* table = single_kernels();
+
+    // Rounded once per call; the transposed layout serves the dense_group path
+    ComplexFloat m[1 << (2 * MAX_FUSED_QUBITS)];
+    bool transpose = pattern->fixed_qubits[0] < 2;
+    for (int r = 0; r < dim; r++) {
+        for (int c = 0; c < dim; c++) {
+            size_t at = transpose ? (size_t)c * dim + r : (size_t)r * dim + c;
+            m[at] = (ComplexFloat)matrix[(size_t)r * dim + c];
+        }
+    }
+
+    if (!transpose) {
+        for (size_t k = begin; k < end; ) {
+            size_t len = contiguous_run(pattern, 0, k, end);
+            table->dense_span(amplitudes + pattern_index(pattern, k), offsets, dim, m, len);
+            k += len;
+        }
+        return;
+    }
+
+    int skip = 0;
+    while (skip < pattern->num_fixed && pattern->fixed_qubits[skip] == skip) {
+        skip++;
+    }
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, skip, k, end);
+        table->dense_group(amplitudes + pattern_index(pattern, k), offsets, dim, m, len, (size_t)1 << skip);
+        k += len;
+    }
+}
+
+void kernel_multiply_single(ComplexFloat* out, const ComplexFloat* x, const ComplexFloat* y, size_t len) {
+    single_kernels()->product_span(out, x, y, len);
+}
+
+double kernel_norm_squared_single(const ComplexFloat* amplitudes, const IndexPattern* pattern,
+                                  size_t begin, size_t end) {
+    double sum = 0.0;
+    for (size_t k = begin; k < end; ) {
+        size_t len = contiguous_run(pattern, 0, k, end);
+        const float* a = (const float*)(amplitudes + pattern_index(pattern, k));
+        for (size_t j = 0; j < 2 * len; j++) {
+            sum += (double)a[j] * a[j];
+        }
+        k += len;
+    }
+    return sum;
+}
@@ -0,0 +1,92 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include "quantum.h"
+
+// Describes the base indices visited by a gate sweep.
+// The k-th base index is k with a zero bit inserted at every fixed qubit,
+// OR'd with set_mask (e.g. control bits that must be 1).
+typedef struct {
+    int fixed_qubits[MAX_QUBITS];  // sorted ascending
+    int num_fixed;
+    size_t set_mask;
+    size_t count;                  // number of base indices
+} IndexPattern;
+
+void make_index_pattern(IndexPattern* pattern, int num_qubits, size_t fixed_mask, size_t set_mask);
+
+static inline size_t pattern_index(const IndexPattern* pattern, size_t k) {
+    for (int f = 0; f < pattern->num_fixed; f++) {
+        size_t low = k & (((size_t)1 << pattern->fixed_qubits[f]) - 1);
+        k = ((k ^ low) << 1) | low;
+    }
+    return k | pattern->set_mask;
+}
+
+// Applies a 2x2 matrix to the pairs (i, i|target_mask) for base indices [begin, end)
+void kernel_apply_matrix(ComplexNum* amplitudes, const IndexPattern* pattern, size_t target_mask,
+                         const ComplexNum matrix[2][2], size_t begin, size_t end);
+
+// Multiplies the amplitudes at base indices [begin, end) by phase
+void kernel_apply_phase(ComplexNum* amplitudes, const IndexPattern* pattern, ComplexNum phase,
+                        size_t begin, size_t end);
+
+// Exchanges the amplitudes at i and i^swap_mask for base indices [begin, end)
+void kernel_swap(ComplexNum* amplitudes, const IndexPattern* pattern, size_t swap_mask,
+                 size_t begin, size_t end);
+
+// Applies a dense dim x dim matrix (row-major) to the amplitudes at
+// base + offsets[0..dim) for base indices [begin, end)
+void kernel_apply_dense(ComplexNum* amplitudes, const IndexPattern* pattern, const size_t* offsets,
+                        int dim, const ComplexNum* matrix, size_t begin, size_t end);
+
+// out[j] = x[j] * y[j] for j < len; out may alias x
+void kernel_multiply(ComplexNum* out, const ComplexNum* x, const ComplexNum* y, size_t len);
+
+// Returns the sum of |a_i|^2 over base indices [begin, end)
+double kernel_norm_squared(const ComplexNum* amplitudes, const IndexPattern* pattern, size_t begin, size_t end);
+
+// Row versions for batched states (see batched.h), which store row i, the
+// amplitude i of each of lanes instances, at rows + i * lanes. Base indices,
+// masks and offsets count rows. Lane j of a per-lane matrix has entry (r, c)
+// at lane_matrices[(r * dim + c) * lanes + j] (dim = 2 for 2x2 matrices).
+void kernel_apply_matrix_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, size_t target_mask,
+                              const ComplexNum matrix[2][2], size_t begin, size_t end);
+void kernel_apply_lane_matrices_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern,
+                                     size_t target_mask, const ComplexNum* lane_matrices,
+                                     size_t begin, size_t end);
+void kernel_apply_phase_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, ComplexNum phase,
+                             size_t begin, size_t end);
+// Multiplies lane j of each row by phases[j]
+void kernel_apply_lane_phases_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern,
+                                   const ComplexNum* phases, size_t begin, size_t end);
+void kernel_swap_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, size_t swap_mask,
+                      size_t begin, size_t end);
+void kernel_apply_dense_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern, const size_t* offsets,
+                             int dim, const ComplexNum* matrix, size_t begin, size_t end);
+void kernel_apply_lane_dense_rows(ComplexNum* rows, size_t lanes, const IndexPattern* pattern,
+                                  const size_t* offsets, int dim, const ComplexNum* lane_matrices,
+                                  size_t begin, size_t end);
+// Adds the |a|^2 of lane j over the rows to sums[j]
+void kernel_norm_squared_rows(const ComplexNum* rows, size_t lanes, const IndexPattern* pattern, double* sums,
+                              size_t begin, size_t end);
+
+// Single precision versions of the kernels above. Matrices and phases are
+// given in double precision and rounded once per call; sums accumulate in double.
+void kernel_apply_matrix_single(ComplexFloat* amplitudes, const IndexPattern* pattern, size_t target_mask,
+                                const ComplexNum matrix[2][2], size_t begin, size_t end);
+void kernel_apply_phase_single(ComplexFloat* amplitudes, const IndexPattern* pattern, ComplexNum phase,
+                               size_t begin, size_t end);
+void kernel_swap_single(ComplexFloat* amplitudes, const IndexPattern* pattern, size_t swap_mask,
+                        size_t begin, size_t end);
+void kernel_apply_dense_single(ComplexFloat* amplitudes, const IndexPattern* pattern, const size_t* offsets,
+                               int dim, const ComplexNum* matrix, size_t begin, size_t end);
+void kernel_multiply_single(ComplexFloat* out, const ComplexFloat* x, const ComplexFloat* y, size_t len);
+double kernel_norm_squared_single(const ComplexFloat* amplitudes, const IndexPattern* pattern,
+                                  size_t begin, size_t end);
+
+// Name of the instruction set selected at runtime ("avx512", "avx2" or "scalar")
+const char* kernel_isa_name(void);
+
+#endif /* KERNELS_H */
@@ -3,18 +3,37 @@
 #include <time.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
 #include "quantum.h"
+#include "batched.h"
+#include "circuit.h"
+#include "qasm.h"
+#include "mps.h"
+#include "noise.h"
+#include "observable.h"
+#include "outofcore.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "sparse.h"
+#include "stabilizer.h"
+#ifdef QSIM_WITH_MPI
+#include "distributed.h"
+#endif
 
 #define PI 3.14159265358979323846
 #define MAX_INPUT 100
+#define DEFAULT_SHOTS 1024
+#define AMPLITUDE_CUTOFF 1e-12
+#define PHASE_SWEEP_BITS 5
 
 void print_state(QuantumState* state) {
     printf("Quantum State:\n");
-    for (int i = 0; i < state->state_size; i++) {
-        if (cabs(state->amplitudes[i]) > 0.001) {
-            printf("|%d>: %.3f + %.3fi\n", i, 
-                   creal(state->amplitudes[i]), 
-                   cimag(state->amplitudes[i]));
+    for (size_t i = 0; i < state->state_size; i++) {
+        ComplexNum amplitude = get_amplitude(state, i);
+        if (cabs(amplitude) > 0.001) {
+            printf("|%zu>: %.3f + %.3fi\n", i, 
+                   creal(amplitude), 
+                   cimag(amplitude));
         }
     }
     printf("\n");
@@ -95,32 +114,52 @@ void interactive_grovers_search() {
     }
     
     int max_state = 1 << num_qubits;
-    int marked_state;
-    
-    printf("Enter state to search for (0-%d): ", max_state-1);
-    scanf("%d", &marked_state);
-    clear_input_buffer();
+    size_t marked_states[16];
+    size_t num_marked = 0;
+    char line[256];
+    
+    printf("Enter states to search for (0-%d, separated by spaces): ", max_state-1);
+    if (fgets(line, sizeof(line), stdin)) {
+        char* cursor = line;
+        char* end;
+        for (long value = strtol(cursor, &end, 10); end != cursor && num_marked < (size_t)max_state / 2;
+             value = strtol(cursor, &end, 10)) {
+            cursor = end;
+            bool duplicate = false;
+            for (size_t m = 0; m < num_marked; m++) {
+                duplicate = duplicate || marked_states[m] == (size_t)value;
+            }
+            if (value < 0 || value >= max_state) {
+                printf("Ignoring invalid state %ld.\n", value);
+            } else if (!duplicate) {
+                marked_states[num_marked++] = value;
+            }
+        }
+    }
     
-    if (marked_state < 0 || marked_state >= max_state) {
-        printf("Invalid state. Using state |0>.\n");
-        marked_state = 0;
+    if (num_marked == 0) {
+        printf("No valid state. Using state |0>.\n");
+        marked_states[num_marked++] = 0;
     }
     
     QuantumState* state = create_quantum_state(num_qubits);
-    printf("\nSearching for state |%d>:\n", marked_state);
+    printf("\nSearching for state%s", num_marked > 1 ? "s" : "");
+    for (size_t m = 0; m < num_marked; m++) {
+        printf(" |%zu>", marked_states[m]);
+    }
+    printf(" (%zu iterations):\n", grover_iterations(num_qubits, num_marked));
     
-    grover_search(state, marked_state);
+    grover_search_oracle(state, &(GroverOracle){ .marked_states = marked_states, .num_marked = num_marked });
     
     printf("After Grover's algorithm:\n");
     print_state(state);
     
     printf("Measuring state...\n");
-    int result = 0;
-    for (int i = 0; i < num_qubits; i++) {
-        int bit = measure_qubit(state, i);
-        result |= (bit << i);
+    ShotHistogram histogram;
+    if (sample_shots(state, 1, NULL, num_qubits, &histogram)) {
+        printf("Final measurement: |%zu>\n", histogram.counts[0].outcome);
+        free_shot_histogram(&histogram);
     }
-    printf("Final measurement: |%d>\n", result);
     
     destroy_quantum_state(state);
 }
@@ -249,7 +288,7 @@ void interactive_quantum_teleportation() {
         case 4: {
             double angle;
             printf("Enter rotation angle (0-360 degrees): ");
-            scanf("%f", &angle);
+            scanf("%lf", &angle);
             clear_input_buffer();
             apply_rotation_y(source, 0, angle * PI / 180.0);
             break;
@@ -261,7 +300,7 @@ void interactive_quantum_teleportation() {
     
     // Perform teleportation
     printf("\nPerforming quantum teleportation...\n");
-    quantum_teleportation(source, target, 0, 0);
+    quantum_teleportation(source, target, 0, 1);
     
     printf("\nFinal target state:\n");
     print_state(target);
@@ -270,6 +309,56 @@ void interactive_quantum_teleportation() {
     destroy_quantum_state(target);
 }
 
+// One run of the 3-qubit bit flip code with independent flips of probability
+// p on every qubit; counts 1 when the decoded value is wrong
+typedef struct {
+    int logical;
+    double probability;
+} CodeTrial;
+
+size_t error_correction_trial(QuantumState* state, void* ctx) {
+    const CodeTrial* trial = ctx;
+    apply_error_correction_encoding(state, 0);
+    for (int q = 0; q < 3; q++) {
+        apply_noise_channel(state, NOISE_BIT_FLIP, q, trial->probability);
+    }
+    int syndrome[2];
+    apply_error_correction_syndrome(state, 0, syndrome);
+    apply_error_correction_recovery(state, 0, syndrome);
+    return measure_qubit(state, 0) != trial->logical;
+}
+
+void interactive_logical_error_rate(int logical) {
+    CodeTrial trial = { logical, 0.1 };
+    printf("Enter bit flip probability per qubit (0-1): ");
+    if (scanf("%lf", &trial.probability) != 1 || !(trial.probability >= 0.0 && trial.probability <= 1.0)) {
+        printf("Invalid probability. Using 0.1.\n");
+        trial.probability = 0.1;
+    }
+    clear_input_buffer();
+
+    QuantumState* state = create_quantum_state(3);
+    if (logical) {
+        apply_pauli_x(state, 0);
+    }
+    uint64_t trials = 100000;
+    ShotHistogram histogram;
+    if (run_trajectories(state, trials, error_correction_trial, &trial, &histogram)) {
+        uint64_t failures = 0;
+        for (size_t i = 0; i < histogram.num_outcomes; i++) {
+            failures += histogram.counts[i].outcome ? histogram.counts[i].count : 0;
+        }
+        double rate = (double)failures / trials;
+        double p = trial.probability;
+        printf("\nLogical |%d> over %llu noisy runs:\n", logical, (unsigned long long)trials);
+        printf("Physical error rate: %.4f\n", p);
+        printf("Logical error rate:  %.4f +- %.4f (expected 3p^2 - 2p^3 = %.4f)\n",
+               rate, sqrt(rate * (1.0 - rate) / trials), 3 * p * p - 2 * p * p * p);
+        free_shot_histogram(&histogram);
+    }
+    destroy_quantum_state(state);
+}
+
 void interactive_error_correction() {
     printf("\n=== Quantum Error Correction ===\n");
     QuantumState* state = create_quantum_state(3);
@@ -308,11 +397,23 @@ void interactive_error_correction() {
     printf("2. Bit flip on qubit 1\n");
     printf("3. Bit flip on qubit 2\n");
     printf("4. Bit flip on qubit 3\n");
+    printf("5. Random bit flips on every qubit (estimate the logical error rate)\n");
     
-    printf("Choose error type (1-4): ");
+    int initial = choice;
+    printf("Choose error type (1-5): ");
     scanf("%d", &choice);
     clear_input_buffer();
     
+    if (choice == 5) {
+        // The syndrome measurement collapses superpositions, so errors are counted on a basis state
+        if (initial == 3) {
+            printf("The syndrome measurement collapses |+>; counting logical errors on |0> instead.\n");
+        }
+        interactive_logical_error_rate(initial == 2);
+        destroy_quantum_state(state);
+        return;
+    }
+    
     if (choice > 1 && choice <= 4) {
         apply_pauli_x(state, choice - 2);
     }
@@ -396,6 +497,44 @@ void interactive_quantum_walk() {
     destroy_quantum_state(state);
 }
 
+// Estimates count evenly spaced phases, one instance of a batched state each,
+// and prints the most likely readout of every instance
+void phase_estimation_sweep(int count) {
+    int num_qubits = 2 * PHASE_SWEEP_BITS;
+    int target_qubit = num_qubits - 1;
+    BatchedState* batch = create_batched_state(num_qubits, count);
+    Circuit** circuits = calloc(count, sizeof(Circuit*));
+    bool ok = batch && circuits;
+    for (int b = 0; ok && b < count; b++) {
+        circuits[b] = build_phase_estimation_circuit(num_qubits, 2 * PI * b / count);
+        ok = circuits[b] != NULL;
+    }
+    ok = ok && execute_circuits_batched((const Circuit* const*)circuits, batch, NULL);
+
+    for (int b = 0; ok && b < count; b++) {
+        size_t best = 0;
+        double best_probability = 0.0;
+        for (size_t k = 0; k < ((size_t)1 << PHASE_SWEEP_BITS); k++) {
+            ComplexNum amplitude = batched_amplitude(batch, b, k | ((size_t)1 << target_qubit));
+            double probability = creal(amplitude * conj(amplitude));
+            if (probability > best_probability) {
+                best = k;
+                best_probability = probability;
+            }
+        }
+        printf("Phase %.4f: estimate %.4f (probability %.3f)\n", (double)b / count,
+               (double)best / (1 << PHASE_SWEEP_BITS), best_probability);
+    }
+
+    for (int b = 0; circuits && b < count; b++) {
+        if (circuits[b]) {
+            destroy_circuit(circuits[b]);
+        }
+    }
+    free(circuits);
+    destroy_batched_state(batch);
+}
+
 void interactive_phase_estimation() {
     printf("\n=== Quantum Phase Estimation ===\n");
     
@@ -419,6 +558,16 @@ void interactive_phase_estimation() {
     print_state(state);
     
     destroy_quantum_state(state);
+
+    int sweep;
+    printf("\nPhases to sweep over [0, 1) in one batched run (0 to skip): ");
+    if (scanf("%d", &sweep) != 1) {
+        sweep = 0;
+    }
+    clear_input_buffer();
+    if (sweep > 0) {
+        phase_estimation_sweep(sweep);
+    }
 }
 
 void interactive_shor() {
@@ -451,6 +600,875 @@ void interactive_shor() {
     destroy_quantum_state(state);
 }
 
+// Options for running an OpenQASM file without the menu
+typedef struct {
+    const char* qasm_path;
+    const char* output_path;   // NULL: stdout
+    const char* load_path;     // snapshot to start from instead of |0>, or NULL
+    const char* save_path;     // snapshot to write the final state to, or NULL
+    const char* out_of_core_dir; // directory for an out-of-core state file, or NULL
+    size_t memory_limit;       // out-of-core buffer bytes; 0: half of the physical memory
+    bool distributed;          // spread the state over the ranks of an MPI job
+    bool fixed_layout;         // distributed: move global targets back after every gate
+    uint64_t shots;
+    bool amplitudes;           // print the final state instead of counts
+    const char** observables;  // Pauli strings whose expectation values are printed instead of counts
+    int num_observables;
+    int fused_qubits;          // 0: no fusion, -1: fuse large states only
+    int local_qubits;          // cache-blocking tile size; 0: off, -1: states larger than the cache
+    Precision precision;
+    Backend backend;
+    int max_bond;              // MPS backend limits
+    double truncation;
+    bool seeded;
+    uint64_t seed;
+    NoiseModel noise;          // each shot becomes a noisy trajectory when it has rules
+    bool profiled;
+    ProfileFormat profile_format;
+} BatchOptions;
+
+void print_usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s                 (interactive menu)\n"
+            "       %s --qasm FILE [options]\n"
+            "Options:\n"
+            "  --shots N                 number of shots for counts (default %d)\n"
+            "  --output counts|amplitudes\n"
+            "                            print measurement counts (default) or the final state\n"
+            "  --expect PAULIS           print the expectation value of a Pauli string such as\n"
+            "                            \"X0 Z1 Y3\" in the final state instead of counts (repeatable)\n"
+            "  -o FILE                   write results to FILE instead of stdout\n"
+            "  --load-state FILE         start from a state snapshot instead of |0> (statevector backend;\n"
+            "                            the snapshot sets the precision)\n"
+            "  --save-state FILE         write the final state to a snapshot FILE\n"
+            "  --out-of-core DIR         keep the state in a file in DIR and run the circuit in passes\n"
+            "                            over it, for states larger than memory (counts or amplitudes)\n"
+            "  --memory-limit MIB        memory for the out-of-core buffers (default half of the RAM)\n"
+            "  --distributed remap|fixed spread the state over the ranks of an MPI job (MPI builds\n"
+            "                            only); gates on global qubits leave them local (remap) or\n"
+            "                            move them back after every gate (fixed)\n"
+            "  --fuse K                  fuse gates into blocks of up to K qubits (0 disables)\n"
+            "  --block L                 apply gates in cache-sized tiles of 2^L amplitudes (0 disables)\n"
+            "  --precision single|double store amplitudes as complex float or double (default %s)\n"
+            "  --backend statevector|stabilizer|mps|sparse\n"
+            "                            simulate with amplitudes (default), a stabilizer tableau\n"
+            "                            (Clifford circuits only, up to %d qubits), a matrix\n"
+            "                            product state (weakly entangled circuits, up to %d qubits)\n"
+            "                            or a sparse amplitude map (few non-zero amplitudes, up to\n"
+            "                            %d qubits; becomes a state vector once it fills up)\n"
+            "  --max-bond N              largest MPS bond dimension (default %d)\n"
+            "  --truncation EPS          weight of singular values one MPS SVD may drop (default %g)\n"
+            "  --noise CHANNEL:P         apply a noise channel to the qubits of every gate; each\n"
+            "                            shot then runs as an independent noisy trajectory.\n"
+            "                            CHANNEL is bitflip, phaseflip, depolarizing or damping\n"
+            "  --layer-noise CHANNEL:P   apply a noise channel to every qubit after each layer of\n"
+            "                            gates on disjoint qubits (both options may be repeated)\n"
+            "  --seed N                  seed the random number generator for reproducible runs\n"
+            "                            (also accepted without --qasm for the interactive menu)\n"
+            "  --profile table|json      print time, sweeps and allocations per operation and\n"
+            "                            target qubit to stderr at exit (as QSIM_PROFILE does)\n",
+            program, program, DEFAULT_SHOTS, DEFAULT_PRECISION == PRECISION_SINGLE ? "single" : "double",
+            MAX_STABILIZER_QUBITS, MAX_MPS_QUBITS, MAX_SPARSE_QUBITS, MPS_DEFAULT_MAX_BOND, MPS_DEFAULT_TRUNCATION);
+}
+
+// Parses CHANNEL:P for --noise and --layer-noise
+bool parse_noise_channel(const char* value, NoiseChannel* channel, double* probability) {
+    static const struct { const char* name; NoiseChannel channel; } channels[] = {
+        { "bitflip", NOISE_BIT_FLIP },
+        { "phaseflip", NOISE_PHASE_FLIP },
+        { "depolarizing", NOISE_DEPOLARIZING },
+        { "damping", NOISE_AMPLITUDE_DAMPING }
+    };
+    const char* colon = strchr(value, ':');
+    for (size_t c = 0; colon && c < sizeof(channels) / sizeof(channels[0]); c++) {
+        if (strlen(channels[c].name) == (size_t)(colon - value) &&
+            strncmp(value, channels[c].name, colon - value) == 0) {
+            char* end;
+            *channel = channels[c].channel;
+            *probability = strtod(colon + 1, &end);
+            if (*end == '\0' && colon[1] != '\0') {
+                return true;
+            }
+        }
+    }
+    fprintf(stderr, "Error: Invalid noise '%s' (expected bitflip, phaseflip, depolarizing or damping:P)\n", value);
+    return false;
+}
+
+bool parse_batch_options(int argc, char** argv, BatchOptions* options) {
+    options->qasm_path = NULL;
+    options->output_path = NULL;
+    options->load_path = NULL;
+    options->save_path = NULL;
+    options->out_of_core_dir = NULL;
+    options->memory_limit = 0;
+    options->distributed = false;
+    options->fixed_layout = false;
+    options->shots = DEFAULT_SHOTS;
+    options->amplitudes = false;
+    options->observables = NULL;
+    options->num_observables = 0;
+    options->fused_qubits = -1;
+    options->local_qubits = -1;
+    options->precision = DEFAULT_PRECISION;
+    options->backend = BACKEND_STATE_VECTOR;
+    options->max_bond = MPS_DEFAULT_MAX_BOND;
+    options->truncation = MPS_DEFAULT_TRUNCATION;
+    options->seeded = false;
+    options->profiled = false;
+    noise_model_init(&options->noise);
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool takes_value = strcmp(arg, "--qasm") == 0 || strcmp(arg, "--shots") == 0 ||
+                           strcmp(arg, "--output") == 0 || strcmp(arg, "-o") == 0 ||
+                           strcmp(arg, "--fuse") == 0 || strcmp(arg, "--block") == 0 ||
+                           strcmp(arg, "--precision") == 0 || strcmp(arg, "--backend") == 0 ||
+                           strcmp(arg, "--max-bond") == 0 || strcmp(arg, "--truncation") == 0 ||
+                           strcmp(arg, "--seed") == 0 || strcmp(arg, "--noise") == 0 ||
+                           strcmp(arg, "--layer-noise") == 0 || strcmp(arg, "--profile") == 0 ||
+                           strcmp(arg, "--expect") == 0 || strcmp(arg, "--load-state") == 0 ||
+                           strcmp(arg, "--save-state") == 0 || strcmp(arg, "--out-of-core") == 0 ||
+                           strcmp(arg, "--memory-limit") == 0 || strcmp(arg, "--distributed") == 0;
+        if (takes_value && !value) {
+            fprintf(stderr, "Error: %s needs a value\n", arg);
+            return false;
+        }
+
+        if (strcmp(arg, "--qasm") == 0) {
+            options->qasm_path = value;
+        } else if (strcmp(arg, "--shots") == 0) {
+            char* end;
+            options->shots = strtoull(value, &end, 10);
+            if (*end != '\0' || options->shots == 0 || value[0] == '-') {
+                fprintf(stderr, "Error: Invalid shot count '%s'\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--output") == 0) {
+            if (strcmp(value, "counts") != 0 && strcmp(value, "amplitudes") != 0) {
+                fprintf(stderr, "Error: --output must be 'counts' or 'amplitudes'\n");
+                return false;
+            }
+            options->amplitudes = strcmp(value, "amplitudes") == 0;
+        } else if (strcmp(arg, "--expect") == 0) {
+            PauliTerm term;
+            const char** observables = realloc(options->observables,
+                                               (options->num_observables + 1) * sizeof(const char*));
+            if (!observables || !parse_pauli_term(value, &term)) {
+                if (observables) {
+                    options->observables = observables;
+                }
+                return false;
+            }
+            options->observables = observables;
+            options->observables[options->num_observables++] = value;
+        } else if (strcmp(arg, "-o") == 0) {
+            options->output_path = value;
+        } else if (strcmp(arg, "--load-state") == 0) {
+            options->load_path = value;
+        } else if (strcmp(arg, "--save-state") == 0) {
+            options->save_path = value;
+        } else if (strcmp(arg, "--out-of-core") == 0) {
+            options->out_of_core_dir = value;
+        } else if (strcmp(arg, "--memory-limit") == 0) {
+            char* end;
+            unsigned long long mebibytes = strtoull(value, &end, 10);
+            if (*end != '\0' || mebibytes == 0 || value[0] == '-') {
+                fprintf(stderr, "Error: Invalid memory limit '%s'\n", value);
+                return false;
+            }
+            options->memory_limit = (size_t)mebibytes << 20;
+        } else if (strcmp(arg, "--distributed") == 0) {
+            if (strcmp(value, "remap") != 0 && strcmp(value, "fixed") != 0) {
+                fprintf(stderr, "Error: --distributed must be 'remap' or 'fixed'\n");
+                return false;
+            }
+#ifndef QSIM_WITH_MPI
+            fprintf(stderr, "Error: --distributed needs a build with MPI (mpicc -DQSIM_WITH_MPI ... distributed.c)\n");
+            return false;
+#endif
+            options->distributed = true;
+            options->fixed_layout = strcmp(value, "fixed") == 0;
+        } else if (strcmp(arg, "--fuse") == 0) {
+            options->fused_qubits = atoi(value);
+            if (options->fused_qubits < 0 || options->fused_qubits > MAX_FUSED_QUBITS) {
+                fprintf(stderr, "Error: --fuse must be between 0 and %d\n", MAX_FUSED_QUBITS);
+                return false;
+            }
+        } else if (strcmp(arg, "--block") == 0) {
+            options->local_qubits = atoi(value);
+            if (options->local_qubits < 0 || options->local_qubits > MAX_QUBITS) {
+                fprintf(stderr, "Error: --block must be between 0 and %d\n", MAX_QUBITS);
+                return false;
+            }
+        } else if (strcmp(arg, "--precision") == 0) {
+            if (strcmp(value, "single") != 0 && strcmp(value, "double") != 0) {
+                fprintf(stderr, "Error: --precision must be 'single' or 'double'\n");
+                return false;
+            }
+            options->precision = strcmp(value, "single") == 0 ? PRECISION_SINGLE : PRECISION_DOUBLE;
+        } else if (strcmp(arg, "--backend") == 0) {
+            if (strcmp(value, "statevector") == 0) {
+                options->backend = BACKEND_STATE_VECTOR;
+            } else if (strcmp(value, "stabilizer") == 0) {
+                options->backend = BACKEND_STABILIZER;
+            } else if (strcmp(value, "mps") == 0) {
+                options->backend = BACKEND_MPS;
+            } else if (strcmp(value, "sparse") == 0) {
+                options->backend = BACKEND_SPARSE;
+            } else {
+                fprintf(stderr, "Error: --backend must be 'statevector', 'stabilizer', 'mps' or 'sparse'\n");
+                return false;
+            }
+        } else if (strcmp(arg, "--max-bond") == 0) {
+            options->max_bond = atoi(value);
+            if (options->max_bond < 1) {
+                fprintf(stderr, "Error: --max-bond must be at least 1\n");
+                return false;
+            }
+        } else if (strcmp(arg, "--truncation") == 0) {
+            char* end;
+            options->truncation = strtod(value, &end);
+            if (*end != '\0' || !(options->truncation >= 0.0 && options->truncation < 1.0)) {
+                fprintf(stderr, "Error: Invalid truncation threshold '%s'\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--noise") == 0 || strcmp(arg, "--layer-noise") == 0) {
+            NoiseChannel channel;
+            double probability;
+            if (!parse_noise_channel(value, &channel, &probability)) {
+                return false;
+            }
+            bool added = strcmp(arg, "--noise") == 0
+                             ? noise_model_add_gate_noise(&options->noise, channel, probability, NOISE_ANY_GATE)
+                             : noise_model_add_layer_noise(&options->noise, channel, probability);
+            if (!added) {
+                return false;
+            }
+        } else if (strcmp(arg, "--seed") == 0) {
+            char* end;
+            options->seed = strtoull(value, &end, 0);
+            options->seeded = true;
+            if (*end != '\0' || value[0] == '-') {
+                fprintf(stderr, "Error: Invalid seed '%s'\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--profile") == 0) {
+            if (strcmp(value, "table") != 0 && strcmp(value, "json") != 0) {
+                fprintf(stderr, "Error: --profile must be 'table' or 'json'\n");
+                return false;
+            }
+            options->profiled = true;
+            options->profile_format = strcmp(value, "json") == 0 ? PROFILE_JSON : PROFILE_TABLE;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", arg);
+            return false;
+        }
+        i += takes_value;
+    }
+
+    // A lone --seed N keeps the interactive menu
+    if (!options->qasm_path && !(options->seeded && argc == 3)) {
+        fprintf(stderr, "Error: No input file given (use --qasm FILE)\n");
+        return false;
+    }
+    return true;
+}
+
+void write_bits(FILE* out, uint64_t value, int num_bits) {
+    for (int b = num_bits - 1; b >= 0; b--) {
+        fputc((value >> b) & 1 ? '1' : '0', out);
+    }
+}
+
+// Writes the amplitudes of a state vector that holds indices first_index onwards
+void write_dense_amplitudes(FILE* out, const QuantumState* state, size_t first_index, int num_bits) {
+    // Enough digits to round-trip the stored precision
+    int digits = state->precision == PRECISION_SINGLE ? 9 : 17;
+    for (size_t i = 0; i < state->state_size; i++) {
+        ComplexNum amplitude = get_amplitude(state, i);
+        if (cabs(amplitude) > AMPLITUDE_CUTOFF) {
+            write_bits(out, first_index + i, num_bits);
+            fprintf(out, " %.*g %.*g\n", digits, creal(amplitude), digits, cimag(amplitude));
+        }
+    }
+}
+
+void write_amplitudes(FILE* out, const QuantumState* state) {
+    if (state->backend == BACKEND_SPARSE) {
+        size_t count = sparse_count(state->sparse);
+        size_t* indices = malloc(count * sizeof(size_t));
+        ComplexNum* values = malloc(count * sizeof(ComplexNum));
+        sparse_entries(state->sparse, indices, values);
+        for (size_t i = 0; i < count; i++) {
+            if (cabs(values[i]) > AMPLITUDE_CUTOFF) {
+                write_bits(out, indices[i], state->num_qubits);
+                fprintf(out, " %.17g %.17g\n", creal(values[i]), cimag(values[i]));
+            }
+        }
+        free(indices);
+        free(values);
+        return;
+    }
+
+    write_dense_amplitudes(out, state, 0, state->num_qubits);
+}
+
+// Prints "PAULIS value" for each observable, all evaluated together
+bool write_expectations(FILE* out, const QuantumState* state, const char** observables, int num_observables) {
+    PauliTerm* terms = malloc(num_observables * sizeof(PauliTerm));
+    double* values = malloc(num_observables * sizeof(double));
+    bool ok = terms && values;
+    for (int i = 0; ok && i < num_observables; i++) {
+        ok = parse_pauli_term(observables[i], &terms[i]);
+    }
+    ok = ok && pauli_expectations(state, terms, num_observables, values);
+    for (int i = 0; ok && i < num_observables; i++) {
+        fprintf(out, "%s %.17g\n", observables[i], values[i]);
+    }
+    free(terms);
+    free(values);
+    return ok;
+}
+
+int compare_shot_counts(const void* a, const void* b) {
+    size_t x = ((const ShotCount*)a)->outcome;
+    size_t y = ((const ShotCount*)b)->outcome;
+    return (x > y) - (x < y);
+}
+
+void write_counts(FILE* out, const ShotCount* counts, size_t num_outcomes, int num_bits) {
+    for (size_t i = 0; i < num_outcomes; i++) {
+        write_bits(out, counts[i].outcome, num_bits);
+        fprintf(out, " %llu\n", (unsigned long long)counts[i].count);
+    }
+}
+
+bool has_measurements(const Circuit* circuit) {
+    for (size_t g = 0; g < circuit->num_gates; g++) {
+        if (circuit->gates[g].type == MEASURE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Counts of a circuit without measurements are taken over every qubit:
+// classical bit q gets qubit q, and classical registers it declares but never
+// writes are dropped
+void measure_unmeasured_circuit(Circuit* circuit) {
+    if (has_measurements(circuit)) {
+        return;
+    }
+    circuit->num_classical_bits = 0;
+    for (int q = 0; q < circuit->num_qubits; q++) {
+        circuit_measure(circuit, q, q);
+    }
+}
+
+// The measurements that end a circuit, as qubits to sample
+typedef struct {
+    int source[64];     // qubit whose result lands in each classical bit, or -1
+    int position[64];   // index of that qubit in the sampled list
+    int qubits[64];
+    int num_sampled;
+} TerminalMeasurements;
+
+// Collects the measurements from first_measure on; returns false when a gate follows one
+bool find_terminal_measurements(const Circuit* circuit, size_t first_measure, TerminalMeasurements* terminal) {
+    for (int b = 0; b < circuit->num_classical_bits; b++) terminal->source[b] = -1;
+
+    for (size_t g = first_measure; g < circuit->num_gates; g++) {
+        if (circuit->gates[g].type != MEASURE) {
+            return false;
+        }
+        terminal->source[circuit->gates[g].classical_bit] = circuit->gates[g].qubits[0];
+    }
+
+    terminal->num_sampled = 0;
+    for (int b = 0; b < circuit->num_classical_bits; b++) {
+        if (terminal->source[b] < 0) {
+            continue;
+        }
+        int* position = &terminal->position[b];
+        *position = 0;
+        while (*position < terminal->num_sampled && terminal->qubits[*position] != terminal->source[b]) {
+            (*position)++;
+        }
+        if (*position == terminal->num_sampled) {
+            terminal->qubits[terminal->num_sampled++] = terminal->source[b];
+        }
+    }
+    return true;
+}
+
+// Maps sampled qubit outcomes onto classical bits and writes the counts
+void write_terminal_counts(FILE* out, const Circuit* circuit, const TerminalMeasurements* terminal,
+                           ShotHistogram* histogram) {
+    for (size_t i = 0; i < histogram->num_outcomes; i++) {
+        size_t sampled = histogram->counts[i].outcome;
+        size_t classical = 0;
+        for (int b = 0; b < circuit->num_classical_bits; b++) {
+            if (terminal->source[b] >= 0) {
+                classical |= ((sampled >> terminal->position[b]) & 1) << b;
+            }
+        }
+        histogram->counts[i].outcome = classical;
+    }
+    qsort(histogram->counts, histogram->num_outcomes, sizeof(ShotCount), compare_shot_counts);
+    write_counts(out, histogram->counts, histogram->num_outcomes, circuit->num_classical_bits);
+}
+
+// Fast path for circuits whose measurements all come last: the final state is
+// sampled with sample_shots and qubit outcomes are mapped onto classical bits.
+// Returns false (without output) when a gate follows a measurement.
+bool sample_terminal_measurements(const Circuit* circuit, size_t first_measure, QuantumState* state,
+                                  uint64_t shots, FILE* out, bool* ok) {
+    TerminalMeasurements terminal;
+    if (!find_terminal_measurements(circuit, first_measure, &terminal)) {
+        return false;
+    }
+    ShotHistogram histogram;
+    *ok = sample_shots(state, shots, terminal.qubits, terminal.num_sampled, &histogram);
+    if (*ok) {
+        write_terminal_counts(out, circuit, &terminal, &histogram);
+        free_shot_histogram(&histogram);
+    }
+    return true;
+}
+
+// General path for mid-circuit measurements: every shot replays the gates
+// from the first measurement on a copy of the pre-measurement state
+bool replay_shots(const Circuit* circuit, size_t first_measure, QuantumState* state, uint64_t shots, FILE* out) {
+    int num_bits = circuit->num_classical_bits;
+    QuantumState* shot_state = shots > 1 ? clone_quantum_state(state) : state;
+    ShotCount* outcomes = malloc(shots * sizeof(ShotCount));
+    int* bits = malloc(num_bits * sizeof(int));
+    if (!shot_state || !outcomes || !bits) {
+        fprintf(stderr, "Error: Out of memory for %llu shots\n", (unsigned long long)shots);
+        if (shot_state && shot_state != state) destroy_quantum_state(shot_state);
+        free(outcomes);
+        free(bits);
+        return false;
+    }
+
+    for (uint64_t s = 0; s < shots; s++) {
+        if (shot_state != state) {
+            copy_quantum_state(shot_state, state);
+        }
+        memset(bits, 0, num_bits * sizeof(int));
+        for (size_t g = first_measure; g < circuit->num_gates; g++) {
+            apply_gate(shot_state, &circuit->gates[g], bits);
+        }
+        outcomes[s].outcome = 0;
+        outcomes[s].count = 1;
+        for (int b = 0; b < num_bits; b++) {
+            outcomes[s].outcome |= (size_t)bits[b] << b;
+        }
+    }
+
+    // Sort, then merge equal outcomes in place
+    qsort(outcomes, shots, sizeof(ShotCount), compare_shot_counts);
+    size_t num_outcomes = 0;
+    for (uint64_t s = 0; s < shots; s++) {
+        if (num_outcomes > 0 && outcomes[num_outcomes - 1].outcome == outcomes[s].outcome) {
+            outcomes[num_outcomes - 1].count++;
+        } else {
+            outcomes[num_outcomes++] = outcomes[s];
+        }
+    }
+    write_counts(out, outcomes, num_outcomes, num_bits);
+
+    if (shot_state != state) {
+        destroy_quantum_state(shot_state);
+    }
+    free(outcomes);
+    free(bits);
+    return true;
+}
+
+// Runs the gates before first_measure, tiled when local_qubits > 0, then
+// reports on stderr what the run cost in accuracy or size: the norm drift of
+// single precision states, the truncation error and largest bond of matrix
+// product states, and the number of non-zero amplitudes of sparse states (or
+// that they filled up and became a state vector).
+void run_prefix(const Circuit* circuit, size_t first_measure, QuantumState* state, int* bits, int local_qubits) {
+    bool sparse = state->backend == BACKEND_SPARSE;
+    Circuit prefix = *circuit;
+    prefix.num_gates = first_measure;
+    if (local_qubits > 0) {
+        execute_circuit_blocked(&prefix, state, bits, local_qubits);
+    } else {
+        execute_circuit(&prefix, state, bits);
+    }
+    if (state->precision == PRECISION_SINGLE) {
+        double drift = check_norm_drift(state, NORM_DRIFT_TOLERANCE);
+        fprintf(stderr, "Norm drift %.3g%s\n", drift, drift > NORM_DRIFT_TOLERANCE ? " (renormalized)" : "");
+    }
+    if (state->backend == BACKEND_MPS) {
+        fprintf(stderr, "Truncation error %.3g, largest bond %d\n", truncation_error(state),
+                mps_bond_dimension(state->mps));
+    }
+    if (state->backend == BACKEND_SPARSE) {
+        fprintf(stderr, "Sparse state holds %zu non-zero amplitudes\n", sparse_count(state->sparse));
+    } else if (sparse) {
+        fprintf(stderr, "Sparse state filled up and became a state vector\n");
+    }
+}
+
+// Runs the circuit for the requested shots and writes one "bitstring count"
+// line per outcome. Gates before the first measurement are simulated once.
+bool run_shots(Circuit* circuit, QuantumState* state, uint64_t shots, FILE* out, int local_qubits) {
+    measure_unmeasured_circuit(circuit);
+    size_t first_measure = 0;
+    while (first_measure < circuit->num_gates && circuit->gates[first_measure].type != MEASURE) {
+        first_measure++;
+    }
+    run_prefix(circuit, first_measure, state, NULL, local_qubits);
+
+    bool ok;
+    if (sample_terminal_measurements(circuit, first_measure, state, shots, out, &ok)) {
+        return ok;
+    }
+    return replay_shots(circuit, first_measure, state, shots, out);
+}
+
+// Noisy runs: every shot is a separate trajectory through the whole circuit,
+// spread over the threads
+bool run_noisy_shots(Circuit* circuit, const NoiseModel* model, QuantumState* state, uint64_t shots, FILE* out) {
+    measure_unmeasured_circuit(circuit);
+    ShotHistogram histogram;
+    if (!run_noisy_circuit(circuit, model, state, shots, &histogram)) {
+        return false;
+    }
+    write_counts(out, histogram.counts, histogram.num_outcomes, circuit->num_classical_bits);
+    free_shot_histogram(&histogram);
+    fprintf(stderr, "Ran %llu noisy trajectories\n", (unsigned long long)shots);
+    return true;
+}
+
+typedef struct {
+    FILE* out;
+    int num_bits;
+} AmplitudeOutput;
+
+bool write_chunk_amplitudes(const QuantumState* chunk, size_t first_index, void* ctx) {
+    AmplitudeOutput* output = ctx;
+    write_dense_amplitudes(output->out, chunk, first_index, output->num_bits);
+    return true;
+}
+
+// Out-of-core and distributed states run the circuit once: counts come from
+// sampling the final measurements, or from a single run of the whole circuit
+// when gates follow a measurement. Finds the first measurement and whether
+// the measurements are all terminal; returns false after printing an error.
+bool plan_single_run(Circuit* circuit, const BatchOptions* options, size_t* first_measure,
+                     TerminalMeasurements* terminal, bool* terminal_only) {
+    if (!options->amplitudes) {
+        measure_unmeasured_circuit(circuit);
+    }
+    *first_measure = 0;
+    while (*first_measure < circuit->num_gates && circuit->gates[*first_measure].type != MEASURE) {
+        (*first_measure)++;
+    }
+    *terminal_only = find_terminal_measurements(circuit, *first_measure, terminal);
+    if (!options->amplitudes && !*terminal_only && options->shots > 1) {
+        fprintf(stderr, "Error: Out-of-core and distributed runs cannot replay mid-circuit measurements; "
+                        "use --shots 1\n");
+        return false;
+    }
+    return true;
+}
+
+// Out-of-core runs keep the state in a file in options->out_of_core_dir
+bool run_out_of_core(Circuit* circuit, const BatchOptions* options, FILE* out) {
+    size_t first_measure;
+    TerminalMeasurements terminal;
+    bool terminal_only;
+    if (!plan_single_run(circuit, options, &first_measure, &terminal, &terminal_only)) {
+        return false;
+    }
+
+    OutOfCoreState* state = create_out_of_core_state(circuit->num_qubits, options->precision,
+                                                     options->out_of_core_dir, options->memory_limit);
+    if (!state) {
+        return false;
+    }
+    int* bits = calloc(circuit->num_classical_bits + 1, sizeof(int));
+    bool ok;
+    if (options->amplitudes) {
+        AmplitudeOutput output = { out, circuit->num_qubits };
+        ok = execute_circuit_out_of_core(circuit, state, bits) &&
+             visit_out_of_core_chunks(state, write_chunk_amplitudes, &output);
+    } else if (terminal_only) {
+        Circuit prefix = *circuit;
+        prefix.num_gates = first_measure;
+        ShotHistogram histogram;
+        ok = execute_circuit_out_of_core(&prefix, state, bits) &&
+             sample_out_of_core_shots(state, options->shots, terminal.qubits, terminal.num_sampled, &histogram);
+        if (ok) {
+            write_terminal_counts(out, circuit, &terminal, &histogram);
+            free_shot_histogram(&histogram);
+        }
+    } else {
+        ok = execute_circuit_out_of_core(circuit, state, bits);
+        ShotCount count = { 0, 1 };
+        for (int b = 0; b < circuit->num_classical_bits; b++) {
+            count.outcome |= (size_t)bits[b] << b;
+        }
+        if (ok) {
+            write_counts(out, &count, 1, circuit->num_classical_bits);
+        }
+    }
+    free(bits);
+
+    OutOfCoreStats stats;
+    out_of_core_stats(state, &stats);
+    fprintf(stderr, "Out-of-core state: %zu passes, %.2f GiB read, %.2f GiB written, %.3f s waiting for the disk\n",
+            stats.passes, stats.bytes_read / 1073741824.0, stats.bytes_written / 1073741824.0,
+            stats.io_wait_seconds);
+    destroy_out_of_core_state(state);
+    return ok;
+}
+
+#ifdef QSIM_WITH_MPI
+// Distributed runs spread the state over the ranks of the MPI job, which all
+// run the same batch; only rank 0 writes results
+bool run_distributed(Circuit* circuit, const BatchOptions* options, FILE* out) {
+    size_t first_measure;
+    TerminalMeasurements terminal;
+    bool terminal_only;
+    if (!plan_single_run(circuit, options, &first_measure, &terminal, &terminal_only)) {
+        return false;
+    }
+
+    DistributedState* state = create_distributed_state(circuit->num_qubits, options->precision,
+                                                       options->fixed_layout);
+    if (!state) {
+        return false;
+    }
+    bool root = distributed_rank() == 0;
+    int* bits = calloc(circuit->num_classical_bits + 1, sizeof(int));
+    bool ok;
+    if (options->amplitudes) {
+        AmplitudeOutput output = { out, circuit->num_qubits };
+        ok = execute_circuit_distributed(circuit, state, bits) &&
+             visit_distributed_chunks(state, write_chunk_amplitudes, &output);
+    } else if (terminal_only) {
+        Circuit prefix = *circuit;
+        prefix.num_gates = first_measure;
+        ShotHistogram histogram;
+        ok = execute_circuit_distributed(&prefix, state, bits) &&
+             sample_distributed_shots(state, options->shots, terminal.qubits, terminal.num_sampled, &histogram);
+        if (ok && root) {
+            write_terminal_counts(out, circuit, &terminal, &histogram);
+        }
+        if (ok) {
+            free_shot_histogram(&histogram);
+        }
+    } else {
+        ok = execute_circuit_distributed(circuit, state, bits);
+        ShotCount count = { 0, 1 };
+        for (int b = 0; b < circuit->num_classical_bits; b++) {
+            count.outcome |= (size_t)bits[b] << b;
+        }
+        if (ok && root) {
+            write_counts(out, &count, 1, circuit->num_classical_bits);
+        }
+    }
+    free(bits);
+
+    DistributedStats stats;
+    distributed_stats(state, &stats);
+    if (root) {
+        fprintf(stderr, "Distributed state: %d ranks, %zu exchanges, %.2f GiB sent per rank, %.3f s exchanging\n",
+                distributed_num_ranks(), stats.exchanges, stats.bytes_sent / 1073741824.0, stats.exchange_seconds);
+    }
+    destroy_distributed_state(state);
+    return ok;
+}
+#endif
+
+// Checks up front that every gate can run on the stabilizer backend
+bool check_clifford_circuit(const Circuit* circuit, const BatchOptions* options) {
+    if (options->amplitudes) {
+        fprintf(stderr, "Error: The stabilizer backend has no amplitudes to print\n");
+        return false;
+    }
+    for (size_t g = 0; g < circuit->num_gates; g++) {
+        if (!is_clifford_gate(&circuit->gates[g])) {
+            fprintf(stderr, "Error: Gate %zu of %s is not a Clifford gate; use --backend statevector\n",
+                    g + 1, options->qasm_path);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The initial state for options->backend, or the snapshot to start from;
+// NULL after printing an error
+QuantumState* create_batch_state(const Circuit* circuit, const BatchOptions* options) {
+    QuantumState* state;
+    switch (options->backend) {
+        case BACKEND_STABILIZER:
+            state = create_stabilizer_state(circuit->num_qubits);
+            break;
+        case BACKEND_MPS:
+            state = create_mps_state(circuit->num_qubits, options->max_bond, options->truncation);
+            break;
+        case BACKEND_SPARSE:
+            state = create_sparse_state(circuit->num_qubits);
+            if (state) {
+                state->precision = options->precision;
+            }
+            break;
+        default:
+            state = options->load_path ? load_state_snapshot(options->load_path)
+                                       : create_quantum_state_with_precision(circuit->num_qubits, options->precision);
+            break;
+    }
+    if (state && state->num_qubits != circuit->num_qubits) {
+        fprintf(stderr, "Error: The snapshot has %d qubits but the circuit has %d\n", state->num_qubits,
+                circuit->num_qubits);
+        destroy_quantum_state(state);
+        state = NULL;
+    }
+    return state;
+}
+
+int run_batch(const BatchOptions* options) {
+    Circuit* circuit = load_qasm_file(options->qasm_path);
+    if (!circuit) {
+        return 1;
+    }
+    if (options->backend == BACKEND_STABILIZER && !check_clifford_circuit(circuit, options)) {
+        destroy_circuit(circuit);
+        return 1;
+    }
+    if (options->backend == BACKEND_MPS && options->amplitudes) {
+        fprintf(stderr, "Error: The MPS backend has no amplitudes to print\n");
+        destroy_circuit(circuit);
+        return 1;
+    }
+    if ((options->backend == BACKEND_MPS || options->backend == BACKEND_STABILIZER) && options->num_observables > 0) {
+        fprintf(stderr, "Error: --expect needs the statevector or sparse backend\n");
+        destroy_circuit(circuit);
+        return 1;
+    }
+    if (options->backend != BACKEND_STATE_VECTOR && (options->load_path || options->save_path)) {
+        fprintf(stderr, "Error: State snapshots need the statevector backend\n");
+        destroy_circuit(circuit);
+        return 1;
+    }
+    bool noisy = options->noise.num_rules > 0;
+    if (noisy && (options->amplitudes || options->num_observables > 0 || options->save_path)) {
+        fprintf(stderr, "Error: Noisy runs end in a different state every shot; use --output counts\n");
+        destroy_circuit(circuit);
+        return 1;
+    }
+    if (options->out_of_core_dir && (options->backend != BACKEND_STATE_VECTOR || noisy ||
+                                     options->num_observables > 0 || options->load_path || options->save_path)) {
+        fprintf(stderr, "Error: --out-of-core runs noiseless state vectors and prints counts or amplitudes\n");
+        destroy_circuit(circuit);
+        return 1;
+    }
+    if (options->distributed && (options->out_of_core_dir || options->backend != BACKEND_STATE_VECTOR || noisy ||
+                                 options->num_observables > 0 || options->load_path || options->save_path)) {
+        fprintf(stderr, "Error: --distributed runs noiseless state vectors in memory and prints counts or amplitudes\n");
+        destroy_circuit(circuit);
+        return 1;
+    }
+
+    // Outcomes are counted as 64-bit words, and a circuit without measurements
+    // counts every qubit; single runs also map their measurements that way
+    bool counts = !options->amplitudes && options->num_observables == 0 && !options->save_path;
+    int counted_bits = counts && !has_measurements(circuit) ? circuit->num_qubits : circuit->num_classical_bits;
+    if ((counts || options->out_of_core_dir || options->distributed) && counted_bits > 64) {
+        fprintf(stderr, "Error: Counts support at most 64 classical bits; measure at most 64 qubits explicitly\n");
+        destroy_circuit(circuit);
+        return 1;
+    }
+
+    // States larger than the cache are tiled rather than fused unless asked otherwise:
+    // fused blocks spanning high qubits would force a swap into the tile each time
+    // (both only apply to noiseless state vectors, since noise follows the original gates).
+    // Out-of-core passes and distributed ranks tile their amplitudes themselves
+    // and fuse only when asked.
+    bool rewrite = options->backend == BACKEND_STATE_VECTOR && !noisy;
+    bool out_of_core = options->out_of_core_dir != NULL;
+    bool single_run = out_of_core || options->distributed;
+    int local_qubits = rewrite && !single_run ? options->local_qubits : 0;
+    if (local_qubits < 0) {
+        local_qubits = options->fused_qubits <= 0 && circuit->num_qubits > default_local_qubits()
+                           ? default_local_qubits() : 0;
+    }
+    int fused_qubits = rewrite ? options->fused_qubits : 0;
+    if (fused_qubits < 0) {
+        fused_qubits = circuit->num_qubits >= FUSION_MIN_QUBITS && local_qubits == 0 && !single_run
+                           ? DEFAULT_FUSED_QUBITS : 0;
+    }
+    if (fused_qubits > 0) {
+        Circuit* fused = fuse_circuit(circuit, fused_qubits);
+        destroy_circuit(circuit);
+        circuit = fused;
+    }
+
+    // Only rank 0 of a distributed run writes results
+    bool writer = true;
+#ifdef QSIM_WITH_MPI
+    writer = !options->distributed || distributed_rank() == 0;
+#endif
+    FILE* out = stdout;
+    if (writer && options->output_path && !(out = fopen(options->output_path, "w"))) {
+        fprintf(stderr, "Error: Cannot write %s\n", options->output_path);
+        destroy_circuit(circuit);
+        return 1;
+    }
+
+    bool ok = false;
+    QuantumState* state = single_run ? NULL : create_batch_state(circuit, options);
+    if (single_run || state) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (out_of_core) {
+            ok = run_out_of_core(circuit, options, out);
+#ifdef QSIM_WITH_MPI
+        } else if (options->distributed) {
+            ok = run_distributed(circuit, options, out);
+#endif
+        } else if (options->amplitudes || options->num_observables > 0 || options->save_path) {
+            int* bits = calloc(circuit->num_classical_bits + 1, sizeof(int));
+            run_prefix(circuit, circuit->num_gates, state, bits, local_qubits);
+            if (options->amplitudes) {
+                write_amplitudes(out, state);
+            }
+            ok = options->num_observables == 0 ||
+                 write_expectations(out, state, options->observables, options->num_observables);
+            ok = ok && (!options->save_path || save_state_snapshot(state, options->save_path));
+            free(bits);
+        } else if (noisy) {
+            ok = run_noisy_shots(circuit, &options->noise, state, options->shots, out);
+        } else {
+            ok = run_shots(circuit, state, options->shots, out, local_qubits);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (ok && writer) {
+            fprintf(stderr, "Simulated %zu gates on %d qubits in %.3f s\n", circuit->num_gates, circuit->num_qubits,
+                    (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9);
+        }
+    }
+    if (state) {
+        destroy_quantum_state(state);
+    }
+
+    if (writer && out != stdout) {
+        fclose(out);
+    }
+    destroy_circuit(circuit);
+    return ok ? 0 : 1;
+}
+
 void print_menu() {
     printf("\n=== Quantum Computing Simulator ===\n");
     printf("1. Phase Gate Experiment\n");
@@ -467,8 +1485,40 @@ void print_menu() {
     printf("Enter choice (1-11): ");
 }
 
-int main() {
-    srand(time(NULL));
+int main(int argc, char** argv) {
+    BatchOptions options = { .seeded = false };
+    noise_model_init(&options.noise);
+    if (argc > 1 && !parse_batch_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        noise_model_free(&options.noise);
+        free(options.observables);
+        return 1;
+    }
+    qsim_set_seed(options.seeded ? options.seed : (uint64_t)time(NULL));
+
+    if (options.profiled) {
+        profile_enable(options.profile_format);
+    }
+
+    // Any argument other than a lone --seed selects batch mode
+    if (options.qasm_path) {
+#ifdef QSIM_WITH_MPI
+        if (options.distributed && !distributed_init(&argc, &argv)) {
+            noise_model_free(&options.noise);
+            free(options.observables);
+            return 1;
+        }
+#endif
+        int status = run_batch(&options);
+#ifdef QSIM_WITH_MPI
+        if (options.distributed) {
+            distributed_finalize();
+        }
+#endif
+        noise_model_free(&options.noise);
+        free(options.observables);
+        return status;
+    }
     
     while (1) {
         print_menu();
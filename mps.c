@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mps.h"
+#include "profile.h"
+
+// Jacobi sweeps stop once every pair of rows is orthogonal to this relative precision
+#define JACOBI_TOLERANCE 1e-14
+#define JACOBI_MAX_SWEEPS 60
+
+// Singular values carrying less relative weight than this are numerically zero
+#define ZERO_WEIGHT 1e-28
+
+// sites[i][(l * 2 + s) * bond[i + 1] + r] is entry (l, s, r) of site i. Sites
+// left of center are left-canonical, sites right of it right-canonical, so the
+// state's norm is the norm of the center site.
+struct MpsState {
+    int num_qubits;
+    int max_bond;
+    double truncation_threshold;
+    double truncation_error;
+    ComplexNum** sites;
+    int* bond;            // bond[i] links sites i - 1 and i; bond[0] = bond[n] = 1
+    int center;
+    int* site_of;         // qubit -> site
+    int* qubit_at;        // site -> qubit
+    uint64_t* last_use;   // per qubit, value of clock at the last gate on it
+    uint64_t clock;
+};
+
+static inline size_t site_size(const MpsState* mps, int site) {
+    return (size_t)mps->bond[site] * 2 * mps->bond[site + 1];
+}
+
+MpsState* create_mps(int num_qubits, int max_bond, double truncation_threshold) {
+    if (num_qubits < 1 || num_qubits > MAX_MPS_QUBITS) {
+        fprintf(stderr, "Error: Matrix product states have 1 to %d qubits\n", MAX_MPS_QUBITS);
+        return NULL;
+    }
+    if (max_bond < 1 || !(truncation_threshold >= 0.0)) {
+        fprintf(stderr, "Error: MPS bond dimension must be at least 1 and the truncation threshold non-negative\n");
+        return NULL;
+    }
+
+    MpsState* mps = calloc(1, sizeof(MpsState));
+    mps->num_qubits = num_qubits;
+    mps->max_bond = max_bond;
+    mps->truncation_threshold = truncation_threshold;
+    mps->sites = calloc(num_qubits, sizeof(ComplexNum*));
+    mps->bond = malloc((num_qubits + 1) * sizeof(int));
+    mps->site_of = malloc(num_qubits * sizeof(int));
+    mps->qubit_at = malloc(num_qubits * sizeof(int));
+    mps->last_use = calloc(num_qubits, sizeof(uint64_t));
+    bool ok = mps->sites && mps->bond && mps->site_of && mps->qubit_at && mps->last_use;
+
+    // |0...0> is a product state: every bond has dimension 1
+    for (int i = 0; ok && i < num_qubits; i++) {
+        mps->sites[i] = calloc(2, sizeof(ComplexNum));
+        ok = mps->sites[i] != NULL;
+        if (ok) {
+            mps->sites[i][0] = 1.0;
+        }
+        mps->bond[i] = 1;
+        mps->site_of[i] = i;
+        mps->qubit_at[i] = i;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Could not allocate a %d-qubit matrix product state\n", num_qubits);
+        destroy_mps(mps);
+        return NULL;
+    }
+    mps->bond[num_qubits] = 1;
+    return mps;
+}
+
+void destroy_mps(MpsState* mps) {
+    if (mps->sites) {
+        for (int i = 0; i < mps->num_qubits; i++) {
+            free(mps->sites[i]);
+        }
+    }
+    free(mps->sites);
+    free(mps->bond);
+    free(mps->site_of);
+    free(mps->qubit_at);
+    free(mps->last_use);
+    free(mps);
+}
+
+bool copy_mps(MpsState* dest, const MpsState* src) {
+    int n = src->num_qubits;
+    if (dest->num_qubits != n) {
+        fprintf(stderr, "Error: Cannot copy a %d-qubit MPS into a %d-qubit one\n", n, dest->num_qubits);
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        size_t size = site_size(src, i);
+        ComplexNum* site = realloc(dest->sites[i], size * sizeof(ComplexNum));
+        if (!site) {
+            fprintf(stderr, "Error: Out of memory copying a matrix product state\n");
+            return false;
+        }
+        dest->sites[i] = site;
+        memcpy(site, src->sites[i], size * sizeof(ComplexNum));
+    }
+    memcpy(dest->bond, src->bond, (n + 1) * sizeof(int));
+    memcpy(dest->site_of, src->site_of, n * sizeof(int));
+    memcpy(dest->qubit_at, src->qubit_at, n * sizeof(int));
+    memcpy(dest->last_use, src->last_use, n * sizeof(uint64_t));
+    dest->max_bond = src->max_bond;
+    dest->truncation_threshold = src->truncation_threshold;
+    dest->truncation_error = src->truncation_error;
+    dest->center = src->center;
+    dest->clock = src->clock;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Linear algebra
+// ---------------------------------------------------------------------------
+
+// c (m x n) = a (m x k) * b (k x n), all row-major
+static void multiply(const ComplexNum* a, const ComplexNum* b, ComplexNum* c, int m, int k, int n) {
+    memset(c, 0, (size_t)m * n * sizeof(ComplexNum));
+    for (int i = 0; i < m; i++) {
+        ComplexNum* out = c + (size_t)i * n;
+        for (int l = 0; l < k; l++) {
+            ComplexNum x = a[(size_t)i * k + l];
+            if (x == 0) continue;
+            const ComplexNum* row = b + (size_t)l * n;
+            for (int j = 0; j < n; j++) {
+                out[j] += x * row[j];
+            }
+        }
+    }
+}
+
+static double norm_squared(const ComplexNum* v, int length) {
+    double sum = 0.0;
+    for (int j = 0; j < length; j++) {
+        sum += creal(v[j]) * creal(v[j]) + cimag(v[j]) * cimag(v[j]);
+    }
+    return sum;
+}
+
+// (x, y) <- (c x - s e y, s x + c e y)
+static void rotate_rows(ComplexNum* x, ComplexNum* y, int length, double c, double s, ComplexNum e) {
+    // Spelled out in real arithmetic so the loop vectorizes
+    double er = creal(e), ei = cimag(e);
+    double* xd = (double*)x;
+    double* yd = (double*)y;
+    for (int j = 0; j < length; j++) {
+        double xr = xd[2 * j], xi = xd[2 * j + 1];
+        double yr = yd[2 * j] * er - yd[2 * j + 1] * ei;
+        double yi = yd[2 * j] * ei + yd[2 * j + 1] * er;
+        xd[2 * j] = c * xr - s * yr;
+        xd[2 * j + 1] = c * xi - s * yi;
+        yd[2 * j] = s * xr + c * yr;
+        yd[2 * j + 1] = s * xi + c * yi;
+    }
+}
+
+// Thin SVD a = u diag(s) vh of the m x n row-major matrix a by one-sided
+// Jacobi rotations, applied to the rows of a or of a^H, whichever are fewer.
+// Writes k = min(m, n) triplets (u is m x k, vh is k x n) in descending
+// order of s and returns k.
+static int svd(const ComplexNum* a, int m, int n, ComplexNum* u, double* s, ComplexNum* vh) {
+    bool transposed = m > n;
+    int rows = transposed ? n : m;
+    int cols = transposed ? m : n;
+    ComplexNum* b = malloc((size_t)rows * cols * sizeof(ComplexNum));
+    ComplexNum* w = calloc((size_t)rows * rows, sizeof(ComplexNum));
+    double* norms = malloc(rows * sizeof(double));
+    int* order = malloc(rows * sizeof(int));
+    profile_allocate(4, (size_t)rows * (cols + rows) * sizeof(ComplexNum) + rows * (sizeof(double) + sizeof(int)));
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            b[(size_t)i * cols + j] = transposed ? conj(a[(size_t)j * n + i]) : a[(size_t)i * n + j];
+        }
+        w[(size_t)i * rows + i] = 1.0;
+    }
+
+    // Rotate pairs of rows of b until all are orthogonal; w collects the
+    // rotations, so b = w a (or w a^H) throughout
+    // (squared row norms are refreshed every sweep and updated per rotation)
+    for (int sweep = 0; sweep < JACOBI_MAX_SWEEPS; sweep++) {
+        bool rotated = false;
+        for (int i = 0; i < rows; i++) {
+            norms[i] = norm_squared(b + (size_t)i * cols, cols);
+        }
+        for (int p = 0; p + 1 < rows; p++) {
+            ComplexNum* bp = b + (size_t)p * cols;
+            for (int q = p + 1; q < rows; q++) {
+                ComplexNum* bq = b + (size_t)q * cols;
+                double alpha = norms[p];
+                double beta = norms[q];
+                const double* pd = (const double*)bp;
+                const double* qd = (const double*)bq;
+                double gamma_re = 0.0, gamma_im = 0.0;
+                for (int j = 0; j < cols; j++) {
+                    gamma_re += pd[2 * j] * qd[2 * j] + pd[2 * j + 1] * qd[2 * j + 1];
+                    gamma_im += pd[2 * j] * qd[2 * j + 1] - pd[2 * j + 1] * qd[2 * j];
+                }
+                ComplexNum gamma = gamma_re + I * gamma_im;
+                double g = cabs(gamma);
+                if (g == 0.0 || g <= JACOBI_TOLERANCE * sqrt(alpha * beta)) {
+                    continue;
+                }
+                rotated = true;
+
+                // Phase e makes <bp, e bq> real, then a real rotation zeroes it
+                double zeta = (beta - alpha) / (2 * g);
+                double t = (zeta >= 0 ? 1.0 : -1.0) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+                double c = 1 / sqrt(1 + t * t);
+                ComplexNum e = conj(gamma) / g;
+                rotate_rows(bp, bq, cols, c, c * t, e);
+                rotate_rows(w + (size_t)p * rows, w + (size_t)q * rows, rows, c, c * t, e);
+                norms[p] = alpha - t * g;
+                norms[q] = beta + t * g;
+            }
+        }
+        if (!rotated) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < rows; i++) {
+        norms[i] = sqrt(norm_squared(b + (size_t)i * cols, cols));
+        order[i] = i;
+        for (int k = i; k > 0 && norms[order[k - 1]] < norms[order[k]]; k--) {
+            int temp = order[k];
+            order[k] = order[k - 1];
+            order[k - 1] = temp;
+        }
+    }
+
+    // Row i of b is s_i times a right singular vector of a (or of a^H), and
+    // row i of w the matching left one, conjugated
+    for (int k = 0; k < rows; k++) {
+        int i = order[k];
+        const ComplexNum* bi = b + (size_t)i * cols;
+        const ComplexNum* wi = w + (size_t)i * rows;
+        double inverse = norms[i] > 0.0 ? 1.0 / norms[i] : 0.0;
+        s[k] = norms[i];
+        for (int r = 0; r < m; r++) {
+            u[(size_t)r * rows + k] = transposed ? conj(bi[r]) * inverse : conj(wi[r]);
+        }
+        for (int j = 0; j < n; j++) {
+            vh[(size_t)k * n + j] = transposed ? wi[j] : bi[j] * inverse;
+        }
+    }
+
+    free(b);
+    free(w);
+    free(norms);
+    free(order);
+    return rows;
+}
+
+// Number of leading singular values to keep: at most max_bond, dropping the
+// smallest while their total weight stays within the threshold. Exact splits
+// only drop numerical zeros. The kept values are rescaled to unit norm and
+// the dropped weight is added to the truncation error.
+static int truncate_spectrum(MpsState* mps, double* s, int count, bool exact) {
+    double total = 0.0;
+    for (int k = 0; k < count; k++) {
+        total += s[k] * s[k];
+    }
+    double threshold = exact || mps->truncation_threshold < ZERO_WEIGHT ? ZERO_WEIGHT : mps->truncation_threshold;
+    int limit = exact ? count : mps->max_bond;
+
+    int kept = count;
+    double dropped = 0.0;
+    while (kept > 1 && (kept > limit || dropped + s[kept - 1] * s[kept - 1] <= threshold * total)) {
+        kept--;
+        dropped += s[kept] * s[kept];
+    }
+    if (total > 0.0) {
+        mps->truncation_error += dropped / total;
+        double scale = 1.0 / sqrt(total - dropped);
+        for (int k = 0; k < kept; k++) {
+            s[k] *= scale;
+        }
+    }
+    return kept;
+}
+
+// Splits the m x n matrix a into *left (m x k) and *right (k x n) through a
+// truncated SVD. The singular values go into the right factor when
+// absorb_right is set, else into the left one. Returns k.
+static int split(MpsState* mps, const ComplexNum* a, int m, int n, bool exact, bool absorb_right,
+                 ComplexNum** left, ComplexNum** right) {
+    int count = m < n ? m : n;
+    ComplexNum* u = malloc((size_t)m * count * sizeof(ComplexNum));
+    ComplexNum* vh = malloc((size_t)count * n * sizeof(ComplexNum));
+    double* s = malloc(count * sizeof(double));
+    svd(a, m, n, u, s, vh);
+    int kept = truncate_spectrum(mps, s, count, exact);
+
+    *left = malloc((size_t)m * kept * sizeof(ComplexNum));
+    *right = malloc((size_t)kept * n * sizeof(ComplexNum));
+    profile_allocate(5, ((size_t)m * count + (size_t)count * n + (size_t)m * kept + (size_t)kept * n) *
+                            sizeof(ComplexNum) + count * sizeof(double));
+    for (int r = 0; r < m; r++) {
+        for (int k = 0; k < kept; k++) {
+            (*left)[(size_t)r * kept + k] = u[(size_t)r * count + k] * (absorb_right ? 1.0 : s[k]);
+        }
+    }
+    for (int k = 0; k < kept; k++) {
+        for (int j = 0; j < n; j++) {
+            (*right)[(size_t)k * n + j] = vh[(size_t)k * n + j] * (absorb_right ? s[k] : 1.0);
+        }
+    }
+    free(u);
+    free(vh);
+    free(s);
+    return kept;
+}
+
+// ---------------------------------------------------------------------------
+// Canonical form and gates
+// ---------------------------------------------------------------------------
+
+static void shift_center_right(MpsState* mps) {
+    int c = mps->center;
+    int right_cols = 2 * mps->bond[c + 2];
+    ComplexNum *left, *carry;
+    int kept = split(mps, mps->sites[c], 2 * mps->bond[c], mps->bond[c + 1], true, true, &left, &carry);
+
+    ComplexNum* next = malloc((size_t)kept * right_cols * sizeof(ComplexNum));
+    multiply(carry, mps->sites[c + 1], next, kept, mps->bond[c + 1], right_cols);
+    free(mps->sites[c]);
+    free(mps->sites[c + 1]);
+    free(carry);
+    mps->sites[c] = left;
+    mps->sites[c + 1] = next;
+    mps->bond[c + 1] = kept;
+    mps->center = c + 1;
+}
+
+static void shift_center_left(MpsState* mps) {
+    int c = mps->center;
+    int left_rows = 2 * mps->bond[c - 1];
+    ComplexNum *carry, *right;
+    int kept = split(mps, mps->sites[c], mps->bond[c], 2 * mps->bond[c + 1], true, false, &carry, &right);
+
+    ComplexNum* previous = malloc((size_t)left_rows * kept * sizeof(ComplexNum));
+    multiply(mps->sites[c - 1], carry, previous, left_rows, mps->bond[c], kept);
+    free(mps->sites[c]);
+    free(mps->sites[c - 1]);
+    free(carry);
+    mps->sites[c] = right;
+    mps->sites[c - 1] = previous;
+    mps->bond[c] = kept;
+    mps->center = c - 1;
+}
+
+static void move_center(MpsState* mps, int site) {
+    while (mps->center < site) {
+        shift_center_right(mps);
+    }
+    while (mps->center > site) {
+        shift_center_left(mps);
+    }
+}
+
+// A one-qubit gate only touches its site and keeps the canonical form
+static void apply_site_matrix(MpsState* mps, int site, const ComplexNum* matrix) {
+    int right_bond = mps->bond[site + 1];
+    for (int l = 0; l < mps->bond[site]; l++) {
+        ComplexNum* a0 = mps->sites[site] + (size_t)l * 2 * right_bond;
+        ComplexNum* a1 = a0 + right_bond;
+        for (int r = 0; r < right_bond; r++) {
+            ComplexNum x = a0[r];
+            ComplexNum y = a1[r];
+            a0[r] = matrix[0] * x + matrix[1] * y;
+            a1[r] = matrix[2] * x + matrix[3] * y;
+        }
+    }
+}
+
+// Applies a 2^k x 2^k matrix to sites first..first+k-1 (the first site is the
+// most significant digit of a row/column index) and splits the result back
+// into k sites, left to right; the center ends on the last of them
+static void apply_window(MpsState* mps, int first, int k, const ComplexNum* matrix) {
+    move_center(mps, first);
+    int dim = 1 << k;
+    int left_bond = mps->bond[first];
+
+    // Contract the window into theta: (left bond, 2^k, right bond)
+    int rows = 2 * left_bond;
+    ComplexNum* theta = malloc(site_size(mps, first) * sizeof(ComplexNum));
+    memcpy(theta, mps->sites[first], site_size(mps, first) * sizeof(ComplexNum));
+    for (int p = 1; p < k; p++) {
+        int site = first + p;
+        int cols = 2 * mps->bond[site + 1];
+        ComplexNum* next = malloc((size_t)rows * cols * sizeof(ComplexNum));
+        multiply(theta, mps->sites[site], next, rows, mps->bond[site], cols);
+        free(theta);
+        theta = next;
+        rows *= 2;
+    }
+    int right_bond = mps->bond[first + k];
+
+    size_t block = (size_t)dim * right_bond;
+    ComplexNum* rest = malloc(left_bond * block * sizeof(ComplexNum));
+    for (int l = 0; l < left_bond; l++) {
+        multiply(matrix, theta + l * block, rest + l * block, dim, dim, right_bond);
+    }
+    free(theta);
+
+    int rest_rows = left_bond;
+    for (int p = 0; p + 1 < k; p++) {
+        ComplexNum *site, *right;
+        int kept = split(mps, rest, 2 * rest_rows, (dim >> (p + 1)) * right_bond, false, true, &site, &right);
+        free(mps->sites[first + p]);
+        free(rest);
+        mps->sites[first + p] = site;
+        mps->bond[first + p + 1] = kept;
+        rest = right;
+        rest_rows = kept;
+    }
+    free(mps->sites[first + k - 1]);
+    mps->sites[first + k - 1] = rest;
+    mps->center = first + k - 1;
+}
+
+// Exchanges the qubits held by sites site and site + 1
+static void swap_sites(MpsState* mps, int site) {
+    static const ComplexNum swap_matrix[16] = {
+        1, 0, 0, 0,
+        0, 0, 1, 0,
+        0, 1, 0, 0,
+        0, 0, 0, 1
+    };
+    apply_window(mps, site, 2, swap_matrix);
+    int a = mps->qubit_at[site];
+    int b = mps->qubit_at[site + 1];
+    mps->qubit_at[site] = b;
+    mps->qubit_at[site + 1] = a;
+    mps->site_of[a] = site + 1;
+    mps->site_of[b] = site;
+}
+
+// Moves the gate's qubits onto consecutive sites around the one that was used
+// least recently, which stays put; a qubit that interacts with many partners
+// in a row (a fan-out control, a QFT target) is carried along instead of
+// every partner being fetched. Returns the first site of the window.
+static int gather(MpsState* mps, const int* qubits, int k) {
+    int anchor = qubits[0];
+    for (int j = 1; j < k; j++) {
+        if (mps->last_use[qubits[j]] < mps->last_use[anchor]) {
+            anchor = qubits[j];
+        }
+    }
+
+    // Gate qubits ordered by site, so the nearest ones move first
+    int sorted[MAX_FUSED_QUBITS];
+    for (int j = 0; j < k; j++) {
+        int m = j;
+        sorted[j] = qubits[j];
+        for (; m > 0 && mps->site_of[sorted[m - 1]] > mps->site_of[sorted[m]]; m--) {
+            int temp = sorted[m];
+            sorted[m] = sorted[m - 1];
+            sorted[m - 1] = temp;
+        }
+    }
+
+    int low = mps->site_of[anchor];
+    int high = low;
+    for (int j = 0; j < k; j++) {
+        int q = sorted[j];
+        if (mps->site_of[q] > high) {
+            while (mps->site_of[q] > high + 1) {
+                swap_sites(mps, mps->site_of[q] - 1);
+            }
+            high++;
+        }
+    }
+    for (int j = k - 1; j >= 0; j--) {
+        int q = sorted[j];
+        if (mps->site_of[q] < low) {
+            while (mps->site_of[q] < low - 1) {
+                swap_sites(mps, mps->site_of[q]);
+            }
+            low--;
+        }
+    }
+    return low;
+}
+
+bool mps_apply_gate(MpsState* mps, const Gate* gate) {
+    int k = gate->num_qubits;
+    if (gate->type == PHASE_FLIP || gate->type == MEASURE) {
+        fprintf(stderr, "Error: The MPS backend cannot apply %s gates\n",
+                gate->type == PHASE_FLIP ? "whole-register phase flip" : "measurement");
+        return false;
+    }
+    for (int j = 0; j < k; j++) {
+        bool repeated = false;
+        for (int i = 0; i < j; i++) {
+            repeated = repeated || gate->qubits[i] == gate->qubits[j];
+        }
+        if (gate->qubits[j] < 0 || gate->qubits[j] >= mps->num_qubits || repeated) {
+            fprintf(stderr, "Error: Invalid or repeated qubit %d in MPS gate\n", gate->qubits[j]);
+            return false;
+        }
+    }
+
+    // Swaps only relabel sites
+    if (gate->type == SWAP) {
+        int a = gate->qubits[0];
+        int b = gate->qubits[1];
+        int site_a = mps->site_of[a];
+        mps->site_of[a] = mps->site_of[b];
+        mps->site_of[b] = site_a;
+        mps->qubit_at[mps->site_of[a]] = a;
+        mps->qubit_at[mps->site_of[b]] = b;
+        return true;
+    }
+
+    int dim = 1 << k;
+    ComplexNum* matrix = malloc((size_t)dim * dim * sizeof(ComplexNum));
+    if (!gate_matrix(gate, matrix)) {
+        free(matrix);
+        return false;
+    }
+    mps->clock++;
+
+    if (k == 1) {
+        apply_site_matrix(mps, mps->site_of[gate->qubits[0]], matrix);
+    } else {
+        int first = gather(mps, gate->qubits, k);
+
+        // Reorder the matrix: digit p of a window index (most significant
+        // first) is site first + p, bit j of a gate index is qubits[j]
+        int gate_index[1 << MAX_FUSED_QUBITS];
+        for (int d = 0; d < dim; d++) {
+            gate_index[d] = 0;
+            for (int j = 0; j < k; j++) {
+                int p = mps->site_of[gate->qubits[j]] - first;
+                gate_index[d] |= ((d >> (k - 1 - p)) & 1) << j;
+            }
+        }
+        ComplexNum* window = malloc((size_t)dim * dim * sizeof(ComplexNum));
+        for (int row = 0; row < dim; row++) {
+            for (int col = 0; col < dim; col++) {
+                window[(size_t)row * dim + col] = matrix[(size_t)gate_index[row] * dim + gate_index[col]];
+            }
+        }
+        apply_window(mps, first, k, window);
+        free(window);
+    }
+    for (int j = 0; j < k; j++) {
+        mps->last_use[gate->qubits[j]] = mps->clock;
+    }
+    free(matrix);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Measurement and sampling
+// ---------------------------------------------------------------------------
+
+// Moves the center onto qubit's site and returns the site; with the center
+// there, its entries carry the whole probability of each outcome
+static int site_weights(MpsState* mps, int qubit, double prob[2]) {
+    int site = mps->site_of[qubit];
+    move_center(mps, site);
+
+    int right_bond = mps->bond[site + 1];
+    const ComplexNum* a = mps->sites[site];
+    prob[0] = prob[1] = 0.0;
+    for (int l = 0; l < mps->bond[site]; l++) {
+        for (int s = 0; s < 2; s++) {
+            prob[s] += norm_squared(a + ((size_t)l * 2 + s) * right_bond, right_bond);
+        }
+    }
+    return site;
+}
+
+double mps_probability(MpsState* mps, int qubit) {
+    double prob[2];
+    site_weights(mps, qubit, prob);
+    return prob[1] / (prob[0] + prob[1]);
+}
+
+int mps_measure(MpsState* mps, int qubit, RngState* rng) {
+    double prob[2];
+    int site = site_weights(mps, qubit, prob);
+    int right_bond = mps->bond[site + 1];
+    ComplexNum* a = mps->sites[site];
+
+    int result = rng_uniform(rng) * (prob[0] + prob[1]) >= prob[0] ? 1 : 0;
+    double scale = 1.0 / sqrt(prob[result]);
+    for (int l = 0; l < mps->bond[site]; l++) {
+        for (int s = 0; s < 2; s++) {
+            ComplexNum* row = a + ((size_t)l * 2 + s) * right_bond;
+            for (int r = 0; r < right_bond; r++) {
+                row[r] = s == result ? row[r] * scale : 0.0;
+            }
+        }
+    }
+    return result;
+}
+
+void mps_sample(MpsState* mps, RngState* rng, const int* qubits, int num_qubits, uint64_t shots,
+                size_t* outcomes) {
+    // With every site right-canonical, the sites past the current one sum to
+    // the identity, so each site's conditional distribution needs only the
+    // vector carried over from the sites before it
+    move_center(mps, 0);
+
+    int* position = malloc(mps->num_qubits * sizeof(int));
+    int last = -1;
+    for (int i = 0; i < mps->num_qubits; i++) {
+        position[i] = -1;
+    }
+    for (int j = 0; j < num_qubits; j++) {
+        int site = mps->site_of[qubits[j]];
+        position[site] = j;
+        last = site > last ? site : last;
+    }
+
+    int width = mps_bond_dimension(mps);
+    ComplexNum* carry = malloc(width * sizeof(ComplexNum));
+    ComplexNum* next = malloc(2 * (size_t)width * sizeof(ComplexNum));
+    for (uint64_t shot = 0; shot < shots; shot++) {
+        size_t outcome = 0;
+        carry[0] = 1.0;
+        for (int site = 0; site <= last; site++) {
+            int right_bond = mps->bond[site + 1];
+            memset(next, 0, 2 * (size_t)right_bond * sizeof(ComplexNum));
+            for (int l = 0; l < mps->bond[site]; l++) {
+                const ComplexNum* row = mps->sites[site] + (size_t)l * 2 * right_bond;
+                for (int j = 0; j < 2 * right_bond; j++) {
+                    next[j] += carry[l] * row[j];
+                }
+            }
+            double prob_0 = norm_squared(next, right_bond);
+            double prob_1 = norm_squared(next + right_bond, right_bond);
+            int bit = rng_uniform(rng) * (prob_0 + prob_1) >= prob_0 ? 1 : 0;
+            double scale = 1.0 / sqrt(bit ? prob_1 : prob_0);
+            for (int r = 0; r < right_bond; r++) {
+                carry[r] = next[bit * right_bond + r] * scale;
+            }
+            if (position[site] >= 0) {
+                outcome |= (size_t)bit << position[site];
+            }
+        }
+        outcomes[shot] = outcome;
+    }
+    free(position);
+    free(carry);
+    free(next);
+}
+
+double mps_truncation_error(const MpsState* mps) {
+    return mps->truncation_error;
+}
+
+int mps_bond_dimension(const MpsState* mps) {
+    int largest = 1;
+    for (int i = 1; i < mps->num_qubits; i++) {
+        largest = mps->bond[i] > largest ? mps->bond[i] : largest;
+    }
+    return largest;
+}
@@ -0,0 +1,50 @@
+#ifndef MPS_H
+#define MPS_H
+
+#include <stdbool.h>
+#include "circuit.h"
+#include "rng.h"
+
+// Matrix product state: one tensor per qubit of shape (left bond, 2, right
+// bond), kept in mixed canonical form around one site. Memory and gate cost
+// grow with the bond dimension (the entanglement across a cut) rather than
+// 2^n, so weakly entangled circuits on hundreds of qubits stay cheap.
+//
+// Two-qubit gates contract the neighbouring sites, apply the gate and split
+// them again by SVD, dropping singular values beyond max_bond or below the
+// truncation threshold. Gates on sites that are not neighbours first move
+// their qubits together with swaps; qubits stay where the swaps leave them.
+//
+// States created with create_mps_state use this backend through the regular
+// gate API; the functions below are the backend itself.
+
+MpsState* create_mps(int num_qubits, int max_bond, double truncation_threshold);
+void destroy_mps(MpsState* mps);
+
+// Copies src (tensors, qubit layout, limits and error so far) into dest,
+// which must have the same qubit count
+bool copy_mps(MpsState* dest, const MpsState* src);
+
+// Applies any gate except PHASE_FLIP, which prints an error and returns false
+bool mps_apply_gate(MpsState* mps, const Gate* gate);
+
+// Probability of measuring 1 on qubit. The canonical center moves to its
+// site, so a following one-qubit gate on it may be any (even non-unitary) matrix.
+double mps_probability(MpsState* mps, int qubit);
+
+// Measures qubit in the computational basis and collapses the state
+int mps_measure(MpsState* mps, int qubit, RngState* rng);
+
+// Draws shots samples of qubits[0..num_qubits) without collapsing the state;
+// bit j of outcomes[s] is the result for qubits[j]. Each shot sweeps the
+// sites once, up to the last one holding a sampled qubit.
+void mps_sample(MpsState* mps, RngState* rng, const int* qubits, int num_qubits, uint64_t shots,
+                size_t* outcomes);
+
+// Sum over all SVDs of the weight they discarded: 1 - fidelity is about this much at most
+double mps_truncation_error(const MpsState* mps);
+
+// Largest bond dimension currently in the state
+int mps_bond_dimension(const MpsState* mps);
+
+#endif /* MPS_H */
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "noise.h"
+#include "threadpool.h"
+
+void noise_model_init(NoiseModel* model) {
+    model->rules = NULL;
+    model->num_rules = 0;
+    model->capacity = 0;
+}
+
+void noise_model_free(NoiseModel* model) {
+    free(model->rules);
+    noise_model_init(model);
+}
+
+static bool add_rule(NoiseModel* model, NoiseRule rule) {
+    if (!(rule.probability >= 0.0 && rule.probability <= 1.0)) {
+        fprintf(stderr, "Error: Noise probability %g is outside [0, 1]\n", rule.probability);
+        return false;
+    }
+    if (model->num_rules == model->capacity) {
+        int capacity = model->capacity ? 2 * model->capacity : 4;
+        NoiseRule* grown = realloc(model->rules, capacity * sizeof(NoiseRule));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory for noise rules\n");
+            return false;
+        }
+        model->rules = grown;
+        model->capacity = capacity;
+    }
+    model->rules[model->num_rules++] = rule;
+    return true;
+}
+
+bool noise_model_add_gate_noise(NoiseModel* model, NoiseChannel channel, double probability, int gate_type) {
+    return add_rule(model, (NoiseRule){ channel, probability, false, gate_type });
+}
+
+bool noise_model_add_layer_noise(NoiseModel* model, NoiseChannel channel, double probability) {
+    return add_rule(model, (NoiseRule){ channel, probability, true, NOISE_ANY_GATE });
+}
+
+bool noise_model_supports(const NoiseModel* model, const QuantumState* state) {
+    for (int r = 0; r < model->num_rules; r++) {
+        if (model->rules[r].channel == NOISE_AMPLITUDE_DAMPING && state->backend == BACKEND_STABILIZER) {
+            fprintf(stderr, "Error: Amplitude damping is not a Clifford channel; use another backend\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+void apply_noise_channel(QuantumState* state, NoiseChannel channel, int qubit, double probability) {
+    double u = rng_uniform(&state->rng);
+    switch (channel) {
+        case NOISE_BIT_FLIP:
+            if (u < probability) apply_pauli_x(state, qubit);
+            break;
+        case NOISE_PHASE_FLIP:
+            if (u < probability) apply_pauli_z(state, qubit);
+            break;
+        case NOISE_DEPOLARIZING:
+            // Given an error, u / probability is uniform again and picks the Pauli
+            if (u < probability) {
+                int pauli = (int)(3.0 * u / probability);
+                if (pauli == 0) apply_pauli_x(state, qubit);
+                else if (pauli == 1) apply_pauli_y(state, qubit);
+                else apply_pauli_z(state, qubit);
+            }
+            break;
+        case NOISE_AMPLITUDE_DAMPING: {
+            // Kraus operators K0 = diag(1, sqrt(1 - p)) and K1 = sqrt(p)|0><1|;
+            // K1 fires with probability p * P(1). Either one is applied scaled
+            // so the state stays normalized.
+            double one = qubit_probability(state, qubit);
+            double jump = probability * one;
+            ComplexNum kraus[2][2] = { { 0.0, 0.0 }, { 0.0, 0.0 } };
+            if (u < jump) {
+                kraus[0][1] = 1.0 / sqrt(one);
+            } else {
+                double scale = 1.0 / sqrt(1.0 - jump);
+                kraus[0][0] = scale;
+                kraus[1][1] = sqrt(1.0 - probability) * scale;
+            }
+            apply_single_qubit_unitary(state, qubit, (const ComplexNum (*)[2])kraus);
+            break;
+        }
+    }
+}
+
+static void apply_layer_noise(QuantumState* state, const NoiseModel* model) {
+    for (int r = 0; r < model->num_rules; r++) {
+        const NoiseRule* rule = &model->rules[r];
+        if (rule->per_layer) {
+            for (int q = 0; q < state->num_qubits; q++) {
+                apply_noise_channel(state, rule->channel, q, rule->probability);
+            }
+        }
+    }
+}
+
+// Qubits a gate acts on: its listed ones, or the register of a Fourier transform
+static bool is_fourier_gate(const Gate* gate) {
+    return gate->type == QFT || gate->type == INVERSE_QFT;
+}
+
+static int gate_width(const Gate* gate) {
+    return is_fourier_gate(gate) ? gate->register_size : gate->num_qubits;
+}
+
+static int gate_qubit(const Gate* gate, int j) {
+    return is_fourier_gate(gate) ? gate->first_qubit + j : gate->qubits[j];
+}
+
+static void apply_gate_noise(QuantumState* state, const NoiseModel* model, const Gate* gate) {
+    for (int r = 0; r < model->num_rules; r++) {
+        const NoiseRule* rule = &model->rules[r];
+        bool matches = rule->gate_type == NOISE_ANY_GATE ? gate->type != MEASURE : rule->gate_type == (int)gate->type;
+        if (!rule->per_layer && matches) {
+            for (int j = 0; j < gate_width(gate); j++) {
+                apply_noise_channel(state, rule->channel, gate_qubit(gate, j), rule->probability);
+            }
+        }
+    }
+}
+
+void execute_noisy_circuit(const Circuit* circuit, const NoiseModel* model, QuantumState* state,
+                           int* classical_bits) {
+    if (circuit->num_qubits != state->num_qubits) {
+        fprintf(stderr, "Error: Circuit has %d qubits but state has %d\n", circuit->num_qubits, state->num_qubits);
+        return;
+    }
+    bool layered = false;
+    for (int r = 0; r < model->num_rules; r++) {
+        layered = layered || model->rules[r].per_layer;
+    }
+
+    // layer_of[q] is the last layer with a gate on q; a gate on a qubit of the
+    // current layer closes it. Whole-register phase flips fill a layer alone.
+    int* layer_of = layered ? calloc(state->num_qubits, sizeof(int)) : NULL;
+    int layer = 1;
+    bool layer_empty = true, layer_full = false;
+    if (layered && !layer_of) {
+        fprintf(stderr, "Error: Out of memory tracking circuit layers\n");
+        return;
+    }
+
+    for (size_t g = 0; g < circuit->num_gates; g++) {
+        const Gate* gate = &circuit->gates[g];
+        if (layered) {
+            bool conflict = layer_full || (gate->type == PHASE_FLIP && !layer_empty);
+            for (int j = 0; j < gate_width(gate); j++) {
+                conflict = conflict || layer_of[gate_qubit(gate, j)] == layer;
+            }
+            if (conflict) {
+                apply_layer_noise(state, model);
+                layer++;
+                layer_full = false;
+            }
+            for (int j = 0; j < gate_width(gate); j++) {
+                layer_of[gate_qubit(gate, j)] = layer;
+            }
+            layer_empty = false;
+            layer_full = gate->type == PHASE_FLIP;
+        }
+        apply_gate(state, gate, classical_bits);
+        apply_gate_noise(state, model, gate);
+    }
+    if (layered && !layer_empty) {
+        apply_layer_noise(state, model);
+    }
+    free(layer_of);
+}
+
+// Shared by the workers of one run_trajectories call; each worker owns one
+// copy of the state and claims trajectories until none are left
+typedef struct {
+    QuantumState* initial;
+    QuantumState** copies;
+    uint64_t seed;
+    uint64_t trajectories;
+    atomic_uint_fast64_t next;
+    TrajectoryFn fn;
+    void* ctx;
+    ShotCount* outcomes;
+} TrajectoryRun;
+
+static void trajectory_range(void* ctx, size_t begin, size_t end) {
+    TrajectoryRun* run = ctx;
+    for (size_t w = begin; w < end; w++) {
+        QuantumState* state = run->copies[w];
+        uint64_t t;
+        while ((t = atomic_fetch_add(&run->next, 1)) < run->trajectories) {
+            copy_quantum_state(state, run->initial);
+            rng_seed(&state->rng, run->seed, t);
+            run->outcomes[t].outcome = run->fn(state, run->ctx);
+            run->outcomes[t].count = 1;
+        }
+    }
+}
+
+static int compare_counts(const void* a, const void* b) {
+    size_t x = ((const ShotCount*)a)->outcome;
+    size_t y = ((const ShotCount*)b)->outcome;
+    return (x > y) - (x < y);
+}
+
+bool run_trajectories(QuantumState* initial, uint64_t trajectories, TrajectoryFn fn, void* ctx,
+                      ShotHistogram* histogram) {
+    histogram->counts = NULL;
+    histogram->num_outcomes = 0;
+    histogram->shots = 0;
+    if (trajectories == 0) {
+        return true;
+    }
+
+    // Large state vectors parallelize inside each gate instead
+    uint64_t num_copies = threadpool_num_threads();
+    if (initial->backend == BACKEND_STATE_VECTOR && initial->num_qubits > TRAJECTORY_MAX_PARALLEL_QUBITS) {
+        num_copies = 1;
+    }
+    num_copies = trajectories < num_copies ? trajectories : num_copies;
+
+    TrajectoryRun run = {
+        .initial = initial,
+        .copies = calloc(num_copies, sizeof(QuantumState*)),
+        .seed = rng_next(&initial->rng),
+        .trajectories = trajectories,
+        .fn = fn,
+        .ctx = ctx,
+        .outcomes = malloc(trajectories * sizeof(ShotCount))
+    };
+    atomic_init(&run.next, 0);
+    bool ok = run.copies && run.outcomes;
+    for (uint64_t w = 0; ok && w < num_copies; w++) {
+        ok = (run.copies[w] = clone_quantum_state(initial)) != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory for %llu trajectory states\n", (unsigned long long)num_copies);
+    } else if (num_copies == 1) {
+        trajectory_range(&run, 0, 1);
+    } else {
+        parallel_for_coarse(num_copies, trajectory_range, &run);
+    }
+    for (uint64_t w = 0; run.copies && w < num_copies && run.copies[w]; w++) {
+        destroy_quantum_state(run.copies[w]);
+    }
+    free(run.copies);
+    if (!ok) {
+        free(run.outcomes);
+        return false;
+    }
+
+    // Sort, then merge equal outcomes in place
+    qsort(run.outcomes, trajectories, sizeof(ShotCount), compare_counts);
+    size_t num_outcomes = 0;
+    for (uint64_t t = 0; t < trajectories; t++) {
+        if (num_outcomes > 0 && run.outcomes[num_outcomes - 1].outcome == run.outcomes[t].outcome) {
+            run.outcomes[num_outcomes - 1].count++;
+        } else {
+            run.outcomes[num_outcomes++] = run.outcomes[t];
+        }
+    }
+    ShotCount* shrunk = realloc(run.outcomes, num_outcomes * sizeof(ShotCount));
+    histogram->counts = shrunk ? shrunk : run.outcomes;
+    histogram->num_outcomes = num_outcomes;
+    histogram->shots = trajectories;
+    return true;
+}
+
+typedef struct {
+    const Circuit* circuit;
+    const NoiseModel* model;
+} NoisyCircuit;
+
+static size_t noisy_circuit_trajectory(QuantumState* state, void* ctx) {
+    const NoisyCircuit* noisy = ctx;
+    int bits[64] = { 0 };
+    execute_noisy_circuit(noisy->circuit, noisy->model, state, bits);
+    size_t outcome = 0;
+    for (int b = 0; b < noisy->circuit->num_classical_bits; b++) {
+        outcome |= (size_t)bits[b] << b;
+    }
+    return outcome;
+}
+
+bool run_noisy_circuit(const Circuit* circuit, const NoiseModel* model, QuantumState* initial,
+                       uint64_t trajectories, ShotHistogram* histogram) {
+    histogram->counts = NULL;
+    histogram->num_outcomes = 0;
+    histogram->shots = 0;
+    if (circuit->num_qubits != initial->num_qubits) {
+        fprintf(stderr, "Error: Circuit has %d qubits but state has %d\n", circuit->num_qubits, initial->num_qubits);
+        return false;
+    }
+    if (circuit->num_classical_bits > 64) {
+        fprintf(stderr, "Error: Trajectories count at most 64 classical bits\n");
+        return false;
+    }
+    if (!noise_model_supports(model, initial)) {
+        return false;
+    }
+    NoisyCircuit noisy = { circuit, model };
+    return run_trajectories(initial, trajectories, noisy_circuit_trajectory, &noisy, histogram);
+}
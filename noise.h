@@ -0,0 +1,79 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "circuit.h"
+
+// Noise is simulated with quantum trajectories: every run of a circuit draws
+// which error, if any, each channel applies and keeps a pure state, so the
+// average over many runs matches the noisy density matrix without storing its
+// 4^n entries. Trajectories run on separate copies of the state across the
+// worker threads; trajectory t always draws from random stream t, so results
+// do not depend on the thread count.
+
+typedef enum {
+    NOISE_BIT_FLIP,           // X with probability p
+    NOISE_PHASE_FLIP,         // Z with probability p
+    NOISE_DEPOLARIZING,       // X, Y or Z, each with probability p / 3
+    NOISE_AMPLITUDE_DAMPING   // |1> decays to |0> with probability p (not on stabilizer states)
+} NoiseChannel;
+
+// Gate type of rules that follow every gate except measurements
+#define NOISE_ANY_GATE (-1)
+
+// State vectors larger than this run one trajectory at a time, with each gate
+// spread over the threads instead (and a single copy of the state)
+#define TRAJECTORY_MAX_PARALLEL_QUBITS 20
+
+// One channel attached either to gates or to circuit layers. Gate rules act on
+// each qubit of every matching gate right after it. Layer rules act on every
+// qubit after each layer, a run of consecutive gates on disjoint qubits.
+typedef struct {
+    NoiseChannel channel;
+    double probability;
+    bool per_layer;
+    int gate_type;   // GateType of gate rules, or NOISE_ANY_GATE
+} NoiseRule;
+
+typedef struct {
+    NoiseRule* rules;
+    int num_rules;
+    int capacity;
+} NoiseModel;
+
+void noise_model_init(NoiseModel* model);
+void noise_model_free(NoiseModel* model);
+
+// Both return false after printing an error when probability is outside [0, 1]
+bool noise_model_add_gate_noise(NoiseModel* model, NoiseChannel channel, double probability, int gate_type);
+bool noise_model_add_layer_noise(NoiseModel* model, NoiseChannel channel, double probability);
+
+// Whether every channel of the model can act on state's backend (prints an error if not)
+bool noise_model_supports(const NoiseModel* model, const QuantumState* state);
+
+// Draws one outcome of channel on qubit from the state's random stream and applies it
+void apply_noise_channel(QuantumState* state, NoiseChannel channel, int qubit, double probability);
+
+// Runs one trajectory of the circuit with the model's noise
+void execute_noisy_circuit(const Circuit* circuit, const NoiseModel* model, QuantumState* state,
+                           int* classical_bits);
+
+// Body of one trajectory: receives a fresh copy of the initial state with its
+// own random stream and returns the outcome to count. Runs concurrently with
+// other trajectories, so ctx must only be read.
+typedef size_t (*TrajectoryFn)(QuantumState* state, void* ctx);
+
+// Runs fn on `trajectories` copies of initial and counts the outcomes. The
+// streams derive from initial's random stream, which is the only one that
+// advances. Returns false after printing an error; free the result with
+// free_shot_histogram.
+bool run_trajectories(QuantumState* initial, uint64_t trajectories, TrajectoryFn fn, void* ctx,
+                      ShotHistogram* histogram);
+
+// Runs the noisy circuit once per trajectory from initial and counts its
+// classical bits (bit j of an outcome is classical bit j, at most 64 bits)
+bool run_noisy_circuit(const Circuit* circuit, const NoiseModel* model, QuantumState* initial,
+                       uint64_t trajectories, ShotHistogram* histogram);
+
+#endif /* NOISE_H */
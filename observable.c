@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "observable.h"
+#include "kernels.h"
+#include "profile.h"
+#include "sparse.h"
+#include "threadpool.h"
+
+// A pass is summed in at most this many chunks, each at least
+// REDUCTION_CHUNK pairs; the split depends only on the state size, so the
+// results do not depend on the thread count
+#define MAX_EXPECTATION_CHUNKS 1024
+
+// Amplitude products worked on at a time inside a chunk
+#define PRODUCT_BLOCK 256
+
+// With y = popcount(x_mask & z_mask) Y factors, P|i> = i^y (-1)^|i & z_mask| |i ^ x_mask>,
+// so <P> = sum_i i^y (-1)^|i & z_mask| conj(a[i ^ x_mask]) a[i]. Every term
+// takes the real (y even) or imaginary (y odd) part of the products, negated
+// when y mod 4 is 1 or 2.
+typedef struct {
+    uint64_t z_mask;
+    bool imaginary;
+    bool negate;
+} TermSign;
+
+static TermSign term_sign(const PauliTerm* term) {
+    int y = __builtin_popcountll(term->x_mask & term->z_mask) % 4;
+    return (TermSign){ .z_mask = term->z_mask, .imaginary = y % 2 == 1, .negate = y == 1 || y == 2 };
+}
+
+// v with its sign flipped when bit 0 of flip is set, without a branch (the
+// signs of a term are as good as random, so a branch would mispredict)
+static inline double flip_sign(double v, uint64_t flip) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bits ^= flip << 63;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Parity of every LOW_BITS-bit value
+#define LOW_BITS 10
+static uint8_t low_parity[1 << LOW_BITS];
+
+__attribute__((constructor)) static void fill_low_parity(void) {
+    for (size_t v = 0; v < (1 << LOW_BITS); v++) {
+        low_parity[v] = __builtin_parityll(v);
+    }
+}
+
+// Adds sign * (Re or Im of the products) over a block of indices to sums,
+// with four partial sums per term to keep the additions independent. The
+// indices share their bits from LOW_BITS up (high), so each term's sign is
+// that part's parity, found once, times a table lookup per index.
+static void accumulate_terms(const TermSign* signs, int num_terms, size_t high, const uint16_t* low,
+                             const double* re, const double* im, size_t len, double* sums) {
+    for (int t = 0; t < num_terms; t++) {
+        const double* part = signs[t].imaginary ? im : re;
+        unsigned low_mask = signs[t].z_mask & ((1 << LOW_BITS) - 1);
+        double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+        size_t j = 0;
+        for (; j + 4 <= len; j += 4) {
+            for (int u = 0; u < 4; u++) {
+                sum[u] += flip_sign(part[j + u], low_parity[low[j + u] & low_mask]);
+            }
+        }
+        for (; j < len; j++) {
+            sum[0] += flip_sign(part[j], low_parity[low[j] & low_mask]);
+        }
+        double total = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+        sums[t] += __builtin_parityll(high & signs[t].z_mask) ? -total : total;
+    }
+}
+
+// One pass over a state vector for terms sharing x_mask. A non-zero x_mask
+// pairs i with i ^ x_mask: only the index of each pair with pattern's fixed
+// bit (the highest of x_mask) clear is visited, and the pair's two products
+// are conjugates with the same sign, which doubles the real or imaginary part.
+typedef struct {
+    const ComplexNum* amplitudes;
+    const ComplexFloat* amplitudes_single;
+    IndexPattern pattern;
+    uint64_t x_mask;
+    const TermSign* signs;
+    int num_terms;
+    size_t chunk_size;
+    double* partials;   // num_terms sums per chunk
+} ExpectationPass;
+
+static void expectation_range(void* ctx, size_t begin, size_t end) {
+    ExpectationPass* pass = ctx;
+    uint16_t low[PRODUCT_BLOCK];
+    double re[PRODUCT_BLOCK], im[PRODUCT_BLOCK];
+    for (size_t chunk = begin; chunk < end; chunk++) {
+        double* sums = pass->partials + chunk * pass->num_terms;
+        size_t last = (chunk + 1) * pass->chunk_size;
+        if (last > pass->pattern.count) {
+            last = pass->pattern.count;
+        }
+        memset(sums, 0, pass->num_terms * sizeof(double));
+        for (size_t k = chunk * pass->chunk_size; k < last; k += PRODUCT_BLOCK) {
+            size_t len = last - k < PRODUCT_BLOCK ? last - k : PRODUCT_BLOCK;
+            // conj(a[i ^ x_mask]) * a[i]
+            for (size_t j = 0; j < len; j++) {
+                size_t i = pattern_index(&pass->pattern, k + j);
+                ComplexNum a, b;
+                if (pass->amplitudes_single) {
+                    a = pass->amplitudes_single[i];
+                    b = pass->amplitudes_single[i ^ pass->x_mask];
+                } else {
+                    a = pass->amplitudes[i];
+                    b = pass->amplitudes[i ^ pass->x_mask];
+                }
+                low[j] = i & ((1 << LOW_BITS) - 1);
+                re[j] = creal(b) * creal(a) + cimag(b) * cimag(a);
+                im[j] = creal(b) * cimag(a) - cimag(b) * creal(a);
+            }
+            // Blocks start at multiples of PRODUCT_BLOCK and insert at most one bit
+            size_t high = pattern_index(&pass->pattern, k) & ~(size_t)((1 << LOW_BITS) - 1);
+            accumulate_terms(pass->signs, pass->num_terms, high, low, re, im, len, sums);
+        }
+    }
+}
+
+static bool state_vector_batch(const QuantumState* state, uint64_t x_mask, const TermSign* signs, int num_terms,
+                               double* values) {
+    ExpectationPass pass = {
+        .amplitudes = state->amplitudes,
+        .amplitudes_single = state->amplitudes_single,
+        .x_mask = x_mask,
+        .signs = signs,
+        .num_terms = num_terms
+    };
+    size_t pair_mask = x_mask ? (size_t)1 << (63 - __builtin_clzll(x_mask)) : 0;
+    make_index_pattern(&pass.pattern, state->num_qubits, pair_mask, 0);
+
+    pass.chunk_size = pass.pattern.count / MAX_EXPECTATION_CHUNKS;
+    if (pass.chunk_size < REDUCTION_CHUNK) {
+        pass.chunk_size = REDUCTION_CHUNK;
+    }
+    size_t num_chunks = (pass.pattern.count + pass.chunk_size - 1) / pass.chunk_size;
+    pass.partials = malloc(num_chunks * num_terms * sizeof(double));
+    if (!pass.partials) {
+        fprintf(stderr, "Error: Out of memory for the expectation sums\n");
+        return false;
+    }
+    profile_allocate(1, num_chunks * num_terms * sizeof(double));
+    profile_sweep(state->state_size);
+    parallel_for_coarse(num_chunks, expectation_range, &pass);
+
+    for (int t = 0; t < num_terms; t++) {
+        double sum = 0.0;
+        for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+            sum += pass.partials[chunk * num_terms + t];
+        }
+        values[t] = x_mask ? 2.0 * sum : sum;
+    }
+    free(pass.partials);
+    return true;
+}
+
+// Sparse states sum over their stored entries (in increasing index order),
+// looking up each partner; a block ends where the bits above LOW_BITS change
+static void sparse_batch(const QuantumState* state, const size_t* indices, const ComplexNum* entries, size_t count,
+                         uint64_t x_mask, const TermSign* signs, int num_terms, double* values) {
+    double sums[EXPECTATION_BATCH] = { 0 };
+    uint16_t low[PRODUCT_BLOCK];
+    double re[PRODUCT_BLOCK], im[PRODUCT_BLOCK];
+    profile_sweep(count);
+    for (size_t k = 0; k < count;) {
+        size_t high = indices[k] >> LOW_BITS << LOW_BITS;
+        size_t len = 0;
+        for (; len < PRODUCT_BLOCK && k + len < count && indices[k + len] >> LOW_BITS << LOW_BITS == high; len++) {
+            ComplexNum a = entries[k + len];
+            ComplexNum b = x_mask ? sparse_get(state->sparse, indices[k + len] ^ x_mask) : a;
+            low[len] = indices[k + len] - high;
+            re[len] = creal(b) * creal(a) + cimag(b) * cimag(a);
+            im[len] = creal(b) * cimag(a) - cimag(b) * creal(a);
+        }
+        accumulate_terms(signs, num_terms, high, low, re, im, len, sums);
+        k += len;
+    }
+    memcpy(values, sums, num_terms * sizeof(double));
+}
+
+bool parse_pauli_term(const char* text, PauliTerm* term) {
+    *term = (PauliTerm){ .coefficient = 1.0 };
+    const char* p = text;
+    while (*p) {
+        if (isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        char pauli = toupper((unsigned char)*p++);
+        if (pauli == 'I' && (*p == '\0' || isspace((unsigned char)*p))) {
+            continue;
+        }
+        char* end;
+        long qubit = isdigit((unsigned char)*p) ? strtol(p, &end, 10) : -1;
+        if (!strchr("IXYZ", pauli) || qubit < 0 || qubit >= 64 || (*end && !isspace((unsigned char)*end))) {
+            fprintf(stderr, "Error: Invalid Pauli string '%s' (expected factors such as X0 Z3 Y12)\n", text);
+            return false;
+        }
+        uint64_t bit = (uint64_t)1 << qubit;
+        if ((term->x_mask | term->z_mask) & bit) {
+            fprintf(stderr, "Error: Qubit %ld appears twice in Pauli string '%s'\n", qubit, text);
+            return false;
+        }
+        term->x_mask |= pauli == 'X' || pauli == 'Y' ? bit : 0;
+        term->z_mask |= pauli == 'Z' || pauli == 'Y' ? bit : 0;
+        p = end;
+    }
+    return true;
+}
+
+// Term order by X mask (then by position, to keep the grouping deterministic)
+typedef struct {
+    uint64_t x_mask;
+    size_t index;
+} TermKey;
+
+static int compare_term_keys(const void* a, const void* b) {
+    const TermKey* x = a;
+    const TermKey* y = b;
+    if (x->x_mask != y->x_mask) {
+        return x->x_mask < y->x_mask ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+bool pauli_expectations(const QuantumState* state, const PauliTerm* terms, size_t num_terms,
+                        double* expectations) {
+    PROFILE_SCOPE(PROFILE_EXPECTATION, -1);
+    if (state->backend != BACKEND_STATE_VECTOR && state->backend != BACKEND_SPARSE) {
+        fprintf(stderr, "Error: Expectation values need a state vector or sparse state\n");
+        return false;
+    }
+    for (size_t t = 0; t < num_terms; t++) {
+        if (state->num_qubits < 64 && (terms[t].x_mask | terms[t].z_mask) >> state->num_qubits) {
+            fprintf(stderr, "Error: Pauli term %zu acts on a qubit outside the %d-qubit state\n", t,
+                    state->num_qubits);
+            return false;
+        }
+    }
+
+    TermKey* keys = malloc(num_terms * sizeof(TermKey));
+    size_t* indices = NULL;
+    ComplexNum* entries = NULL;
+    size_t count = state->backend == BACKEND_SPARSE ? sparse_count(state->sparse) : 0;
+    if (count > 0) {
+        indices = malloc(count * sizeof(size_t));
+        entries = malloc(count * sizeof(ComplexNum));
+    }
+    if ((num_terms > 0 && !keys) || (count > 0 && (!indices || !entries))) {
+        fprintf(stderr, "Error: Out of memory for the expectation values\n");
+        free(keys);
+        free(indices);
+        free(entries);
+        return false;
+    }
+    if (count > 0) {
+        sparse_entries(state->sparse, indices, entries);
+    }
+
+    for (size_t t = 0; t < num_terms; t++) {
+        keys[t] = (TermKey){ .x_mask = terms[t].x_mask, .index = t };
+    }
+    qsort(keys, num_terms, sizeof(TermKey), compare_term_keys);
+
+    // Each batch is a run of up to EXPECTATION_BATCH terms with the same X mask
+    bool ok = true;
+    for (size_t first = 0; ok && first < num_terms;) {
+        uint64_t x_mask = keys[first].x_mask;
+        TermSign signs[EXPECTATION_BATCH];
+        double values[EXPECTATION_BATCH];
+        int batch = 0;
+        while (first + batch < num_terms && batch < EXPECTATION_BATCH && keys[first + batch].x_mask == x_mask) {
+            signs[batch] = term_sign(&terms[keys[first + batch].index]);
+            batch++;
+        }
+        if (state->backend == BACKEND_SPARSE) {
+            sparse_batch(state, indices, entries, count, x_mask, signs, batch, values);
+        } else {
+            ok = state_vector_batch(state, x_mask, signs, batch, values);
+        }
+        for (int b = 0; b < batch; b++) {
+            expectations[keys[first + b].index] = signs[b].negate ? -values[b] : values[b];
+        }
+        first += batch;
+    }
+
+    free(keys);
+    free(indices);
+    free(entries);
+    return ok;
+}
+
+bool hamiltonian_expectation(const QuantumState* state, const PauliTerm* terms, size_t num_terms,
+                             double* energy) {
+    double* values = malloc((num_terms > 0 ? num_terms : 1) * sizeof(double));
+    if (!values) {
+        fprintf(stderr, "Error: Out of memory for the expectation values\n");
+        return false;
+    }
+    bool ok = pauli_expectations(state, terms, num_terms, values);
+    if (ok) {
+        *energy = 0.0;
+        for (size_t t = 0; t < num_terms; t++) {
+            *energy += terms[t].coefficient * values[t];
+        }
+    }
+    free(values);
+    return ok;
+}
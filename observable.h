@@ -0,0 +1,47 @@
+#ifndef OBSERVABLE_H
+#define OBSERVABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "quantum.h"
+
+// Expectation values of Pauli-string observables, read from the amplitudes
+// without measuring, copying or changing the state.
+//
+// A Pauli string P maps |i> to a phase times |i ^ x_mask>, so <P> only pairs
+// amplitudes that differ by x_mask. Terms are grouped by their X mask (X or Y
+// on a qubit) and every pass over the state evaluates up to
+// EXPECTATION_BATCH terms of one group from the same amplitude products; the
+// terms differ only in the sign their Z mask gives each index. A Hamiltonian
+// of diagonal terms (Z strings) therefore costs one pass per batch.
+// State vectors (either precision) and sparse states are supported.
+
+// Terms evaluated per pass over the state
+#define EXPECTATION_BATCH 32
+
+// Tensor product of single-qubit Paulis: qubit q carries X when only bit q
+// of x_mask is set, Z when only bit q of z_mask is set, Y when both are, and
+// the identity otherwise
+typedef struct {
+    uint64_t x_mask;
+    uint64_t z_mask;
+    double coefficient;   // weight of the term in a Hamiltonian
+} PauliTerm;
+
+// Parses whitespace-separated factors such as "X0 Z3 Y12" (qubit numbers
+// after the Pauli letter; "I" or an empty string is the identity) into term
+// with coefficient 1. Returns false after printing an error.
+bool parse_pauli_term(const char* text, PauliTerm* term);
+
+// Writes <P> for each of the num_terms terms into expectations (coefficients
+// are ignored). Returns false after printing an error when the backend has no
+// amplitudes or a term acts on a qubit outside the state.
+bool pauli_expectations(const QuantumState* state, const PauliTerm* terms, size_t num_terms,
+                        double* expectations);
+
+// Sum of coefficient * <P> over the terms, in *energy
+bool hamiltonian_expectation(const QuantumState* state, const PauliTerm* terms, size_t num_terms,
+                             double* energy);
+
+#endif /* OBSERVABLE_H */
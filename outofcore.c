@@ -0,0 +1,826 @@
+#define _GNU_SOURCE   // O_DIRECT, fallocate
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "outofcore.h"
+#include "kernels.h"
+#include "profile.h"
+#include "threadpool.h"
+
+// Direct I/O moves blocks of this size, at offsets and addresses aligned to it
+#define DIRECT_IO_ALIGNMENT 4096
+
+// Transfers the I/O thread can have queued
+#define IO_QUEUE 4
+
+// Once a gate has been deferred, a pass looks at most this many gates further
+#define SCHEDULE_LOOKAHEAD 4096
+
+// The chunks of each group of a pass, as bits of the chunk index (a high
+// qubit q is bit q - chunk_qubits): bit i of a chunk's place in its group is
+// chunk bit high[i], and bit r of the group number is chunk bit rest[r]
+typedef struct {
+    int num_high;
+    int high[MAX_QUBITS];
+    int num_rest;
+    int rest[MAX_QUBITS];
+} GroupLayout;
+
+typedef struct {
+    bool write;
+    size_t group;
+    int slot;
+    const GroupLayout* layout;
+} IoRequest;
+
+struct OutOfCoreState {
+    int num_qubits;
+    Precision precision;
+    int chunk_qubits;
+    int buffer_qubits;
+    size_t chunk_bytes;
+    int fd;
+    void* slots[OUT_OF_CORE_SLOTS];
+    RngState rng;
+    OutOfCoreStats stats;
+
+    // I/O thread: requests [completed, submitted) wait in queue and run in order
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    IoRequest queue[IO_QUEUE];
+    uint64_t submitted;
+    uint64_t completed;
+    int error;      // errno of the first failed transfer, 0 if none
+    bool stopping;
+};
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// Reads or writes all of bytes at offset, retrying short transfers and interruptions
+static bool transfer_all(int fd, bool writing, char* data, size_t bytes, off_t offset) {
+    while (bytes > 0) {
+        ssize_t done = writing ? pwrite(fd, data, bytes, offset) : pread(fd, data, bytes, offset);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            if (done == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        data += done;
+        bytes -= (size_t)done;
+        offset += done;
+    }
+    return true;
+}
+
+static size_t group_chunk(const GroupLayout* layout, size_t group, size_t place) {
+    size_t chunk = 0;
+    for (int i = 0; i < layout->num_high; i++) {
+        chunk |= ((place >> i) & 1) << layout->high[i];
+    }
+    for (int r = 0; r < layout->num_rest; r++) {
+        chunk |= ((group >> r) & 1) << layout->rest[r];
+    }
+    return chunk;
+}
+
+static void* io_thread(void* arg) {
+    OutOfCoreState* state = arg;
+    pthread_mutex_lock(&state->lock);
+    while (true) {
+        while (state->completed == state->submitted && !state->stopping) {
+            pthread_cond_wait(&state->changed, &state->lock);
+        }
+        if (state->completed == state->submitted) {
+            break;
+        }
+        IoRequest request = state->queue[state->completed % IO_QUEUE];
+        bool skip = state->error != 0;
+        pthread_mutex_unlock(&state->lock);
+
+        // After a failure the remaining requests only complete
+        int error = 0;
+        size_t chunks = (size_t)1 << request.layout->num_high;
+        char* buffer = state->slots[request.slot];
+        for (size_t j = 0; j < chunks && !skip && !error; j++) {
+            off_t offset = (off_t)(group_chunk(request.layout, request.group, j) * state->chunk_bytes);
+            if (!transfer_all(state->fd, request.write, buffer + j * state->chunk_bytes, state->chunk_bytes, offset)) {
+                error = errno;
+            }
+        }
+
+        pthread_mutex_lock(&state->lock);
+        if (!skip && !error) {
+            uint64_t bytes = (uint64_t)chunks * state->chunk_bytes;
+            if (request.write) {
+                state->stats.bytes_written += bytes;
+            } else {
+                state->stats.bytes_read += bytes;
+            }
+        }
+        if (error && !state->error) {
+            state->error = error;
+        }
+        state->completed++;
+        pthread_cond_broadcast(&state->changed);
+    }
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+// Queues a transfer of one group between the file and a slot; returns its ticket
+static uint64_t submit(OutOfCoreState* state, bool write, size_t group, int slot, const GroupLayout* layout) {
+    pthread_mutex_lock(&state->lock);
+    while (state->submitted - state->completed == IO_QUEUE) {
+        pthread_cond_wait(&state->changed, &state->lock);
+    }
+    state->queue[state->submitted % IO_QUEUE] = (IoRequest){ write, group, slot, layout };
+    uint64_t ticket = state->submitted++;
+    pthread_cond_broadcast(&state->changed);
+    pthread_mutex_unlock(&state->lock);
+    return ticket;
+}
+
+// Waits for the transfers up to and including ticket; false if any transfer failed
+static bool wait_for(OutOfCoreState* state, uint64_t ticket) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&state->lock);
+    while (state->completed <= ticket) {
+        pthread_cond_wait(&state->changed, &state->lock);
+    }
+    bool ok = state->error == 0;
+    pthread_mutex_unlock(&state->lock);
+    state->stats.io_wait_seconds += seconds_since(&start);
+    return ok;
+}
+
+typedef bool (*GroupFn)(QuantumState* group_state, size_t group, void* ctx);
+
+// One pass over the file: every group of layout is read into a slot, handed
+// to compute as a state vector and, with write_back, written back. The next
+// group is read and the previous one written while compute runs.
+static bool run_pass(OutOfCoreState* state, const GroupLayout* layout, bool write_back, GroupFn compute, void* ctx) {
+    PROFILE_SCOPE(PROFILE_DISK_PASS, -1);
+    profile_sweep((size_t)1 << state->num_qubits);
+    int group_qubits = state->chunk_qubits + layout->num_high;
+    QuantumState group_state = {
+        .num_qubits = group_qubits,
+        .state_size = (size_t)1 << group_qubits,
+        .backend = BACKEND_STATE_VECTOR,
+        .precision = state->precision
+    };
+    size_t num_groups = (size_t)1 << layout->num_rest;
+
+    // A slot is read again only after the write queued before that read
+    uint64_t next = submit(state, false, 0, 0, layout);
+    bool ok = true;
+    for (size_t g = 0; g < num_groups && ok; g++) {
+        ok = wait_for(state, next);
+        if (!ok) {
+            break;
+        }
+        if (g + 1 < num_groups) {
+            next = submit(state, false, g + 1, (g + 1) % OUT_OF_CORE_SLOTS, layout);
+        }
+        void* buffer = state->slots[g % OUT_OF_CORE_SLOTS];
+        if (state->precision == PRECISION_SINGLE) {
+            group_state.amplitudes_single = buffer;
+        } else {
+            group_state.amplitudes = buffer;
+        }
+        ok = compute(&group_state, g, ctx);
+        if (ok && write_back) {
+            submit(state, true, g, g % OUT_OF_CORE_SLOTS, layout);
+        }
+    }
+
+    // The layout must outlive the queued transfers
+    if (state->submitted > 0 && !wait_for(state, state->submitted - 1)) {
+        fprintf(stderr, "Error: Out-of-core state transfer failed: %s\n", strerror(state->error));
+        ok = false;
+    }
+    state->stats.passes++;
+    return ok;
+}
+
+// Numbers the qubits for a pass loading the high qubits in mask high: chunk
+// qubits keep their number, the loaded high qubits follow in order, then the
+// others, so that bit r above the group qubits is bit r of the group number
+static void make_layout(const OutOfCoreState* state, uint64_t high, GroupLayout* layout, int* position) {
+    int chunk_qubits = state->chunk_qubits;
+    layout->num_high = 0;
+    layout->num_rest = 0;
+    for (int q = 0; q < chunk_qubits; q++) {
+        position[q] = q;
+    }
+    for (int q = chunk_qubits; q < state->num_qubits; q++) {
+        if ((high >> q) & 1) {
+            position[q] = chunk_qubits + layout->num_high;
+            layout->high[layout->num_high++] = q - chunk_qubits;
+        }
+    }
+    for (int q = chunk_qubits; q < state->num_qubits; q++) {
+        if (!((high >> q) & 1)) {
+            position[q] = chunk_qubits + layout->num_high + layout->num_rest;
+            layout->rest[layout->num_rest++] = q - chunk_qubits;
+        }
+    }
+}
+
+typedef struct {
+    const QuantumState* state;
+    IndexPattern pattern;
+} WeightSweep;
+
+static double weight_range(void* ctx, size_t begin, size_t end) {
+    WeightSweep* sweep = ctx;
+    if (sweep->state->precision == PRECISION_SINGLE) {
+        return kernel_norm_squared_single(sweep->state->amplitudes_single, &sweep->pattern, begin, end);
+    }
+    return kernel_norm_squared(sweep->state->amplitudes, &sweep->pattern, begin, end);
+}
+
+// Sum of |a_i|^2 over the indices with i & fixed_mask == set_mask
+static double group_weight(const QuantumState* group_state, size_t fixed_mask, size_t set_mask) {
+    WeightSweep sweep = { .state = group_state };
+    make_index_pattern(&sweep.pattern, group_state->num_qubits, fixed_mask, set_mask);
+    return parallel_sum(sweep.pattern.count, weight_range, &sweep);
+}
+
+// Qubits gate acts on
+static uint64_t gate_qubit_mask(const Gate* gate, int num_qubits) {
+    if (gate->type == PHASE_FLIP) {
+        return ((uint64_t)1 << num_qubits) - 1;
+    }
+    if (gate->type == QFT || gate->type == INVERSE_QFT) {
+        return (((uint64_t)1 << gate->register_size) - 1) << gate->first_qubit;
+    }
+    uint64_t mask = 0;
+    for (int j = 0; j < gate->num_qubits; j++) {
+        mask |= (uint64_t)1 << gate->qubits[j];
+    }
+    return mask;
+}
+
+// High qubits gate needs inside a group. A Fourier transform also takes the
+// high qubits below its register, so the register stays contiguous in the group.
+static uint64_t high_targets(const Gate* gate, int chunk_qubits) {
+    uint64_t mask = 0;
+    if (gate->type == QFT || gate->type == INVERSE_QFT) {
+        int end = gate->first_qubit + gate->register_size;
+        return end > chunk_qubits ? (((uint64_t)1 << end) - 1) & ~(((uint64_t)1 << chunk_qubits) - 1) : 0;
+    }
+    for (int j = 0; j < gate->num_qubits; j++) {
+        if (gate->qubits[j] >= chunk_qubits && gate_needs_local(gate, j)) {
+            mask |= (uint64_t)1 << gate->qubits[j];
+        }
+    }
+    return mask;
+}
+
+typedef struct {
+    size_t* gates;      // indices into the circuit, in circuit order
+    size_t num_gates;
+    uint64_t high;      // high qubits loaded with the chunks
+    size_t measure;     // measurement whose weights the pass collects, or SIZE_MAX
+} PassPlan;
+
+// Chooses the gates of the next pass, scanning from the first pending one. A
+// gate joins when its high targets fit beside those already chosen;
+// otherwise it is deferred, and so is every later gate sharing a qubit with
+// a deferred one, which keeps the order of the gates on each qubit. The next
+// measurement can join unless it is deferred: the pass collects its weights,
+// and its collapse must come before any later gate on the qubit.
+static void plan_pass(const Circuit* circuit, const bool* done, size_t first, int chunk_qubits, int max_high,
+                      PassPlan* plan) {
+    uint64_t all = ((uint64_t)1 << circuit->num_qubits) - 1;
+    uint64_t blocked = 0;
+    bool measure_seen = false;   // measurements draw their outcomes in circuit order
+    size_t scanned = 0;
+    plan->num_gates = 0;
+    plan->high = 0;
+    plan->measure = SIZE_MAX;
+
+    for (size_t g = first; g < circuit->num_gates && blocked != all && scanned <= SCHEDULE_LOOKAHEAD; g++) {
+        if (done[g]) {
+            continue;
+        }
+        scanned += blocked != 0;
+        const Gate* gate = &circuit->gates[g];
+        uint64_t qubits = gate_qubit_mask(gate, circuit->num_qubits);
+        if (qubits & blocked) {
+            blocked |= qubits;
+            measure_seen = measure_seen || gate->type == MEASURE;
+            continue;
+        }
+        if (gate->type == MEASURE) {
+            if (!measure_seen) {
+                plan->measure = g;
+            }
+            measure_seen = true;
+            blocked |= qubits;
+            continue;
+        }
+        uint64_t high = plan->high | high_targets(gate, chunk_qubits);
+        if (__builtin_popcountll(high) <= max_high) {
+            plan->high = high;
+            plan->gates[plan->num_gates++] = g;
+        } else {
+            blocked |= qubits;
+        }
+    }
+}
+
+// Copy of gate with its qubits renumbered for the groups of a pass
+static Gate group_gate(const Gate* gate, const int* position, int num_qubits) {
+    Gate mapped = *gate;
+    for (int j = 0; j < gate->num_qubits; j++) {
+        mapped.qubits[j] = position[gate->qubits[j]];
+    }
+    if (gate->type == QFT || gate->type == INVERSE_QFT) {
+        mapped.first_qubit = position[gate->first_qubit];
+    }
+    if (gate->type == PHASE_FLIP) {
+        mapped.basis_state = 0;
+        for (int q = 0; q < num_qubits; q++) {
+            if ((gate->basis_state >> q) & 1) {
+                mapped.basis_state |= (size_t)1 << position[q];
+            }
+        }
+    }
+    return mapped;
+}
+
+typedef struct {
+    Gate* gates;        // renumbered gates of the pass
+    size_t num_gates;
+    int group_qubits;
+    int measured;       // renumbered qubit whose outcome weights are collected, or -1
+    double weights[2];  // total |a|^2 with the measured qubit 0 and 1
+    Circuit* scratch;
+    DiagonalBatch constant;
+} PassJob;
+
+static bool run_group(QuantumState* group_state, size_t group, void* ctx) {
+    // The gates on each group belong to the pass being recorded
+    PROFILE_QUIET_SCOPE();
+    PassJob* job = ctx;
+    double angle = 0.0;
+    job->scratch->num_gates = 0;
+    for (size_t g = 0; g < job->num_gates; g++) {
+        Gate gate = job->gates[g];
+        if (gate.type == PHASE_FLIP) {
+            // The flipped amplitude lies in one group
+            if ((gate.basis_state >> job->group_qubits) != group) {
+                continue;
+            }
+            gate.basis_state &= group_state->state_size - 1;
+        }
+        append_tile_gate(job->scratch, &gate, group, job->group_qubits, &angle);
+    }
+    execute_circuit_blocked(job->scratch, group_state, NULL, 0);
+    if (angle != 0.0) {
+        job->constant.global_angle = angle;
+        diagonal_batch_apply(group_state, &job->constant);
+    }
+
+    if (job->measured >= job->group_qubits) {
+        job->weights[(group >> (job->measured - job->group_qubits)) & 1] += group_weight(group_state, 0, 0);
+    } else if (job->measured >= 0) {
+        size_t mask = (size_t)1 << job->measured;
+        job->weights[0] += group_weight(group_state, mask, 0);
+        job->weights[1] += group_weight(group_state, mask, mask);
+    }
+    return true;
+}
+
+// Draws the outcome of a measurement from the weights its pass collected and
+// turns the gate into the projection onto that outcome, which a later pass
+// applies like any other gate
+static bool record_measurement(OutOfCoreState* state, Gate* gate, const double weights[2], int* classical_bits) {
+    ComplexNum* projection = calloc(4, sizeof(ComplexNum));
+    if (!projection) {
+        fprintf(stderr, "Error: Out of memory recording a measurement\n");
+        return false;
+    }
+    int result = rng_uniform(&state->rng) * (weights[0] + weights[1]) > weights[0] ? 1 : 0;
+    projection[result ? 3 : 0] = 1.0 / sqrt(weights[result]);
+    if (classical_bits) {
+        classical_bits[gate->classical_bit] = result;
+    }
+    gate->type = UNITARY;
+    gate->matrix = projection;
+    return true;
+}
+
+bool execute_circuit_out_of_core(const Circuit* circuit, OutOfCoreState* state, int* classical_bits) {
+    if (circuit->num_qubits != state->num_qubits) {
+        fprintf(stderr, "Error: Circuit has %d qubits but the state has %d\n",
+                circuit->num_qubits, state->num_qubits);
+        return false;
+    }
+
+    Circuit* work = expand_transforms(circuit, state->buffer_qubits);
+    size_t num_gates = work ? work->num_gates : 0;
+    bool* done = calloc(num_gates + 1, sizeof(bool));
+    PassPlan plan = { .gates = malloc((num_gates + 1) * sizeof(size_t)) };
+    PassJob job = { .gates = malloc((num_gates + 1) * sizeof(Gate)) };
+    diagonal_batch_init(&job.constant);
+    bool ok = work && done && plan.gates && job.gates;
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory scheduling %zu gates\n", circuit->num_gates);
+    }
+
+    int max_high = state->buffer_qubits - state->chunk_qubits;
+    size_t first = 0;
+    while (ok) {
+        while (first < num_gates && done[first]) {
+            first++;
+        }
+        if (first == num_gates) {
+            break;
+        }
+        plan_pass(work, done, first, state->chunk_qubits, max_high, &plan);
+        if (plan.num_gates == 0 && plan.measure == SIZE_MAX) {
+            fprintf(stderr, "Error: Gate %zu needs more qubits than the out-of-core buffers hold\n", first + 1);
+            ok = false;
+            break;
+        }
+
+        GroupLayout layout;
+        int position[MAX_QUBITS];
+        make_layout(state, plan.high, &layout, position);
+        job.group_qubits = state->chunk_qubits + layout.num_high;
+        job.num_gates = plan.num_gates;
+        for (size_t i = 0; i < plan.num_gates; i++) {
+            job.gates[i] = group_gate(&work->gates[plan.gates[i]], position, state->num_qubits);
+            done[plan.gates[i]] = true;
+        }
+        job.measured = plan.measure != SIZE_MAX ? position[work->gates[plan.measure].qubits[0]] : -1;
+        job.weights[0] = 0.0;
+        job.weights[1] = 0.0;
+        job.scratch = create_circuit(job.group_qubits);
+
+        // A pass that only measures leaves the file as it is
+        ok = run_pass(state, &layout, plan.num_gates > 0, run_group, &job);
+        job.scratch->num_gates = 0;
+        destroy_circuit(job.scratch);
+        if (ok && plan.measure != SIZE_MAX) {
+            ok = record_measurement(state, &work->gates[plan.measure], job.weights, classical_bits);
+        }
+    }
+
+    diagonal_batch_free(&job.constant);
+    free(job.gates);
+    free(plan.gates);
+    free(done);
+    if (work) {
+        destroy_circuit(work);
+    }
+    return ok;
+}
+
+typedef struct {
+    ChunkVisitor visit;
+    void* ctx;
+} VisitJob;
+
+static bool visit_group(QuantumState* group_state, size_t group, void* ctx) {
+    PROFILE_QUIET_SCOPE();
+    VisitJob* job = ctx;
+    return job->visit(group_state, group << group_state->num_qubits, job->ctx);
+}
+
+bool visit_out_of_core_chunks(OutOfCoreState* state, ChunkVisitor visit, void* ctx) {
+    GroupLayout layout;
+    int position[MAX_QUBITS];
+    make_layout(state, 0, &layout, position);
+    VisitJob job = { visit, ctx };
+    return run_pass(state, &layout, false, visit_group, &job);
+}
+
+static bool total_chunk(const QuantumState* chunk, size_t first_index, void* ctx) {
+    double* totals = ctx;
+    totals[first_index >> chunk->num_qubits] = group_weight(chunk, 0, 0);
+    return true;
+}
+
+static inline double probability_at(const OutOfCoreState* state, size_t index) {
+    if (state->precision == PRECISION_SINGLE) {
+        ComplexFloat a = ((const ComplexFloat*)state->slots[0])[index];
+        return (double)crealf(a) * crealf(a) + (double)cimagf(a) * cimagf(a);
+    }
+    ComplexNum a = ((const ComplexNum*)state->slots[0])[index];
+    return creal(a) * creal(a) + cimag(a) * cimag(a);
+}
+
+static int compare_outcomes(const void* a, const void* b) {
+    size_t x = *(const size_t*)a;
+    size_t y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+bool sample_out_of_core_shots(OutOfCoreState* state, uint64_t shots, const int* qubits, int num_qubits,
+                              ShotHistogram* histogram) {
+    PROFILE_SCOPE(PROFILE_SAMPLE, -1);
+    histogram->counts = NULL;
+    histogram->num_outcomes = 0;
+    histogram->shots = 0;
+    if (num_qubits < 1 || num_qubits > state->num_qubits || num_qubits > 64) {
+        fprintf(stderr, "Error: Cannot sample %d qubits of a %d-qubit state\n", num_qubits, state->num_qubits);
+        return false;
+    }
+    for (int j = 0; j < num_qubits; j++) {
+        bool repeated = false;
+        for (int k = 0; k < j; k++) {
+            repeated = repeated || qubits[k] == qubits[j];
+        }
+        if (qubits[j] < 0 || qubits[j] >= state->num_qubits || repeated) {
+            fprintf(stderr, "Error: Invalid or repeated qubit %d in sample\n", qubits[j]);
+            return false;
+        }
+    }
+
+    size_t num_chunks = (size_t)1 << (state->num_qubits - state->chunk_qubits);
+    size_t chunk_size = (size_t)1 << state->chunk_qubits;
+    double* totals = malloc(num_chunks * sizeof(double));
+    size_t* outcomes = malloc(shots * sizeof(size_t));
+    if (!totals || !outcomes) {
+        fprintf(stderr, "Error: Out of memory for %llu shots\n", (unsigned long long)shots);
+        free(totals);
+        free(outcomes);
+        return false;
+    }
+    bool ok = visit_out_of_core_chunks(state, total_chunk, totals);
+    double total = 0.0;
+    for (size_t c = 0; c < num_chunks; c++) {
+        total += totals[c];
+    }
+
+    // Ascending draws as in sample_shots, so each chunk that receives shots
+    // is read once
+    double remaining = 1.0;
+    size_t chunk = 0;
+    size_t loaded = SIZE_MAX;
+    size_t index = 0;
+    double chunk_start = 0.0;   // probability of the chunks before `chunk`
+    double cumulative = 0.0;    // probability of the amplitudes before `index`
+    for (uint64_t s = 0; s < shots && ok; s++) {
+        remaining *= pow(rng_uniform_open(&state->rng), 1.0 / (double)(shots - s));
+        double position = total * (1.0 - remaining);
+        while (chunk + 1 < num_chunks && chunk_start + totals[chunk] <= position) {
+            chunk_start += totals[chunk];
+            chunk++;
+        }
+        if (loaded != chunk) {
+            ok = transfer_all(state->fd, false, state->slots[0], state->chunk_bytes,
+                              (off_t)(chunk * state->chunk_bytes));
+            if (!ok) {
+                fprintf(stderr, "Error: Out-of-core state transfer failed: %s\n", strerror(errno));
+                break;
+            }
+            state->stats.bytes_read += state->chunk_bytes;
+            loaded = chunk;
+            index = 0;
+            cumulative = chunk_start;
+        }
+
+        // Rounding at the chunk end falls back to its last non-zero amplitude
+        double p = probability_at(state, index);
+        while (index + 1 < chunk_size && (cumulative + p <= position || p == 0.0)) {
+            cumulative += p;
+            index++;
+            p = probability_at(state, index);
+        }
+        while (p == 0.0 && index > 0) {
+            index--;
+            p = probability_at(state, index);
+            cumulative -= p;
+        }
+        size_t basis_state = (chunk << state->chunk_qubits) | index;
+        outcomes[s] = 0;
+        for (int j = 0; j < num_qubits; j++) {
+            outcomes[s] |= ((basis_state >> qubits[j]) & 1) << j;
+        }
+    }
+    free(totals);
+
+    size_t num_outcomes = 0;
+    if (ok) {
+        qsort(outcomes, shots, sizeof(size_t), compare_outcomes);
+        for (uint64_t s = 0; s < shots; s++) {
+            num_outcomes += s == 0 || outcomes[s] != outcomes[s - 1];
+        }
+        histogram->counts = malloc(num_outcomes * sizeof(ShotCount));
+        if (!histogram->counts) {
+            fprintf(stderr, "Error: Out of memory for the shot histogram\n");
+            ok = false;
+        }
+    }
+    for (uint64_t s = 0; ok && s < shots; s++) {
+        if (s > 0 && outcomes[s] == outcomes[s - 1]) {
+            histogram->counts[histogram->num_outcomes - 1].count++;
+        } else {
+            histogram->counts[histogram->num_outcomes++] = (ShotCount){ outcomes[s], 1 };
+        }
+    }
+    free(outcomes);
+    histogram->shots = ok ? shots : 0;
+    return ok;
+}
+
+// Half of the physical memory, or 1 GiB when it cannot be found
+static size_t default_memory(void) {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return (size_t)1 << 30;
+    }
+    return (size_t)pages * (size_t)page_size / 2;
+}
+
+static int default_chunk_qubits(void) {
+    const char* env = getenv("QSIM_CHUNK_QUBITS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+    return OUT_OF_CORE_CHUNK_QUBITS;
+}
+
+// Creates the state file in directory and reserves its space; returns the
+// descriptor, or -1 after printing an error
+static int create_state_file(const char* directory, int num_qubits, size_t element_size, size_t chunk_bytes) {
+    size_t length = strlen(directory) + sizeof("/qsim-state-XXXXXX");
+    char* path = malloc(length);
+    if (!path) {
+        fprintf(stderr, "Error: Out of memory creating a state file\n");
+        return -1;
+    }
+    snprintf(path, length, "%s/qsim-state-XXXXXX", directory);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create a state file in %s: %s\n", directory, strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    // Direct I/O keeps the state out of the page cache, which it would only
+    // thrash; file systems without it use the cache
+    if (chunk_bytes % DIRECT_IO_ALIGNMENT == 0) {
+        int direct = open(path, O_RDWR | O_DIRECT);
+        if (direct >= 0) {
+            close(fd);
+            fd = direct;
+        }
+    }
+    unlink(path);
+    free(path);
+
+    // Reserved space reads as zeros; without fallocate the file is sparse
+    off_t bytes = (off_t)(element_size << num_qubits);
+    int error = fallocate(fd, 0, 0, bytes) == 0 ? 0 : errno;
+    if (error == EOPNOTSUPP) {
+        error = ftruncate(fd, bytes) == 0 ? 0 : errno;
+    }
+    if (error) {
+        fprintf(stderr, "Error: Cannot reserve %.1f GiB for a %d-qubit state in %s: %s\n",
+                bytes / 1073741824.0, num_qubits, directory, strerror(error));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+OutOfCoreState* create_out_of_core_state(int num_qubits, Precision precision, const char* directory,
+                                         size_t memory_bytes) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    if (num_qubits < 1 || num_qubits > MAX_QUBITS) {
+        fprintf(stderr, "Error: Number of qubits must be between 1 and %d\n", MAX_QUBITS);
+        return NULL;
+    }
+    size_t element_size = precision == PRECISION_SINGLE ? sizeof(ComplexFloat) : sizeof(ComplexNum);
+    if (memory_bytes == 0) {
+        memory_bytes = default_memory();
+    }
+
+    // The largest buffers that fit, with chunks small enough that the targets
+    // of any gate fit in a group
+    int buffer_qubits = 0;
+    while (buffer_qubits < num_qubits && OUT_OF_CORE_SLOTS * (element_size << (buffer_qubits + 1)) <= memory_bytes) {
+        buffer_qubits++;
+    }
+    int chunk_qubits = default_chunk_qubits();
+    if (chunk_qubits > buffer_qubits - MAX_FUSED_QUBITS) {
+        chunk_qubits = buffer_qubits - MAX_FUSED_QUBITS;
+    }
+    if (chunk_qubits < 1) {
+        chunk_qubits = 1;
+    }
+    if (chunk_qubits > num_qubits) {
+        chunk_qubits = num_qubits;
+    }
+    int widest = num_qubits - chunk_qubits < MAX_FUSED_QUBITS ? num_qubits : chunk_qubits + MAX_FUSED_QUBITS;
+    if (buffer_qubits < widest) {
+        fprintf(stderr, "Error: %.1f MiB of memory is too little for out-of-core buffers (%d qubits need %.1f MiB)\n",
+                memory_bytes / 1048576.0, num_qubits, OUT_OF_CORE_SLOTS * (element_size << widest) / 1048576.0);
+        return NULL;
+    }
+
+    OutOfCoreState* state = calloc(1, sizeof(OutOfCoreState));
+    if (!state) {
+        fprintf(stderr, "Error: Out of memory for an out-of-core state\n");
+        return NULL;
+    }
+    state->num_qubits = num_qubits;
+    state->precision = precision;
+    state->chunk_qubits = chunk_qubits;
+    state->buffer_qubits = buffer_qubits;
+    state->chunk_bytes = element_size << chunk_qubits;
+    size_t slot_bytes = element_size << buffer_qubits;
+    bool ok = true;
+    for (int s = 0; s < OUT_OF_CORE_SLOTS; s++) {
+        ok = ok && posix_memalign(&state->slots[s], DIRECT_IO_ALIGNMENT, slot_bytes) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Could not allocate %.1f MiB of out-of-core buffers\n",
+                OUT_OF_CORE_SLOTS * slot_bytes / 1048576.0);
+    }
+    profile_allocate(OUT_OF_CORE_SLOTS, OUT_OF_CORE_SLOTS * slot_bytes);
+
+    // |0...0>: the reserved file is zero apart from the first amplitude
+    state->fd = ok ? create_state_file(directory, num_qubits, element_size, state->chunk_bytes) : -1;
+    if (state->fd >= 0) {
+        memset(state->slots[0], 0, state->chunk_bytes);
+        if (precision == PRECISION_SINGLE) {
+            ((ComplexFloat*)state->slots[0])[0] = 1.0f;
+        } else {
+            ((ComplexNum*)state->slots[0])[0] = 1.0;
+        }
+        ok = transfer_all(state->fd, true, state->slots[0], state->chunk_bytes, 0);
+        if (!ok) {
+            fprintf(stderr, "Error: Cannot write the state file: %s\n", strerror(errno));
+        }
+    }
+    ok = ok && state->fd >= 0;
+
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->changed, NULL);
+    if (ok && pthread_create(&state->thread, NULL, io_thread, state) != 0) {
+        fprintf(stderr, "Error: Could not start the out-of-core I/O thread\n");
+        ok = false;
+    }
+    if (!ok) {
+        if (state->fd >= 0) {
+            close(state->fd);
+        }
+        pthread_mutex_destroy(&state->lock);
+        pthread_cond_destroy(&state->changed);
+        for (int s = 0; s < OUT_OF_CORE_SLOTS; s++) {
+            free(state->slots[s]);
+        }
+        free(state);
+        return NULL;
+    }
+    rng_seed_next_stream(&state->rng);
+    return state;
+}
+
+void destroy_out_of_core_state(OutOfCoreState* state) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    pthread_mutex_lock(&state->lock);
+    state->stopping = true;
+    pthread_cond_broadcast(&state->changed);
+    pthread_mutex_unlock(&state->lock);
+    pthread_join(state->thread, NULL);
+
+    pthread_mutex_destroy(&state->lock);
+    pthread_cond_destroy(&state->changed);
+    for (int s = 0; s < OUT_OF_CORE_SLOTS; s++) {
+        free(state->slots[s]);
+    }
+    close(state->fd);
+    free(state);
+}
+
+int out_of_core_num_qubits(const OutOfCoreState* state) {
+    return state->num_qubits;
+}
+
+void out_of_core_stats(const OutOfCoreState* state, OutOfCoreStats* stats) {
+    *stats = state->stats;
+}
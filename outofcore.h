@@ -0,0 +1,70 @@
+#ifndef OUTOFCORE_H
+#define OUTOFCORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "circuit.h"
+
+// Out-of-core state vectors, for registers whose amplitudes do not fit in
+// memory. The state lives in one file on local disk, in index order, and is
+// read and written in chunks of 2^chunk_qubits amplitudes; only
+// OUT_OF_CORE_SLOTS buffers of 2^buffer_qubits amplitudes are kept in memory.
+//
+// Circuits run in passes over the file. A pass loads, besides the chunk
+// qubits, up to buffer_qubits - chunk_qubits chosen high qubits: the chunks
+// are read in groups that differ only in those qubits, so every group is a
+// complete state on the chunk qubits plus the chosen ones. Controls and
+// diagonal gates on the remaining high qubits are constant over a group and
+// need no data movement (as in execute_circuit_blocked). The scheduler fills
+// each pass with as many of the upcoming gates as fit, letting gates move
+// ahead of deferred gates that share no qubit with them. While one group is
+// computed, an I/O thread writes the previous group back and reads the next.
+
+// Buffers in memory: one computed, one being written back, one being read
+#define OUT_OF_CORE_SLOTS 3
+
+// Chunk size used unless QSIM_CHUNK_QUBITS overrides it (16 MiB at double
+// precision); smaller memory limits shrink it so any gate still fits a group
+#define OUT_OF_CORE_CHUNK_QUBITS 20
+
+typedef struct OutOfCoreState OutOfCoreState;
+
+// Disk traffic of a state so far
+typedef struct {
+    size_t passes;             // passes over the whole file
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    double io_wait_seconds;    // time compute spent waiting for the disk
+} OutOfCoreStats;
+
+// |0...0> on num_qubits qubits in a new file in directory. The file is
+// unlinked as soon as it is open, so it goes away with the state or the
+// process, and its space is reserved up front. Buffers take at most
+// memory_bytes (0: half of the physical memory). Returns NULL after printing
+// an error.
+OutOfCoreState* create_out_of_core_state(int num_qubits, Precision precision, const char* directory,
+                                         size_t memory_bytes);
+void destroy_out_of_core_state(OutOfCoreState* state);
+
+int out_of_core_num_qubits(const OutOfCoreState* state);
+void out_of_core_stats(const OutOfCoreState* state, OutOfCoreStats* stats);
+
+// Runs every gate of the circuit against state, which must have the same
+// qubit count. A measurement costs no pass of its own: its probabilities are
+// collected during the pass that runs the gates before it, and the collapse
+// joins the next pass. Results go to classical_bits (may be NULL). Returns
+// false after printing an error; a failed read or write leaves the state
+// undefined.
+bool execute_circuit_out_of_core(const Circuit* circuit, OutOfCoreState* state, int* classical_bits);
+
+// Calls visit for every chunk in index order (see ChunkVisitor). Stops early,
+// returning false, when visit does.
+bool visit_out_of_core_chunks(OutOfCoreState* state, ChunkVisitor visit, void* ctx);
+
+// sample_shots for out-of-core states: one pass sums the chunks, then only
+// the chunks the shots land in are read again
+bool sample_out_of_core_shots(OutOfCoreState* state, uint64_t shots, const int* qubits, int num_qubits,
+                              ShotHistogram* histogram);
+
+#endif /* OUTOFCORE_H */
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "profile.h"
+
+bool profile_enabled = false;
+_Thread_local ProfileScope* profile_current = NULL;
+
+typedef struct {
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t nanoseconds;
+    atomic_uint_fast64_t sweeps;
+    atomic_uint_fast64_t amplitudes;
+    atomic_uint_fast64_t allocations;
+    atomic_uint_fast64_t allocated_bytes;
+} ProfileCounters;
+
+static ProfileCounters totals[PROFILE_NUM_OPS];
+static ProfileCounters by_qubit[PROFILE_NUM_OPS][PROFILE_MAX_QUBITS];
+static ProfileFormat output_format = PROFILE_TABLE;
+
+static const char* op_names[PROFILE_NUM_OPS] = {
+    [HADAMARD] = "hadamard",
+    [PAULI_X] = "pauli_x",
+    [PAULI_Y] = "pauli_y",
+    [PAULI_Z] = "pauli_z",
+    [PHASE] = "phase",
+    [CNOT] = "cnot",
+    [SWAP] = "swap",
+    [TOFFOLI] = "toffoli",
+    [CONTROLLED_PHASE] = "controlled_phase",
+    [ROTATION_X] = "rotation_x",
+    [ROTATION_Y] = "rotation_y",
+    [ROTATION_Z] = "rotation_z",
+    [PHASE_FLIP] = "phase_flip",
+    [MEASURE] = "measure",
+    [UNITARY] = "unitary",
+    [QFT] = "qft",
+    [INVERSE_QFT] = "inverse_qft",
+    [PROFILE_NORMALIZE] = "normalize",
+    [PROFILE_PROBABILITY] = "probability",
+    [PROFILE_DIAGONAL_BATCH] = "diagonal_batch",
+    [PROFILE_TILED_RUN] = "tiled_run",
+    [PROFILE_SAMPLE] = "sample",
+    [PROFILE_GROVER_DIFFUSION] = "grover_diffusion",
+    [PROFILE_GROVER_ITERATION] = "grover_iteration",
+    [PROFILE_EXPECTATION] = "expectation",
+    [PROFILE_SNAPSHOT] = "snapshot",
+    [PROFILE_DISK_PASS] = "disk_pass",
+    [PROFILE_EXCHANGE] = "exchange",
+    [PROFILE_STATE] = "state"
+};
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+void profile_begin(ProfileScope* scope, int op, int qubit) {
+    // Nested calls stay PROFILE_OFF and count towards the open scope
+    if (profile_current) {
+        return;
+    }
+    *scope = (ProfileScope){ .op = op, .qubit = qubit, .start_ns = now_ns() };
+    profile_current = scope;
+}
+
+static void add_counters(ProfileCounters* counters, const ProfileScope* scope, uint64_t elapsed) {
+    atomic_fetch_add(&counters->calls, 1);
+    atomic_fetch_add(&counters->nanoseconds, elapsed);
+    atomic_fetch_add(&counters->sweeps, scope->sweeps);
+    atomic_fetch_add(&counters->amplitudes, scope->amplitudes);
+    atomic_fetch_add(&counters->allocations, scope->allocations);
+    atomic_fetch_add(&counters->allocated_bytes, scope->allocated_bytes);
+}
+
+void profile_finish(ProfileScope* scope) {
+    profile_current = NULL;
+    if (scope->op == PROFILE_QUIET) {
+        return;
+    }
+    uint64_t elapsed = now_ns() - scope->start_ns;
+    add_counters(&totals[scope->op], scope, elapsed);
+    if (scope->qubit >= 0 && scope->qubit < PROFILE_MAX_QUBITS) {
+        add_counters(&by_qubit[scope->op][scope->qubit], scope, elapsed);
+    }
+}
+
+void profile_record_allocation(size_t count, size_t bytes) {
+    ProfileScope* scope = profile_current;
+    if (scope && scope->op != PROFILE_QUIET) {
+        scope->allocations += count;
+        scope->allocated_bytes += bytes;
+    } else if (!scope) {
+        atomic_fetch_add(&totals[PROFILE_STATE].allocations, count);
+        atomic_fetch_add(&totals[PROFILE_STATE].allocated_bytes, bytes);
+    }
+}
+
+static bool has_data(const ProfileCounters* counters) {
+    return atomic_load(&counters->calls) > 0 || atomic_load(&counters->allocations) > 0;
+}
+
+static double average_us(const ProfileCounters* counters) {
+    uint64_t calls = atomic_load(&counters->calls);
+    return calls ? atomic_load(&counters->nanoseconds) * 1e-3 / calls : 0.0;
+}
+
+static void print_table(FILE* out) {
+    fprintf(out, "\nProfile (outermost calls only; times add up over threads)\n");
+    fprintf(out, "%-17s %10s %12s %10s %10s %14s %8s %10s\n", "operation", "calls", "total ms", "avg us",
+            "sweeps", "amplitudes", "allocs", "alloc MiB");
+    for (int op = 0; op < PROFILE_NUM_OPS; op++) {
+        const ProfileCounters* c = &totals[op];
+        if (!has_data(c)) {
+            continue;
+        }
+        fprintf(out, "%-17s %10llu %12.3f %10.3f %10llu %14llu %8llu %10.2f\n", op_names[op],
+                (unsigned long long)atomic_load(&c->calls), atomic_load(&c->nanoseconds) * 1e-6, average_us(c),
+                (unsigned long long)atomic_load(&c->sweeps), (unsigned long long)atomic_load(&c->amplitudes),
+                (unsigned long long)atomic_load(&c->allocations),
+                atomic_load(&c->allocated_bytes) / (1024.0 * 1024.0));
+    }
+
+    fprintf(out, "\nBy target qubit\n");
+    fprintf(out, "%-17s %5s %10s %12s %10s %14s\n", "operation", "qubit", "calls", "total ms", "avg us",
+            "amplitudes");
+    for (int op = 0; op < PROFILE_NUM_OPS; op++) {
+        for (int q = 0; q < PROFILE_MAX_QUBITS; q++) {
+            const ProfileCounters* c = &by_qubit[op][q];
+            if (!has_data(c)) {
+                continue;
+            }
+            fprintf(out, "%-17s %5d %10llu %12.3f %10.3f %14llu\n", op_names[op], q,
+                    (unsigned long long)atomic_load(&c->calls), atomic_load(&c->nanoseconds) * 1e-6,
+                    average_us(c), (unsigned long long)atomic_load(&c->amplitudes));
+        }
+    }
+}
+
+static void print_counters_json(FILE* out, const ProfileCounters* c) {
+    fprintf(out, "\"calls\": %llu, \"seconds\": %.9f, \"average_seconds\": %.9e, \"sweeps\": %llu, "
+            "\"amplitudes\": %llu, \"allocations\": %llu, \"allocated_bytes\": %llu",
+            (unsigned long long)atomic_load(&c->calls), atomic_load(&c->nanoseconds) * 1e-9, average_us(c) * 1e-6,
+            (unsigned long long)atomic_load(&c->sweeps), (unsigned long long)atomic_load(&c->amplitudes),
+            (unsigned long long)atomic_load(&c->allocations), (unsigned long long)atomic_load(&c->allocated_bytes));
+}
+
+static void print_json(FILE* out) {
+    bool first_op = true;
+    fprintf(out, "{\"operations\": [");
+    for (int op = 0; op < PROFILE_NUM_OPS; op++) {
+        if (!has_data(&totals[op])) {
+            continue;
+        }
+        fprintf(out, "%s\n  {\"name\": \"%s\", ", first_op ? "" : ",", op_names[op]);
+        print_counters_json(out, &totals[op]);
+        fprintf(out, ", \"qubits\": [");
+        bool first_qubit = true;
+        for (int q = 0; q < PROFILE_MAX_QUBITS; q++) {
+            if (!has_data(&by_qubit[op][q])) {
+                continue;
+            }
+            fprintf(out, "%s\n    {\"qubit\": %d, ", first_qubit ? "" : ",", q);
+            print_counters_json(out, &by_qubit[op][q]);
+            fprintf(out, "}");
+            first_qubit = false;
+        }
+        fprintf(out, "%s]}", first_qubit ? "" : "\n  ");
+        first_op = false;
+    }
+    fprintf(out, "\n]}\n");
+}
+
+static void print_profile(void) {
+    if (output_format == PROFILE_JSON) {
+        print_json(stderr);
+    } else {
+        print_table(stderr);
+    }
+}
+
+void profile_enable(ProfileFormat format) {
+    output_format = format;
+    if (!profile_enabled) {
+        profile_enabled = true;
+        atexit(print_profile);
+    }
+}
+
+__attribute__((constructor)) static void profile_from_environment(void) {
+    const char* value = getenv("QSIM_PROFILE");
+    if (value && *value && strcmp(value, "0") != 0) {
+        profile_enable(strcmp(value, "json") == 0 ? PROFILE_JSON : PROFILE_TABLE);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "quantum.h"
+
+// Optional instrumentation of the hot paths. For every gate type and other
+// state operation, and for each target qubit, it records call counts, wall
+// time, sweeps over the amplitudes, amplitudes touched and allocations.
+// Enable it with QSIM_PROFILE=table|json or --profile in batch mode; the
+// summary goes to stderr when the program exits. While disabled, every hook
+// is a single untaken branch.
+//
+// Only the outermost instrumented call on a thread is recorded: an
+// apply_cnot inside a noise channel, or the kernels behind a gate, count
+// towards their caller. Calls made on different threads (e.g. trajectories)
+// are recorded separately, so times add up over threads.
+
+// Operations recorded besides the GateType values (which come first)
+typedef enum {
+    PROFILE_NORMALIZE = INVERSE_QFT + 1, // norm checks and renormalization
+    PROFILE_PROBABILITY,                 // qubit_probability
+    PROFILE_DIAGONAL_BATCH,              // diagonal_batch_apply
+    PROFILE_TILED_RUN,                   // one group of gates run tile by tile
+    PROFILE_SAMPLE,                      // sample_shots
+    PROFILE_GROVER_DIFFUSION,            // grover_diffusion
+    PROFILE_GROVER_ITERATION,            // grover_iteration (oracle and diffusion)
+    PROFILE_EXPECTATION,                 // pauli_expectations
+    PROFILE_SNAPSHOT,                    // saving and loading state snapshots
+    PROFILE_DISK_PASS,                   // one pass over an out-of-core state file
+    PROFILE_EXCHANGE,                    // amplitudes traded with another rank of a distributed state
+    PROFILE_STATE,                       // creating, copying and destroying states
+    PROFILE_NUM_OPS
+} ProfileOp;
+
+// Per-qubit counters are kept for target qubits below this
+#define PROFILE_MAX_QUBITS 64
+
+typedef enum {
+    PROFILE_TABLE,
+    PROFILE_JSON
+} ProfileFormat;
+
+// Scope markers: no scope is open, or it only hides nested calls
+#define PROFILE_OFF (-1)
+#define PROFILE_QUIET (-2)
+
+typedef struct {
+    int op;
+    int qubit;
+    uint64_t start_ns;
+    uint64_t sweeps;
+    uint64_t amplitudes;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+} ProfileScope;
+
+extern bool profile_enabled;
+extern _Thread_local ProfileScope* profile_current;
+
+// Turns profiling on and prints the summary in format at exit (QSIM_PROFILE
+// calls this before main)
+void profile_enable(ProfileFormat format);
+
+void profile_begin(ProfileScope* scope, int op, int qubit);
+void profile_finish(ProfileScope* scope);
+
+static inline void profile_end(ProfileScope* scope) {
+    if (scope->op != PROFILE_OFF) {
+        profile_finish(scope);
+    }
+}
+
+// Records the enclosing function as one call of op on target qubit (-1: none)
+// until it returns
+#define PROFILE_SCOPE(operation, target) \
+    ProfileScope profile_scope __attribute__((cleanup(profile_end))) = { .op = PROFILE_OFF }; \
+    if (profile_enabled) profile_begin(&profile_scope, (operation), (target))
+
+// Hides the calls the enclosing function makes, for work done on behalf of a
+// scope open on another thread (e.g. the tiles of a tiled run)
+#define PROFILE_QUIET_SCOPE() PROFILE_SCOPE(PROFILE_QUIET, -1)
+
+// One pass over `amplitudes` amplitudes by the current operation
+static inline void profile_sweep(uint64_t amplitudes) {
+    if (profile_enabled && profile_current) {
+        profile_current->sweeps++;
+        profile_current->amplitudes += amplitudes;
+    }
+}
+
+// count allocations totalling bytes by the current operation (or PROFILE_STATE outside one)
+void profile_record_allocation(size_t count, size_t bytes);
+
+static inline void profile_allocate(size_t count, size_t bytes) {
+    if (profile_enabled) {
+        profile_record_allocation(count, bytes);
+    }
+}
+
+#endif /* PROFILE_H */
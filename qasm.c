@@ -0,0 +1,558 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qasm.h"
+
+#define PI 3.14159265358979323846
+#define MAX_TOKEN 64
+#define MAX_REGISTERS 64
+#define MAX_GATE_QUBITS 3
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_IDENT,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_SYMBOL   // single characters plus "->" and "=="
+} TokenKind;
+
+typedef struct {
+    TokenKind kind;
+    char text[MAX_TOKEN];
+    double number;
+    int line;
+} Token;
+
+typedef struct {
+    char name[MAX_TOKEN];
+    int offset;   // first qubit (or classical bit) of the register
+    int size;
+} Register;
+
+// A gate operand: one qubit, or a whole register when count > 1
+typedef struct {
+    int first;
+    int count;
+} Operand;
+
+// The parser only keeps the current token and the register tables, so
+// circuits of any length stream straight from the file into the gate list
+typedef struct {
+    FILE* input;
+    const char* name;
+    int line;
+    int statement_line;   // reported in error messages
+    Token token;
+    Register qregs[MAX_REGISTERS];
+    int num_qregs;
+    Register cregs[MAX_REGISTERS];
+    int num_cregs;
+    Circuit* circuit;
+    bool failed;
+} Parser;
+
+typedef struct {
+    const char* name;
+    GateType type;
+    int num_params;   // 0 or 1 (the gate angle)
+    int num_qubits;
+    double angle;     // fixed angle for gates without parameters
+} QasmGate;
+
+static const QasmGate qasm_gates[] = {
+    { "h",    HADAMARD,         0, 1, 0.0 },
+    { "x",    PAULI_X,          0, 1, 0.0 },
+    { "y",    PAULI_Y,          0, 1, 0.0 },
+    { "z",    PAULI_Z,          0, 1, 0.0 },
+    { "s",    PHASE,            0, 1, PI / 2 },
+    { "sdg",  PHASE,            0, 1, -PI / 2 },
+    { "t",    PHASE,            0, 1, PI / 4 },
+    { "tdg",  PHASE,            0, 1, -PI / 4 },
+    { "rx",   ROTATION_X,       1, 1, 0.0 },
+    { "ry",   ROTATION_Y,       1, 1, 0.0 },
+    { "rz",   ROTATION_Z,       1, 1, 0.0 },
+    { "p",    PHASE,            1, 1, 0.0 },
+    { "u1",   PHASE,            1, 1, 0.0 },
+    { "cx",   CNOT,             0, 2, 0.0 },
+    { "CX",   CNOT,             0, 2, 0.0 },
+    { "cz",   CONTROLLED_PHASE, 0, 2, PI },
+    { "swap", SWAP,             0, 2, 0.0 },
+    { "ccx",  TOFFOLI,          0, 3, 0.0 },
+    { "cp",   CONTROLLED_PHASE, 1, 2, 0.0 },
+    { "cu1",  CONTROLLED_PHASE, 1, 2, 0.0 },
+};
+
+static void parse_error(Parser* p, const char* format, ...) {
+    if (p->failed) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "Error: %s:%d: ", p->name, p->statement_line);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    p->failed = true;
+}
+
+// Skips whitespace and // comments, returning the first significant character
+static int skip_blanks(Parser* p) {
+    for (;;) {
+        int c = getc(p->input);
+        if (c == '\n') {
+            p->line++;
+        } else if (c == '/') {
+            int next = getc(p->input);
+            if (next != '/') {
+                ungetc(next, p->input);
+                return c;
+            }
+            while ((c = getc(p->input)) != '\n' && c != EOF);
+            if (c == EOF) {
+                return EOF;
+            }
+            p->line++;
+        } else if (!isspace(c)) {
+            return c;
+        }
+    }
+}
+
+static void next_token(Parser* p) {
+    Token* t = &p->token;
+    int c = skip_blanks(p);
+    int length = 0;
+    t->line = p->line;
+    t->text[0] = '\0';
+
+    if (c == EOF) {
+        t->kind = TOKEN_END;
+        return;
+    }
+
+    if (isalpha(c) || c == '_') {
+        t->kind = TOKEN_IDENT;
+        while (isalnum(c) || c == '_') {
+            if (length == MAX_TOKEN - 1) {
+                parse_error(p, "identifier is too long");
+                return;
+            }
+            t->text[length++] = (char)c;
+            c = getc(p->input);
+        }
+        ungetc(c, p->input);
+    } else if (isdigit(c) || c == '.') {
+        t->kind = TOKEN_NUMBER;
+        while (isdigit(c) || c == '.' || c == 'e' || c == 'E' ||
+               ((c == '+' || c == '-') && length > 0 && (t->text[length - 1] == 'e' || t->text[length - 1] == 'E'))) {
+            if (length == MAX_TOKEN - 1) {
+                parse_error(p, "number is too long");
+                return;
+            }
+            t->text[length++] = (char)c;
+            c = getc(p->input);
+        }
+        ungetc(c, p->input);
+        t->text[length] = '\0';
+        char* end;
+        t->number = strtod(t->text, &end);
+        if (*end != '\0') {
+            parse_error(p, "malformed number '%s'", t->text);
+        }
+    } else if (c == '"') {
+        t->kind = TOKEN_STRING;
+        while ((c = getc(p->input)) != '"') {
+            if (c == EOF || c == '\n') {
+                parse_error(p, "unterminated string");
+                return;
+            }
+            if (length < MAX_TOKEN - 1) {
+                t->text[length++] = (char)c;
+            }
+        }
+    } else {
+        t->kind = TOKEN_SYMBOL;
+        t->text[length++] = (char)c;
+        int next = getc(p->input);
+        if ((c == '-' && next == '>') || (c == '=' && next == '=')) {
+            t->text[length++] = (char)next;
+        } else {
+            ungetc(next, p->input);
+        }
+    }
+    t->text[length] = '\0';
+}
+
+static bool is_symbol(const Parser* p, const char* symbol) {
+    return p->token.kind == TOKEN_SYMBOL && strcmp(p->token.text, symbol) == 0;
+}
+
+static bool accept(Parser* p, const char* symbol) {
+    if (!is_symbol(p, symbol)) {
+        return false;
+    }
+    next_token(p);
+    return true;
+}
+
+static void expect(Parser* p, const char* symbol) {
+    if (!accept(p, symbol)) {
+        parse_error(p, "expected '%s' but found '%s'", symbol, p->token.text);
+    }
+}
+
+static void expect_identifier(Parser* p, char* name) {
+    if (p->token.kind != TOKEN_IDENT) {
+        parse_error(p, "expected a name but found '%s'", p->token.text);
+        name[0] = '\0';
+        return;
+    }
+    strcpy(name, p->token.text);
+    next_token(p);
+}
+
+static int expect_index(Parser* p) {
+    double value = p->token.number;
+    if (p->token.kind != TOKEN_NUMBER || value != floor(value) || value < 0 || value > MAX_QUBITS * 1024) {
+        parse_error(p, "expected a non-negative integer but found '%s'", p->token.text);
+        return 0;
+    }
+    next_token(p);
+    return (int)value;
+}
+
+// Parameter expressions: numbers, pi, + - * / ^, parentheses and the
+// standard unary functions
+static double parse_expression(Parser* p);
+
+static double parse_primary(Parser* p) {
+    if (p->token.kind == TOKEN_NUMBER) {
+        double value = p->token.number;
+        next_token(p);
+        return value;
+    }
+    if (accept(p, "(")) {
+        double value = parse_expression(p);
+        expect(p, ")");
+        return value;
+    }
+    if (p->token.kind != TOKEN_IDENT) {
+        parse_error(p, "expected an expression but found '%s'", p->token.text);
+        return 0.0;
+    }
+
+    char name[MAX_TOKEN];
+    expect_identifier(p, name);
+    if (strcmp(name, "pi") == 0) {
+        return PI;
+    }
+
+    static const struct { const char* name; double (*fn)(double); } functions[] = {
+        { "sin", sin }, { "cos", cos }, { "tan", tan },
+        { "exp", exp }, { "ln", log }, { "sqrt", sqrt },
+    };
+    for (size_t f = 0; f < sizeof(functions) / sizeof(functions[0]); f++) {
+        if (strcmp(name, functions[f].name) == 0) {
+            expect(p, "(");
+            double argument = parse_expression(p);
+            expect(p, ")");
+            return functions[f].fn(argument);
+        }
+    }
+    parse_error(p, "unknown identifier '%s' in expression", name);
+    return 0.0;
+}
+
+static double parse_unary(Parser* p) {
+    if (accept(p, "-")) {
+        return -parse_unary(p);
+    }
+    if (accept(p, "+")) {
+        return parse_unary(p);
+    }
+    double base = parse_primary(p);
+    if (accept(p, "^")) {
+        return pow(base, parse_unary(p));
+    }
+    return base;
+}
+
+static double parse_term(Parser* p) {
+    double value = parse_unary(p);
+    for (;;) {
+        if (accept(p, "*")) {
+            value *= parse_unary(p);
+        } else if (accept(p, "/")) {
+            value /= parse_unary(p);
+        } else {
+            return value;
+        }
+    }
+}
+
+static double parse_expression(Parser* p) {
+    double value = parse_term(p);
+    while (!p->failed) {
+        if (accept(p, "+")) {
+            value += parse_term(p);
+        } else if (accept(p, "-")) {
+            value -= parse_term(p);
+        } else {
+            break;
+        }
+    }
+    return value;
+}
+
+static const Register* find_register(const Register* registers, int count, const char* name) {
+    for (int r = 0; r < count; r++) {
+        if (strcmp(registers[r].name, name) == 0) {
+            return &registers[r];
+        }
+    }
+    return NULL;
+}
+
+// Parses "name" (the whole register) or "name[index]"
+static Operand parse_operand(Parser* p, const Register* registers, int count, const char* kind) {
+    Operand operand = { 0, 0 };
+    char name[MAX_TOKEN];
+    expect_identifier(p, name);
+    if (p->failed) {
+        return operand;
+    }
+
+    const Register* reg = find_register(registers, count, name);
+    if (!reg) {
+        parse_error(p, "unknown %s register '%s'", kind, name);
+        return operand;
+    }
+
+    operand.first = reg->offset;
+    operand.count = reg->size;
+    if (accept(p, "[")) {
+        int index = expect_index(p);
+        if (!p->failed && index >= reg->size) {
+            parse_error(p, "index %d is outside register '%s' of size %d", index, name, reg->size);
+        }
+        expect(p, "]");
+        operand.first += index;
+        operand.count = 1;
+    }
+    return operand;
+}
+
+// Number of times a statement runs when whole registers are broadcast over
+static int broadcast_size(Parser* p, const Operand* operands, int count) {
+    int size = 1;
+    for (int i = 0; i < count; i++) {
+        if (operands[i].count == 1) {
+            continue;
+        }
+        if (size != 1 && operands[i].count != size) {
+            parse_error(p, "registers of different sizes (%d and %d) in one statement", size, operands[i].count);
+            return 0;
+        }
+        size = operands[i].count;
+    }
+    return size;
+}
+
+static int operand_qubit(const Operand* operand, int i) {
+    return operand->first + (operand->count > 1 ? i : 0);
+}
+
+static void parse_register(Parser* p, bool quantum) {
+    Register* registers = quantum ? p->qregs : p->cregs;
+    int* count = quantum ? &p->num_qregs : &p->num_cregs;
+
+    Register reg;
+    expect_identifier(p, reg.name);
+    expect(p, "[");
+    reg.size = expect_index(p);
+    expect(p, "]");
+    expect(p, ";");
+    if (p->failed) {
+        return;
+    }
+    if (reg.size < 1) {
+        parse_error(p, "register '%s' must hold at least one bit", reg.name);
+        return;
+    }
+    if (find_register(p->qregs, p->num_qregs, reg.name) || find_register(p->cregs, p->num_cregs, reg.name)) {
+        parse_error(p, "register '%s' is already declared", reg.name);
+        return;
+    }
+    if (*count == MAX_REGISTERS) {
+        parse_error(p, "too many registers (at most %d of each kind)", MAX_REGISTERS);
+        return;
+    }
+
+    if (quantum) {
+        reg.offset = p->circuit->num_qubits;
+        if (reg.offset + reg.size > MAX_CIRCUIT_QUBITS) {
+            parse_error(p, "the program declares more than %d qubits", MAX_CIRCUIT_QUBITS);
+            return;
+        }
+        p->circuit->num_qubits += reg.size;
+    } else {
+        reg.offset = *count > 0 ? registers[*count - 1].offset + registers[*count - 1].size : 0;
+        p->circuit->num_classical_bits = reg.offset + reg.size;
+    }
+    registers[(*count)++] = reg;
+}
+
+static void parse_measure(Parser* p) {
+    Operand operands[2];
+    operands[0] = parse_operand(p, p->qregs, p->num_qregs, "quantum");
+    expect(p, "->");
+    operands[1] = parse_operand(p, p->cregs, p->num_cregs, "classical");
+    expect(p, ";");
+    if (p->failed) {
+        return;
+    }
+    if (operands[0].count != operands[1].count) {
+        parse_error(p, "measure needs operands of the same size");
+        return;
+    }
+    for (int i = 0; i < operands[0].count; i++) {
+        circuit_measure(p->circuit, operand_qubit(&operands[0], i), operand_qubit(&operands[1], i));
+    }
+}
+
+static void parse_barrier(Parser* p) {
+    do {
+        parse_operand(p, p->qregs, p->num_qregs, "quantum");
+    } while (!p->failed && accept(p, ","));
+    expect(p, ";");
+}
+
+static void parse_gate(Parser* p, const char* name) {
+    const QasmGate* def = NULL;
+    for (size_t g = 0; g < sizeof(qasm_gates) / sizeof(qasm_gates[0]); g++) {
+        if (strcmp(qasm_gates[g].name, name) == 0) {
+            def = &qasm_gates[g];
+            break;
+        }
+    }
+    if (!def) {
+        parse_error(p, "unsupported gate '%s'", name);
+        return;
+    }
+
+    double angle = def->angle;
+    if (def->num_params > 0) {
+        expect(p, "(");
+        angle = parse_expression(p);
+        if (!p->failed && !isfinite(angle)) {
+            parse_error(p, "parameter is not a finite number");
+            return;
+        }
+        expect(p, ")");
+    }
+
+    Operand operands[MAX_GATE_QUBITS];
+    for (int j = 0; j < def->num_qubits && !p->failed; j++) {
+        if (j > 0) {
+            expect(p, ",");
+        }
+        operands[j] = parse_operand(p, p->qregs, p->num_qregs, "quantum");
+    }
+    expect(p, ";");
+    if (p->failed) {
+        return;
+    }
+
+    int size = broadcast_size(p, operands, def->num_qubits);
+    for (int i = 0; i < size && !p->failed; i++) {
+        Gate gate = { .type = def->type, .num_qubits = def->num_qubits, .angle = angle };
+        for (int j = 0; j < def->num_qubits; j++) {
+            gate.qubits[j] = operand_qubit(&operands[j], i);
+            for (int k = 0; k < j; k++) {
+                if (gate.qubits[k] == gate.qubits[j]) {
+                    parse_error(p, "gate '%s' uses qubit %d twice", name, gate.qubits[j]);
+                }
+            }
+        }
+        if (!p->failed && !circuit_append(p->circuit, &gate)) {
+            p->failed = true;
+        }
+    }
+}
+
+static void parse_statement(Parser* p) {
+    char keyword[MAX_TOKEN];
+    p->statement_line = p->token.line;
+    expect_identifier(p, keyword);
+    if (p->failed) {
+        return;
+    }
+
+    if (strcmp(keyword, "OPENQASM") == 0) {
+        parse_error(p, "duplicate OPENQASM header");
+    } else if (strcmp(keyword, "include") == 0) {
+        // qelib1.inc gates are built in; other libraries would need gate definitions
+        if (p->token.kind != TOKEN_STRING || strcmp(p->token.text, "qelib1.inc") != 0) {
+            parse_error(p, "only \"qelib1.inc\" can be included");
+            return;
+        }
+        next_token(p);
+        expect(p, ";");
+    } else if (strcmp(keyword, "qreg") == 0) {
+        parse_register(p, true);
+    } else if (strcmp(keyword, "creg") == 0) {
+        parse_register(p, false);
+    } else if (strcmp(keyword, "measure") == 0) {
+        parse_measure(p);
+    } else if (strcmp(keyword, "barrier") == 0) {
+        parse_barrier(p);
+    } else if (strcmp(keyword, "gate") == 0 || strcmp(keyword, "opaque") == 0 ||
+               strcmp(keyword, "if") == 0 || strcmp(keyword, "reset") == 0) {
+        parse_error(p, "'%s' statements are not supported", keyword);
+    } else {
+        parse_gate(p, keyword);
+    }
+}
+
+Circuit* parse_qasm(FILE* input, const char* name) {
+    Parser p = { .input = input, .name = name, .line = 1 };
+    p.circuit = create_circuit(0);
+    next_token(&p);
+    p.statement_line = p.token.line;
+
+    // Header: OPENQASM 2.x;
+    if (p.token.kind != TOKEN_IDENT || strcmp(p.token.text, "OPENQASM") != 0) {
+        parse_error(&p, "expected 'OPENQASM 2.0;' header");
+    } else {
+        next_token(&p);
+        if (p.token.kind != TOKEN_NUMBER || floor(p.token.number) != 2.0) {
+            parse_error(&p, "only OpenQASM 2 is supported");
+        }
+        next_token(&p);
+        expect(&p, ";");
+    }
+
+    while (!p.failed && p.token.kind != TOKEN_END) {
+        parse_statement(&p);
+    }
+
+    if (p.failed) {
+        destroy_circuit(p.circuit);
+        return NULL;
+    }
+    return p.circuit;
+}
+
+Circuit* load_qasm_file(const char* path) {
+    FILE* input = fopen(path, "r");
+    if (!input) {
+        fprintf(stderr, "Error: Cannot open %s\n", path);
+        return NULL;
+    }
+    Circuit* circuit = parse_qasm(input, path);
+    fclose(input);
+    return circuit;
+}
@@ -0,0 +1,19 @@
+#ifndef QASM_H
+#define QASM_H
+
+#include <stdio.h>
+#include "circuit.h"
+
+// Parses an OpenQASM 2.0 program into a circuit, one statement at a time.
+// Quantum registers are laid out in declaration order (the first qreg holds
+// the lowest qubits), and classical registers are laid out the same way.
+// Supported statements: OPENQASM, include, qreg, creg, barrier, measure and
+// the gates h, x, y, z, s, sdg, t, tdg, rx, ry, rz, p/u1, cx, cz, swap,
+// ccx and cp/cu1, applied to single qubits or broadcast over whole registers.
+// name is only used in error messages. Returns NULL after printing an error.
+Circuit* parse_qasm(FILE* input, const char* name);
+
+// Opens path and parses it with parse_qasm
+Circuit* load_qasm_file(const char* path);
+
+#endif /* QASM_H */
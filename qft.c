@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "quantum.h"
+#include "circuit.h"
+#include "profile.h"
+#include "threadpool.h"
+
+#define PI 3.14159265358979323846
+#define MAX_REVERSE_SPLIT 5
+
+// The transform is a decimation-in-frequency FFT over the register bits.
+// Stage j (from the highest register bit down) is a Hadamard on bit j
+// followed by the twiddle e^(+-2 pi i t / 2^(j+1)) on the amplitudes with bit
+// j set, where t is the value of the register bits below j. Two stages are
+// done per sweep (radix 4). The stages whose bits lie inside a cache-sized
+// tile all run in one more sweep, tile by tile, and a last sweep reverses
+// the register bits. That is about m/2 + 2 sweeps for m qubits, against
+// m(m+1)/2 + m/2 for the gate-by-gate circuit.
+
+typedef struct {
+    ComplexNum* amplitudes;
+    ComplexFloat* amplitudes_single;
+    int first_qubit;
+    int num_qubits;             // register size m
+    // Roots e^(sign 2 pi i t / 2^m) = root_high[t >> low_bits] * root_low[t & low_mask]
+    ComplexNum* root_low;
+    ComplexNum* root_high;
+    int low_bits;
+    double sign;                // +1 for the transform, -1 for the inverse
+    // Stage of a full sweep: bit, and bit - 1 too when radix4
+    int bit;
+    bool radix4;
+    // Tiled sweep: register bits below tile_bits, inside tiles of 2^local_qubits
+    int local_qubits;
+    int tile_bits;
+    bool tile_reverse;          // the bit reversal fits inside a tile too
+    int reverse_split;          // top and bottom bits of the blocked bit reversal
+} QftSweep;
+
+// Plain complex products (without the C99 infinity/NaN recovery calls)
+static inline ComplexNum cmul(ComplexNum x, ComplexNum y) {
+    return CMPLX(creal(x) * creal(y) - cimag(x) * cimag(y),
+                 creal(x) * cimag(y) + cimag(x) * creal(y));
+}
+
+static inline ComplexNum root(const QftSweep* s, size_t t) {
+    return cmul(s->root_high[t >> s->low_bits], s->root_low[t & (((size_t)1 << s->low_bits) - 1)]);
+}
+
+static inline ComplexFloat cmulf(ComplexFloat x, ComplexFloat y) {
+    return CMPLXF(crealf(x) * crealf(y) - cimagf(x) * cimagf(y),
+                  crealf(x) * cimagf(y) + cimagf(x) * crealf(y));
+}
+
+// One radix-2 butterfly per j < len on (a[j], b[j]); the difference is
+// twiddled by root(t + j * step)
+static void radix2_span(const QftSweep* s, ComplexNum* a, ComplexNum* b, size_t len, size_t t, size_t step) {
+    ComplexNum w = root(s, t);
+    for (size_t j = 0; j < len; j++) {
+        if (step) w = root(s, t + j * step);
+        ComplexNum x = a[j], y = b[j];
+        a[j] = (x + y) * M_SQRT1_2;
+        b[j] = cmul(x - y, w) * M_SQRT1_2;
+    }
+}
+
+static void radix2_span_single(const QftSweep* s, ComplexFloat* a, ComplexFloat* b, size_t len, size_t t, size_t step) {
+    ComplexFloat w = (ComplexFloat)root(s, t);
+    for (size_t j = 0; j < len; j++) {
+        if (step) w = (ComplexFloat)root(s, t + j * step);
+        ComplexFloat x = a[j], y = b[j];
+        a[j] = (x + y) * (float)M_SQRT1_2;
+        b[j] = cmulf(x - y, w) * (float)M_SQRT1_2;
+    }
+}
+
+// Two stages at once on (a0, a1, a2, a3)[j] for j < len: the higher stage
+// pairs (a0, a2) and (a1, a3) with twiddles w1 = root(t + j * step) and w1
+// times a quarter turn (their t differ by half the lower stage's range), the
+// lower one pairs the results (a0, a1) and (a2, a3) with twiddle w1^2
+static void radix4_span(const QftSweep* s, ComplexNum* a0, ComplexNum* a1, ComplexNum* a2, ComplexNum* a3,
+                        size_t len, size_t t, size_t step) {
+    ComplexNum w1 = root(s, t);
+    for (size_t j = 0; j < len; j++) {
+        if (step) w1 = root(s, t + j * step);
+        ComplexNum w2 = CMPLX(-s->sign * cimag(w1), s->sign * creal(w1)), w3 = cmul(w1, w1);
+        ComplexNum x0 = a0[j], x1 = a1[j], x2 = a2[j], x3 = a3[j];
+        ComplexNum b0 = x0 + x2, b2 = cmul(x0 - x2, w1);
+        ComplexNum b1 = x1 + x3, b3 = cmul(x1 - x3, w2);
+        a0[j] = (b0 + b1) * 0.5;
+        a1[j] = cmul(b0 - b1, w3) * 0.5;
+        a2[j] = (b2 + b3) * 0.5;
+        a3[j] = cmul(b2 - b3, w3) * 0.5;
+    }
+}
+
+static void radix4_span_single(const QftSweep* s, ComplexFloat* a0, ComplexFloat* a1, ComplexFloat* a2,
+                               ComplexFloat* a3, size_t len, size_t t, size_t step) {
+    ComplexNum w = root(s, t);
+    for (size_t j = 0; j < len; j++) {
+        if (step) w = root(s, t + j * step);
+        ComplexFloat w1 = (ComplexFloat)w;
+        ComplexFloat w2 = CMPLXF(-(float)s->sign * cimagf(w1), (float)s->sign * crealf(w1)), w3 = cmulf(w1, w1);
+        ComplexFloat x0 = a0[j], x1 = a1[j], x2 = a2[j], x3 = a3[j];
+        ComplexFloat b0 = x0 + x2, b2 = cmulf(x0 - x2, w1);
+        ComplexFloat b1 = x1 + x3, b3 = cmulf(x1 - x3, w2);
+        a0[j] = (b0 + b1) * 0.5f;
+        a1[j] = cmulf(b0 - b1, w3) * 0.5f;
+        a2[j] = (b2 + b3) * 0.5f;
+        a3[j] = cmulf(b2 - b3, w3) * 0.5f;
+    }
+}
+
+// Stage `bit` (and bit - 1 when radix4) for the butterflies [begin, end) of
+// the amplitudes from offset on. Butterfly k starts at k with zero bits
+// inserted at the stage positions, so the butterflies between two inserted
+// bits are contiguous; their twiddle index t (the register bits below the
+// stage) steps every 2^first_qubit butterflies.
+static void butterflies(const QftSweep* s, int bit, bool radix4, size_t offset, size_t begin, size_t end) {
+    int first = s->first_qubit;
+    int position = first + bit;
+    size_t high = (size_t)1 << position, low = high >> 1;
+    int shift = radix4 ? position - 1 : position;   // bits of k below the stage positions
+    size_t low_mask = ((size_t)1 << shift) - 1;
+    size_t inner_mask = ((size_t)1 << first) - 1;
+    size_t step = (size_t)1 << (s->num_qubits - 1 - bit);
+
+    for (size_t k = begin; k < end;) {
+        size_t i0 = offset + (((k >> shift) << (shift + (radix4 ? 2 : 1))) | (k & low_mask));
+        size_t t = ((k & low_mask) >> first) * step;
+        // With the register at qubit 0 the twiddle changes every butterfly and
+        // the span runs to the next inserted bit; otherwise it covers one twiddle
+        size_t len = first == 0 ? low_mask + 1 - (k & low_mask) : inner_mask + 1 - (k & inner_mask);
+        if (len > end - k) len = end - k;
+        size_t span_step = first == 0 ? step : 0;
+
+        if (!radix4) {
+            if (s->amplitudes_single) {
+                radix2_span_single(s, s->amplitudes_single + i0, s->amplitudes_single + (i0 | high), len, t, span_step);
+            } else {
+                radix2_span(s, s->amplitudes + i0, s->amplitudes + (i0 | high), len, t, span_step);
+            }
+        } else if (s->amplitudes_single) {
+            ComplexFloat* a = s->amplitudes_single;
+            radix4_span_single(s, a + i0, a + (i0 | low), a + (i0 | high), a + (i0 | high | low), len, t, span_step);
+        } else {
+            ComplexNum* a = s->amplitudes;
+            radix4_span(s, a + i0, a + (i0 | low), a + (i0 | high), a + (i0 | high | low), len, t, span_step);
+        }
+        k += len;
+    }
+}
+
+static inline uint64_t reverse_bits(uint64_t x, int bits) {
+    x = ((x >> 1) & 0x5555555555555555ull) | ((x & 0x5555555555555555ull) << 1);
+    x = ((x >> 2) & 0x3333333333333333ull) | ((x & 0x3333333333333333ull) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((x & 0x0F0F0F0F0F0F0F0Full) << 4);
+    x = ((x >> 8) & 0x00FF00FF00FF00FFull) | ((x & 0x00FF00FF00FF00FFull) << 8);
+    x = ((x >> 16) & 0x0000FFFF0000FFFFull) | ((x & 0x0000FFFF0000FFFFull) << 16);
+    x = (x >> 32) | (x << 32);
+    return x >> (64 - bits);
+}
+
+// Swaps the len amplitudes from i with those from j
+static inline void swap_span(const QftSweep* s, size_t i, size_t j, size_t len) {
+    if (s->amplitudes_single) {
+        ComplexFloat* a = s->amplitudes_single;
+        for (size_t k = 0; k < len; k++) {
+            ComplexFloat x = a[i + k];
+            a[i + k] = a[j + k];
+            a[j + k] = x;
+        }
+    } else {
+        ComplexNum* a = s->amplitudes;
+        for (size_t k = 0; k < len; k++) {
+            ComplexNum x = a[i + k];
+            a[i + k] = a[j + k];
+            a[j + k] = x;
+        }
+    }
+}
+
+// Puts the register bits back in order for the indices whose other bits are
+// base. Register values are split as (top, middle, bottom) with reverse_split
+// bits in top and bottom; reversing one maps the block of a middle value onto
+// the block of the reversed middle, with top and bottom exchanged. Swapping a
+// pair of blocks at a time keeps both sides in cache, where swapping index by
+// index would miss on nearly every access.
+static void reverse_block(const QftSweep* s, size_t base, size_t middle) {
+    int m = s->num_qubits, h = s->reverse_split;
+    int middle_bits = m - 2 * h;
+    size_t reversed_middle = middle_bits > 0 ? reverse_bits(middle, middle_bits) : 0;
+    if (reversed_middle < middle) {
+        return;   // swapped from the other block
+    }
+    size_t inner = (size_t)1 << s->first_qubit;
+    size_t edge = (size_t)1 << h;
+    size_t reversed[1 << MAX_REVERSE_SPLIT];
+    for (size_t v = 0; v < edge; v++) {
+        reversed[v] = reverse_bits(v, h);
+    }
+    for (size_t top = 0; top < edge; top++) {
+        for (size_t bottom = 0; bottom < edge; bottom++) {
+            size_t x = (top << (m - h)) | (middle << h) | bottom;
+            size_t r = (reversed[bottom] << (m - h)) | (reversed_middle << h) | reversed[top];
+            if (reversed_middle != middle || r > x) {
+                swap_span(s, base + (x << s->first_qubit), base + (r << s->first_qubit), inner);
+            }
+        }
+    }
+}
+
+// Bit reversal of the register for the blocks [begin, end) of the amplitudes
+// from offset on (a tile or the whole state)
+static void reverse_register(const QftSweep* s, size_t offset, size_t begin, size_t end) {
+    int middle_bits = s->num_qubits - 2 * s->reverse_split;
+    int above = s->first_qubit + s->num_qubits;
+    for (size_t block = begin; block < end; block++) {
+        size_t base = offset + ((block >> middle_bits) << above);
+        reverse_block(s, base, block & (((size_t)1 << middle_bits) - 1));
+    }
+}
+
+// Blocks of reverse_register in 2^n amplitudes
+static size_t reverse_blocks(const QftSweep* s, int n) {
+    return (size_t)1 << (n - s->first_qubit - 2 * s->reverse_split);
+}
+
+static void stage_range(void* ctx, size_t begin, size_t end) {
+    QftSweep* s = ctx;
+    butterflies(s, s->bit, s->radix4, 0, begin, end);
+}
+
+static void reverse_range(void* ctx, size_t begin, size_t end) {
+    reverse_register(ctx, 0, begin, end);
+}
+
+static void tile_range(void* ctx, size_t begin, size_t end) {
+    QftSweep* s = ctx;
+    for (size_t tile = begin; tile < end; tile++) {
+        size_t offset = tile << s->local_qubits;
+        for (int bit = s->tile_bits - 1; bit >= 0; bit -= 2) {
+            size_t count = (size_t)1 << (s->local_qubits - (bit > 0 ? 2 : 1));
+            butterflies(s, bit, bit > 0, offset, 0, count);
+        }
+        if (s->tile_reverse) {
+            reverse_register(s, offset, 0, reverse_blocks(s, s->local_qubits));
+        }
+    }
+}
+
+static void fft_register(QuantumState* state, int first_qubit, int num_qubits, double sign) {
+    QftSweep* s = malloc(sizeof(QftSweep));
+    int high_bits = num_qubits - num_qubits / 2;
+    int low_bits = num_qubits / 2;
+    size_t num_roots = ((size_t)1 << low_bits) + ((size_t)1 << high_bits);
+    ComplexNum* roots = malloc(num_roots * sizeof(ComplexNum));
+    if (!s || !roots) {
+        fprintf(stderr, "Error: Out of memory for the QFT tables\n");
+        free(s);
+        free(roots);
+        return;
+    }
+    profile_allocate(2, sizeof(QftSweep) + num_roots * sizeof(ComplexNum));
+
+    s->amplitudes = state->amplitudes;
+    s->amplitudes_single = state->amplitudes_single;
+    s->first_qubit = first_qubit;
+    s->num_qubits = num_qubits;
+    s->sign = sign;
+    s->low_bits = low_bits;
+    s->root_low = roots;
+    s->root_high = roots + ((size_t)1 << low_bits);
+    double turn = sign * 2.0 * PI / ldexp(1.0, num_qubits);
+    for (size_t t = 0; t < (size_t)1 << low_bits; t++) {
+        s->root_low[t] = cexp(I * turn * (double)t);
+    }
+    for (size_t t = 0; t < (size_t)1 << high_bits; t++) {
+        s->root_high[t] = cexp(I * turn * ldexp((double)t, low_bits));
+    }
+
+    // Register bits below tile_bits stay inside one tile; tiling pays off
+    // once it saves a sweep, and only for states larger than a tile
+    s->local_qubits = default_local_qubits();
+    s->tile_bits = s->local_qubits - first_qubit;
+    if (s->tile_bits > num_qubits) s->tile_bits = num_qubits;
+    if (s->tile_bits < 2 || s->local_qubits >= state->num_qubits) s->tile_bits = 0;
+    s->tile_reverse = s->tile_bits == num_qubits;
+
+    // Reversal blocks of 2^(2 split) spans of 2^first_qubit amplitudes, up to 2^10 amplitudes
+    s->reverse_split = (MAX_REVERSE_SPLIT * 2 - first_qubit) / 2;
+    if (s->reverse_split > num_qubits / 2) s->reverse_split = num_qubits / 2;
+    if (s->reverse_split < 1) s->reverse_split = 1;
+
+    // High stages, two per sweep
+    for (int bit = num_qubits - 1; bit >= s->tile_bits; bit -= 2) {
+        s->bit = bit;
+        s->radix4 = bit - 1 >= s->tile_bits;
+        profile_sweep(state->state_size);
+        parallel_for(state->state_size >> (s->radix4 ? 2 : 1), stage_range, s);
+    }
+
+    // Low stages, tile by tile
+    if (s->tile_bits > 0) {
+        profile_sweep(state->state_size);
+        parallel_for_coarse(state->state_size >> s->local_qubits, tile_range, s);
+    }
+
+    if (num_qubits > 1 && !s->tile_reverse) {
+        profile_sweep(state->state_size);
+        parallel_for(reverse_blocks(s, state->num_qubits), reverse_range, s);
+    }
+    free(roots);
+    free(s);
+}
+
+// The same transform as Hadamards, controlled phases and swaps, for backends
+// without a state vector
+static void qft_gates(QuantumState* state, int first_qubit, int num_qubits, double sign) {
+    for (int j = num_qubits - 1; j >= 0; j--) {
+        apply_hadamard(state, first_qubit + j);
+        for (int l = j - 1; l >= 0; l--) {
+            apply_controlled_phase(state, first_qubit + j, first_qubit + l, sign * PI / ldexp(1.0, j - l));
+        }
+    }
+    for (int l = 0; l < num_qubits / 2; l++) {
+        apply_swap(state, first_qubit + l, first_qubit + num_qubits - 1 - l);
+    }
+}
+
+static void transform_register(QuantumState* state, int first_qubit, int num_qubits, double sign) {
+    if (first_qubit < 0 || num_qubits < 1 || first_qubit + num_qubits > state->num_qubits) {
+        fprintf(stderr, "Error: Qubits %d to %d are outside the %d-qubit state\n",
+                first_qubit, first_qubit + num_qubits - 1, state->num_qubits);
+        return;
+    }
+    if (state->backend == BACKEND_STABILIZER && num_qubits > 1) {
+        fprintf(stderr, "Error: The QFT is not a Clifford operation and cannot run on the stabilizer backend\n");
+        return;
+    }
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        qft_gates(state, first_qubit, num_qubits, sign);
+        return;
+    }
+    fft_register(state, first_qubit, num_qubits, sign);
+}
+
+void apply_qft(QuantumState* state, int first_qubit, int num_qubits) {
+    PROFILE_SCOPE(QFT, first_qubit);
+    transform_register(state, first_qubit, num_qubits, 1.0);
+}
+
+void apply_inverse_qft(QuantumState* state, int first_qubit, int num_qubits) {
+    PROFILE_SCOPE(INVERSE_QFT, first_qubit);
+    transform_register(state, first_qubit, num_qubits, -1.0);
+}
@@ -1,192 +1,774 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "quantum.h"
+#include "circuit.h"
+#include "kernels.h"
+#include "mps.h"
+#include "profile.h"
+#include "sparse.h"
+#include "stabilizer.h"
+#include "threadpool.h"
 
 #define PI 3.14159265358979323846
 
-QuantumState* create_quantum_state(int num_qubits) {
-    if (num_qubits > MAX_QUBITS) {
-        fprintf(stderr, "Error: Too many qubits requested\n");
+#define AMPLITUDE_ALIGNMENT 64
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+typedef struct {
+    char* memory;
+    size_t element_size;
+} ZeroJob;
+
+static void zero_range(void* ctx, size_t begin, size_t end) {
+    ZeroJob* job = ctx;
+    memset(job->memory + begin * job->element_size, 0, (end - begin) * job->element_size);
+}
+
+// Bytes per amplitude of a state stored at precision
+static size_t amplitude_size(Precision precision) {
+    return precision == PRECISION_SINGLE ? sizeof(ComplexFloat) : sizeof(ComplexNum);
+}
+
+// Whether bytes is less than the machine's physical memory
+static bool fits_in_memory(size_t bytes) {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    return pages <= 0 || page_size <= 0 || bytes / (size_t)page_size < (size_t)pages;
+}
+
+// Allocates a zeroed amplitude array. Large arrays are aligned to 2 MiB and
+// advised to use transparent huge pages; zeroing is done by the worker pool
+// so the pages are first touched by the threads that will sweep them.
+static void* allocate_amplitudes(int num_qubits, size_t count, size_t element_size) {
+    size_t bytes = count * element_size;
+    size_t alignment = bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : AMPLITUDE_ALIGNMENT;
+
+    if (!fits_in_memory(bytes)) {
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page_size = sysconf(_SC_PAGESIZE);
+        fprintf(stderr, "Error: A %d-qubit state needs %.1f GiB but the machine has %.1f GiB of memory\n",
+                num_qubits, bytes / 1073741824.0, (double)pages * page_size / 1073741824.0);
+        return NULL;
+    }
+
+    void* memory = NULL;
+    if (posix_memalign(&memory, alignment, bytes) != 0) {
+        fprintf(stderr, "Error: Could not allocate %.1f GiB for a %d-qubit state\n",
+                bytes / 1073741824.0, num_qubits);
         return NULL;
     }
+#ifdef MADV_HUGEPAGE
+    if (alignment == HUGE_PAGE_SIZE) {
+        madvise(memory, bytes, MADV_HUGEPAGE);
+    }
+#endif
+
+    profile_allocate(1, bytes);
+    profile_sweep(count);
+    ZeroJob job = { memory, element_size };
+    parallel_for(count, zero_range, &job);
+    return memory;
+}
 
-    QuantumState* state = malloc(sizeof(QuantumState));
+// A state of the given backend with no storage attached yet; the
+// constructors below fill in the storage and seed its random stream.
+// Returns NULL after printing an error.
+static QuantumState* new_state(int num_qubits, Backend backend, Precision precision) {
+    QuantumState* state = calloc(1, sizeof(QuantumState));
+    if (!state) {
+        fprintf(stderr, "Error: Out of memory for a %d-qubit state\n", num_qubits);
+        return NULL;
+    }
     state->num_qubits = num_qubits;
-    state->state_size = 1 << num_qubits;  // 2^num_qubits
-    state->amplitudes = calloc(state->state_size, sizeof(ComplexNum));
+    state->backend = backend;
+    state->precision = precision;
+    return state;
+}
+
+QuantumState* create_quantum_state(int num_qubits) {
+    return create_quantum_state_with_precision(num_qubits, DEFAULT_PRECISION);
+}
+
+QuantumState* create_quantum_state_with_precision(int num_qubits, Precision precision) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    if (num_qubits < 0 || num_qubits > MAX_QUBITS) {
+        fprintf(stderr, "Error: Number of qubits must be between 0 and %d\n", MAX_QUBITS);
+        return NULL;
+    }
+
+    QuantumState* state = new_state(num_qubits, BACKEND_STATE_VECTOR, precision);
+    if (!state) {
+        return NULL;
+    }
+    state->state_size = (size_t)1 << num_qubits;  // 2^num_qubits
+    void* memory = allocate_amplitudes(num_qubits, state->state_size, amplitude_size(precision));
+    if (!memory) {
+        free(state);
+        return NULL;
+    }
+    if (precision == PRECISION_SINGLE) {
+        state->amplitudes_single = memory;
+    } else {
+        state->amplitudes = memory;
+    }
     
     // Initialize to |0> state
-    state->amplitudes[0] = 1.0 + 0.0*I;
+    set_amplitude(state, 0, 1.0);
+    rng_seed_next_stream(&state->rng);
     
     return state;
 }
 
+QuantumState* create_stabilizer_state(int num_qubits) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    QuantumState* state = new_state(num_qubits, BACKEND_STABILIZER, PRECISION_DOUBLE);
+    if (!state || !(state->tableau = create_tableau(num_qubits))) {
+        free(state);
+        return NULL;
+    }
+    rng_seed_next_stream(&state->rng);
+    return state;
+}
+
+QuantumState* create_mps_state(int num_qubits, int max_bond, double truncation_threshold) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    QuantumState* state = new_state(num_qubits, BACKEND_MPS, PRECISION_DOUBLE);
+    if (!state || !(state->mps = create_mps(num_qubits, max_bond, truncation_threshold))) {
+        free(state);
+        return NULL;
+    }
+    rng_seed_next_stream(&state->rng);
+    return state;
+}
+
+QuantumState* create_sparse_state(int num_qubits) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    // The precision is used once the state is densified
+    QuantumState* state = new_state(num_qubits, BACKEND_SPARSE, DEFAULT_PRECISION);
+    if (!state || !(state->sparse = create_sparse(num_qubits))) {
+        free(state);
+        return NULL;
+    }
+    rng_seed_next_stream(&state->rng);
+    return state;
+}
+
+// Turns a sparse state into a state vector once more than SPARSE_DENSE_FILL
+// of its amplitudes are non-zero. States too large for memory stay sparse.
+static void densify_if_full(QuantumState* state) {
+    int n = state->num_qubits;
+    size_t count = sparse_count(state->sparse);
+    if (n > MAX_QUBITS || (double)count <= SPARSE_DENSE_FILL * ldexp(1.0, n) ||
+        !fits_in_memory(((size_t)1 << n) * amplitude_size(state->precision))) {
+        return;
+    }
+    void* memory = allocate_amplitudes(n, (size_t)1 << n, amplitude_size(state->precision));
+    size_t* indices = malloc(count * sizeof(size_t));
+    ComplexNum* values = malloc(count * sizeof(ComplexNum));
+    if (!memory || !indices || !values) {
+        free(memory);
+        free(indices);
+        free(values);
+        return;
+    }
+    sparse_entries(state->sparse, indices, values);
+    destroy_sparse(state->sparse);
+    state->sparse = NULL;
+
+    state->backend = BACKEND_STATE_VECTOR;
+    state->state_size = (size_t)1 << n;
+    if (state->precision == PRECISION_SINGLE) {
+        state->amplitudes_single = memory;
+    } else {
+        state->amplitudes = memory;
+    }
+    for (size_t i = 0; i < count; i++) {
+        set_amplitude(state, indices[i], values[i]);
+    }
+    free(indices);
+    free(values);
+}
+
 void destroy_quantum_state(QuantumState* state) {
-    free(state->amplitudes);
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    if (state->mapping) {
+        munmap(state->mapping, state->mapping_size);
+    } else {
+        free(state->amplitudes);
+        free(state->amplitudes_single);
+    }
+    if (state->tableau) {
+        destroy_tableau(state->tableau);
+    }
+    if (state->mps) {
+        destroy_mps(state->mps);
+    }
+    if (state->sparse) {
+        destroy_sparse(state->sparse);
+    }
     free(state);
 }
 
+void copy_quantum_state(QuantumState* dest, const QuantumState* src) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    // A copy of a sparse state may have been densified since; the entries go back as amplitudes
+    if (src->backend == BACKEND_SPARSE && dest->backend == BACKEND_STATE_VECTOR &&
+        dest->num_qubits == src->num_qubits) {
+        size_t count = sparse_count(src->sparse);
+        size_t* indices = malloc(count * sizeof(size_t));
+        ComplexNum* values = malloc(count * sizeof(ComplexNum));
+        if (!indices || !values) {
+            fprintf(stderr, "Error: Out of memory copying a sparse state\n");
+        } else {
+            ZeroJob job = {
+                dest->amplitudes ? (char*)dest->amplitudes : (char*)dest->amplitudes_single,
+                amplitude_size(dest->precision)
+            };
+            profile_sweep(dest->state_size);
+            parallel_for(dest->state_size, zero_range, &job);
+            sparse_entries(src->sparse, indices, values);
+            for (size_t i = 0; i < count; i++) {
+                set_amplitude(dest, indices[i], values[i]);
+            }
+        }
+        free(indices);
+        free(values);
+        return;
+    }
+    if (dest->num_qubits != src->num_qubits || dest->backend != src->backend || dest->precision != src->precision) {
+        fprintf(stderr, "Error: Cannot copy a %d-qubit state into a different state layout\n", src->num_qubits);
+        return;
+    }
+    if (src->backend == BACKEND_STABILIZER) {
+        copy_tableau(dest->tableau, src->tableau);
+    } else if (src->backend == BACKEND_MPS) {
+        copy_mps(dest->mps, src->mps);
+    } else if (src->backend == BACKEND_SPARSE) {
+        copy_sparse(dest->sparse, src->sparse);
+    } else if (src->precision == PRECISION_SINGLE) {
+        profile_sweep(src->state_size);
+        memcpy(dest->amplitudes_single, src->amplitudes_single, src->state_size * sizeof(ComplexFloat));
+    } else {
+        profile_sweep(src->state_size);
+        memcpy(dest->amplitudes, src->amplitudes, src->state_size * sizeof(ComplexNum));
+    }
+}
+
+QuantumState* clone_quantum_state(const QuantumState* state) {
+    PROFILE_SCOPE(PROFILE_STATE, -1);
+    QuantumState* clone;
+    switch (state->backend) {
+        case BACKEND_STABILIZER:
+            clone = create_stabilizer_state(state->num_qubits);
+            break;
+        case BACKEND_MPS:
+            // copy_mps carries the bond limits over
+            clone = create_mps_state(state->num_qubits, MPS_DEFAULT_MAX_BOND, MPS_DEFAULT_TRUNCATION);
+            break;
+        case BACKEND_SPARSE:
+            clone = create_sparse_state(state->num_qubits);
+            if (clone) {
+                clone->precision = state->precision;
+            }
+            break;
+        default:
+            clone = create_quantum_state_with_precision(state->num_qubits, state->precision);
+            break;
+    }
+    if (clone) {
+        copy_quantum_state(clone, state);
+    }
+    return clone;
+}
+
+ComplexNum get_amplitude(const QuantumState* state, size_t index) {
+    if (state->backend == BACKEND_SPARSE) {
+        return sparse_get(state->sparse, index);
+    }
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        fprintf(stderr, "Error: Only state vectors have amplitudes to read\n");
+        return 0;
+    }
+    if (state->precision == PRECISION_SINGLE) {
+        return state->amplitudes_single[index];
+    }
+    return state->amplitudes[index];
+}
+
+void set_amplitude(QuantumState* state, size_t index, ComplexNum value) {
+    if (state->backend == BACKEND_SPARSE) {
+        sparse_set(state->sparse, index, value);
+        return;
+    }
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        fprintf(stderr, "Error: Only state vectors have amplitudes to write\n");
+        return;
+    }
+    if (state->precision == PRECISION_SINGLE) {
+        state->amplitudes_single[index] = (ComplexFloat)value;
+    } else {
+        state->amplitudes[index] = value;
+    }
+}
+
+// Gates on states that are not plain state vectors go to their backend
+static void apply_backend_gate(QuantumState* state, const Gate* gate) {
+    switch (state->backend) {
+        case BACKEND_STABILIZER:
+            tableau_apply_gate(state->tableau, gate);
+            break;
+        case BACKEND_MPS:
+            mps_apply_gate(state->mps, gate);
+            break;
+        case BACKEND_SPARSE:
+            sparse_apply_gate(state->sparse, gate);
+            densify_if_full(state);
+            break;
+        case BACKEND_STATE_VECTOR:
+            break;
+    }
+}
+
+// Arguments shared by the workers of one parallel gate sweep
+typedef struct {
+    ComplexNum* amplitudes;
+    ComplexFloat* amplitudes_single;   // set instead of amplitudes for single precision states
+    IndexPattern pattern;
+    size_t target_mask;
+    const ComplexNum (*matrix)[2];
+    ComplexNum phase;
+    const ComplexNum* dense_matrix;
+    int dim;
+    size_t offsets[1 << MAX_FUSED_QUBITS];
+} GateSweep;
+
+// A sweep over the amplitudes of state, in whichever precision it is stored
+static GateSweep state_sweep(QuantumState* state) {
+    GateSweep sweep = { .amplitudes = state->amplitudes, .amplitudes_single = state->amplitudes_single };
+    return sweep;
+}
+
+static void matrix_sweep_range(void* ctx, size_t begin, size_t end) {
+    GateSweep* sweep = ctx;
+    if (sweep->amplitudes_single) {
+        kernel_apply_matrix_single(sweep->amplitudes_single, &sweep->pattern, sweep->target_mask, sweep->matrix,
+                                   begin, end);
+    } else {
+        kernel_apply_matrix(sweep->amplitudes, &sweep->pattern, sweep->target_mask, sweep->matrix, begin, end);
+    }
+}
+
+static void phase_sweep_range(void* ctx, size_t begin, size_t end) {
+    GateSweep* sweep = ctx;
+    if (sweep->amplitudes_single) {
+        kernel_apply_phase_single(sweep->amplitudes_single, &sweep->pattern, sweep->phase, begin, end);
+    } else {
+        kernel_apply_phase(sweep->amplitudes, &sweep->pattern, sweep->phase, begin, end);
+    }
+}
+
+static void dense_sweep_range(void* ctx, size_t begin, size_t end) {
+    GateSweep* sweep = ctx;
+    if (sweep->amplitudes_single) {
+        kernel_apply_dense_single(sweep->amplitudes_single, &sweep->pattern, sweep->offsets, sweep->dim,
+                                  sweep->dense_matrix, begin, end);
+    } else {
+        kernel_apply_dense(sweep->amplitudes, &sweep->pattern, sweep->offsets, sweep->dim,
+                           sweep->dense_matrix, begin, end);
+    }
+}
+
+static void swap_sweep_range(void* ctx, size_t begin, size_t end) {
+    GateSweep* sweep = ctx;
+    if (sweep->amplitudes_single) {
+        kernel_swap_single(sweep->amplitudes_single, &sweep->pattern, sweep->target_mask, begin, end);
+    } else {
+        kernel_swap(sweep->amplitudes, &sweep->pattern, sweep->target_mask, begin, end);
+    }
+}
+
+static double norm_sweep_range(void* ctx, size_t begin, size_t end) {
+    GateSweep* sweep = ctx;
+    if (sweep->amplitudes_single) {
+        return kernel_norm_squared_single(sweep->amplitudes_single, &sweep->pattern, begin, end);
+    }
+    return kernel_norm_squared(sweep->amplitudes, &sweep->pattern, begin, end);
+}
+
+// Sum of |a_i|^2 over the indices containing all bits of set_mask and none of the other fixed bits
+static double sum_probabilities(QuantumState* state, size_t fixed_mask, size_t set_mask) {
+    GateSweep sweep = state_sweep(state);
+    make_index_pattern(&sweep.pattern, state->num_qubits, fixed_mask, set_mask);
+    profile_sweep(sweep.pattern.count);
+    return parallel_sum(sweep.pattern.count, norm_sweep_range, &sweep);
+}
+
+// Multiplies every amplitude matching the pattern (fixed_mask, set_mask) by phase
+static void scale_amplitudes(QuantumState* state, size_t fixed_mask, size_t set_mask, ComplexNum phase) {
+    GateSweep sweep = state_sweep(state);
+    sweep.phase = phase;
+    make_index_pattern(&sweep.pattern, state->num_qubits, fixed_mask, set_mask);
+    profile_sweep(sweep.pattern.count);
+    parallel_for(sweep.pattern.count, phase_sweep_range, &sweep);
+}
+
 void normalize_state(QuantumState* state) {
-    double norm = 0.0;
-    for (int i = 0; i < state->state_size; i++) {
-        norm += cabs(state->amplitudes[i]) * cabs(state->amplitudes[i]);
+    PROFILE_SCOPE(PROFILE_NORMALIZE, -1);
+    // Other backends keep their states normalized by construction
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        return;
     }
-    norm = sqrt(norm);
-    
-    for (int i = 0; i < state->state_size; i++) {
-        state->amplitudes[i] /= norm;
+    double norm = sqrt(sum_probabilities(state, 0, 0));
+    scale_amplitudes(state, 0, 0, 1.0 / norm);
+}
+
+double norm_drift(QuantumState* state) {
+    PROFILE_SCOPE(PROFILE_NORMALIZE, -1);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        return 0.0;
     }
+    return fabs(sum_probabilities(state, 0, 0) - 1.0);
 }
 
-void apply_hadamard(QuantumState* state, int target_qubit) {
-    ComplexNum* new_amplitudes = calloc(state->state_size, sizeof(ComplexNum));
-    int mask = 1 << target_qubit;
-    double scale = 1.0 / sqrt(2.0);
+double check_norm_drift(QuantumState* state, double tolerance) {
+    double drift = norm_drift(state);
+    if (drift > tolerance) {
+        normalize_state(state);
+    }
+    return drift;
+}
+
+double truncation_error(const QuantumState* state) {
+    return state->backend == BACKEND_MPS ? mps_truncation_error(state->mps) : 0.0;
+}
+
+void apply_single_qubit_unitary(QuantumState* state, int target_qubit, const ComplexNum matrix[2][2]) {
+    PROFILE_SCOPE(UNITARY, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = UNITARY, .num_qubits = 1, .qubits = { target_qubit }, .matrix = (ComplexNum*)matrix
+        });
+        return;
+    }
+    size_t mask = (size_t)1 << target_qubit;
+    GateSweep sweep = state_sweep(state);
+    sweep.target_mask = mask;
+    sweep.matrix = matrix;
     
-    for (int i = 0; i < state->state_size; i++) {
-        int i0 = i & ~mask;  // i with target bit = 0
-        int i1 = i | mask;   // i with target bit = 1
-        
-        if ((i & mask) == 0) {
-            new_amplitudes[i0] += scale * state->amplitudes[i];
-            new_amplitudes[i1] += scale * state->amplitudes[i];
-        } else {
-            new_amplitudes[i0] += scale * state->amplitudes[i];
-            new_amplitudes[i1] -= scale * state->amplitudes[i];
+    // Visit each pair base (target bit = 0) once and update (i0, i1) in place
+    make_index_pattern(&sweep.pattern, state->num_qubits, mask, 0);
+    profile_sweep(2 * sweep.pattern.count);
+    parallel_for(sweep.pattern.count, matrix_sweep_range, &sweep);
+}
+
+void apply_multi_qubit_unitary(QuantumState* state, const int* qubits, int num_target_qubits,
+                               const ComplexNum* matrix) {
+    PROFILE_SCOPE(UNITARY, num_target_qubits > 0 ? qubits[num_target_qubits - 1] : -1);
+    if (num_target_qubits < 1 || num_target_qubits > MAX_FUSED_QUBITS) {
+        fprintf(stderr, "Error: Dense gates act on 1 to %d qubits\n", MAX_FUSED_QUBITS);
+        return;
+    }
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        Gate gate = { .type = UNITARY, .num_qubits = num_target_qubits, .matrix = (ComplexNum*)matrix };
+        memcpy(gate.qubits, qubits, num_target_qubits * sizeof(int));
+        apply_backend_gate(state, &gate);
+        return;
+    }
+    if (num_target_qubits == 1) {
+        const ComplexNum m[2][2] = { { matrix[0], matrix[1] }, { matrix[2], matrix[3] } };
+        apply_single_qubit_unitary(state, qubits[0], m);
+        return;
+    }
+    
+    GateSweep sweep = state_sweep(state);
+    sweep.dense_matrix = matrix;
+    size_t fixed_mask = 0;
+    sweep.dim = 1 << num_target_qubits;
+    for (int l = 0; l < sweep.dim; l++) {
+        sweep.offsets[l] = 0;
+        for (int j = 0; j < num_target_qubits; j++) {
+            if (l & (1 << j)) {
+                sweep.offsets[l] |= (size_t)1 << qubits[j];
+            }
         }
     }
+    for (int j = 0; j < num_target_qubits; j++) {
+        fixed_mask |= (size_t)1 << qubits[j];
+    }
     
-    free(state->amplitudes);
-    state->amplitudes = new_amplitudes;
+    make_index_pattern(&sweep.pattern, state->num_qubits, fixed_mask, 0);
+    profile_sweep(sweep.pattern.count * sweep.dim);
+    parallel_for(sweep.pattern.count, dense_sweep_range, &sweep);
+}
+
+// Applies matrix to the target qubit on the subspace where all control bits are 1
+static void apply_controlled_matrix(QuantumState* state, size_t control_mask, int target_qubit,
+                                    const ComplexNum matrix[2][2]) {
+    size_t mask = (size_t)1 << target_qubit;
+    if (control_mask & mask) {
+        fprintf(stderr, "Error: Qubit %d is both a control and the target\n", target_qubit);
+        return;
+    }
+    GateSweep sweep = state_sweep(state);
+    sweep.target_mask = mask;
+    sweep.matrix = matrix;
+    make_index_pattern(&sweep.pattern, state->num_qubits, control_mask | mask, control_mask);
+    profile_sweep(2 * sweep.pattern.count);
+    parallel_for(sweep.pattern.count, matrix_sweep_range, &sweep);
+}
+
+// Multiplies every amplitude whose index contains all bits of mask by phase
+static void apply_diagonal_phase(QuantumState* state, size_t mask, ComplexNum phase) {
+    scale_amplitudes(state, mask, mask, phase);
+}
+
+static const ComplexNum pauli_x_matrix[2][2] = {
+    { 0, 1 },
+    { 1, 0 }
+};
+
+void apply_hadamard(QuantumState* state, int target_qubit) {
+    PROFILE_SCOPE(HADAMARD, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){ .type = HADAMARD, .num_qubits = 1, .qubits = { target_qubit } });
+        return;
+    }
+    double scale = 1.0 / sqrt(2.0);
+    const ComplexNum h[2][2] = {
+        { scale,  scale },
+        { scale, -scale }
+    };
+    apply_single_qubit_unitary(state, target_qubit, h);
 }
 
 void apply_pauli_x(QuantumState* state, int target_qubit) {
-    int mask = 1 << target_qubit;
-    for (int i = 0; i < state->state_size; i += 2) {
-        ComplexNum temp = state->amplitudes[i];
-        state->amplitudes[i] = state->amplitudes[i ^ mask];
-        state->amplitudes[i ^ mask] = temp;
+    PROFILE_SCOPE(PAULI_X, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){ .type = PAULI_X, .num_qubits = 1, .qubits = { target_qubit } });
+        return;
     }
+    apply_single_qubit_unitary(state, target_qubit, pauli_x_matrix);
 }
 
 void apply_pauli_z(QuantumState* state, int target_qubit) {
-    int mask = 1 << target_qubit;
-    for (int i = 0; i < state->state_size; i++) {
-        if (i & mask) {
-            state->amplitudes[i] *= -1;
-        }
+    PROFILE_SCOPE(PAULI_Z, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){ .type = PAULI_Z, .num_qubits = 1, .qubits = { target_qubit } });
+        return;
     }
+    apply_diagonal_phase(state, (size_t)1 << target_qubit, -1);
 }
 
 void apply_pauli_y(QuantumState* state, int target_qubit) {
-    int mask = 1 << target_qubit;
-    ComplexNum i_unit = I;  // Imaginary unit
-    
-    for (int i = 0; i < state->state_size; i++) {
-        if (i & mask) {
-            state->amplitudes[i ^ mask] = i_unit * state->amplitudes[i];
-            state->amplitudes[i] = -i_unit * state->amplitudes[i ^ mask];
-        }
+    PROFILE_SCOPE(PAULI_Y, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){ .type = PAULI_Y, .num_qubits = 1, .qubits = { target_qubit } });
+        return;
     }
+    const ComplexNum y[2][2] = {
+        { 0, -I },
+        { I,  0 }
+    };
+    apply_single_qubit_unitary(state, target_qubit, y);
 }
 
 void apply_phase(QuantumState* state, int target_qubit, double angle) {
-    int mask = 1 << target_qubit;
-    ComplexNum phase = cos(angle) + I * sin(angle);
-    
-    for (int i = 0; i < state->state_size; i++) {
-        if (i & mask) {
-            state->amplitudes[i] *= phase;
-        }
+    PROFILE_SCOPE(PHASE, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = PHASE, .num_qubits = 1, .qubits = { target_qubit }, .angle = angle
+        });
+        return;
     }
+    ComplexNum phase = cos(angle) + I * sin(angle);
+    apply_diagonal_phase(state, (size_t)1 << target_qubit, phase);
 }
 
 void apply_cnot(QuantumState* state, int control_qubit, int target_qubit) {
-    int control_mask = 1 << control_qubit;
-    int target_mask = 1 << target_qubit;
-    
-    for (int i = 0; i < state->state_size; i++) {
-        if (i & control_mask) {  // If control qubit is 1
-            int j = i ^ target_mask;  // Flip target qubit
-            ComplexNum temp = state->amplitudes[i];
-            state->amplitudes[i] = state->amplitudes[j];
-            state->amplitudes[j] = temp;
-        }
+    PROFILE_SCOPE(CNOT, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = CNOT, .num_qubits = 2, .qubits = { control_qubit, target_qubit }
+        });
+        return;
     }
+    apply_controlled_matrix(state, (size_t)1 << control_qubit, target_qubit, pauli_x_matrix);
 }
 
 void apply_swap(QuantumState* state, int qubit1, int qubit2) {
-    int mask1 = 1 << qubit1;
-    int mask2 = 1 << qubit2;
-    
-    for (int i = 0; i < state->state_size; i++) {
-        int bit1 = (i & mask1) != 0;
-        int bit2 = (i & mask2) != 0;
-        
-        if (bit1 != bit2) {
-            int j = i ^ mask1 ^ mask2;  // Flip both bits
-            ComplexNum temp = state->amplitudes[i];
-            state->amplitudes[i] = state->amplitudes[j];
-            state->amplitudes[j] = temp;
-        }
+    PROFILE_SCOPE(SWAP, qubit2);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){ .type = SWAP, .num_qubits = 2, .qubits = { qubit1, qubit2 } });
+        return;
+    }
+    if (qubit1 == qubit2) {
+        return;
     }
+    
+    size_t mask1 = (size_t)1 << qubit1;
+    size_t mask2 = (size_t)1 << qubit2;
+    GateSweep sweep = state_sweep(state);
+    sweep.target_mask = mask1 | mask2;
+    
+    // Exchange |..1..0..> with |..0..1..>; each pair is visited once
+    make_index_pattern(&sweep.pattern, state->num_qubits, mask1 | mask2, mask1);
+    profile_sweep(2 * sweep.pattern.count);
+    parallel_for(sweep.pattern.count, swap_sweep_range, &sweep);
 }
 
 void apply_toffoli(QuantumState* state, int control1, int control2, int target) {
-    int c1_mask = 1 << control1;
-    int c2_mask = 1 << control2;
-    int target_mask = 1 << target;
-    
-    for (int i = 0; i < state->state_size; i++) {
-        if ((i & c1_mask) && (i & c2_mask)) {  // Both controls are 1
-            int j = i ^ target_mask;  // Flip target bit
-            ComplexNum temp = state->amplitudes[i];
-            state->amplitudes[i] = state->amplitudes[j];
-            state->amplitudes[j] = temp;
-        }
+    PROFILE_SCOPE(TOFFOLI, target);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = TOFFOLI, .num_qubits = 3, .qubits = { control1, control2, target }
+        });
+        return;
     }
+    size_t control_mask = ((size_t)1 << control1) | ((size_t)1 << control2);
+    apply_controlled_matrix(state, control_mask, target, pauli_x_matrix);
 }
 
 int measure_qubit(QuantumState* state, int qubit) {
-    double prob_0 = 0.0;
-    int mask = 1 << qubit;
-    
-    // Calculate probability of measuring |0>
-    for (int i = 0; i < state->state_size; i++) {
-        if ((i & mask) == 0) {
-            prob_0 += cabs(state->amplitudes[i]) * cabs(state->amplitudes[i]);
-        }
+    PROFILE_SCOPE(MEASURE, qubit);
+    if (state->backend == BACKEND_STABILIZER) {
+        return tableau_measure(state->tableau, qubit, &state->rng);
+    }
+    if (state->backend == BACKEND_MPS) {
+        return mps_measure(state->mps, qubit, &state->rng);
     }
+    if (state->backend == BACKEND_SPARSE) {
+        return sparse_measure(state->sparse, qubit, &state->rng);
+    }
+    size_t mask = (size_t)1 << qubit;
     
-    // Random measurement
-    double rand_val = (double)rand() / RAND_MAX;
-    int result = (rand_val > prob_0) ? 1 : 0;
+    // Probabilities of measuring |0> and |1> (their sum is the current norm)
+    double prob_0 = sum_probabilities(state, mask, 0);
+    double prob_1 = sum_probabilities(state, mask, mask);
     
-    // Collapse state
-    for (int i = 0; i < state->state_size; i++) {
-        if ((i & mask) != (result << qubit)) {
-            state->amplitudes[i] = 0;
-        }
-    }
+    // Random measurement
+    double rand_val = rng_uniform(&state->rng);
+    int result = (rand_val * (prob_0 + prob_1) > prob_0) ? 1 : 0;
+    double kept = result ? prob_1 : prob_0;
     
-    normalize_state(state);
+    // Collapse and renormalize: zero the rejected half, rescale the kept half
+    scale_amplitudes(state, mask, result ? 0 : mask, 0.0);
+    scale_amplitudes(state, mask, result ? mask : 0, 1.0 / sqrt(kept));
     return result;
 }
 
-void grover_oracle(QuantumState* state, int marked_state) {
+double qubit_probability(QuantumState* state, int qubit) {
+    PROFILE_SCOPE(PROFILE_PROBABILITY, qubit);
+    if (state->backend == BACKEND_STABILIZER) {
+        fprintf(stderr, "Error: Stabilizer states do not expose outcome probabilities\n");
+        return 0.0;
+    }
+    if (state->backend == BACKEND_MPS) {
+        return mps_probability(state->mps, qubit);
+    }
+    if (state->backend == BACKEND_SPARSE) {
+        return sparse_probability(state->sparse, qubit);
+    }
+    size_t mask = (size_t)1 << qubit;
+    double prob_0 = sum_probabilities(state, mask, 0);
+    double prob_1 = sum_probabilities(state, mask, mask);
+    return prob_1 / (prob_0 + prob_1);
+}
+
+void grover_oracle(QuantumState* state, size_t marked_state) {
+    PROFILE_SCOPE(PHASE_FLIP, -1);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){ .type = PHASE_FLIP, .basis_state = marked_state });
+        return;
+    }
     // Phase flip for marked state
-    state->amplitudes[marked_state] *= -1;
+    set_amplitude(state, marked_state, -get_amplitude(state, marked_state));
+}
+
+// Sweeps of a Grover iteration over a state vector: the first flips the
+// amplitudes chosen by a predicate oracle (if any) and sums all of them, the
+// second subtracts shift from every amplitude
+typedef struct {
+    ComplexNum* amplitudes;
+    ComplexFloat* amplitudes_single;
+    const GroverOracle* oracle;
+    ComplexNum shift;
+} GroverSweep;
+
+static ComplexNum grover_sum_range(void* ctx, size_t begin, size_t end) {
+    GroverSweep* sweep = ctx;
+    GroverPredicate predicate = sweep->oracle ? sweep->oracle->predicate : NULL;
+    void* predicate_ctx = sweep->oracle ? sweep->oracle->ctx : NULL;
+    ComplexNum sum = 0.0;
+    if (sweep->amplitudes_single) {
+        ComplexFloat* a = sweep->amplitudes_single;
+        if (predicate) {
+            for (size_t i = begin; i < end; i++) {
+                if (predicate(i, predicate_ctx)) a[i] = -a[i];
+                sum += a[i];
+            }
+        } else {
+            for (size_t i = begin; i < end; i++) sum += a[i];
+        }
+    } else {
+        ComplexNum* a = sweep->amplitudes;
+        if (predicate) {
+            for (size_t i = begin; i < end; i++) {
+                if (predicate(i, predicate_ctx)) a[i] = -a[i];
+                sum += a[i];
+            }
+        } else {
+            for (size_t i = begin; i < end; i++) sum += a[i];
+        }
+    }
+    return sum;
+}
+
+static void grover_reflect_range(void* ctx, size_t begin, size_t end) {
+    GroverSweep* sweep = ctx;
+    if (sweep->amplitudes_single) {
+        ComplexFloat shift = (ComplexFloat)sweep->shift;
+        for (size_t i = begin; i < end; i++) sweep->amplitudes_single[i] -= shift;
+    } else {
+        for (size_t i = begin; i < end; i++) sweep->amplitudes[i] -= sweep->shift;
+    }
+}
+
+// Applies the oracle (if not NULL) and then I - 2|s><s|, which is what
+// H on every qubit, a phase flip of |0> and H again amount to: every
+// amplitude loses twice the mean amplitude. Two passes over the state.
+static void reflect_about_mean(QuantumState* state, const GroverOracle* oracle) {
+    GroverSweep sweep = { state->amplitudes, state->amplitudes_single, oracle, 0.0 };
+    if (oracle && !oracle->predicate) {
+        for (size_t m = 0; m < oracle->num_marked; m++) {
+            size_t marked = oracle->marked_states[m];
+            set_amplitude(state, marked, -get_amplitude(state, marked));
+        }
+    }
+    profile_sweep(state->state_size);
+    ComplexNum sum = parallel_sum_complex(state->state_size, grover_sum_range, &sweep);
+    sweep.shift = 2.0 * sum / (double)state->state_size;
+    profile_sweep(state->state_size);
+    parallel_for(state->state_size, grover_reflect_range, &sweep);
 }
 
 void grover_diffusion(QuantumState* state) {
+    PROFILE_SCOPE(PROFILE_GROVER_DIFFUSION, -1);
+    if (state->backend == BACKEND_STATE_VECTOR) {
+        reflect_about_mean(state, NULL);
+        return;
+    }
+
     // Apply H gates to all qubits
     for (int i = 0; i < state->num_qubits; i++) {
         apply_hadamard(state, i);
     }
     
     // Apply phase flip to |0> state
-    state->amplitudes[0] *= -1;
+    grover_oracle(state, 0);
     
     // Apply H gates again
     for (int i = 0; i < state->num_qubits; i++) {
@@ -194,40 +776,123 @@ void grover_diffusion(QuantumState* state) {
     }
 }
 
-void grover_search(QuantumState* state, int marked_state) {
-    // Initialize with superposition
-    for (int i = 0; i < state->num_qubits; i++) {
-        apply_hadamard(state, i);
+// Whether oracle can act on state (prints an error if not)
+static bool check_grover_oracle(const QuantumState* state, const GroverOracle* oracle) {
+    if (oracle->predicate) {
+        if (state->backend != BACKEND_STATE_VECTOR) {
+            fprintf(stderr, "Error: Predicate oracles need a state vector; list the marked states instead\n");
+            return false;
+        }
+        return true;
     }
-    
-    // Number of Grover iterations
-    int iterations = (int)(PI / 4.0 * sqrt(state->state_size));
-    
-    // Apply Grover iteration
-    for (int i = 0; i < iterations; i++) {
-        grover_oracle(state, marked_state);
-        grover_diffusion(state);
+    for (size_t m = 0; m < oracle->num_marked; m++) {
+        if (state->num_qubits < 64 && oracle->marked_states[m] >> state->num_qubits) {
+            fprintf(stderr, "Error: Marked state %zu does not fit in %d qubits\n", oracle->marked_states[m],
+                    state->num_qubits);
+            return false;
+        }
     }
+    return true;
 }
 
-void quantum_fourier_transform(QuantumState* state) {
-    // Apply QFT to all qubits
+static void run_grover_iteration(QuantumState* state, const GroverOracle* oracle) {
+    if (state->backend == BACKEND_STATE_VECTOR) {
+        reflect_about_mean(state, oracle);
+        return;
+    }
+    for (size_t m = 0; m < oracle->num_marked; m++) {
+        grover_oracle(state, oracle->marked_states[m]);
+    }
+    grover_diffusion(state);
+}
+
+void grover_iteration(QuantumState* state, const GroverOracle* oracle) {
+    PROFILE_SCOPE(PROFILE_GROVER_ITERATION, -1);
+    if (check_grover_oracle(state, oracle)) {
+        run_grover_iteration(state, oracle);
+    }
+}
+
+size_t grover_iterations(int num_qubits, size_t num_marked) {
+    double size = ldexp(1.0, num_qubits);
+    if (num_marked == 0 || num_marked >= size) {
+        return 0;
+    }
+    // The uniform state starts theta away from the unmarked states and every
+    // iteration turns it by 2 theta; stop closest to the marked ones
+    double theta = asin(sqrt(num_marked / size));
+    return (size_t)(PI / (4.0 * theta));
+}
+
+static double count_marked_range(void* ctx, size_t begin, size_t end) {
+    const GroverOracle* oracle = ctx;
+    size_t count = 0;
+    for (size_t i = begin; i < end; i++) {
+        count += oracle->predicate(i, oracle->ctx);
+    }
+    return (double)count;
+}
+
+// Runs an algorithm circuit on state and releases it. State vectors larger
+// than the cache are executed tile by tile, other memory-bound ones are fused.
+// Single precision states are renormalized if rounding moved their norm.
+static void run_algorithm_circuit(QuantumState* state, Circuit* circuit, int* classical_bits) {
+    int local_qubits = default_local_qubits();
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        execute_circuit(circuit, state, classical_bits);
+    } else if (state->num_qubits > local_qubits) {
+        execute_circuit_blocked(circuit, state, classical_bits, local_qubits);
+    } else {
+        if (state->num_qubits >= FUSION_MIN_QUBITS) {
+            Circuit* fused = fuse_circuit(circuit, DEFAULT_FUSED_QUBITS);
+            destroy_circuit(circuit);
+            circuit = fused;
+        }
+        execute_circuit(circuit, state, classical_bits);
+    }
+    destroy_circuit(circuit);
+    if (state->precision == PRECISION_SINGLE) {
+        check_norm_drift(state, NORM_DRIFT_TOLERANCE);
+    }
+}
+
+void grover_search(QuantumState* state, size_t marked_state) {
+    grover_search_oracle(state, &(GroverOracle){ .marked_states = &marked_state, .num_marked = 1 });
+}
+
+void grover_search_oracle(QuantumState* state, const GroverOracle* oracle) {
+    if (!check_grover_oracle(state, oracle)) {
+        return;
+    }
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        run_algorithm_circuit(state, build_grover_oracle_circuit(state->num_qubits, oracle->marked_states,
+                                                                 oracle->num_marked), NULL);
+        return;
+    }
+
+    size_t num_marked = oracle->num_marked;
+    if (oracle->predicate) {
+        num_marked = (size_t)parallel_sum(state->state_size, count_marked_range, (void*)oracle);
+    }
+
+    // Initialize with superposition, then iterate with two passes each
     for (int i = 0; i < state->num_qubits; i++) {
         apply_hadamard(state, i);
-        
-        // Apply controlled phase rotations
-        for (int j = i + 1; j < state->num_qubits; j++) {
-            double angle = PI / pow(2, j - i);
-            apply_phase(state, j, angle);
-        }
     }
-    
-    // Reverse qubit order
-    for (int i = 0; i < state->num_qubits / 2; i++) {
-        apply_swap(state, i, state->num_qubits - 1 - i);
+    size_t iterations = grover_iterations(state->num_qubits, num_marked);
+    for (size_t i = 0; i < iterations; i++) {
+        PROFILE_SCOPE(PROFILE_GROVER_ITERATION, -1);
+        run_grover_iteration(state, oracle);
+    }
+    if (state->precision == PRECISION_SINGLE) {
+        check_norm_drift(state, NORM_DRIFT_TOLERANCE);
     }
 }
 
+void quantum_fourier_transform(QuantumState* state) {
+    apply_qft(state, 0, state->num_qubits);
+}
+
 void deutsch_jozsa(QuantumState* state, bool is_constant) {
     // Initialize state
     for (int i = 0; i < state->num_qubits; i++) {
@@ -236,8 +901,8 @@ void deutsch_jozsa(QuantumState* state, bool is_constant) {
     
     // Apply oracle
     if (!is_constant) {
-        // Balanced function: flip half of the outputs
-        for (int i = 0; i < state->state_size / 2; i++) {
+        // Balanced function: phase by the parity of the input bits
+        for (int i = 0; i < state->num_qubits; i++) {
             apply_pauli_z(state, i);
         }
     }
@@ -266,47 +931,64 @@ void quantum_teleportation(QuantumState* source, QuantumState* target, int sourc
 }
 
 void apply_controlled_phase(QuantumState* state, int control_qubit, int target_qubit, double angle) {
-    int control_mask = 1 << control_qubit;
-    int target_mask = 1 << target_qubit;
-    ComplexNum phase = cos(angle) + I * sin(angle);
-    
-    for (int i = 0; i < state->state_size; i++) {
-        if ((i & control_mask) && (i & target_mask)) {
-            state->amplitudes[i] *= phase;
-        }
+    PROFILE_SCOPE(CONTROLLED_PHASE, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = CONTROLLED_PHASE, .num_qubits = 2, .qubits = { control_qubit, target_qubit }, .angle = angle
+        });
+        return;
     }
+    ComplexNum phase = cos(angle) + I * sin(angle);
+    apply_diagonal_phase(state, ((size_t)1 << control_qubit) | ((size_t)1 << target_qubit), phase);
 }
 
 void apply_rotation_x(QuantumState* state, int target_qubit, double angle) {
-    int mask = 1 << target_qubit;
+    PROFILE_SCOPE(ROTATION_X, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = ROTATION_X, .num_qubits = 1, .qubits = { target_qubit }, .angle = angle
+        });
+        return;
+    }
     double cos_half = cos(angle/2);
     double sin_half = sin(angle/2);
-    
-    for (int i = 0; i < state->state_size; i++) {
-        int i0 = i & ~mask;
-        int i1 = i | mask;
-        ComplexNum temp = state->amplitudes[i0];
-        state->amplitudes[i0] = cos_half * temp - I * sin_half * state->amplitudes[i1];
-        state->amplitudes[i1] = -I * sin_half * temp + cos_half * state->amplitudes[i1];
-    }
+    const ComplexNum rx[2][2] = {
+        { cos_half,        -I * sin_half },
+        { -I * sin_half,   cos_half      }
+    };
+    apply_single_qubit_unitary(state, target_qubit, rx);
 }
 
 void apply_rotation_y(QuantumState* state, int target_qubit, double angle) {
-    int mask = 1 << target_qubit;
+    PROFILE_SCOPE(ROTATION_Y, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = ROTATION_Y, .num_qubits = 1, .qubits = { target_qubit }, .angle = angle
+        });
+        return;
+    }
     double cos_half = cos(angle/2);
     double sin_half = sin(angle/2);
-    
-    for (int i = 0; i < state->state_size; i++) {
-        int i0 = i & ~mask;
-        int i1 = i | mask;
-        ComplexNum temp = state->amplitudes[i0];
-        state->amplitudes[i0] = cos_half * temp - sin_half * state->amplitudes[i1];
-        state->amplitudes[i1] = sin_half * temp + cos_half * state->amplitudes[i1];
-    }
+    const ComplexNum ry[2][2] = {
+        { cos_half, -sin_half },
+        { sin_half,  cos_half }
+    };
+    apply_single_qubit_unitary(state, target_qubit, ry);
 }
 
 void apply_rotation_z(QuantumState* state, int target_qubit, double angle) {
-    apply_phase(state, target_qubit, angle);
+    PROFILE_SCOPE(ROTATION_Z, target_qubit);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        apply_backend_gate(state, &(Gate){
+            .type = ROTATION_Z, .num_qubits = 1, .qubits = { target_qubit }, .angle = angle
+        });
+        return;
+    }
+    const ComplexNum rz[2][2] = {
+        { cexp(-I * angle / 2), 0                   },
+        { 0,                    cexp(I * angle / 2) }
+    };
+    apply_single_qubit_unitary(state, target_qubit, rz);
 }
 
 void create_bell_pair(QuantumState* state, int qubit1, int qubit2) {
@@ -349,57 +1031,38 @@ void quantum_random_number(QuantumState* state, int num_bits, int* result) {
 }
 
 void quantum_walk_1d(QuantumState* state, int steps) {
+    DiagonalBatch shift;
+    diagonal_batch_init(&shift);
+
     // Quantum walk on a line
     for (int step = 0; step < steps; step++) {
         // Coin flip (Hadamard)
         apply_hadamard(state, 0);
         
-        // Conditional shift
+        // Conditional shift, applied as one diagonal sweep
         for (int i = 1; i < state->num_qubits; i++) {
-            apply_controlled_phase(state, 0, i, PI/2);
+            diagonal_batch_controlled_phase(&shift, 0, i, PI/2);
         }
+        diagonal_batch_apply(state, &shift);
     }
+    diagonal_batch_free(&shift);
 }
 
 void quantum_phase_estimation(QuantumState* state, double true_phase) {
-    int precision_qubits = state->num_qubits / 2;
-    int target_qubit = state->num_qubits - 1;
-    
-    // Initialize phase estimation qubits
-    for (int i = 0; i < precision_qubits; i++) {
-        apply_hadamard(state, i);
-    }
-    
-    // Apply controlled rotations
-    for (int i = 0; i < precision_qubits; i++) {
-        double angle = true_phase * pow(2, i);
-        apply_controlled_phase(state, i, target_qubit, angle);
-    }
-    
-    // Inverse QFT
-    quantum_fourier_transform(state);
+    run_algorithm_circuit(state, build_phase_estimation_circuit(state->num_qubits, true_phase), NULL);
 }
 
 void shor_period_finding(QuantumState* state, int number_to_factor, int* period) {
-    // Simplified implementation for demonstration
-    int register_size = state->num_qubits / 2;
-    
-    // Initialize first register in superposition
-    for (int i = 0; i < register_size; i++) {
-        apply_hadamard(state, i);
-    }
-    
-    // Apply modular exponentiation (simplified)
-    for (int i = 0; i < register_size; i++) {
-        apply_controlled_phase(state, i, register_size + i, 2 * PI / number_to_factor);
-    }
-    
-    // QFT on first register
-    quantum_fourier_transform(state);
+    Circuit* circuit = build_shor_period_finding_circuit(state->num_qubits, number_to_factor);
+    int num_bits = circuit->num_classical_bits;
+    int* bits = calloc(num_bits + 1, sizeof(int));
+    run_algorithm_circuit(state, circuit, bits);
     
     // Measure to find period (simplified)
     *period = 0;
-    for (int i = 0; i < register_size; i++) {
-        *period |= (measure_qubit(state, i) << i);
+    for (int i = 0; i < num_bits; i++) {
+        *period |= (bits[i] << i);
     }
+    
+    free(bits);
 }
@@ -3,20 +3,90 @@
 
 #include <complex.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "rng.h"
 
-#define MAX_QUBITS 16
+// Upper bound on the qubit count; the practical limit is available memory
+// (a double precision state needs 16 * 2^n bytes: 16 GiB at 30 qubits,
+// a single precision state half of that)
+#define MAX_QUBITS 48
+
+// Upper bound for stabilizer states, whose tableau takes n^2 / 2 bytes
+#define MAX_STABILIZER_QUBITS 16384
+
+// Upper bound for matrix product states, whose size depends on entanglement
+#define MAX_MPS_QUBITS 4096
+
+// Upper bound for sparse states, whose basis indices must fit in 63 bits
+#define MAX_SPARSE_QUBITS 63
+
+// Sparse states become state vectors once more than this fraction of the
+// amplitudes is non-zero: a sparse entry takes several times the memory of a
+// dense one and costs a hash lookup per gate
+#define SPARSE_DENSE_FILL (1.0 / 16)
+
+// Matrix product state limits used unless given explicitly: the largest bond
+// dimension, and the weight of the singular values one SVD may discard
+#define MPS_DEFAULT_MAX_BOND 64
+#define MPS_DEFAULT_TRUNCATION 1e-12
+
+// Largest gate (in qubits) that can be applied as one dense matrix
+#define MAX_FUSED_QUBITS 6
 
 // Complex number type for quantum amplitudes
 typedef double complex ComplexNum;
 
+// Amplitude type of single precision states
+typedef float complex ComplexFloat;
+
+// Storage precision of a state vector. Gate matrices, angles and probability
+// sums stay in double precision either way.
+typedef enum {
+    PRECISION_DOUBLE,
+    PRECISION_SINGLE
+} Precision;
+
+// Precision used by create_quantum_state (build with -DQSIM_SINGLE_PRECISION
+// to make single precision the default)
+#ifdef QSIM_SINGLE_PRECISION
+#define DEFAULT_PRECISION PRECISION_SINGLE
+#else
+#define DEFAULT_PRECISION PRECISION_DOUBLE
+#endif
+
+// Largest |norm^2 - 1| that check_norm_drift leaves uncorrected
+#define NORM_DRIFT_TOLERANCE 1e-6
+
+// How a state is stored. Every backend is driven through the same gate API.
+typedef enum {
+    BACKEND_STATE_VECTOR,   // 2^n amplitudes, any gate
+    BACKEND_STABILIZER,     // stabilizer tableau: Clifford gates only, thousands of qubits
+    BACKEND_MPS,            // matrix product state: weakly entangled circuits on hundreds of qubits
+    BACKEND_SPARSE          // hash of the non-zero amplitudes, densified once it fills up
+} Backend;
+
+typedef struct StabilizerTableau StabilizerTableau;
+typedef struct MpsState MpsState;
+typedef struct SparseState SparseState;
+
 // Quantum state structure
 typedef struct {
     int num_qubits;
-    int state_size;
-    ComplexNum* amplitudes;
+    size_t state_size;       // number of amplitudes (0 for backends without a state vector)
+    Backend backend;
+    Precision precision;
+    ComplexNum* amplitudes;          // double precision storage, NULL for single precision states
+    ComplexFloat* amplitudes_single; // single precision storage, NULL for double precision states
+    StabilizerTableau* tableau;      // BACKEND_STABILIZER only
+    MpsState* mps;                   // BACKEND_MPS only
+    SparseState* sparse;             // BACKEND_SPARSE only
+    void* mapping;                   // snapshot file the amplitudes are mapped from (see snapshot.h), or NULL
+    size_t mapping_size;
+    RngState rng;                    // measurement randomness, one stream per state
 } QuantumState;
 
-// Basic quantum gates
+// Gate types recorded in circuits (see circuit.h)
 typedef enum {
     HADAMARD,
     PAULI_X,
@@ -25,20 +95,68 @@ typedef enum {
     PHASE,
     CNOT,
     SWAP,
-    TOFFOLI
+    TOFFOLI,
+    CONTROLLED_PHASE,
+    ROTATION_X,
+    ROTATION_Y,
+    ROTATION_Z,
+    PHASE_FLIP,     // negate the amplitude of one basis state
+    MEASURE,
+    UNITARY,        // dense matrix on up to MAX_FUSED_QUBITS qubits
+    QFT,            // quantum Fourier transform of a contiguous register
+    INVERSE_QFT
 } GateType;
 
 // Function prototypes
+// New states start in |0> and take the next random stream of the seed set by qsim_set_seed
 QuantumState* create_quantum_state(int num_qubits);
+QuantumState* create_quantum_state_with_precision(int num_qubits, Precision precision);
+
+// Stabilizer state in |0...0> for up to MAX_STABILIZER_QUBITS qubits. It accepts
+// H, X, Y, Z, CNOT, SWAP, measurement, phases and rotations by multiples of pi/2
+// and controlled phases by multiples of pi; other gates print an error and
+// leave the state unchanged.
+QuantumState* create_stabilizer_state(int num_qubits);
+
+// Matrix product state in |0...0> for up to MAX_MPS_QUBITS qubits. Bonds are
+// capped at max_bond, and each SVD drops the smallest singular values while
+// their weight stays within truncation_threshold (see truncation_error).
+// Every gate except whole-register phase flips is accepted.
+QuantumState* create_mps_state(int num_qubits, int max_bond, double truncation_threshold);
+
+// Sparse state in |0...0> for up to MAX_SPARSE_QUBITS qubits: gates cost time
+// proportional to the number of non-zero amplitudes. Once more than
+// SPARSE_DENSE_FILL of them are non-zero (and 2^n amplitudes fit in memory)
+// the state turns into a state vector in place, stored at state->precision
+// (DEFAULT_PRECISION unless changed before it fills up).
+QuantumState* create_sparse_state(int num_qubits);
 void destroy_quantum_state(QuantumState* state);
 
+// Copies src into dest (same backend, qubit count and precision)
+void copy_quantum_state(QuantumState* dest, const QuantumState* src);
+
+// New state holding a copy of state, with its own random stream
+QuantumState* clone_quantum_state(const QuantumState* state);
+
+// Element access that works for either precision (amplitudes are widened to double).
+// Only state vectors and sparse states have amplitudes.
+ComplexNum get_amplitude(const QuantumState* state, size_t index);
+void set_amplitude(QuantumState* state, size_t index, ComplexNum value);
+
 // Single qubit gates
+// Applies an arbitrary 2x2 matrix to the target qubit in place
+void apply_single_qubit_unitary(QuantumState* state, int target_qubit, const ComplexNum matrix[2][2]);
 void apply_hadamard(QuantumState* state, int target_qubit);
 void apply_pauli_x(QuantumState* state, int target_qubit);
 void apply_pauli_y(QuantumState* state, int target_qubit);
 void apply_pauli_z(QuantumState* state, int target_qubit);
 void apply_phase(QuantumState* state, int target_qubit, double angle);
 
+// Applies a dense 2^k x 2^k row-major matrix to k qubits (k <= MAX_FUSED_QUBITS).
+// Bit j of a row/column index corresponds to qubits[j].
+void apply_multi_qubit_unitary(QuantumState* state, const int* qubits, int num_target_qubits,
+                               const ComplexNum* matrix);
+
 // Two qubit gates
 void apply_cnot(QuantumState* state, int control_qubit, int target_qubit);
 void apply_swap(QuantumState* state, int qubit1, int qubit2);
@@ -50,14 +168,113 @@ void apply_rotation_x(QuantumState* state, int target_qubit, double angle);
 void apply_rotation_y(QuantumState* state, int target_qubit, double angle);
 void apply_rotation_z(QuantumState* state, int target_qubit, double angle);
 
+// Quantum Fourier transform of the register formed by qubits first_qubit ..
+// first_qubit + num_qubits - 1 (qubit first_qubit is its lowest bit):
+// |x> -> 2^(-m/2) sum_k e^(2 pi i x k / 2^m) |k>, with m = num_qubits, for
+// every value of the other qubits. The inverse uses e^(-2 pi i x k / 2^m).
+// State vectors run it as an in-place FFT; other backends apply the
+// equivalent Hadamards, controlled phases and swaps.
+void apply_qft(QuantumState* state, int first_qubit, int num_qubits);
+void apply_inverse_qft(QuantumState* state, int first_qubit, int num_qubits);
+
+// Diagonal gate batching: phases of consecutive diagonal gates are collected
+// and applied together in one pass over the state
+
+// Phases are looked up per run of 2^DIAGONAL_TABLE_BITS amplitudes: one table
+// over the low bits of the index, multiplied by one table per set high bit
+#define DIAGONAL_TABLE_BITS 8
+
+typedef struct {
+    size_t mask;   // one or two qubits
+    double angle;  // multiplies every amplitude whose index contains mask by e^{i angle}
+} DiagonalTerm;
+
+typedef struct {
+    DiagonalTerm* terms;
+    int num_terms;
+    int capacity;
+    double global_angle;
+} DiagonalBatch;
+
+void diagonal_batch_init(DiagonalBatch* batch);
+void diagonal_batch_free(DiagonalBatch* batch);
+void diagonal_batch_add(DiagonalBatch* batch, size_t mask, double angle);
+void diagonal_batch_phase(DiagonalBatch* batch, int qubit, double angle);
+void diagonal_batch_pauli_z(DiagonalBatch* batch, int qubit);
+void diagonal_batch_rotation_z(DiagonalBatch* batch, int qubit, double angle);
+void diagonal_batch_controlled_phase(DiagonalBatch* batch, int control_qubit, int target_qubit, double angle);
+// Applies every collected gate in a single sweep and empties the batch
+void diagonal_batch_apply(QuantumState* state, DiagonalBatch* batch);
+
 // Measurement
 int measure_qubit(QuantumState* state, int qubit);
+
+// Probability of measuring 1 on qubit, without collapsing the state.
+// Stabilizer states print an error and return 0.
+double qubit_probability(QuantumState* state, int qubit);
 void normalize_state(QuantumState* state);
 
+// Rounding error makes the norm of long single precision runs wander from 1.
+// norm_drift returns |norm^2 - 1|; check_norm_drift renormalizes the state when
+// the drift exceeds tolerance and returns the drift it found.
+double norm_drift(QuantumState* state);
+double check_norm_drift(QuantumState* state, double tolerance);
+
+// Weight discarded by MPS truncations so far, summed over every SVD: the
+// fidelity with the exact state is at least about 1 minus this. Other
+// backends are exact and report 0.
+double truncation_error(const QuantumState* state);
+
+// One histogram entry: bit j of outcome is the result for the j-th sampled qubit
+typedef struct {
+    size_t outcome;
+    uint64_t count;
+} ShotCount;
+
+// Aggregated sampling results, sorted by outcome
+typedef struct {
+    ShotCount* counts;
+    size_t num_outcomes;
+    uint64_t shots;
+} ShotHistogram;
+
+// Measures qubits[0..num_qubits) shots times without collapsing the state
+// (qubits == NULL samples every qubit); only the state's random stream advances. The distribution is built once, so
+// each extra shot costs a few operations instead of a pass over the state.
+// Returns false after printing an error; free the result with free_shot_histogram.
+bool sample_shots(QuantumState* state, uint64_t shots, const int* qubits, int num_qubits,
+                  ShotHistogram* histogram);
+void free_shot_histogram(ShotHistogram* histogram);
+
+// Callback for states held in pieces (out-of-core and distributed states):
+// chunk is a state vector holding a run of consecutive amplitudes, to be read
+// but not changed, and first_index is the index of its first amplitude
+typedef bool (*ChunkVisitor)(const QuantumState* chunk, size_t first_index, void* ctx);
+
 // Grover's algorithm
-void grover_search(QuantumState* state, int marked_state);
+typedef bool (*GroverPredicate)(size_t basis_state, void* ctx);
+
+// Oracle of a search: flips the phase of the distinct basis states in
+// marked_states, or of those for which predicate returns true when it is set
+// (called concurrently, so ctx must only be read). Predicates need a state vector.
+typedef struct {
+    const size_t* marked_states;
+    size_t num_marked;
+    GroverPredicate predicate;
+    void* ctx;
+} GroverOracle;
+
+void grover_search(QuantumState* state, size_t marked_state);
+void grover_search_oracle(QuantumState* state, const GroverOracle* oracle);
 void grover_diffusion(QuantumState* state);
-void grover_oracle(QuantumState* state, int marked_state);
+void grover_oracle(QuantumState* state, size_t marked_state);
+
+// One oracle call and diffusion. State vectors take two passes: one flips the
+// marked amplitudes and sums them all, the other reflects them about the mean.
+void grover_iteration(QuantumState* state, const GroverOracle* oracle);
+
+// Iterations that maximize the chance of measuring one of num_marked states
+size_t grover_iterations(int num_qubits, size_t num_marked);
 
 // Quantum algorithms
 void quantum_fourier_transform(QuantumState* state);
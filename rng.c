@@ -0,0 +1,60 @@
+#include <stdatomic.h>
+#include "rng.h"
+
+// Used until qsim_set_seed is called
+#define DEFAULT_SEED 0x5EEDC0FFEE123457ULL
+
+static atomic_uint_fast64_t global_seed = DEFAULT_SEED;
+static atomic_uint_fast64_t next_stream = 0;
+
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(RngState* rng, uint64_t seed, uint64_t stream) {
+    // Hash the stream number into the seed, then expand with splitmix64 as
+    // recommended by the xoshiro authors (never yields the all-zero state)
+    uint64_t mix = stream;
+    uint64_t x = seed ^ splitmix64(&mix);
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&x);
+    }
+}
+
+void rng_seed_next_stream(RngState* rng) {
+    rng_seed(rng, atomic_load(&global_seed), atomic_fetch_add(&next_stream, 1));
+}
+
+uint64_t rng_next(RngState* rng) {
+    uint64_t* s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+double rng_uniform(RngState* rng) {
+    return (rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+double rng_uniform_open(RngState* rng) {
+    return ((rng_next(rng) >> 11) + 0.5) * 0x1.0p-53;
+}
+
+void qsim_set_seed(uint64_t seed) {
+    atomic_store(&global_seed, seed);
+    atomic_store(&next_stream, 0);
+}
@@ -0,0 +1,32 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// xoshiro256** generator state. Each QuantumState owns one, so states can be
+// measured and sampled from different threads without sharing a generator.
+typedef struct {
+    uint64_t s[4];
+} RngState;
+
+// Seeds rng for stream number `stream` of `seed`; different streams of the
+// same seed are statistically independent
+void rng_seed(RngState* rng, uint64_t seed, uint64_t stream);
+
+// Seeds rng with the next stream of the process-wide seed (see qsim_set_seed)
+void rng_seed_next_stream(RngState* rng);
+
+uint64_t rng_next(RngState* rng);
+
+// Uniform double in [0, 1) with 53 bits of resolution
+double rng_uniform(RngState* rng);
+
+// Uniform double in (0, 1), safe to pass to log()
+double rng_uniform_open(RngState* rng);
+
+// Sets the process-wide seed and restarts stream numbering, so a program that
+// creates its states in the same order draws the same random numbers on every
+// run, whatever the thread count
+void qsim_set_seed(uint64_t seed);
+
+#endif /* RNG_H */
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "quantum.h"
+#include "kernels.h"
+#include "mps.h"
+#include "profile.h"
+#include "sparse.h"
+#include "threadpool.h"
+
+// Outcomes are grouped into blocks of this size; only the block totals are
+// kept as a prefix sum, and blocks are rescanned when a shot lands in them
+#define SAMPLE_BLOCK (1 << 12)
+
+typedef struct {
+    const QuantumState* state;
+    const int* qubits;
+    int num_qubits;
+    double* probabilities;   // marginal distribution, NULL when sampling every qubit in order
+    double* block_totals;
+} Sampler;
+
+static inline double outcome_probability(const Sampler* sampler, size_t outcome) {
+    if (sampler->probabilities) {
+        return sampler->probabilities[outcome];
+    }
+    if (sampler->state->precision == PRECISION_SINGLE) {
+        ComplexFloat a = sampler->state->amplitudes_single[outcome];
+        return (double)crealf(a) * crealf(a) + (double)cimagf(a) * cimagf(a);
+    }
+    ComplexNum a = sampler->state->amplitudes[outcome];
+    return creal(a) * creal(a) + cimag(a) * cimag(a);
+}
+
+typedef struct {
+    const ComplexNum* amplitudes;
+    const ComplexFloat* amplitudes_single;
+    IndexPattern pattern;
+} MarginalSweep;
+
+static double marginal_sweep_range(void* ctx, size_t begin, size_t end) {
+    MarginalSweep* sweep = ctx;
+    if (sweep->amplitudes_single) {
+        return kernel_norm_squared_single(sweep->amplitudes_single, &sweep->pattern, begin, end);
+    }
+    return kernel_norm_squared(sweep->amplitudes, &sweep->pattern, begin, end);
+}
+
+// probabilities[o] = sum of |a_i|^2 over the indices whose sampled bits spell o.
+// Small outcome spaces parallelize the inner sums, large ones the outcomes.
+static void marginal_range(void* ctx, size_t begin, size_t end) {
+    Sampler* sampler = ctx;
+    size_t fixed_mask = 0;
+    for (int j = 0; j < sampler->num_qubits; j++) {
+        fixed_mask |= (size_t)1 << sampler->qubits[j];
+    }
+
+    for (size_t outcome = begin; outcome < end; outcome++) {
+        MarginalSweep sweep = {
+            .amplitudes = sampler->state->amplitudes,
+            .amplitudes_single = sampler->state->amplitudes_single
+        };
+        size_t set_mask = 0;
+        for (int j = 0; j < sampler->num_qubits; j++) {
+            if (outcome & ((size_t)1 << j)) {
+                set_mask |= (size_t)1 << sampler->qubits[j];
+            }
+        }
+        make_index_pattern(&sweep.pattern, sampler->state->num_qubits, fixed_mask, set_mask);
+        sampler->probabilities[outcome] = parallel_sum(sweep.pattern.count, marginal_sweep_range, &sweep);
+    }
+}
+
+static void block_total_range(void* ctx, size_t begin, size_t end) {
+    Sampler* sampler = ctx;
+    size_t num_outcomes = (size_t)1 << sampler->num_qubits;
+    for (size_t b = begin; b < end; b++) {
+        size_t last = (b + 1) * SAMPLE_BLOCK < num_outcomes ? (b + 1) * SAMPLE_BLOCK : num_outcomes;
+        double total = 0.0;
+        for (size_t outcome = b * SAMPLE_BLOCK; outcome < last; outcome++) {
+            total += outcome_probability(sampler, outcome);
+        }
+        sampler->block_totals[b] = total;
+    }
+}
+
+static bool add_count(ShotHistogram* histogram, size_t* capacity, size_t outcome) {
+    size_t n = histogram->num_outcomes;
+    if (n > 0 && histogram->counts[n - 1].outcome == outcome) {
+        histogram->counts[n - 1].count++;
+        return true;
+    }
+    if (n == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 64;
+        ShotCount* grown = realloc(histogram->counts, *capacity * sizeof(ShotCount));
+        if (!grown) {
+            return false;
+        }
+        histogram->counts = grown;
+    }
+    histogram->counts[n].outcome = outcome;
+    histogram->counts[n].count = 1;
+    histogram->num_outcomes++;
+    return true;
+}
+
+static int compare_outcomes(const void* a, const void* b) {
+    size_t x = *(const size_t*)a;
+    size_t y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Measures a fresh copy of the state for every shot
+static bool measure_copies(QuantumState* state, uint64_t shots, const int* qubits, int num_qubits,
+                           size_t* outcomes) {
+    QuantumState* copy = clone_quantum_state(state);
+    if (!copy) {
+        fprintf(stderr, "Error: Out of memory copying the state for sampling\n");
+        return false;
+    }
+
+    // The copy draws from the state's stream, so only that stream advances
+    copy->rng = state->rng;
+    for (uint64_t s = 0; s < shots; s++) {
+        if (s > 0) {
+            copy_quantum_state(copy, state);
+        }
+        outcomes[s] = 0;
+        for (int j = 0; j < num_qubits; j++) {
+            outcomes[s] |= (size_t)measure_qubit(copy, qubits[j]) << j;
+        }
+    }
+    state->rng = copy->rng;
+    destroy_quantum_state(copy);
+    return true;
+}
+
+typedef struct {
+    size_t outcome;
+    double probability;
+} WeightedOutcome;
+
+static int compare_weighted(const void* a, const void* b) {
+    size_t x = ((const WeightedOutcome*)a)->outcome;
+    size_t y = ((const WeightedOutcome*)b)->outcome;
+    return (x > y) - (x < y);
+}
+
+// Sparse states: the marginal distribution is built from the stored entries
+// alone and walked once with sorted draws, like the dense path
+static bool sample_sparse(QuantumState* state, uint64_t shots, const int* qubits, int num_qubits,
+                          ShotHistogram* histogram) {
+    size_t count = sparse_count(state->sparse);
+    size_t* indices = malloc(count * sizeof(size_t));
+    ComplexNum* values = malloc(count * sizeof(ComplexNum));
+    WeightedOutcome* outcomes = malloc(count * sizeof(WeightedOutcome));
+    if (!indices || !values || !outcomes) {
+        fprintf(stderr, "Error: Out of memory sampling %zu sparse amplitudes\n", count);
+        free(indices);
+        free(values);
+        free(outcomes);
+        return false;
+    }
+
+    sparse_entries(state->sparse, indices, values);
+    double total = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        outcomes[i].outcome = 0;
+        for (int j = 0; j < num_qubits; j++) {
+            outcomes[i].outcome |= ((indices[i] >> qubits[j]) & 1) << j;
+        }
+        outcomes[i].probability = creal(values[i]) * creal(values[i]) + cimag(values[i]) * cimag(values[i]);
+        total += outcomes[i].probability;
+    }
+    free(indices);
+    free(values);
+
+    // Merge entries with the same outcome
+    qsort(outcomes, count, sizeof(WeightedOutcome), compare_weighted);
+    size_t num_outcomes = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (num_outcomes > 0 && outcomes[num_outcomes - 1].outcome == outcomes[i].outcome) {
+            outcomes[num_outcomes - 1].probability += outcomes[i].probability;
+        } else {
+            outcomes[num_outcomes++] = outcomes[i];
+        }
+    }
+
+    size_t capacity = 0;
+    double remaining = 1.0;
+    double cumulative = 0.0;
+    size_t k = 0;
+    bool ok = true;
+    for (uint64_t s = 0; s < shots && ok; s++) {
+        remaining *= pow(rng_uniform_open(&state->rng), 1.0 / (double)(shots - s));
+        double position = total * (1.0 - remaining);
+        while (k + 1 < num_outcomes && cumulative + outcomes[k].probability <= position) {
+            cumulative += outcomes[k].probability;
+            k++;
+        }
+        ok = add_count(histogram, &capacity, outcomes[k].outcome);
+    }
+    free(outcomes);
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory for the shot histogram\n");
+        free_shot_histogram(histogram);
+        return false;
+    }
+    histogram->shots = shots;
+    return true;
+}
+
+// Backends without an amplitude array draw each shot separately: matrix
+// product states sweep their sites, others measure a copy of the state
+static bool sample_without_amplitudes(QuantumState* state, uint64_t shots, const int* qubits, int num_qubits,
+                                      ShotHistogram* histogram) {
+    size_t* outcomes = malloc(shots * sizeof(size_t));
+    if (!outcomes) {
+        fprintf(stderr, "Error: Out of memory for %llu shots\n", (unsigned long long)shots);
+        return false;
+    }
+    if (state->backend == BACKEND_MPS) {
+        mps_sample(state->mps, &state->rng, qubits, num_qubits, shots, outcomes);
+    } else if (!measure_copies(state, shots, qubits, num_qubits, outcomes)) {
+        free(outcomes);
+        return false;
+    }
+
+    qsort(outcomes, shots, sizeof(size_t), compare_outcomes);
+    size_t capacity = 0;
+    bool ok = true;
+    for (uint64_t s = 0; s < shots && ok; s++) {
+        ok = add_count(histogram, &capacity, outcomes[s]);
+    }
+    free(outcomes);
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory for the shot histogram\n");
+        free_shot_histogram(histogram);
+        return false;
+    }
+    histogram->shots = shots;
+    return true;
+}
+
+bool sample_shots(QuantumState* state, uint64_t shots, const int* qubits, int num_qubits,
+                  ShotHistogram* histogram) {
+    PROFILE_SCOPE(PROFILE_SAMPLE, -1);
+    histogram->counts = NULL;
+    histogram->num_outcomes = 0;
+    histogram->shots = 0;
+
+    int all_qubits[64];
+    if (!qubits) {
+        if (state->num_qubits > 64) {
+            fprintf(stderr, "Error: Cannot sample all %d qubits at once; list the qubits to sample\n",
+                    state->num_qubits);
+            return false;
+        }
+        num_qubits = state->num_qubits;
+        for (int q = 0; q < num_qubits; q++) {
+            all_qubits[q] = q;
+        }
+        qubits = all_qubits;
+    }
+    // Outcomes are size_t bit strings
+    if (num_qubits < 0 || num_qubits > state->num_qubits || num_qubits > 64) {
+        fprintf(stderr, "Error: Cannot sample %d qubits of a %d-qubit state\n", num_qubits, state->num_qubits);
+        return false;
+    }
+
+    // Reading the amplitudes directly works when outcome bit j is qubit j for every qubit
+    bool in_order = num_qubits == state->num_qubits;
+    for (int j = 0; j < num_qubits; j++) {
+        bool repeated = false;
+        for (int k = 0; k < j; k++) {
+            repeated = repeated || qubits[k] == qubits[j];
+        }
+        if (qubits[j] < 0 || qubits[j] >= state->num_qubits || repeated) {
+            fprintf(stderr, "Error: Invalid or repeated qubit %d in sample\n", qubits[j]);
+            return false;
+        }
+        in_order = in_order && qubits[j] == j;
+    }
+    if (state->backend == BACKEND_SPARSE) {
+        profile_sweep(sparse_count(state->sparse));
+        return sample_sparse(state, shots, qubits, num_qubits, histogram);
+    }
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        return sample_without_amplitudes(state, shots, qubits, num_qubits, histogram);
+    }
+
+    // The marginals, or the block totals when sampling in order, read the state once
+    profile_sweep(state->state_size);
+    size_t num_outcomes = (size_t)1 << num_qubits;
+    size_t num_blocks = (num_outcomes + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK;
+    Sampler sampler = { state, qubits, num_qubits, NULL, malloc(num_blocks * sizeof(double)) };
+    if (!in_order) {
+        sampler.probabilities = malloc(num_outcomes * sizeof(double));
+    }
+    if (!sampler.block_totals || (!in_order && !sampler.probabilities)) {
+        fprintf(stderr, "Error: Out of memory building a %d-qubit distribution\n", num_qubits);
+        free(sampler.block_totals);
+        free(sampler.probabilities);
+        return false;
+    }
+
+    if (!in_order) {
+        parallel_for(num_outcomes, marginal_range, &sampler);
+    }
+    parallel_for(num_blocks, block_total_range, &sampler);
+
+    // Block totals become a prefix sum (in block order, so independent of threads)
+    double total = 0.0;
+    for (size_t b = 0; b < num_blocks; b++) {
+        double block = sampler.block_totals[b];
+        sampler.block_totals[b] = total;
+        total += block;
+    }
+
+    // Draw the shots as ascending order statistics of uniforms, so one
+    // forward walk over the distribution assigns them all and the outcomes
+    // come out already grouped. remaining is 1 - (current uniform).
+    size_t capacity = 0;
+    double remaining = 1.0;
+    size_t block = 0;
+    size_t outcome = 0;
+    double cumulative = 0.0;   // probability of the outcomes before `outcome`
+    bool ok = true;
+
+    for (uint64_t s = 0; s < shots && ok; s++) {
+        remaining *= pow(rng_uniform_open(&state->rng), 1.0 / (double)(shots - s));
+        double position = total * (1.0 - remaining);
+
+        // Jump ahead to the block holding position
+        if (block + 1 < num_blocks && sampler.block_totals[block + 1] <= position) {
+            size_t low = block + 1, high = num_blocks - 1;
+            while (low < high) {
+                size_t mid = low + (high - low + 1) / 2;
+                if (sampler.block_totals[mid] <= position) low = mid; else high = mid - 1;
+            }
+            block = low;
+            outcome = block * SAMPLE_BLOCK;
+            cumulative = sampler.block_totals[block];
+        }
+
+        // Walk the block to the outcome whose interval contains position;
+        // rounding at the block end falls back to its last non-zero outcome
+        size_t block_end = (block + 1) * SAMPLE_BLOCK < num_outcomes ? (block + 1) * SAMPLE_BLOCK : num_outcomes;
+        double p = outcome_probability(&sampler, outcome);
+        while (outcome + 1 < block_end && (cumulative + p <= position || p == 0.0)) {
+            cumulative += p;
+            outcome++;
+            p = outcome_probability(&sampler, outcome);
+        }
+        while (p == 0.0 && outcome > block * SAMPLE_BLOCK) {
+            outcome--;
+            p = outcome_probability(&sampler, outcome);
+            cumulative -= p;
+        }
+        ok = add_count(histogram, &capacity, outcome);
+    }
+
+    free(sampler.block_totals);
+    free(sampler.probabilities);
+    if (!ok) {
+        fprintf(stderr, "Error: Out of memory for the shot histogram\n");
+        free_shot_histogram(histogram);
+        return false;
+    }
+    histogram->shots = shots;
+    return true;
+}
+
+void free_shot_histogram(ShotHistogram* histogram) {
+    free(histogram->counts);
+    histogram->counts = NULL;
+    histogram->num_outcomes = 0;
+    histogram->shots = 0;
+}
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "profile.h"
+
+#define SNAPSHOT_MAGIC "QSIMSNAP"
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+// Amplitude data is written this many bytes per write call
+#define SNAPSHOT_WRITE_CHUNK ((size_t)64 << 20)
+
+// The fields at the start of the header, in file order (no padding)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint32_t num_qubits;
+    uint32_t precision;
+    uint32_t layout;
+    uint64_t state_size;
+    uint64_t data_bytes;
+    uint64_t rng[4];
+} SnapshotHeader;
+
+_Static_assert(sizeof(SnapshotHeader) == 80, "snapshot header fields must not be padded");
+_Static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_HEADER_SIZE, "snapshot header does not fit");
+
+// Writes all of bytes, retrying short writes and interruptions
+static bool write_all(int fd, const char* data, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t written = write(fd, data, bytes < SNAPSHOT_WRITE_CHUNK ? bytes : SNAPSHOT_WRITE_CHUNK);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        bytes -= (size_t)written;
+    }
+    return true;
+}
+
+bool save_state_snapshot(const QuantumState* state, const char* path) {
+    PROFILE_SCOPE(PROFILE_SNAPSHOT, -1);
+    if (state->backend != BACKEND_STATE_VECTOR) {
+        fprintf(stderr, "Error: Only state vectors can be saved as snapshots\n");
+        return false;
+    }
+
+    size_t element_size = state->precision == PRECISION_SINGLE ? sizeof(ComplexFloat) : sizeof(ComplexNum);
+    const char* data = state->precision == PRECISION_SINGLE ? (const char*)state->amplitudes_single
+                                                             : (const char*)state->amplitudes;
+    char* header = calloc(1, SNAPSHOT_HEADER_SIZE);
+    char* temporary = malloc(strlen(path) + 5);
+    if (!header || !temporary) {
+        fprintf(stderr, "Error: Out of memory saving %s\n", path);
+        free(header);
+        free(temporary);
+        return false;
+    }
+    SnapshotHeader fields = {
+        .version = SNAPSHOT_VERSION,
+        .byte_order = SNAPSHOT_BYTE_ORDER,
+        .header_size = SNAPSHOT_HEADER_SIZE,
+        .num_qubits = (uint32_t)state->num_qubits,
+        .precision = state->precision == PRECISION_SINGLE ? 1 : 0,
+        .layout = SNAPSHOT_LAYOUT_DENSE,
+        .state_size = state->state_size,
+        .data_bytes = state->state_size * element_size
+    };
+    memcpy(fields.magic, SNAPSHOT_MAGIC, sizeof(fields.magic));
+    memcpy(fields.rng, state->rng.s, sizeof(fields.rng));
+    memcpy(header, &fields, sizeof(fields));
+    sprintf(temporary, "%s.tmp", path);
+
+    profile_sweep(state->state_size);
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, header, SNAPSHOT_HEADER_SIZE) &&
+              write_all(fd, data, state->state_size * element_size) && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) {
+        ok = false;
+    }
+    if (ok && rename(temporary, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot write snapshot %s: %s\n", path, strerror(errno));
+        unlink(temporary);
+    }
+    free(header);
+    free(temporary);
+    return ok;
+}
+
+// Checks the header against the file size; prints an error and returns false if it does not fit
+static bool check_header(const SnapshotHeader* header, off_t file_size, const char* path) {
+    const char* problem = NULL;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        problem = "not a state snapshot";
+    } else if (header->version != SNAPSHOT_VERSION) {
+        problem = "unsupported format version";
+    } else if (header->byte_order != SNAPSHOT_BYTE_ORDER) {
+        problem = "written with a different byte order";
+    } else if (header->header_size != SNAPSHOT_HEADER_SIZE || header->layout != SNAPSHOT_LAYOUT_DENSE ||
+               header->precision > 1) {
+        problem = "unsupported header size, layout or precision";
+    } else if (header->num_qubits > MAX_QUBITS || header->state_size != (uint64_t)1 << header->num_qubits ||
+               header->data_bytes != header->state_size *
+                   (header->precision == 1 ? sizeof(ComplexFloat) : sizeof(ComplexNum))) {
+        problem = "inconsistent qubit count and data size";
+    } else if ((uint64_t)file_size < SNAPSHOT_HEADER_SIZE + header->data_bytes) {
+        problem = "file is truncated";
+    }
+    if (problem) {
+        fprintf(stderr, "Error: Cannot load snapshot %s: %s\n", path, problem);
+        return false;
+    }
+    return true;
+}
+
+QuantumState* load_state_snapshot(const char* path) {
+    PROFILE_SCOPE(PROFILE_SNAPSHOT, -1);
+    errno = 0;
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    SnapshotHeader header;
+    if (fd < 0 || fstat(fd, &info) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        fprintf(stderr, "Error: Cannot read snapshot %s: %s\n", path,
+                errno ? strerror(errno) : "file is truncated");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    if (!check_header(&header, info.st_size, path)) {
+        close(fd);
+        return NULL;
+    }
+
+    // A private writable mapping: no copy up front, and the file stays as saved
+    size_t mapping_size = SNAPSHOT_HEADER_SIZE + header.data_bytes;
+    void* mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    QuantumState* state = mapping != MAP_FAILED ? malloc(sizeof(QuantumState)) : NULL;
+    if (!state) {
+        fprintf(stderr, "Error: Cannot map snapshot %s: %s\n", path, strerror(errno));
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, mapping_size);
+        }
+        return NULL;
+    }
+
+    state->num_qubits = (int)header.num_qubits;
+    state->state_size = header.state_size;
+    state->backend = BACKEND_STATE_VECTOR;
+    state->precision = header.precision == 1 ? PRECISION_SINGLE : PRECISION_DOUBLE;
+    state->amplitudes = NULL;
+    state->amplitudes_single = NULL;
+    state->tableau = NULL;
+    state->mps = NULL;
+    state->sparse = NULL;
+    state->mapping = mapping;
+    state->mapping_size = mapping_size;
+    void* amplitudes = (char*)mapping + SNAPSHOT_HEADER_SIZE;
+    if (state->precision == PRECISION_SINGLE) {
+        state->amplitudes_single = amplitudes;
+    } else {
+        state->amplitudes = amplitudes;
+    }
+    memcpy(state->rng.s, header.rng, sizeof(header.rng));
+    return state;
+}
@@ -0,0 +1,47 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "quantum.h"
+
+// Binary checkpoints of state vectors. A snapshot is a SNAPSHOT_HEADER_SIZE
+// byte header followed by the raw amplitude array in index order (real and
+// imaginary parts interleaved, in the state's precision and the host byte
+// order), so a loaded snapshot maps the file instead of reading it:
+//
+//   offset  size  field
+//        0     8  magic "QSIMSNAP"
+//        8     4  format version (SNAPSHOT_VERSION)
+//       12     4  byte order mark 0x01020304, as written by the host
+//       16     4  header size in bytes
+//       20     4  number of qubits
+//       24     4  precision (0: double, 1: single)
+//       28     4  layout (SNAPSHOT_LAYOUT_DENSE)
+//       32     8  number of amplitudes
+//       40     8  bytes of amplitude data
+//       48    32  random generator state (four 64-bit words)
+//
+// The rest of the header is zero. Readers reject other versions, byte orders
+// and layouts rather than guessing.
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER_SIZE 4096   // keeps the amplitudes page aligned in the file
+
+// Every amplitude of the state vector, in index order
+#define SNAPSHOT_LAYOUT_DENSE 0
+
+// Writes state (a state vector of either precision) to path in large
+// sequential writes. The data goes to a temporary file next to path that
+// replaces it only once complete, so an interrupted save keeps the previous
+// checkpoint. Returns false after printing an error.
+bool save_state_snapshot(const QuantumState* state, const char* path);
+
+// Maps the snapshot at path and returns a state vector using the mapped
+// amplitudes without copying them: pages are read from the file when first
+// touched and stay in the page cache, and gates modify private copies of the
+// pages they write (the file itself never changes). The state resumes the
+// saved random stream. Returns NULL after printing an error.
+QuantumState* load_state_snapshot(const char* path);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sparse.h"
+#include "profile.h"
+
+// Free slots hold this key; it is never a basis index (at most 63 qubits)
+#define EMPTY_KEY SIZE_MAX
+
+// Tables are kept at most half full
+#define MIN_TABLE_BITS 4
+
+typedef struct {
+    size_t* keys;
+    ComplexNum* values;
+    int bits;          // capacity is 2^bits
+} Table;
+
+// Gates write their result into `spare`, which then swaps with `table`
+struct SparseState {
+    int num_qubits;
+    size_t count;
+    Table table;
+    Table spare;
+    size_t spare_count;
+};
+
+static inline size_t capacity(const Table* t) {
+    return (size_t)1 << t->bits;
+}
+
+// Fibonacci hashing: the top bits of key times 2^64 / golden ratio
+static inline size_t home_slot(const Table* t, size_t key) {
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> (64 - t->bits));
+}
+
+static bool table_init(Table* t, int bits) {
+    t->bits = bits;
+    t->keys = malloc(capacity(t) * sizeof(size_t));
+    t->values = malloc(capacity(t) * sizeof(ComplexNum));
+    if (!t->keys || !t->values) {
+        free(t->keys);
+        free(t->values);
+        t->keys = NULL;
+        t->values = NULL;
+        return false;
+    }
+    memset(t->keys, 0xff, capacity(t) * sizeof(size_t));
+    profile_allocate(2, capacity(t) * (sizeof(size_t) + sizeof(ComplexNum)));
+    return true;
+}
+
+static void table_free(Table* t) {
+    free(t->keys);
+    free(t->values);
+    t->keys = NULL;
+    t->values = NULL;
+}
+
+static ComplexNum* table_find(const Table* t, size_t key) {
+    size_t mask = capacity(t) - 1;
+    for (size_t slot = home_slot(t, key); t->keys[slot] != EMPTY_KEY; slot = (slot + 1) & mask) {
+        if (t->keys[slot] == key) {
+            return &t->values[slot];
+        }
+    }
+    return NULL;
+}
+
+// Adds value to the entry for key, creating it if needed; returns true for a new entry
+static bool table_add(Table* t, size_t key, ComplexNum value) {
+    size_t mask = capacity(t) - 1;
+    size_t slot = home_slot(t, key);
+    for (; t->keys[slot] != EMPTY_KEY; slot = (slot + 1) & mask) {
+        if (t->keys[slot] == key) {
+            t->values[slot] += value;
+            return false;
+        }
+    }
+    t->keys[slot] = key;
+    t->values[slot] = value;
+    return true;
+}
+
+// Smallest table size holding `entries` at most half full
+static int bits_for(size_t entries) {
+    int bits = MIN_TABLE_BITS;
+    while (((size_t)1 << bits) < 2 * entries) {
+        bits++;
+    }
+    return bits;
+}
+
+// Empties the spare table, sized for up to max_entries results
+static bool begin_rebuild(SparseState* s, size_t max_entries) {
+    int bits = bits_for(max_entries);
+    if (s->spare.keys && s->spare.bits == bits) {
+        memset(s->spare.keys, 0xff, capacity(&s->spare) * sizeof(size_t));
+    } else {
+        table_free(&s->spare);
+        if (!table_init(&s->spare, bits)) {
+            fprintf(stderr, "Error: Out of memory for a sparse state of %zu amplitudes\n", max_entries);
+            return false;
+        }
+    }
+    s->spare_count = 0;
+    return true;
+}
+
+static inline void rebuild_add(SparseState* s, size_t key, ComplexNum value) {
+    if (creal(value) * creal(value) + cimag(value) * cimag(value) > SPARSE_ZERO_WEIGHT) {
+        s->spare_count += table_add(&s->spare, key, value);
+    }
+}
+
+static void finish_rebuild(SparseState* s) {
+    Table previous = s->table;
+    s->table = s->spare;
+    s->spare = previous;
+    s->count = s->spare_count;
+}
+
+SparseState* create_sparse(int num_qubits) {
+    if (num_qubits < 1 || num_qubits > MAX_SPARSE_QUBITS) {
+        fprintf(stderr, "Error: Sparse states have 1 to %d qubits\n", MAX_SPARSE_QUBITS);
+        return NULL;
+    }
+    SparseState* s = calloc(1, sizeof(SparseState));
+    s->num_qubits = num_qubits;
+    if (!table_init(&s->table, MIN_TABLE_BITS)) {
+        fprintf(stderr, "Error: Could not allocate a sparse state\n");
+        free(s);
+        return NULL;
+    }
+    table_add(&s->table, 0, 1.0);
+    s->count = 1;
+    return s;
+}
+
+void destroy_sparse(SparseState* sparse) {
+    table_free(&sparse->table);
+    table_free(&sparse->spare);
+    free(sparse);
+}
+
+bool copy_sparse(SparseState* dest, const SparseState* src) {
+    if (dest->num_qubits != src->num_qubits) {
+        fprintf(stderr, "Error: Cannot copy a %d-qubit sparse state into a %d-qubit one\n",
+                src->num_qubits, dest->num_qubits);
+        return false;
+    }
+    if (dest->table.bits != src->table.bits) {
+        Table table;
+        if (!table_init(&table, src->table.bits)) {
+            fprintf(stderr, "Error: Out of memory copying a sparse state\n");
+            return false;
+        }
+        table_free(&dest->table);
+        dest->table = table;
+    }
+    memcpy(dest->table.keys, src->table.keys, capacity(&src->table) * sizeof(size_t));
+    memcpy(dest->table.values, src->table.values, capacity(&src->table) * sizeof(ComplexNum));
+    dest->count = src->count;
+    return true;
+}
+
+size_t sparse_count(const SparseState* sparse) {
+    return sparse->count;
+}
+
+typedef struct {
+    size_t index;
+    ComplexNum value;
+} Entry;
+
+static int compare_entries(const void* a, const void* b) {
+    size_t x = ((const Entry*)a)->index;
+    size_t y = ((const Entry*)b)->index;
+    return (x > y) - (x < y);
+}
+
+void sparse_entries(const SparseState* sparse, size_t* indices, ComplexNum* values) {
+    Entry* entries = malloc((sparse->count + 1) * sizeof(Entry));
+    size_t n = 0;
+    for (size_t slot = 0; slot < capacity(&sparse->table); slot++) {
+        if (sparse->table.keys[slot] != EMPTY_KEY) {
+            entries[n].index = sparse->table.keys[slot];
+            entries[n].value = sparse->table.values[slot];
+            n++;
+        }
+    }
+    qsort(entries, n, sizeof(Entry), compare_entries);
+    for (size_t i = 0; i < n; i++) {
+        indices[i] = entries[i].index;
+        values[i] = entries[i].value;
+    }
+    free(entries);
+}
+
+ComplexNum sparse_get(const SparseState* sparse, size_t index) {
+    const ComplexNum* value = table_find(&sparse->table, index);
+    return value ? *value : 0.0;
+}
+
+void sparse_set(SparseState* sparse, size_t index, ComplexNum value) {
+    ComplexNum* slot = table_find(&sparse->table, index);
+    if (slot) {
+        *slot = value;
+        return;
+    }
+    // Grows through a rebuild when the table would pass half full
+    if (2 * (sparse->count + 1) > capacity(&sparse->table)) {
+        if (!begin_rebuild(sparse, sparse->count + 1)) {
+            return;
+        }
+        for (size_t i = 0; i < capacity(&sparse->table); i++) {
+            if (sparse->table.keys[i] != EMPTY_KEY) {
+                table_add(&sparse->spare, sparse->table.keys[i], sparse->table.values[i]);
+            }
+        }
+        sparse->spare_count = sparse->count;
+        finish_rebuild(sparse);
+    }
+    sparse->count += table_add(&sparse->table, index, value);
+}
+
+// Position of key's gate qubits as a gate-local index (bit j is qubits[j])
+static inline int local_index(size_t key, const int* qubits, int k) {
+    int local = 0;
+    for (int j = 0; j < k; j++) {
+        local |= (int)((key >> qubits[j]) & 1) << j;
+    }
+    return local;
+}
+
+bool sparse_apply_gate(SparseState* s, const Gate* gate) {
+    if (gate->type == MEASURE) {
+        fprintf(stderr, "Error: Sparse measurements go through sparse_measure\n");
+        return false;
+    }
+    if (gate->type == PHASE_FLIP) {
+        ComplexNum* value = table_find(&s->table, gate->basis_state);
+        if (value) {
+            *value = -*value;
+        }
+        return true;
+    }
+
+    int k = gate->num_qubits;
+    const int* q = gate->qubits;
+    for (int j = 0; j < k; j++) {
+        bool repeated = false;
+        for (int i = 0; i < j; i++) {
+            repeated = repeated || q[i] == q[j];
+        }
+        if (q[j] < 0 || q[j] >= s->num_qubits || repeated) {
+            fprintf(stderr, "Error: Invalid or repeated qubit %d in sparse gate\n", q[j]);
+            return false;
+        }
+    }
+
+    int dim = 1 << k;
+    ComplexNum* matrix = malloc((size_t)dim * dim * sizeof(ComplexNum));
+    if (!gate_matrix(gate, matrix)) {
+        free(matrix);
+        return false;
+    }
+    profile_allocate(1, (size_t)dim * dim * sizeof(ComplexNum));
+    profile_sweep(s->count);
+
+    // Basis offsets of the local indices, and each column's single non-zero
+    // row when the matrix is monomial (a permutation times a diagonal)
+    size_t offsets[1 << MAX_FUSED_QUBITS];
+    int target[1 << MAX_FUSED_QUBITS];
+    bool monomial = true, diagonal = true;
+    for (int l = 0; l < dim; l++) {
+        offsets[l] = 0;
+        for (int j = 0; j < k; j++) {
+            if (l & (1 << j)) offsets[l] |= (size_t)1 << q[j];
+        }
+        int nonzero = 0;
+        for (int row = 0; row < dim; row++) {
+            if (matrix[(size_t)row * dim + l] != 0) {
+                nonzero++;
+                target[l] = row;
+            }
+        }
+        monomial = monomial && nonzero == 1;
+        diagonal = diagonal && nonzero == 1 && target[l] == l;
+    }
+    size_t gate_mask = offsets[dim - 1];
+    const Table* t = &s->table;
+
+    if (diagonal) {
+        for (size_t slot = 0; slot < capacity(t); slot++) {
+            if (t->keys[slot] != EMPTY_KEY) {
+                int l = local_index(t->keys[slot], q, k);
+                t->values[slot] *= matrix[(size_t)l * dim + l];
+            }
+        }
+    } else if (monomial) {
+        // Every entry moves to exactly one new index
+        if (!begin_rebuild(s, s->count)) {
+            free(matrix);
+            return false;
+        }
+        for (size_t slot = 0; slot < capacity(t); slot++) {
+            size_t key = t->keys[slot];
+            if (key != EMPTY_KEY) {
+                int l = local_index(key, q, k);
+                size_t moved = (key & ~gate_mask) | offsets[target[l]];
+                rebuild_add(s, moved, matrix[(size_t)target[l] * dim + l] * t->values[slot]);
+            }
+        }
+        finish_rebuild(s);
+    } else {
+        // Each group of entries sharing their other bits is mixed once, from
+        // its first stored member
+        size_t limit = s->num_qubits < 63 ? (size_t)1 << s->num_qubits : SIZE_MAX / 2;
+        size_t bound = s->count <= limit / dim ? s->count * dim : limit;
+        if (!begin_rebuild(s, bound)) {
+            free(matrix);
+            return false;
+        }
+        ComplexNum in[1 << MAX_FUSED_QUBITS];
+        for (size_t slot = 0; slot < capacity(t); slot++) {
+            size_t key = t->keys[slot];
+            if (key == EMPTY_KEY) {
+                continue;
+            }
+            size_t base = key & ~gate_mask;
+            int first = -1;
+            for (int l = 0; l < dim; l++) {
+                const ComplexNum* value = table_find(t, base | offsets[l]);
+                in[l] = value ? *value : 0.0;
+                if (value && first < 0) first = l;
+            }
+            if (offsets[first] != (key & gate_mask)) {
+                continue;
+            }
+            for (int row = 0; row < dim; row++) {
+                ComplexNum sum = 0;
+                for (int col = 0; col < dim; col++) {
+                    sum += matrix[(size_t)row * dim + col] * in[col];
+                }
+                rebuild_add(s, base | offsets[row], sum);
+            }
+        }
+        finish_rebuild(s);
+    }
+    free(matrix);
+    return true;
+}
+
+// Total weight of the entries with the bit of mask clear (prob[0]) and set (prob[1])
+static void bit_weights(const Table* t, size_t mask, double prob[2]) {
+    prob[0] = prob[1] = 0.0;
+    for (size_t slot = 0; slot < capacity(t); slot++) {
+        if (t->keys[slot] != EMPTY_KEY) {
+            ComplexNum a = t->values[slot];
+            prob[(t->keys[slot] & mask) != 0] += creal(a) * creal(a) + cimag(a) * cimag(a);
+        }
+    }
+}
+
+double sparse_probability(const SparseState* s, int qubit) {
+    double prob[2];
+    bit_weights(&s->table, (size_t)1 << qubit, prob);
+    return prob[1] / (prob[0] + prob[1]);
+}
+
+int sparse_measure(SparseState* s, int qubit, RngState* rng) {
+    size_t mask = (size_t)1 << qubit;
+    const Table* t = &s->table;
+    double prob[2];
+    bit_weights(t, mask, prob);
+
+    // Same decision rule as the state vector, so both backends agree for a given stream
+    int result = (rng_uniform(rng) * (prob[0] + prob[1]) > prob[0]) ? 1 : 0;
+    double scale = 1.0 / sqrt(prob[result]);
+    if (!begin_rebuild(s, s->count)) {
+        return result;
+    }
+    for (size_t slot = 0; slot < capacity(t); slot++) {
+        size_t key = t->keys[slot];
+        if (key != EMPTY_KEY && ((key & mask) != 0) == result) {
+            rebuild_add(s, key, t->values[slot] * scale);
+        }
+    }
+    finish_rebuild(s);
+    return result;
+}
@@ -0,0 +1,47 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdbool.h>
+#include "circuit.h"
+#include "rng.h"
+
+// Sparse state: an open-addressing hash table from basis index to amplitude
+// holding only the non-zero amplitudes, so gate cost scales with their number
+// instead of 2^n. Permutation-like gates (X, CNOT, Toffoli, SWAP, Y) move
+// entries, diagonal ones rescale them in place, and mixing gates (H,
+// rotations, dense unitaries) combine the entries of each affected group.
+// Amplitudes that cancel to below SPARSE_ZERO_WEIGHT are dropped.
+//
+// States created with create_sparse_state use this backend through the
+// regular gate API and turn into state vectors once they fill up (see
+// SPARSE_DENSE_FILL); the functions below are the backend itself.
+
+// |amplitude|^2 below which an entry is removed
+#define SPARSE_ZERO_WEIGHT 1e-30
+
+SparseState* create_sparse(int num_qubits);
+void destroy_sparse(SparseState* sparse);
+
+// Copies src into dest (same qubit count)
+bool copy_sparse(SparseState* dest, const SparseState* src);
+
+// Number of stored (non-zero) amplitudes
+size_t sparse_count(const SparseState* sparse);
+
+// Writes the stored entries in increasing index order; both arrays need
+// sparse_count entries
+void sparse_entries(const SparseState* sparse, size_t* indices, ComplexNum* values);
+
+ComplexNum sparse_get(const SparseState* sparse, size_t index);
+void sparse_set(SparseState* sparse, size_t index, ComplexNum value);
+
+// Applies any gate except MEASURE; returns false after printing an error
+bool sparse_apply_gate(SparseState* sparse, const Gate* gate);
+
+// Probability of measuring 1 on qubit
+double sparse_probability(const SparseState* sparse, int qubit);
+
+// Measures qubit in the computational basis and collapses the state
+int sparse_measure(SparseState* sparse, int qubit, RngState* rng);
+
+#endif /* SPARSE_H */
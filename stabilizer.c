@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stabilizer.h"
+
+#define PI 3.14159265358979323846
+
+// Angles within this distance of a multiple of pi/2 count as Clifford
+#define CLIFFORD_ANGLE_TOLERANCE 1e-9
+
+// Rows 0..n-1 are destabilizers, rows n..2n-1 stabilizers. Column q of x/z
+// holds bit q of every row, row_words words long.
+struct StabilizerTableau {
+    int num_qubits;
+    size_t num_rows;
+    size_t row_words;
+    uint64_t* x;
+    uint64_t* z;
+    uint64_t* r;          // sign bit of every row
+    uint64_t* mask;       // scratch row sets used by measurement
+    uint64_t* phase_low;
+    uint64_t* phase_high;
+};
+
+static inline uint64_t* x_column(const StabilizerTableau* t, int q) {
+    return t->x + (size_t)q * t->row_words;
+}
+
+static inline uint64_t* z_column(const StabilizerTableau* t, int q) {
+    return t->z + (size_t)q * t->row_words;
+}
+
+static inline int get_bit(const uint64_t* bits, size_t row) {
+    return (bits[row / 64] >> (row % 64)) & 1;
+}
+
+static inline void set_bit(uint64_t* bits, size_t row, int value) {
+    uint64_t bit = (uint64_t)1 << (row % 64);
+    bits[row / 64] = value ? bits[row / 64] | bit : bits[row / 64] & ~bit;
+}
+
+StabilizerTableau* create_tableau(int num_qubits) {
+    if (num_qubits < 1 || num_qubits > MAX_STABILIZER_QUBITS) {
+        fprintf(stderr, "Error: Stabilizer states have 1 to %d qubits\n", MAX_STABILIZER_QUBITS);
+        return NULL;
+    }
+
+    StabilizerTableau* t = malloc(sizeof(StabilizerTableau));
+    t->num_qubits = num_qubits;
+    t->num_rows = 2 * (size_t)num_qubits;
+    t->row_words = (t->num_rows + 63) / 64;
+    size_t column_words = (size_t)num_qubits * t->row_words;
+    t->x = calloc(column_words, sizeof(uint64_t));
+    t->z = calloc(column_words, sizeof(uint64_t));
+    t->r = calloc(t->row_words, sizeof(uint64_t));
+    t->mask = calloc(t->row_words, sizeof(uint64_t));
+    t->phase_low = calloc(t->row_words, sizeof(uint64_t));
+    t->phase_high = calloc(t->row_words, sizeof(uint64_t));
+    if (!t->x || !t->z || !t->r || !t->mask || !t->phase_low || !t->phase_high) {
+        fprintf(stderr, "Error: Could not allocate a %d-qubit stabilizer tableau\n", num_qubits);
+        destroy_tableau(t);
+        return NULL;
+    }
+
+    // |0...0>: destabilizer q is X_q, stabilizer q is Z_q
+    for (int q = 0; q < num_qubits; q++) {
+        set_bit(x_column(t, q), q, 1);
+        set_bit(z_column(t, q), num_qubits + q, 1);
+    }
+    return t;
+}
+
+void destroy_tableau(StabilizerTableau* tableau) {
+    free(tableau->x);
+    free(tableau->z);
+    free(tableau->r);
+    free(tableau->mask);
+    free(tableau->phase_low);
+    free(tableau->phase_high);
+    free(tableau);
+}
+
+void copy_tableau(StabilizerTableau* dest, const StabilizerTableau* src) {
+    if (dest->num_qubits != src->num_qubits) {
+        fprintf(stderr, "Error: Cannot copy a %d-qubit tableau into a %d-qubit one\n",
+                src->num_qubits, dest->num_qubits);
+        return;
+    }
+    size_t column_words = (size_t)src->num_qubits * src->row_words;
+    memcpy(dest->x, src->x, column_words * sizeof(uint64_t));
+    memcpy(dest->z, src->z, column_words * sizeof(uint64_t));
+    memcpy(dest->r, src->r, src->row_words * sizeof(uint64_t));
+}
+
+// ---------------------------------------------------------------------------
+// Gates: each conjugates every row, one word of 64 rows at a time
+// ---------------------------------------------------------------------------
+
+static void tableau_hadamard(StabilizerTableau* t, int q) {
+    uint64_t* x = x_column(t, q);
+    uint64_t* z = z_column(t, q);
+    for (size_t w = 0; w < t->row_words; w++) {
+        t->r[w] ^= x[w] & z[w];
+        uint64_t temp = x[w];
+        x[w] = z[w];
+        z[w] = temp;
+    }
+}
+
+static void tableau_phase(StabilizerTableau* t, int q) {
+    uint64_t* x = x_column(t, q);
+    uint64_t* z = z_column(t, q);
+    for (size_t w = 0; w < t->row_words; w++) {
+        t->r[w] ^= x[w] & z[w];
+        z[w] ^= x[w];
+    }
+}
+
+// Pauli P flips the sign of every row that anticommutes with it on q
+static void tableau_pauli(StabilizerTableau* t, int q, bool flip_x_rows, bool flip_z_rows) {
+    const uint64_t* x = x_column(t, q);
+    const uint64_t* z = z_column(t, q);
+    for (size_t w = 0; w < t->row_words; w++) {
+        t->r[w] ^= (flip_x_rows ? x[w] : 0) ^ (flip_z_rows ? z[w] : 0);
+    }
+}
+
+static void tableau_cnot(StabilizerTableau* t, int control, int target) {
+    uint64_t* xc = x_column(t, control);
+    uint64_t* zc = z_column(t, control);
+    uint64_t* xt = x_column(t, target);
+    uint64_t* zt = z_column(t, target);
+    for (size_t w = 0; w < t->row_words; w++) {
+        t->r[w] ^= xc[w] & zt[w] & ~(xt[w] ^ zc[w]);
+        xt[w] ^= xc[w];
+        zc[w] ^= zt[w];
+    }
+}
+
+static void tableau_swap(StabilizerTableau* t, int q1, int q2) {
+    uint64_t* x1 = x_column(t, q1);
+    uint64_t* z1 = z_column(t, q1);
+    uint64_t* x2 = x_column(t, q2);
+    uint64_t* z2 = z_column(t, q2);
+    for (size_t w = 0; w < t->row_words; w++) {
+        uint64_t temp = x1[w];
+        x1[w] = x2[w];
+        x2[w] = temp;
+        temp = z1[w];
+        z1[w] = z2[w];
+        z2[w] = temp;
+    }
+}
+
+// diag(1, i^turns), i.e. S^turns (Z for two turns)
+static void tableau_quarter_phase(StabilizerTableau* t, int q, int turns) {
+    if (turns & 1) {
+        tableau_phase(t, q);
+    }
+    if (turns & 2) {
+        tableau_pauli(t, q, true, false);
+    }
+}
+
+// Number of quarter turns (0-3) in angle, or -1 when it is not a multiple of pi/2
+static int quarter_turns(double angle) {
+    double turns = angle / (PI / 2);
+    double rounded = nearbyint(turns);
+    if (fabs(turns - rounded) > CLIFFORD_ANGLE_TOLERANCE) {
+        return -1;
+    }
+    return (int)(((long long)rounded % 4 + 4) % 4);
+}
+
+bool is_clifford_gate(const Gate* gate) {
+    switch (gate->type) {
+        case HADAMARD:
+        case PAULI_X:
+        case PAULI_Y:
+        case PAULI_Z:
+        case CNOT:
+        case SWAP:
+        case MEASURE:
+            return true;
+        case PHASE:
+        case ROTATION_X:
+        case ROTATION_Y:
+        case ROTATION_Z:
+            return quarter_turns(gate->angle) >= 0;
+        case CONTROLLED_PHASE:
+            return quarter_turns(gate->angle) == 0 || quarter_turns(gate->angle) == 2;
+        default:
+            return false;
+    }
+}
+
+static const char* gate_label(GateType type) {
+    switch (type) {
+        case TOFFOLI:          return "Toffoli";
+        case CONTROLLED_PHASE: return "Controlled phase";
+        case PHASE:            return "Phase";
+        case ROTATION_X:       return "Rx";
+        case ROTATION_Y:       return "Ry";
+        case ROTATION_Z:       return "Rz";
+        case PHASE_FLIP:       return "Phase flip";
+        case UNITARY:          return "Dense unitary";
+        case QFT:              return "QFT";
+        case INVERSE_QFT:      return "Inverse QFT";
+        default:               return "Gate";
+    }
+}
+
+bool tableau_apply_gate(StabilizerTableau* t, const Gate* gate) {
+    if (!is_clifford_gate(gate) || gate->type == MEASURE) {
+        if (gate->type == PHASE || gate->type == CONTROLLED_PHASE ||
+            gate->type == ROTATION_X || gate->type == ROTATION_Y || gate->type == ROTATION_Z) {
+            fprintf(stderr, "Error: %s(%g) is not a Clifford gate; the stabilizer backend only takes "
+                    "angles that are multiples of pi/2 (pi for controlled phases)\n",
+                    gate_label(gate->type), gate->angle);
+        } else {
+            fprintf(stderr, "Error: %s is not a Clifford gate and cannot run on the stabilizer backend\n",
+                    gate_label(gate->type));
+        }
+        return false;
+    }
+
+    const int* q = gate->qubits;
+    int turns = quarter_turns(gate->angle);
+    switch (gate->type) {
+        case HADAMARD: tableau_hadamard(t, q[0]); break;
+        case PAULI_X:  tableau_pauli(t, q[0], false, true); break;
+        case PAULI_Y:  tableau_pauli(t, q[0], true, true); break;
+        case PAULI_Z:  tableau_pauli(t, q[0], true, false); break;
+        case CNOT:     tableau_cnot(t, q[0], q[1]); break;
+        case SWAP:     tableau_swap(t, q[0], q[1]); break;
+        case PHASE:
+        case ROTATION_Z:
+            // Rz equals the phase gate up to a global phase, which the tableau drops
+            tableau_quarter_phase(t, q[0], turns);
+            break;
+        case ROTATION_X:
+            tableau_hadamard(t, q[0]);
+            tableau_quarter_phase(t, q[0], turns);
+            tableau_hadamard(t, q[0]);
+            break;
+        case ROTATION_Y:
+            // Ry = S Rx S^dagger
+            tableau_quarter_phase(t, q[0], 3);
+            tableau_hadamard(t, q[0]);
+            tableau_quarter_phase(t, q[0], turns);
+            tableau_hadamard(t, q[0]);
+            tableau_quarter_phase(t, q[0], 1);
+            break;
+        case CONTROLLED_PHASE:
+            if (turns == 2) {
+                tableau_hadamard(t, q[1]);
+                tableau_cnot(t, q[0], q[1]);
+                tableau_hadamard(t, q[1]);
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Measurement
+// ---------------------------------------------------------------------------
+
+// Multiplies row `source` into every row of t->mask (which must not contain
+// source), all rows at once. Each row's exponent of i is tracked mod 4 in the
+// bit planes phase_high:phase_low; a valid product leaves it at 0 or 2.
+static void rowsum_into_mask(StabilizerTableau* t, size_t source) {
+    size_t words = t->row_words;
+    uint64_t* low = t->phase_low;
+    uint64_t* high = t->phase_high;
+    memset(low, 0, words * sizeof(uint64_t));
+    memset(high, 0, words * sizeof(uint64_t));
+
+    for (int q = 0; q < t->num_qubits; q++) {
+        uint64_t* x = x_column(t, q);
+        uint64_t* z = z_column(t, q);
+        int xs = get_bit(x, source);
+        int zs = get_bit(z, source);
+        if (!xs && !zs) {
+            continue;
+        }
+        for (size_t w = 0; w < words; w++) {
+            uint64_t m = t->mask[w];
+            if (!m) continue;
+            // Rows whose Pauli on q picks up +i or -i when multiplied by the source's
+            uint64_t plus, minus;
+            if (xs && zs) {
+                plus = z[w] & ~x[w];
+                minus = x[w] & ~z[w];
+            } else if (xs) {
+                plus = z[w] & x[w];
+                minus = z[w] & ~x[w];
+            } else {
+                plus = x[w] & ~z[w];
+                minus = x[w] & z[w];
+            }
+            plus &= m;
+            minus &= m;
+            high[w] ^= low[w] & plus;
+            low[w] ^= plus;
+            high[w] ^= ~low[w] & minus;
+            low[w] ^= minus;
+            if (xs) x[w] ^= m;
+            if (zs) z[w] ^= m;
+        }
+    }
+
+    // Signs multiply too: the new sign is bit 1 of 2 r_row + 2 r_source + exponent
+    uint64_t source_sign = get_bit(t->r, source) ? ~(uint64_t)0 : 0;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t sign = high[w] ^ t->r[w] ^ source_sign;
+        t->r[w] = (t->r[w] & ~t->mask[w]) | (sign & t->mask[w]);
+    }
+}
+
+// Contribution to the exponent of i when Pauli (x1, z1) multiplies (x2, z2)
+static inline int pauli_product_exponent(int x1, int z1, int x2, int z2) {
+    if (x1 && z1) return z2 - x2;
+    if (x1) return z2 * (2 * x2 - 1);
+    if (z1) return x2 * (1 - 2 * z2);
+    return 0;
+}
+
+// Outcome when Z_qubit commutes with every stabilizer: the sign of the product
+// of the stabilizers paired with destabilizers that anticommute with Z_qubit
+static int deterministic_outcome(const StabilizerTableau* t, int qubit) {
+    int n = t->num_qubits;
+    const uint64_t* xa = x_column(t, qubit);
+    size_t* rows = malloc(n * sizeof(size_t));
+    int num_rows = 0;
+    int exponent = 0;
+    for (int i = 0; i < n; i++) {
+        if (get_bit(xa, i)) {
+            rows[num_rows++] = (size_t)n + i;
+            exponent += 2 * get_bit(t->r, (size_t)n + i);
+        }
+    }
+
+    // Qubits are independent, so the product is accumulated one qubit at a time
+    for (int q = 0; q < n; q++) {
+        const uint64_t* x = x_column(t, q);
+        const uint64_t* z = z_column(t, q);
+        int xp = 0, zp = 0;
+        for (int k = 0; k < num_rows; k++) {
+            int xr = get_bit(x, rows[k]);
+            int zr = get_bit(z, rows[k]);
+            exponent += pauli_product_exponent(xr, zr, xp, zp);
+            xp ^= xr;
+            zp ^= zr;
+        }
+    }
+    free(rows);
+    return ((exponent % 4 + 4) % 4) >> 1;
+}
+
+int tableau_measure(StabilizerTableau* t, int qubit, RngState* rng) {
+    int n = t->num_qubits;
+    const uint64_t* xa = x_column(t, qubit);
+
+    // A stabilizer with X or Y on qubit makes the outcome random
+    size_t pivot = t->num_rows;
+    for (size_t row = n; row < t->num_rows; row++) {
+        if (row % 64 == 0 && xa[row / 64] == 0) {
+            row += 63;
+            continue;
+        }
+        if (get_bit(xa, row)) {
+            pivot = row;
+            break;
+        }
+    }
+    if (pivot == t->num_rows) {
+        return deterministic_outcome(t, qubit);
+    }
+
+    // Every other row anticommuting with Z_qubit absorbs the pivot row
+    memcpy(t->mask, xa, t->row_words * sizeof(uint64_t));
+    set_bit(t->mask, pivot, 0);
+    rowsum_into_mask(t, pivot);
+
+    // The pivot becomes its destabilizer, and Z_qubit with a random sign replaces it
+    size_t partner = pivot - n;
+    int outcome = rng_next(rng) >> 63;
+    for (int q = 0; q < n; q++) {
+        uint64_t* x = x_column(t, q);
+        uint64_t* z = z_column(t, q);
+        set_bit(x, partner, get_bit(x, pivot));
+        set_bit(z, partner, get_bit(z, pivot));
+        set_bit(x, pivot, 0);
+        set_bit(z, pivot, q == qubit);
+    }
+    set_bit(t->r, partner, get_bit(t->r, pivot));
+    set_bit(t->r, pivot, outcome);
+    return outcome;
+}
@@ -0,0 +1,35 @@
+#ifndef STABILIZER_H
+#define STABILIZER_H
+
+#include <stdbool.h>
+#include "circuit.h"
+#include "rng.h"
+
+// Aaronson-Gottesman stabilizer tableau (CHP). An n-qubit stabilizer state is
+// stored as n destabilizer and n stabilizer Pauli rows: 2n bits per qubit plus
+// a sign per row, so memory is O(n^2) bits and Clifford gates cost O(n) bit
+// operations. Bits are stored per qubit, packed 64 rows to a word, so gates
+// and the row additions of a measurement run word-parallel.
+//
+// States created with create_stabilizer_state use this backend through the
+// regular gate API; the functions below are the backend itself.
+
+StabilizerTableau* create_tableau(int num_qubits);
+void destroy_tableau(StabilizerTableau* tableau);
+
+// Copies src into dest (same qubit count)
+void copy_tableau(StabilizerTableau* dest, const StabilizerTableau* src);
+
+// Whether gate is a Clifford operation the tableau can apply: H, X, Y, Z,
+// CNOT, SWAP, phases and rotations by multiples of pi/2, controlled phases
+// by multiples of pi
+bool is_clifford_gate(const Gate* gate);
+
+// Applies a Clifford gate. Anything else prints an error, leaves the state
+// unchanged and returns false.
+bool tableau_apply_gate(StabilizerTableau* tableau, const Gate* gate);
+
+// Measures qubit in the computational basis and collapses the tableau
+int tableau_measure(StabilizerTableau* tableau, int qubit, RngState* rng);
+
+#endif /* STABILIZER_H */
@@ -0,0 +1,218 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+#define MAX_THREADS 256
+
+typedef struct {
+    ParallelRangeFn fn;
+    void* ctx;
+    size_t count;
+    size_t chunk;
+    atomic_size_t next;  // first item not yet claimed
+} ParallelJob;
+
+typedef struct {
+    int num_threads;
+    pthread_t workers[MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+    pthread_mutex_t submit_lock;    // one job in flight at a time
+    ParallelJob* job;
+    unsigned long generation;
+    int busy_workers;
+} ThreadPool;
+
+static ThreadPool pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static __thread int inside_worker = 0;
+
+static void run_job(ParallelJob* job) {
+    for (;;) {
+        size_t begin = atomic_fetch_add(&job->next, job->chunk);
+        if (begin >= job->count) {
+            break;
+        }
+        size_t end = begin + job->chunk < job->count ? begin + job->chunk : job->count;
+        job->fn(job->ctx, begin, end);
+    }
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    unsigned long seen = 0;
+    inside_worker = 1;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.job_ready, &pool.lock);
+        }
+        seen = pool.generation;
+        ParallelJob* job = pool.job;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_job(job);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy_workers == 0) {
+            pthread_cond_signal(&pool.job_done);
+        }
+    }
+    return NULL;
+}
+
+static void create_pool(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int requested = cpus > 0 ? (int)cpus : 1;
+    const char* env = getenv("QSIM_NUM_THREADS");
+    if (env && atoi(env) > 0) {
+        requested = atoi(env);
+    }
+    if (requested > MAX_THREADS) {
+        requested = MAX_THREADS;
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_mutex_init(&pool.submit_lock, NULL);
+    pthread_cond_init(&pool.job_ready, NULL);
+    pthread_cond_init(&pool.job_done, NULL);
+
+    // The calling thread always takes part, so spawn one worker fewer
+    pool.num_threads = 1;
+    for (int t = 0; t < requested - 1; t++) {
+        if (pthread_create(&pool.workers[t], NULL, worker_main, NULL) != 0) {
+            fprintf(stderr, "Warning: Could only start %d worker threads\n", t);
+            break;
+        }
+        pthread_detach(pool.workers[t]);
+        pool.num_threads++;
+    }
+}
+
+int threadpool_num_threads(void) {
+    pthread_once(&pool_once, create_pool);
+    return pool.num_threads;
+}
+
+static void run_parallel(ParallelJob* job) {
+    pthread_mutex_lock(&pool.submit_lock);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job = job;
+    pool.busy_workers = pool.num_threads - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.job_ready);
+    pthread_mutex_unlock(&pool.lock);
+
+    inside_worker = 1;
+    run_job(job);
+    inside_worker = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy_workers > 0) {
+        pthread_cond_wait(&pool.job_done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.submit_lock);
+}
+
+void parallel_for(size_t count, ParallelRangeFn fn, void* ctx) {
+    if (count < PARALLEL_THRESHOLD || inside_worker || threadpool_num_threads() == 1) {
+        if (count > 0) {
+            fn(ctx, 0, count);
+        }
+        return;
+    }
+
+    // A few chunks per thread keeps the load balanced without much contention
+    size_t chunk = count / (pool.num_threads * 4);
+    if (chunk < PARALLEL_THRESHOLD / 4) {
+        chunk = PARALLEL_THRESHOLD / 4;
+    }
+
+    ParallelJob job = { fn, ctx, count, chunk, 0 };
+    run_parallel(&job);
+}
+
+void parallel_for_coarse(size_t count, ParallelRangeFn fn, void* ctx) {
+    if (count < 2 || inside_worker || threadpool_num_threads() == 1) {
+        if (count > 0) {
+            fn(ctx, 0, count);
+        }
+        return;
+    }
+
+    ParallelJob job = { fn, ctx, count, 1, 0 };
+    run_parallel(&job);
+}
+
+typedef struct {
+    ParallelComplexSumFn fn;
+    void* ctx;
+    size_t count;
+    double complex* partials;
+} SumJob;
+
+static void sum_chunks(void* ctx, size_t begin, size_t end) {
+    SumJob* job = ctx;
+    for (size_t c = begin; c < end; c++) {
+        size_t first = c * REDUCTION_CHUNK;
+        size_t last = first + REDUCTION_CHUNK < job->count ? first + REDUCTION_CHUNK : job->count;
+        job->partials[c] = job->fn(job->ctx, first, last);
+    }
+}
+
+double complex parallel_sum_complex(size_t count, ParallelComplexSumFn fn, void* ctx) {
+    size_t num_chunks = (count + REDUCTION_CHUNK - 1) / REDUCTION_CHUNK;
+    if (num_chunks <= 1) {
+        return count > 0 ? fn(ctx, 0, count) : 0.0;
+    }
+
+    // Without room for the partial sums the chunks are summed here, in the
+    // same order, which gives the same total
+    double complex* partials = malloc(num_chunks * sizeof(double complex));
+    if (!partials) {
+        double complex total = 0.0;
+        for (size_t first = 0; first < count; first += REDUCTION_CHUNK) {
+            total += fn(ctx, first, first + REDUCTION_CHUNK < count ? first + REDUCTION_CHUNK : count);
+        }
+        return total;
+    }
+    SumJob job = { fn, ctx, count, partials };
+
+    if (count < PARALLEL_THRESHOLD || inside_worker || threadpool_num_threads() == 1) {
+        sum_chunks(&job, 0, num_chunks);
+    } else {
+        ParallelJob chunks = { sum_chunks, &job, num_chunks, 1, 0 };
+        run_parallel(&chunks);
+    }
+
+    double complex total = 0.0;
+    for (size_t c = 0; c < num_chunks; c++) {
+        total += partials[c];
+    }
+    free(partials);
+    return total;
+}
+
+typedef struct {
+    ParallelSumFn fn;
+    void* ctx;
+} RealSum;
+
+static double complex real_sum_range(void* ctx, size_t begin, size_t end) {
+    RealSum* sum = ctx;
+    return sum->fn(sum->ctx, begin, end);
+}
+
+// Real sums are complex sums with zero imaginary parts, which add exactly
+double parallel_sum(size_t count, ParallelSumFn fn, void* ctx) {
+    RealSum sum = { fn, ctx };
+    return creal(parallel_sum_complex(count, real_sum_range, &sum));
+}
@@ -0,0 +1,34 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+#include <complex.h>
+
+// Ranges smaller than this many items run on the calling thread
+#define PARALLEL_THRESHOLD (1 << 14)
+
+// Reductions always split their range into chunks of this size and add the
+// partial results in chunk order, so sums do not depend on the thread count
+#define REDUCTION_CHUNK (1 << 12)
+
+typedef void (*ParallelRangeFn)(void* ctx, size_t begin, size_t end);
+typedef double (*ParallelSumFn)(void* ctx, size_t begin, size_t end);
+typedef double complex (*ParallelComplexSumFn)(void* ctx, size_t begin, size_t end);
+
+// Runs fn over [0, count) split across the process-wide worker pool.
+// The pool is created on first use with QSIM_NUM_THREADS workers
+// (default: number of online CPUs). Calls made from inside a worker run inline.
+void parallel_for(size_t count, ParallelRangeFn fn, void* ctx);
+
+// Like parallel_for for items that are each a large piece of work (e.g. a
+// cache-sized tile): items are handed out one at a time, so any count > 1 is split
+void parallel_for_coarse(size_t count, ParallelRangeFn fn, void* ctx);
+
+// Returns the sum of fn over [0, count) computed across the worker pool
+double parallel_sum(size_t count, ParallelSumFn fn, void* ctx);
+double complex parallel_sum_complex(size_t count, ParallelComplexSumFn fn, void* ctx);
+
+// Number of threads (including the caller) that take part in parallel calls
+int threadpool_num_threads(void);
+
+#endif /* THREADPOOL_H */